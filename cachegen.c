@@ -0,0 +1,263 @@
+/*
+ * cachegen.c
+ *
+ * Copyright (C) Jon Turney 2015
+ *
+ * This file is part of xwin-xdg-menu
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+//
+// xwin-xdg-menu-cache: generate the shared icon cache
+//
+// This resolves the icons named by the system-wide desktop entries and
+// directory files, and the icons we use ourselves, in the given icon themes,
+// then decodes and converts them at the given sizes, and writes them all into
+// a cache which xwin-xdg-menu instances map read-only.
+//
+// It's intended to be run after packages are installed or removed.  The cache
+// is replaced atomically, so it's safe to run while instances are using it.
+//
+
+#include "iconcache.h"
+#include "icontheme.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gtk/gtk.h>
+#include <windows.h>
+
+// icons used by our own menu items
+static const char *builtin_icons[] =
+  {
+    "application-exit",
+    "help-about",
+    "system-log-out",
+    "system-run",
+    "text-x-generic",
+    "zoom-fit-best",
+    "zoom-original",
+    NULL
+  };
+
+static void
+collect_icon(GHashTable *names, const char *path)
+{
+  GKeyFile *kf = g_key_file_new();
+
+  if (g_key_file_load_from_file(kf, path, G_KEY_FILE_NONE, NULL))
+    {
+      gchar *icon = g_key_file_get_string(kf, G_KEY_FILE_DESKTOP_GROUP,
+                                          G_KEY_FILE_DESKTOP_KEY_ICON, NULL);
+      if (icon && *icon)
+        g_hash_table_add(names, icon);
+      else
+        g_free(icon);
+    }
+
+  g_key_file_free(kf);
+}
+
+// collect the icon names from all the desktop entries under dirname
+static void
+collect_dir(GHashTable *names, const char *dirname)
+{
+  GDir *dir = g_dir_open(dirname, 0, NULL);
+  const char *name;
+
+  if (!dir)
+    return;
+
+  while ((name = g_dir_read_name(dir)))
+    {
+      gchar *path = g_build_filename(dirname, name, NULL);
+
+      if (g_file_test(path, G_FILE_TEST_IS_DIR))
+        collect_dir(names, path);
+      else if (g_str_has_suffix(name, ".desktop") || g_str_has_suffix(name, ".directory"))
+        collect_icon(names, path);
+
+      g_free(path);
+    }
+
+  g_dir_close(dir);
+}
+
+static void
+add_icon(iconcache_writer *writer, GHashTable *done, const char *filename, int size)
+{
+  gchar *key = g_strdup_printf("%d %s", size, filename);
+
+  if (g_hash_table_contains(done, key))
+    {
+      g_free(key);
+      return;
+    }
+  g_hash_table_add(done, key);
+
+  GError *error = NULL;
+  GdkPixbuf *pixbuf = gdk_pixbuf_new_from_file_at_scale(filename, size, size, FALSE, &error);
+  if (!pixbuf)
+    {
+      fprintf(stderr, "%s: %s\n", filename, error->message);
+      g_error_free(error);
+      return;
+    }
+
+  guint8 *pixels = g_malloc(size * size * 4);
+  iconcache_convert_pixels(gdk_pixbuf_get_pixels(pixbuf),
+                           gdk_pixbuf_get_width(pixbuf),
+                           gdk_pixbuf_get_height(pixbuf),
+                           gdk_pixbuf_get_rowstride(pixbuf),
+                           gdk_pixbuf_get_has_alpha(pixbuf),
+                           pixels);
+  iconcache_writer_add(writer, filename, size, pixels);
+
+  g_free(pixels);
+  g_object_unref(pixbuf);
+}
+
+int
+main(int argc, char *argv[])
+{
+  gchar **themes = NULL;
+  gchar **sizes = NULL;
+  gchar *output = NULL;
+  GError *error = NULL;
+  int i, j, k;
+
+  GOptionEntry entries[] =
+    {
+      { "theme", 't', 0, G_OPTION_ARG_STRING_ARRAY, &themes, "Icon theme to resolve icons in (may be repeated)", "THEME" },
+      { "size", 's', 0, G_OPTION_ARG_STRING_ARRAY, &sizes, "Icon size to cache (may be repeated)", "SIZE" },
+      { "output", 'o', 0, G_OPTION_ARG_FILENAME, &output, "Cache file to write (default " ICONCACHE_DEFAULT_PATH ")", "FILE" },
+      { NULL }
+    };
+
+  GOptionContext *context = g_option_context_new("- generate the xwin-xdg-menu shared icon cache");
+  g_option_context_add_main_entries(context, entries, NULL);
+  if (!g_option_context_parse(context, &argc, &argv, &error))
+    {
+      fprintf(stderr, "%s\n", error->message);
+      return 1;
+    }
+  g_option_context_free(context);
+
+  // by default, the sizes offered by the 'Icon size' menu
+  GArray *size_list = g_array_new(FALSE, FALSE, sizeof(int));
+  if (sizes)
+    {
+      for (i = 0; sizes[i]; i++)
+        {
+          int size = atoi(sizes[i]);
+          if (size > 0 && size <= 256)
+            g_array_append_val(size_list, size);
+        }
+    }
+  else
+    {
+      int defaults[] = { 16, 24, 32, 48, 64,
+                         MIN(GetSystemMetrics(SM_CXMENUCHECK), GetSystemMetrics(SM_CYMENUCHECK)) };
+      g_array_append_vals(size_list, defaults, G_N_ELEMENTS(defaults));
+    }
+
+  if (!themes)
+    {
+      themes = g_new0(gchar *, 2);
+      themes[0] = g_strdup("hicolor");
+    }
+
+  // only the system-wide entries, each user's own are overlaid at run time
+  GHashTable *names = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  const gchar * const *data_dirs = g_get_system_data_dirs();
+  for (i = 0; data_dirs[i]; i++)
+    {
+      gchar *dir = g_build_filename(data_dirs[i], "applications", NULL);
+      collect_dir(names, dir);
+      g_free(dir);
+
+      dir = g_build_filename(data_dirs[i], "desktop-directories", NULL);
+      collect_dir(names, dir);
+      g_free(dir);
+    }
+
+  for (i = 0; builtin_icons[i]; i++)
+    g_hash_table_add(names, g_strdup(builtin_icons[i]));
+
+  iconcache_writer *writer = iconcache_writer_new();
+  GHashTable *done = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+  for (i = 0; themes[i]; i++)
+    {
+      iconresolver *theme = iconresolver_new(themes[i]);
+      GHashTableIter iter;
+      gpointer name;
+
+      g_hash_table_iter_init(&iter, names);
+      while (g_hash_table_iter_next(&iter, &name, NULL))
+        {
+          for (j = 0; j < (int)size_list->len; j++)
+            {
+              int size = g_array_index(size_list, int, j);
+              gchar *filename;
+
+              if (g_path_is_absolute(name))
+                filename = g_strdup(name);
+              else
+                filename = iconresolver_lookup(theme, name, size, 1);
+
+              if (filename)
+                add_icon(writer, done, filename, size);
+
+              g_free(filename);
+            }
+        }
+
+      iconresolver_free(theme);
+    }
+
+  if (!output)
+    output = g_strdup(ICONCACHE_DEFAULT_PATH);
+
+  gchar *dirname = g_path_get_dirname(output);
+  g_mkdir_with_parents(dirname, 0755);
+  g_free(dirname);
+
+  k = g_hash_table_size(done);
+  if (!iconcache_writer_save(writer, output, &error))
+    {
+      fprintf(stderr, "Failed to write cache: %s\n", error->message);
+      return 1;
+    }
+
+  printf("Cached %d icons for %d icon names\n", k, g_hash_table_size(names));
+
+  iconcache_writer_free(writer);
+  g_hash_table_destroy(done);
+  g_hash_table_destroy(names);
+  g_array_free(size_list, TRUE);
+  g_strfreev(themes);
+  g_strfreev(sizes);
+  g_free(output);
+
+  return 0;
+}
@@ -0,0 +1,284 @@
+/*
+ * childlog.c
+ *
+ * Copyright (C) Jon Turney 2015
+ *
+ * This file is part of xwin-xdg-menu
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+//
+// Child output logging
+//
+// Each launched process gets a childlog, which keeps a ring buffer of its most
+// recent output lines, and a token bucket which limits the rate at which those
+// lines are written to the log, so one noisy child can't flood it.  Whatever
+// is read from a child's pipes in one go is formatted into a single batch and
+// written with one locked write, so lines from concurrent children never
+// interleave.
+//
+// Log lines look like:
+//
+// 2015-06-01T12:34:56.789 [1234 emacs.desktop stdout] text
+//
+// This only needs GLib, so the logging can be exercised by a tool.
+//
+
+#include "childlog.h"
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/select.h>
+#include <unistd.h>
+
+#define LOG_LINE_MAX 512
+
+G_LOCK_DEFINE_STATIC(output);
+
+typedef struct
+{
+  int fd;
+  const char *name;
+  char buf[LOG_LINE_MAX];
+  size_t len;
+} logstream;
+
+void
+childlog_init(childlog *log, const char *tag, int rate, int burst)
+{
+  memset(log, 0, sizeof(*log));
+  log->tag = g_strdup(tag ? tag : "-");
+  log->pid = -1;
+  log->rate = rate;
+  log->burst = MAX(burst, 1);
+  log->tokens = log->burst;
+  log->refilled = g_get_monotonic_time();
+  log->batch = g_string_new(NULL);
+}
+
+void
+childlog_clear(childlog *log)
+{
+  int i;
+  for (i = 0; i < CHILDLOG_RING_LINES; i++)
+    g_free(log->ring[i].text);
+  g_string_free(log->batch, TRUE);
+  g_free(log->tag);
+}
+
+// the timestamp is taken once per batch, not once per line
+void
+childlog_stamp(childlog *log)
+{
+  GDateTime *now = g_date_time_new_now_local();
+  gchar *s = g_date_time_format(now, "%Y-%m-%dT%H:%M:%S");
+  g_snprintf(log->stamp, sizeof(log->stamp), "%s.%03d", s,
+             g_date_time_get_microsecond(now) / 1000);
+  g_free(s);
+  g_date_time_unref(now);
+}
+
+static void
+childlog_append(childlog *log, const char *fdname, const char *text)
+{
+  g_string_append_printf(log->batch, "%s [%d %s %s] %s\n", log->stamp,
+                         log->pid, log->tag, fdname, text);
+}
+
+void
+childlog_printf(childlog *log, const char *format, ...)
+{
+  va_list ap;
+  va_start(ap, format);
+  gchar *text = g_strdup_vprintf(format, ap);
+  va_end(ap);
+
+  childlog_append(log, "-", text);
+  g_free(text);
+}
+
+void
+childlog_flush(childlog *log)
+{
+  if (!log->batch->len)
+    return;
+
+  G_LOCK(output);
+  fwrite(log->batch->str, 1, log->batch->len, stdout);
+  fflush(stdout);
+  G_UNLOCK(output);
+
+  g_string_truncate(log->batch, 0);
+}
+
+void
+childlog_report_suppressed(childlog *log)
+{
+  if (log->suppressed)
+    {
+      childlog_printf(log, "%u lines suppressed", log->suppressed);
+      log->suppressed = 0;
+    }
+}
+
+static void
+childlog_line(childlog *log, const char *fdname, const char *text)
+{
+  if (!strlen(text))
+    return;
+
+  // record in the ring buffer, whether we log it now or not
+  logline *l = &log->ring[log->ring_next];
+  log->ring_next = (log->ring_next + 1) % CHILDLOG_RING_LINES;
+  g_free(l->text);
+  l->text = g_strdup(text);
+  l->fdname = fdname;
+  l->logged = FALSE;
+
+  if (log->rate > 0)
+    {
+      gint64 now = g_get_monotonic_time();
+      log->tokens = MIN(log->burst,
+                        log->tokens + (now - log->refilled) * log->rate / 1e6);
+      log->refilled = now;
+
+      if (log->tokens < 1)
+        {
+          log->suppressed++;
+          return;
+        }
+      log->tokens -= 1;
+    }
+
+  childlog_report_suppressed(log);
+  childlog_append(log, fdname, text);
+  l->logged = TRUE;
+}
+
+// log the lines in the ring buffer which were suppressed, oldest first
+void
+childlog_dump_ring(childlog *log)
+{
+  unsigned int i;
+  for (i = 0; i < CHILDLOG_RING_LINES; i++)
+    {
+      logline *l = &log->ring[(log->ring_next + i) % CHILDLOG_RING_LINES];
+      if (l->text && !l->logged)
+        {
+          childlog_append(log, l->fdname, l->text);
+          l->logged = TRUE;
+        }
+    }
+}
+
+// read whatever is available from s, and log any complete lines. returns FALSE
+// at EOF (or on a read error other than being interrupted)
+static gboolean
+childlog_read(childlog *log, logstream *s)
+{
+  ssize_t n;
+  do
+    n = read(s->fd, s->buf + s->len, sizeof(s->buf) - 1 - s->len);
+  while ((n < 0) && (errno == EINTR));
+
+  if (n <= 0)
+    {
+      // log any incomplete last line
+      s->buf[s->len] = 0;
+      s->len = 0;
+      childlog_line(log, s->name, s->buf);
+      return FALSE;
+    }
+  s->len += n;
+
+  char *start = s->buf;
+  char *end = s->buf + s->len;
+  char *nl;
+  while ((nl = memchr(start, '\n', end - start)))
+    {
+      *nl = 0;
+      childlog_line(log, s->name, start);
+      start = nl + 1;
+    }
+
+  // a line too long for the buffer is logged in pieces
+  if ((start == s->buf) && (s->len == sizeof(s->buf) - 1))
+    {
+      s->buf[s->len] = 0;
+      childlog_line(log, s->name, s->buf);
+      start = end;
+    }
+
+  s->len = end - start;
+  memmove(s->buf, start, s->len);
+
+  return TRUE;
+}
+
+// read from a child's stdout and stderr pipes, and log what it writes, until
+// both are closed.  The pipes are closed afterwards
+void
+childlog_follow(childlog *log, int out_fd, int err_fd)
+{
+  logstream out = { out_fd, "stdout", "", 0 };
+  logstream err = { err_fd, "stderr", "", 0 };
+  int stdout_ok = TRUE, stderr_ok = TRUE;
+
+  while (stdout_ok || stderr_ok)
+    {
+      fd_set readfds;
+      int nfds = 0;
+
+      FD_ZERO(&readfds);
+      if (stdout_ok)
+        {
+          FD_SET(out.fd, &readfds);
+          nfds = MAX(nfds, out.fd + 1);
+        }
+      if (stderr_ok)
+        {
+          FD_SET(err.fd, &readfds);
+          nfds = MAX(nfds, err.fd + 1);
+        }
+
+      if (select(nfds, &readfds, NULL, NULL, NULL) > 0)
+        {
+          childlog_stamp(log);
+
+          if (stdout_ok && FD_ISSET(out.fd, &readfds))
+            stdout_ok = childlog_read(log, &out);
+
+          if (stderr_ok && FD_ISSET(err.fd, &readfds))
+            stderr_ok = childlog_read(log, &err);
+
+          childlog_flush(log);
+        }
+      else if (errno != EINTR)
+        {
+          break;
+        }
+    }
+
+  close(out.fd);
+  close(err.fd);
+}
@@ -0,0 +1,73 @@
+/*
+ * childlog.h
+ *
+ * Copyright (C) Jon Turney 2015
+ *
+ * This file is part of xwin-xdg-menu
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef CHILDLOG_H
+#define CHILDLOG_H
+
+#include <glib.h>
+
+#define CHILDLOG_RING_LINES 32
+
+typedef struct
+{
+  char *text;
+  const char *fdname;
+  gboolean logged;
+} logline;
+
+typedef struct
+{
+  char *tag;
+  int pid;
+
+  // ring buffer of the most recent output lines
+  logline ring[CHILDLOG_RING_LINES];
+  unsigned int ring_next;
+
+  // token bucket rate limit, in lines per second
+  int rate;
+  int burst;
+  double tokens;
+  gint64 refilled;
+  unsigned int suppressed;
+
+  // lines formatted but not yet written
+  GString *batch;
+  char stamp[32];
+} childlog;
+
+void childlog_init(childlog *log, const char *tag, int rate, int burst);
+void childlog_clear(childlog *log);
+void childlog_stamp(childlog *log);
+void childlog_printf(childlog *log, const char *format, ...) G_GNUC_PRINTF(2, 3);
+void childlog_flush(childlog *log);
+void childlog_report_suppressed(childlog *log);
+void childlog_dump_ring(childlog *log);
+void childlog_follow(childlog *log, int out_fd, int err_fd);
+
+#endif /* CHILDLOG_H */
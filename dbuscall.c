@@ -0,0 +1,220 @@
+/*
+ * dbuscall.c
+ *
+ * Copyright (C) Jon Turney 2015
+ *
+ * This file is part of xwin-xdg-menu
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+//
+// D-Bus method calls on the session bus
+//
+// These are made in-process, rather than by running a helper.  The
+// connection is opened when first needed, and calls are made asynchronously,
+// with the result logged when the reply arrives.
+//
+
+#include "dbuscall.h"
+#include <stdio.h>
+
+#define DBUS_SHUTDOWN_TIMEOUT (2 * G_USEC_PER_SEC)
+
+typedef struct
+{
+  char *tag;
+  char *bus_name;
+  char *object_path;
+  char *interface;
+  char *method;
+  GVariant *parameters;
+  gint64 requested;
+} dbus_call;
+
+static GDBusConnection *session_bus;
+// calls which haven't had a reply yet
+static guint dbus_pending;
+static metrics_counter *dbus_failures;
+
+//
+// Count failed calls with failures (which may be NULL)
+//
+void
+dbus_call_init(metrics_counter *failures)
+{
+  dbus_failures = failures;
+}
+
+static void
+dbus_call_free(dbus_call *call)
+{
+  g_free(call->tag);
+  g_free(call->bus_name);
+  g_free(call->object_path);
+  g_free(call->interface);
+  g_free(call->method);
+  if (call->parameters)
+    g_variant_unref(call->parameters);
+  g_free(call);
+  dbus_pending--;
+}
+
+static void
+dbus_call_done(GObject *source, GAsyncResult *res, gpointer data)
+{
+  dbus_call *call = data;
+  GError *error = NULL;
+
+  GVariant *result = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+  if (result)
+    {
+      printf("[%s dbus] %s completed, %.1f ms after request\n", call->tag, call->method,
+             (g_get_monotonic_time() - call->requested) / 1000.0);
+      g_variant_unref(result);
+    }
+  else
+    {
+      printf("[%s dbus] %s failed: %s\n", call->tag, call->method, error->message);
+      if (dbus_failures)
+        metrics_counter_add(dbus_failures, 1);
+      g_error_free(error);
+    }
+
+  dbus_call_free(call);
+}
+
+static void
+dbus_call_send(dbus_call *call)
+{
+  // the parameters were sunk when the call was made, so the connection takes
+  // its own reference, and ours is dropped when the call is freed
+  g_dbus_connection_call(session_bus, call->bus_name, call->object_path,
+                         call->interface, call->method, call->parameters,
+                         NULL, G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+                         dbus_call_done, call);
+}
+
+static void
+dbus_bus_ready(GObject *source, GAsyncResult *res, gpointer data)
+{
+  dbus_call *call = data;
+  GError *error = NULL;
+
+  GDBusConnection *bus = g_bus_get_finish(res, &error);
+  if (!bus)
+    {
+      printf("[%s dbus] Unable to connect to session bus: %s\n", call->tag, error->message);
+      if (dbus_failures)
+        metrics_counter_add(dbus_failures, 1);
+      g_error_free(error);
+      dbus_call_free(call);
+      return;
+    }
+
+  // g_bus_get() always gives the same connection, so keep one reference
+  if (!session_bus)
+    session_bus = bus;
+  else
+    g_object_unref(bus);
+
+  dbus_call_send(call);
+}
+
+//
+// Call method, logging the result with tag.  A floating parameters reference
+// is consumed
+//
+void
+dbus_call_async(const char *tag, const char *bus_name, const char *object_path,
+                const char *interface, const char *method, GVariant *parameters)
+{
+  dbus_call *call = g_new0(dbus_call, 1);
+  call->tag = g_strdup(tag);
+  call->bus_name = g_strdup(bus_name);
+  call->object_path = g_strdup(object_path);
+  call->interface = g_strdup(interface);
+  call->method = g_strdup(method);
+  call->parameters = parameters ? g_variant_ref_sink(parameters) : NULL;
+  call->requested = g_get_monotonic_time();
+  dbus_pending++;
+
+  if (session_bus)
+    dbus_call_send(call);
+  else
+    g_bus_get(G_BUS_TYPE_SESSION, NULL, dbus_bus_ready, call);
+}
+
+//
+// Activate a DBusActivatable application, as 'gapplication launch' does
+//
+void
+dbus_call_activate(const char *bus_name)
+{
+  // the object path is the bus name with '.' replaced with '/' and '-' with
+  // '_'
+  char *object_path = g_strconcat("/", bus_name, NULL);
+  g_strdelimit(object_path, ".", '/');
+  g_strdelimit(object_path, "-", '_');
+
+  // we don't do startup notification, so have no platform data to offer
+  GVariantBuilder platform_data;
+  g_variant_builder_init(&platform_data, G_VARIANT_TYPE_VARDICT);
+
+  printf("[%s dbus] activating\n", bus_name);
+  dbus_call_async(bus_name, bus_name, object_path,
+                  "org.freedesktop.Application", "Activate",
+                  g_variant_new("(a{sv})", &platform_data));
+
+  g_free(object_path);
+}
+
+//
+// The number of calls which haven't had a reply yet
+//
+guint
+dbus_call_pending(void)
+{
+  return dbus_pending;
+}
+
+//
+// Give any calls in flight (e.g. logout on exit) a chance to complete, and
+// close the connection
+//
+void
+dbus_call_shutdown(void)
+{
+  gint64 deadline = g_get_monotonic_time() + DBUS_SHUTDOWN_TIMEOUT;
+
+  while (dbus_pending && (g_get_monotonic_time() < deadline))
+    {
+      if (!g_main_context_iteration(NULL, FALSE))
+        g_usleep(1000);
+    }
+
+  if (session_bus)
+    {
+      g_dbus_connection_flush_sync(session_bus, NULL, NULL);
+      g_object_unref(session_bus);
+      session_bus = NULL;
+    }
+}
@@ -0,0 +1,42 @@
+/*
+ * dbuscall.h
+ *
+ * Copyright (C) Jon Turney 2015
+ *
+ * This file is part of xwin-xdg-menu
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef DBUSCALL_H
+#define DBUSCALL_H
+
+#include <gio/gio.h>
+#include "metrics.h"
+
+void dbus_call_init(metrics_counter *failures);
+void dbus_call_async(const char *tag, const char *bus_name, const char *object_path,
+                     const char *interface, const char *method, GVariant *parameters);
+void dbus_call_activate(const char *bus_name);
+guint dbus_call_pending(void);
+void dbus_call_shutdown(void);
+
+#endif /* DBUSCALL_H */
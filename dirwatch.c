@@ -0,0 +1,470 @@
+/*
+ * dirwatch.c
+ *
+ * Copyright (C) Jon Turney 2015
+ *
+ * This file is part of xwin-xdg-menu
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+//
+// Notice when any of a set of files and directories change
+//
+// Up to a budget of them are watched with a GFileMonitor (which on Linux
+// uses an inotify watch each, and there are only so many of those).  The rest,
+// and any on a remote filesystem, where change notification can't be relied
+// on, are polled.
+//
+// Each path has a fingerprint of its modification time and size, and for a
+// directory those of everything in it, which takes one pass over the
+// directory.  Polling fingerprints all the polled paths, at an interval which
+// doubles each time nothing has changed, up to DIRWATCH_BACKOFF times the
+// initial interval, and which is long enough that polling takes no more than
+// about 1/DIRWATCH_DUTY of the time.  Once events from a monitor have stopped
+// for DIRWATCH_SETTLE ms, the paths they were for are fingerprinted again.
+//
+// Either way, we're only told about a change if a fingerprint is different,
+// so touching a file, or the spurious events some network filesystems give,
+// don't cause the menu to be read again.
+//
+
+#include "dirwatch.h"
+#include <gio/gio.h>
+#include <string.h>
+
+#define DIRWATCH_BACKOFF 16
+#define DIRWATCH_DUTY 20
+#define DIRWATCH_SETTLE 500
+
+#define DIRWATCH_ATTRIBUTES G_FILE_ATTRIBUTE_STANDARD_NAME "," \
+                            G_FILE_ATTRIBUTE_STANDARD_TYPE "," \
+                            G_FILE_ATTRIBUTE_STANDARD_SIZE "," \
+                            G_FILE_ATTRIBUTE_TIME_MODIFIED "," \
+                            G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC
+
+typedef struct
+{
+  dirwatch *w;
+  char *path;
+  guint64 fingerprint;
+  gboolean remote;
+  // NULL if polled
+  GFileMonitor *monitor;
+  // a monitor has said it changed
+  gboolean dirty;
+} watched_path;
+
+struct _dirwatch
+{
+  int budget;
+  int interval;
+  // the current polling interval
+  int current;
+  // path -> watched_path
+  GHashTable *paths;
+  GPtrArray *polled;
+  guint monitored;
+  guint poll_source;
+  guint settle_source;
+  dirwatch_func changed;
+  gpointer data;
+};
+
+//
+// Fingerprints (FNV-1a)
+//
+
+#define FINGERPRINT_BASIS 14695981039346656037ULL
+#define FINGERPRINT_PRIME 1099511628211ULL
+
+static guint64
+fingerprint_add(guint64 h, const void *data, gsize len)
+{
+  const guchar *p = data;
+
+  while (len--)
+    {
+      h ^= *p++;
+      h *= FINGERPRINT_PRIME;
+    }
+
+  return h;
+}
+
+static guint64
+fingerprint_info(GFileInfo *info)
+{
+  guint64 h = FINGERPRINT_BASIS;
+  const char *name = g_file_info_get_name(info);
+  guint32 type = g_file_info_get_file_type(info);
+  guint64 size = g_file_info_get_size(info);
+  guint64 mtime = g_file_info_get_attribute_uint64(info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+  guint32 usec = g_file_info_get_attribute_uint32(info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC);
+
+  if (name)
+    h = fingerprint_add(h, name, strlen(name));
+  h = fingerprint_add(h, &type, sizeof(type));
+  h = fingerprint_add(h, &size, sizeof(size));
+  h = fingerprint_add(h, &mtime, sizeof(mtime));
+  h = fingerprint_add(h, &usec, sizeof(usec));
+
+  return h;
+}
+
+// the fingerprint of path, or 0 if it doesn't exist
+static guint64
+fingerprint(const char *path)
+{
+  GFile *file = g_file_new_for_path(path);
+  GFileInfo *info = g_file_query_info(file, DIRWATCH_ATTRIBUTES, G_FILE_QUERY_INFO_NONE, NULL, NULL);
+  guint64 h = 0;
+
+  if (info)
+    {
+      h = fingerprint_info(info);
+
+      if (g_file_info_get_file_type(info) == G_FILE_TYPE_DIRECTORY)
+        {
+          GFileEnumerator *e = g_file_enumerate_children(file, DIRWATCH_ATTRIBUTES,
+                                                         G_FILE_QUERY_INFO_NONE, NULL, NULL);
+          if (e)
+            {
+              GFileInfo *child;
+              guint64 children = 0;
+
+              // the order of the children doesn't matter
+              while ((child = g_file_enumerator_next_file(e, NULL, NULL)))
+                {
+                  children += fingerprint_info(child);
+                  g_object_unref(child);
+                }
+              g_object_unref(e);
+
+              h = fingerprint_add(h, &children, sizeof(children));
+            }
+        }
+
+      g_object_unref(info);
+    }
+
+  g_object_unref(file);
+  return h;
+}
+
+// is path (or, if it doesn't exist, the nearest directory above it which does)
+// on a remote filesystem?
+gboolean
+dirwatch_remote(const char *path)
+{
+  GFile *file = g_file_new_for_path(path);
+  gboolean remote = FALSE;
+
+  while (file)
+    {
+      GFileInfo *info = g_file_query_filesystem_info(file, G_FILE_ATTRIBUTE_FILESYSTEM_REMOTE,
+                                                     NULL, NULL);
+      if (info)
+        {
+          remote = g_file_info_get_attribute_boolean(info, G_FILE_ATTRIBUTE_FILESYSTEM_REMOTE);
+          g_object_unref(info);
+          g_object_unref(file);
+          break;
+        }
+
+      GFile *parent = g_file_get_parent(file);
+      g_object_unref(file);
+      file = parent;
+    }
+
+  return remote;
+}
+
+//
+// Polling
+//
+
+static gboolean dirwatch_poll(gpointer data);
+
+static void
+dirwatch_schedule(dirwatch *w)
+{
+  if (w->poll_source)
+    {
+      g_source_remove(w->poll_source);
+      w->poll_source = 0;
+    }
+
+  if (w->polled->len)
+    w->poll_source = g_timeout_add(w->current, dirwatch_poll, w);
+}
+
+static gboolean
+dirwatch_poll(gpointer data)
+{
+  dirwatch *w = data;
+  gint64 start = g_get_monotonic_time();
+  guint changed = 0;
+  guint i;
+
+  w->poll_source = 0;
+
+  for (i = 0; i < w->polled->len; i++)
+    {
+      watched_path *wp = g_ptr_array_index(w->polled, i);
+      guint64 h = fingerprint(wp->path);
+
+      if (h != wp->fingerprint)
+        {
+          wp->fingerprint = h;
+          changed++;
+        }
+    }
+
+  int duration = (g_get_monotonic_time() - start) / 1000;
+
+  if (changed)
+    {
+      g_print("Polling %u paths found %u changed\n", w->polled->len, changed);
+      w->current = w->interval;
+    }
+  else
+    {
+      w->current = MIN(w->current * 2, w->interval * DIRWATCH_BACKOFF);
+    }
+  w->current = MAX(w->current, duration * DIRWATCH_DUTY);
+  dirwatch_schedule(w);
+
+  // this may set the paths again, so must be last
+  if (changed)
+    w->changed(w->data);
+
+  return G_SOURCE_REMOVE;
+}
+
+//
+// Monitoring
+//
+
+static gboolean
+dirwatch_settled(gpointer data)
+{
+  dirwatch *w = data;
+  GHashTableIter iter;
+  gpointer value;
+  guint dirty = 0, changed = 0;
+
+  w->settle_source = 0;
+
+  g_hash_table_iter_init(&iter, w->paths);
+  while (g_hash_table_iter_next(&iter, NULL, &value))
+    {
+      watched_path *wp = value;
+      if (!wp->dirty)
+        continue;
+
+      guint64 h = fingerprint(wp->path);
+      if (h != wp->fingerprint)
+        {
+          wp->fingerprint = h;
+          changed++;
+        }
+      wp->dirty = FALSE;
+      dirty++;
+    }
+
+  if (!changed)
+    {
+      g_print("Changes notified for %u paths made no difference\n", dirty);
+      return G_SOURCE_REMOVE;
+    }
+
+  // this may set the paths again, so must be last
+  w->changed(w->data);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+dirwatch_event(GFileMonitor *monitor, GFile *file, GFile *other,
+               GFileMonitorEvent event, gpointer data)
+{
+  watched_path *wp = data;
+  dirwatch *w = wp->w;
+
+  if (event == G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT)
+    return;
+
+  wp->dirty = TRUE;
+
+  if (w->settle_source)
+    g_source_remove(w->settle_source);
+  w->settle_source = g_timeout_add(DIRWATCH_SETTLE, dirwatch_settled, w);
+}
+
+static void
+watched_path_unmonitor(watched_path *wp)
+{
+  if (!wp->monitor)
+    return;
+
+  g_signal_handlers_disconnect_by_data(wp->monitor, wp);
+  g_file_monitor_cancel(wp->monitor);
+  g_object_unref(wp->monitor);
+  wp->monitor = NULL;
+}
+
+static void
+watched_path_free(gpointer data)
+{
+  watched_path *wp = data;
+
+  watched_path_unmonitor(wp);
+  g_free(wp->path);
+  g_free(wp);
+}
+
+//
+// Interface
+//
+
+// watch up to budget paths (or any number, if negative) with a monitor, and
+// poll the rest, at least every interval ms.  changed is called when anything
+// has changed
+dirwatch *
+dirwatch_new(int budget, int interval, dirwatch_func changed, gpointer data)
+{
+  dirwatch *w = g_new0(dirwatch, 1);
+
+  w->budget = budget;
+  w->interval = MAX(interval, 100);
+  w->current = w->interval;
+  w->paths = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, watched_path_free);
+  w->polled = g_ptr_array_new();
+  w->changed = changed;
+  w->data = data;
+
+  return w;
+}
+
+void
+dirwatch_free(dirwatch *w)
+{
+  if (!w)
+    return;
+
+  if (w->poll_source)
+    g_source_remove(w->poll_source);
+  if (w->settle_source)
+    g_source_remove(w->settle_source);
+  g_hash_table_destroy(w->paths);
+  g_ptr_array_free(w->polled, TRUE);
+  g_free(w);
+}
+
+// watch paths (which needn't exist) instead of what was watched before, taking
+// what they are now as unchanged.  Paths which were already watched keep their
+// monitor, if they had one
+void
+dirwatch_set_paths(dirwatch *w, GPtrArray *paths)
+{
+  GHashTable *old = w->paths;
+  guint monitored = w->monitored, polled = w->polled->len;
+  guint remote = 0;
+  guint i;
+
+  w->paths = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, watched_path_free);
+  g_ptr_array_set_size(w->polled, 0);
+  w->monitored = 0;
+
+  for (i = 0; i < paths->len; i++)
+    {
+      const char *path = g_ptr_array_index(paths, i);
+      watched_path *wp;
+
+      if (g_hash_table_contains(w->paths, path))
+        continue;
+
+      if (g_hash_table_lookup_extended(old, path, NULL, (gpointer *)&wp))
+        {
+          g_hash_table_steal(old, path);
+        }
+      else
+        {
+          wp = g_new0(watched_path, 1);
+          wp->w = w;
+          wp->path = g_strdup(path);
+          wp->remote = dirwatch_remote(path);
+        }
+      g_hash_table_insert(w->paths, wp->path, wp);
+
+      wp->fingerprint = fingerprint(path);
+      wp->dirty = FALSE;
+
+      if (wp->remote)
+        remote++;
+
+      // the first paths in the budget which aren't remote are monitored
+      if (wp->remote || ((w->budget >= 0) && (w->monitored >= (guint)w->budget)))
+        watched_path_unmonitor(wp);
+      else if (!wp->monitor)
+        {
+          GFile *file = g_file_new_for_path(path);
+          wp->monitor = g_file_monitor(file, G_FILE_MONITOR_NONE, NULL, NULL);
+          g_object_unref(file);
+
+          if (wp->monitor)
+            g_signal_connect(wp->monitor, "changed", G_CALLBACK(dirwatch_event), wp);
+        }
+
+      if (wp->monitor)
+        w->monitored++;
+      else
+        g_ptr_array_add(w->polled, wp);
+    }
+
+  g_hash_table_destroy(old);
+
+  if ((w->monitored != monitored) || (w->polled->len != polled))
+    g_print("Monitoring %u paths, polling %u (%u remote)\n", w->monitored, w->polled->len, remote);
+
+  // any pending events were for what's now the starting point
+  if (w->settle_source)
+    {
+      g_source_remove(w->settle_source);
+      w->settle_source = 0;
+    }
+
+  w->current = w->interval;
+  dirwatch_schedule(w);
+}
+
+guint
+dirwatch_monitored(dirwatch *w)
+{
+  return w->monitored;
+}
+
+guint
+dirwatch_polled(dirwatch *w)
+{
+  return w->polled->len;
+}
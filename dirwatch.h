@@ -0,0 +1,46 @@
+/*
+ * dirwatch.h
+ *
+ * Copyright (C) Jon Turney 2015
+ *
+ * This file is part of xwin-xdg-menu
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef DIRWATCH_H
+#define DIRWATCH_H
+
+#include <glib.h>
+
+typedef struct _dirwatch dirwatch;
+
+typedef void (*dirwatch_func)(gpointer data);
+
+dirwatch *dirwatch_new(int budget, int interval, dirwatch_func changed, gpointer data);
+void dirwatch_free(dirwatch *w);
+void dirwatch_set_paths(dirwatch *w, GPtrArray *paths);
+guint dirwatch_monitored(dirwatch *w);
+guint dirwatch_polled(dirwatch *w);
+
+gboolean dirwatch_remote(const char *path);
+
+#endif /* DIRWATCH_H */
@@ -0,0 +1,169 @@
+/*
+ * entrytable.c
+ *
+ * Copyright (C) Jon Turney 2015
+ *
+ * This file is part of xwin-xdg-menu
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+//
+// A compact table of the menu entries, holding just what's needed to launch
+// them
+//
+// Records are fixed size, in one array, and refer to strings by offset into a
+// single pool, in which identical strings (e.g. categories, or exec lines
+// shared by several entries) are stored once.  The hash table used to find
+// identical strings is only needed while the table is being filled in, and is
+// dropped by entrytable_freeze().
+//
+
+#include "entrytable.h"
+#include <string.h>
+
+struct _entrytable
+{
+  GArray *records;
+  GByteArray *pool;
+  // string -> offset + 1, while adding
+  GHashTable *interned;
+};
+
+entrytable *
+entrytable_new(void)
+{
+  entrytable *t = g_new0(entrytable, 1);
+  t->records = g_array_new(FALSE, FALSE, sizeof(entry_record));
+  t->pool = g_byte_array_new();
+  t->interned = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+  // offset 0 is the empty string
+  g_byte_array_append(t->pool, (const guint8 *)"", 1);
+
+  return t;
+}
+
+void
+entrytable_free(entrytable *t)
+{
+  if (!t)
+    return;
+
+  g_array_free(t->records, TRUE);
+  g_byte_array_free(t->pool, TRUE);
+  if (t->interned)
+    g_hash_table_destroy(t->interned);
+  g_free(t);
+}
+
+static guint32
+entrytable_intern(entrytable *t, const char *s)
+{
+  if (!s || !*s)
+    return 0;
+
+  // the pool may move as it grows, so the keys are copies, mapping to the
+  // offset
+  gpointer value;
+  if (g_hash_table_lookup_extended(t->interned, s, NULL, &value))
+    return GPOINTER_TO_UINT(value) - 1;
+
+  guint32 offset = t->pool->len;
+  g_byte_array_append(t->pool, (const guint8 *)s, strlen(s) + 1);
+  g_hash_table_insert(t->interned, g_strdup(s), GUINT_TO_POINTER(offset + 1));
+
+  return offset;
+}
+
+// add an entry, returning its index.  Strings are copied
+guint
+entrytable_add(entrytable *t, const char *id, const char *path,
+               const char *name, const char *exec, const char *icon,
+               const char *categories, guint32 flags)
+{
+  entry_record r;
+
+  // entries added after freezing are only shared amongst themselves
+  if (!t->interned)
+    t->interned = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+  r.id = entrytable_intern(t, id);
+  r.path = entrytable_intern(t, path);
+  r.name = entrytable_intern(t, name);
+  r.exec = entrytable_intern(t, exec);
+  r.icon = entrytable_intern(t, icon);
+  r.categories = entrytable_intern(t, categories);
+  r.flags = flags;
+
+  g_array_append_val(t->records, r);
+  return t->records->len - 1;
+}
+
+// drop what's only needed while adding entries
+void
+entrytable_freeze(entrytable *t)
+{
+  if (!t->interned)
+    return;
+
+  g_hash_table_destroy(t->interned);
+  t->interned = NULL;
+
+  // trim the allocations to size
+  GArray *records = g_array_sized_new(FALSE, FALSE, sizeof(entry_record), t->records->len);
+  g_array_append_vals(records, t->records->data, t->records->len);
+  g_array_free(t->records, TRUE);
+  t->records = records;
+
+  GByteArray *pool = g_byte_array_sized_new(t->pool->len);
+  g_byte_array_append(pool, t->pool->data, t->pool->len);
+  g_byte_array_free(t->pool, TRUE);
+  t->pool = pool;
+}
+
+guint
+entrytable_count(entrytable *t)
+{
+  return t->records->len;
+}
+
+const entry_record *
+entrytable_get(entrytable *t, guint index)
+{
+  if (index >= t->records->len)
+    return NULL;
+
+  return &g_array_index(t->records, entry_record, index);
+}
+
+const char *
+entrytable_string(entrytable *t, guint32 offset)
+{
+  return (const char *)t->pool->data + offset;
+}
+
+// the memory used by the records and strings
+gsize
+entrytable_size(entrytable *t)
+{
+  return t->records->len * sizeof(entry_record) + t->pool->len;
+}
@@ -0,0 +1,62 @@
+/*
+ * entrytable.h
+ *
+ * Copyright (C) Jon Turney 2015
+ *
+ * This file is part of xwin-xdg-menu
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef ENTRYTABLE_H
+#define ENTRYTABLE_H
+
+#include <glib.h>
+
+#define ENTRY_TERMINAL 0x1
+#define ENTRY_DBUS_ACTIVATABLE 0x2
+
+// offsets into the string pool, 0 is the empty string
+typedef struct
+{
+  guint32 id;
+  guint32 path;
+  guint32 name;
+  guint32 exec;
+  guint32 icon;
+  guint32 categories;
+  guint32 flags;
+} entry_record;
+
+typedef struct _entrytable entrytable;
+
+entrytable *entrytable_new(void);
+void entrytable_free(entrytable *table);
+guint entrytable_add(entrytable *table, const char *id, const char *path,
+                     const char *name, const char *exec, const char *icon,
+                     const char *categories, guint32 flags);
+void entrytable_freeze(entrytable *table);
+guint entrytable_count(entrytable *table);
+const entry_record *entrytable_get(entrytable *table, guint index);
+const char *entrytable_string(entrytable *table, guint32 offset);
+gsize entrytable_size(entrytable *table);
+
+#endif /* ENTRYTABLE_H */
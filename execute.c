@@ -34,43 +34,222 @@
 //
 
 #include "execute.h"
+#include "childlog.h"
+#include "dbuscall.h"
+#include "launchsched.h"
+#include "logfile.h"
 #include "menu.h"
+#include "metrics.h"
+#include "policy.h"
+#include "prelaunch.h"
+#include "proctable.h"
+#include "terminal.h"
+#include "trace.h"
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/resource.h>
 #include <sys/wait.h>
 
+static metrics_counter *launches;
+static metrics_counter *launch_failures;
+static metrics_counter *launch_suppressed;
+static metrics_histogram *launch_spawned_us;
+static metrics_histogram *launch_window_us;
+
+// launches are suppressed if repeated too soon, and queued if too many are
+// already starting
+static launchsched *sched;
+
+// how long a launch counts as still starting, if its command hasn't exited
+#define LAUNCH_STARTUP 10000
+
+// how often to log the latency of launching
+#define LATENCY_SUMMARY_INTERVAL 20
+
+// how long after a menu item is selected a window being shown may be
+// attributed to it
+#define WINDOW_TIMEOUT (30 * G_USEC_PER_SEC)
+
+// a launch from the menu waiting for a window to be shown
+typedef struct
+{
+  gint64 selected;
+  metrics_histogram *window_us;
+} window_wait;
+
+// launches waiting for a window, oldest first.  Added to by the launch threads
+static GQueue *awaiting_window;
+G_LOCK_DEFINE_STATIC(awaiting);
+
+// times of launches in the last minute, oldest first.  Only used from the main
+// thread
+static GArray *recent_launches;
+
+// a command being launched, and the logging of its output
+typedef struct
+{
+  char *cmd;
+  // for telling the scheduler when the command has exited
+  guint token;
+  // when the launch was requested, and when the menu item was selected (0
+  // if it wasn't launched from the menu), in monotonic microseconds
+  gint64 requested;
+  gint64 selected;
+
+  // if not NULL, the time from selection to a window being shown is also
+  // recorded in this
+  metrics_histogram *window_us;
+
+  // scheduling policy and resource limits to apply to the child
+  launch_policy policy;
+
+  // environment for the child, with DISPLAY set for the display it was
+  // launched from
+  char **envp;
+
+  // called in the main thread once the command has exited
+  execute_exited exited;
+  gpointer exited_data;
+
+  // a server which keeps running (e.g. a prelaunched instance), so isn't
+  // scheduled, as it would hold a slot for launches until it timed out
+  gboolean server;
+
+  childlog log;
+} launch;
+
+static int
+setting_get_integer(const char *key, int def)
+{
+  GError *err = NULL;
+  int value = g_key_file_get_integer(keyfile, "settings", key, &err);
+  if (err)
+    {
+      g_error_free(err);
+      return def;
+    }
+  return value;
+}
+
+static launch *
+launch_new(char *cmd, const char *tag, const launch_policy *policy, const char *display,
+           gint64 selected, metrics_histogram *window_us)
+{
+  launch *l = g_new0(launch, 1);
+  l->cmd = cmd;
+  // built here, since it's not safe to allocate in the child after fork()
+  l->envp = g_get_environ();
+  if (display)
+    l->envp = g_environ_setenv(l->envp, "DISPLAY", display, TRUE);
+  l->requested = g_get_monotonic_time();
+  l->selected = selected;
+  l->window_us = window_us;
+  if (policy)
+    l->policy = *policy;
+  childlog_init(&l->log, tag, setting_get_integer("lograte", 100),
+                setting_get_integer("logburst", 500));
+  return l;
+}
+
 static void
-LogLineFromFd(int fd, const char *fdname, int pid)
+launch_free(launch *l)
 {
-#define BUFSIZE 512
-    char buf[BUFSIZE];
-    char *bufptr = buf;
+  childlog_clear(&l->log);
+  g_strfreev(l->envp);
+  free(l->cmd);
+  g_free(l);
+}
 
-    /* read from fd until eof, newline or our buffer is full */
-    while ((read(fd, bufptr, 1) > 0) && (bufptr < &(buf[BUFSIZE - 1]))) {
-        if (*bufptr == '\n')
-            break;
-        bufptr++;
+// the child has been forked, so record how long that took after the menu item
+// was selected, and wait for its window
+static void
+launch_spawned(launch *l)
+{
+  if (!l->selected)
+    return;
+
+  metrics_histogram_record(launch_spawned_us, g_get_monotonic_time() - l->selected);
+
+  window_wait *w = g_new(window_wait, 1);
+  w->selected = l->selected;
+  w->window_us = l->window_us;
+  G_LOCK(awaiting);
+  g_queue_push_tail(awaiting_window, w);
+  G_UNLOCK(awaiting);
+
+  if (metrics_histogram_count(launch_spawned_us) % LATENCY_SUMMARY_INTERVAL == 0)
+    {
+      char *summary = metrics_histogram_summary(launch_spawned_us);
+      childlog_printf(&l->log, "selection to launch: %s", summary);
+      g_free(summary);
+    }
+}
+
+//
+// A top-level window has been shown at the monotonic time shown.  We can't
+// tell which application it belongs to, so it's attributed to the oldest
+// launch from the menu still waiting for one.  Called in the main thread
+//
+void
+execute_window_shown(gint64 shown)
+{
+  window_wait *w;
+
+  G_LOCK(awaiting);
+  // forget launches which have waited too long, e.g. as they have no window
+  while ((w = g_queue_peek_head(awaiting_window)) &&
+         (shown - w->selected > WINDOW_TIMEOUT))
+    g_free(g_queue_pop_head(awaiting_window));
+  w = g_queue_pop_head(awaiting_window);
+  G_UNLOCK(awaiting);
+
+  if (!w)
+    return;
+
+  metrics_histogram_record(launch_window_us, shown - w->selected);
+  if (w->window_us)
+    {
+      metrics_histogram_record(w->window_us, shown - w->selected);
+      char *summary = metrics_histogram_summary(w->window_us);
+      printf("window shown %.1f ms after selection, %s: %s\n",
+             (shown - w->selected) / 1000.0, w->window_us->name, summary);
+      g_free(summary);
     }
+  g_free(w);
+}
 
-    /* null terminate and log */
-    *bufptr = 0;
-    if (strlen(buf))
-        printf("(pid %d %s) %s\n", pid, fdname, buf);
+// the command has exited (or couldn't be started).  Called in the main thread
+static gboolean
+execute_finished(gpointer data)
+{
+  launch *l = data;
+  if (sched && l->token)
+    launchsched_finished(sched, l->token);
+  if (l->exited)
+    l->exited(l->exited_data);
+  launch_free(l);
+  return G_SOURCE_REMOVE;
 }
 
 static void *
-ExecAndLogThread(void *cmd)
+ExecAndLogThread(void *data)
 {
+    launch *l = data;
+    childlog *log = &l->log;
     int pid;
     int stdout_filedes[2];
     int stderr_filedes[2];
-    int status;
+    int status = 0;
+
+    trace_thread_name("launch");
 
     /* Create a pair of pipes */
     pipe(stdout_filedes);
     pipe(stderr_filedes);
 
+    TRACE_BEGIN("fork", log->tag);
     switch (pid = fork()) {
     case 0: /* child */
     {
@@ -97,80 +276,340 @@ ExecAndLogThread(void *cmd)
         /* Disassociate any TTYs */
         setsid();
 
-        execl("/bin/sh", "/bin/sh", "-c", cmd, NULL);
-        perror("execl failed");
+        /* Apply scheduling policy and resource limits */
+        policy_apply(&l->policy);
+
+        execle("/bin/sh", "/bin/sh", "-c", l->cmd, NULL, l->envp);
+        perror("execle failed");
         exit(127);
     }
     break;
 
     default: /* parent */
     {
-        int stdout_ok = TRUE, stderr_ok = TRUE;
         close(stdout_filedes[1]);
         close(stderr_filedes[1]);
+        TRACE_END("fork");
+        TRACE_BEGIN("child", l->cmd);
 
-        printf("executing '%s', pid %d\n", (char *) cmd, pid);
+        log->pid = pid;
+        proctable_add(pid, log->tag);
+        childlog_stamp(log);
+        childlog_printf(log, "executing '%s', %.1f ms after request", l->cmd,
+                        (g_get_monotonic_time() - l->requested) / 1000.0);
+        launch_spawned(l);
+        childlog_flush(log);
 
         /* read from pipes, write to log, until both are closed */
-        while (stdout_ok || stderr_ok) {
-            fd_set readfds, errorfds;
-            int nfds = 0;
-
-            FD_ZERO(&readfds);
-            if (stdout_ok) {
-                FD_SET(stdout_filedes[0], &readfds);
-                nfds = max(nfds, stdout_filedes[0] + 1);
-            }
-            if (stderr_ok) {
-                FD_SET(stderr_filedes[0], &readfds);
-                nfds = max(nfds, stderr_filedes[0] + 1);
-            }
-            errorfds = readfds;
-
-            if (select(nfds, &readfds, NULL, &errorfds, NULL) > 0) {
-                if (FD_ISSET(stdout_filedes[0], &errorfds))
-                    stdout_ok = FALSE;
-                else if (FD_ISSET(stdout_filedes[0], &readfds))
-                    LogLineFromFd(stdout_filedes[0], "stdout", pid);
-
-                if (FD_ISSET(stderr_filedes[0], &errorfds))
-                    stderr_ok = FALSE;
-                else if (FD_ISSET(stderr_filedes[0], &readfds))
-                    LogLineFromFd(stderr_filedes[0], "stderr", pid);
-            }
-            else {
-                break;
-            }
+        childlog_follow(log, stdout_filedes[0], stderr_filedes[0]);
+
+        char *summary = proctable_reap(pid, &status);
+        /* the shell couldn't execute the command */
+        if (WIFEXITED(status) && (WEXITSTATUS(status) == 126 || WEXITSTATUS(status) == 127))
+            metrics_counter_add(launch_failures, 1);
+        TRACE_END("child");
+        if (G_UNLIKELY(trace_enabled)) {
+            char detail[64];
+            snprintf(detail, sizeof(detail), "%s status 0x%x", log->tag, status);
+            TRACE_INSTANT("child exit", detail);
         }
 
-        waitpid(pid, &status, 0);
+        childlog_stamp(log);
+        childlog_report_suppressed(log);
+        /* if it failed, the suppressed output may well explain why */
+        if (!WIFEXITED(status) || WEXITSTATUS(status))
+            childlog_dump_ring(log);
+
         if (WIFEXITED(status))
-          printf("pid %d exited with status %d\n", pid, WEXITSTATUS(status));
+          childlog_printf(log, "exited with status %d", WEXITSTATUS(status));
         else if (WIFSIGNALED(status))
-          printf("pid %d terminated by signal %d\n", pid, WTERMSIG(status));
+          childlog_printf(log, "terminated by signal %d", WTERMSIG(status));
         else
-          printf("pid %d status 0x%x\n", pid, status);
+          childlog_printf(log, "status 0x%x", status);
+        childlog_printf(log, "resource usage: %s", summary);
+        childlog_flush(log);
+        g_free(summary);
     }
     break;
 
     case -1: /* error */
+        TRACE_END("fork");
+        metrics_counter_add(launch_failures, 1);
+        close(stdout_filedes[0]);
+        close(stdout_filedes[1]);
+        close(stderr_filedes[0]);
+        close(stderr_filedes[1]);
         printf("fork() to run command failed\n");
     }
 
-    free(cmd);
+    g_idle_add(execute_finished, l);
 
     return (void *) (intptr_t) status;
 }
 
+//
+// Launch a command which will outlive us, for use when we are going to exit
+// immediately afterwards
+//
+// The intermediate child exits as soon as it has forked, so the command is
+// reparented to init and we don't wait for it, and its output isn't
+// redirected into our log (since we won't be around to read it)
+//
 static void
-execute_cmd(char *cmd)
+ExecDetached(launch *l)
 {
-  // note that free() will be applied to cmd after the command has exited
+    childlog *log = &l->log;
+    int pid;
+    int status;
+
+    TRACE_BEGIN("fork", log->tag);
+    switch (pid = fork()) {
+    case 0: /* intermediate child */
+    {
+        struct rlimit rl;
+        unsigned int fd;
+        int sig;
+
+        /* Tell the parent if the grandchild couldn't be forked */
+        switch (fork()) {
+        case -1:
+            _exit(1);
+        case 0:
+            break;
+        default:
+            _exit(0);
+        }
+
+        /*
+         * Don't hold the logfile pipe open, as that would keep its writer
+         * thread from seeing EOF when we exit
+         */
+        int null = open("/dev/null", O_WRONLY);
+        if (null >= 0) {
+            dup2(null, STDOUT_FILENO);
+            dup2(null, STDERR_FILENO);
+            if (null > STDERR_FILENO)
+                close(null);
+        }
+
+        /* Close any open descriptors except for STD* */
+        getrlimit(RLIMIT_NOFILE, &rl);
+        for (fd = STDERR_FILENO + 1; fd < rl.rlim_cur; fd++)
+            close(fd);
+
+        for (sig = 1; sig < NSIG; sig++)
+            signal(sig, SIG_DFL);
+
+        setsid();
+        policy_apply(&l->policy);
+
+        execle("/bin/sh", "/bin/sh", "-c", l->cmd, NULL, l->envp);
+        perror("execle failed");
+        _exit(127);
+    }
+
+    case -1:
+        TRACE_END("fork");
+        metrics_counter_add(launch_failures, 1);
+        printf("fork() to run command failed\n");
+        break;
+
+    default:
+        waitpid(pid, &status, 0);
+        TRACE_END("fork");
+        if (!WIFEXITED(status) || (WEXITSTATUS(status) != 0)) {
+            metrics_counter_add(launch_failures, 1);
+            printf("fork() to run command '%s' detached failed\n", l->cmd);
+            break;
+        }
+        childlog_stamp(log);
+        childlog_printf(log, "executing '%s' detached, %.1f ms after request", l->cmd,
+                        (g_get_monotonic_time() - l->requested) / 1000.0);
+        launch_spawned(l);
+        childlog_flush(log);
+    }
+}
+
+// launch commands detached, rather than logging their output
+static gboolean detached = FALSE;
+
+void
+execute_set_detached(int detach)
+{
+  detached = detach;
+}
+
+// discard launch times more than a minute old
+static void
+recent_launches_expire(gint64 now)
+{
+  guint i;
+  for (i = 0; i < recent_launches->len; i++)
+    if (now - g_array_index(recent_launches, gint64, i) < G_USEC_PER_SEC * 60)
+      break;
+  g_array_remove_range(recent_launches, 0, i);
+}
+
+static gint64
+launches_per_minute_gauge(void)
+{
+  recent_launches_expire(g_get_monotonic_time());
+  return recent_launches->len;
+}
+
+static void
+launch_recorded(gint64 now)
+{
+  metrics_counter_add(launches, 1);
+  recent_launches_expire(now);
+  g_array_append_val(recent_launches, now);
+}
+
+// how long launching from the menu has taken
+char *
+execute_spawned_summary(void)
+{
+  return metrics_histogram_summary(launch_spawned_us);
+}
+
+static gint64
+launches_in_flight_gauge(void)
+{
+  return launchsched_running(sched);
+}
+
+static gint64
+launches_queued_gauge(void)
+{
+  return launchsched_queued(sched);
+}
+
+// start the logging thread, which launches the command
+static gboolean
+execute_start(gpointer data, guint token)
+{
+  launch *l = data;
+  l->token = token;
+
   pthread_t t;
-  if (!pthread_create(&t, NULL, ExecAndLogThread, (void *)cmd))
-    pthread_detach(t);
-  else
-    printf("Creating command output logging thread failed\n");
+  if (!pthread_create(&t, NULL, ExecAndLogThread, l))
+    {
+      pthread_detach(t);
+      return TRUE;
+    }
+
+  printf("Creating command output logging thread failed\n");
+  if (l->exited)
+    l->exited(l->exited_data);
+  launch_free(l);
+  return FALSE;
+}
+
+void
+execute_init(void)
+{
+  launches = metrics_counter_new("launches_total", "Commands launched");
+  launch_failures = metrics_counter_new("launch_failures_total", "Commands which couldn't be forked or executed");
+  dbus_call_init(launch_failures);
+  metrics_gauge_new("launches_per_minute", "Commands launched in the last minute", launches_per_minute_gauge);
+  launch_spawned_us = metrics_histogram_new("launch_spawned_us", "Time from selecting a menu item to its command being forked, in microseconds");
+  metrics_histogram_set_limit(launch_spawned_us, MAX(setting_get_integer("latencylimit", 250), 0) * 1000);
+  launch_window_us = metrics_histogram_new("launch_window_us", "Time from selecting a menu item to a window being shown, in microseconds");
+  awaiting_window = g_queue_new();
+  recent_launches = g_array_new(FALSE, FALSE, sizeof(gint64));
+
+  launch_suppressed = metrics_counter_new("launch_suppressed_total", "Launches suppressed as repeated too soon");
+  metrics_gauge_new("launches_in_flight", "Commands launched which are still starting", launches_in_flight_gauge);
+  metrics_gauge_new("launches_queued", "Commands waiting to be launched", launches_queued_gauge);
+  sched = launchsched_new(setting_get_integer("launchwindow", 1000),
+                          setting_get_integer("launchconcurrency", 4),
+                          LAUNCH_STARTUP, execute_start, (GDestroyNotify)launch_free);
+}
+
+static void
+launch_submit(launch *l)
+{
+  launch_recorded(l->requested);
+
+  // we're about to exit, so launch it now
+  if (detached)
+    {
+      ExecDetached(l);
+      launch_free(l);
+      return;
+    }
+
+  // the scheduler's tokens start at 1
+  if (l->server)
+    {
+      execute_start(l, 0);
+      return;
+    }
+
+  launchsched_submit(sched, l->log.tag, l);
+}
+
+static void
+execute_cmd(char *cmd, const char *tag, const launch_policy *policy, const char *display,
+            gint64 selected, metrics_histogram *window_us)
+{
+  // note that free() will be applied to cmd after the command has exited
+  launch_submit(launch_new(cmd, tag, policy, display, selected, window_us));
+}
+
+static void
+command_submit(const char *cmd, const char *tag, const char *desktop_id,
+               execute_exited exited, gpointer data, gboolean server)
+{
+  launch_policy policy;
+  policy_lookup(desktop_id, NULL, &policy);
+
+  launch *l = launch_new(strdup(cmd), tag, &policy, NULL, 0, NULL);
+  l->exited = exited;
+  l->exited_data = data;
+  l->server = server;
+  launch_submit(l);
+}
+
+//
+// execute an arbitrary command, with the launch policy for desktop_id.  If
+// exited isn't NULL, it's called in the main thread once the command has
+// exited, or failed to start (but not if it's launched detached)
+//
+void
+execute_command(const char *cmd, const char *tag, const char *desktop_id,
+                execute_exited exited, gpointer data)
+{
+  command_submit(cmd, tag, desktop_id, exited, data, FALSE);
+}
+
+//
+// execute a server, which is expected to keep running, in the same way, but
+// at once, rather than waiting for (or taking) a slot for launches in flight
+//
+void
+execute_server(const char *cmd, const char *tag, const char *desktop_id,
+               execute_exited exited, gpointer data)
+{
+  command_submit(cmd, tag, desktop_id, exited, data, TRUE);
+}
+
+//
+// Give any D-Bus calls in flight (e.g. logout on exit) a chance to complete.
+// Launches still queued are dropped
+//
+void
+execute_shutdown(void)
+{
+  if (launchsched_queued(sched))
+    printf("%u queued launches abandoned\n", launchsched_queued(sched));
+  launchsched_free(sched);
+  sched = NULL;
+
+  g_queue_free_full(awaiting_window, g_free);
+  awaiting_window = NULL;
+
+  dbus_call_shutdown();
 }
 
 static void
@@ -184,28 +623,55 @@ menu_cmd_add_text(unsigned int *j, char **cmd, const char *add)
     }
 }
 
+//
+// launch the menu item id, on display, which was selected at the monotonic
+// time selected
+//
 void
-menu_item_execute(int id)
+menu_item_execute(int id, const char *display, gint64 selected)
 {
-  GDesktopAppInfo *appinfo = menu_get_appinfo(id);
-  const char *fmt = g_app_info_get_commandline(G_APP_INFO(appinfo));
+  menu_entry entry;
+  if (!menu_get_entry(id, &entry))
+    return;
+
+  launch_policy policy;
+  const char *desktop_id = entry.id;
+  policy_lookup(desktop_id, entry.categories, &policy);
+
+  // an impatient second click on a slow-starting application shouldn't start
+  // another one
+  if (!policy.repeat && launchsched_suppress(sched, desktop_id))
+    {
+      metrics_counter_add(launch_suppressed, 1);
+      return;
+    }
+
+  const char *fmt = entry.exec;
 
   // process field codes
   char *cmd = malloc(1);
   unsigned int i, j = 0;
 
-  if (g_desktop_app_info_get_boolean(appinfo, "DBusActivatable"))
+  if (entry.flags & ENTRY_DBUS_ACTIVATABLE)
     {
-      const char *filename = g_desktop_app_info_get_filename(appinfo);
-      char *bus_name = g_path_get_basename (filename);
+      char *bus_name = g_path_get_basename (entry.path);
       bus_name[strlen(bus_name) - strlen(".desktop")] = '\0';
-      asprintf(&cmd, "gapplication launch %s", bus_name);
-      execute_cmd(cmd);
+      launch_recorded(g_get_monotonic_time());
+      dbus_call_activate(bus_name);
+      g_free(bus_name);
+      free(cmd);
       return;
     }
 
-  if (g_desktop_app_info_get_boolean(appinfo, "Terminal"))
-    menu_cmd_add_text(&j, &cmd, "xterm -e ");
+  // if there's a warm instance running, use the client command instead
+  metrics_histogram *window_us = NULL;
+  char *client = prelaunch_client_cmd(desktop_id, &window_us);
+  if (client)
+    {
+      free(cmd);
+      execute_cmd(client, desktop_id, &policy, display, selected, window_us);
+      return;
+    }
 
   for (i = 0; i < strlen(fmt) + 1; i++)
     {
@@ -224,33 +690,21 @@ menu_item_execute(int id)
                   break;
                 case 'c':
                   // %c Name key from desktop entry
-                  {
-                    const char *name = g_app_info_get_display_name(G_APP_INFO(appinfo));
-                    menu_cmd_add_text(&j, &cmd, "\"");
-                    menu_cmd_add_text(&j, &cmd, name);
-                    menu_cmd_add_text(&j, &cmd, "\"");
-                  }
+                  menu_cmd_add_text(&j, &cmd, "\"");
+                  menu_cmd_add_text(&j, &cmd, entry.name);
+                  menu_cmd_add_text(&j, &cmd, "\"");
                   break;
                 case 'i':
                   // %i Icon key following '--icon '
-                  {
-                    GIcon *icon = g_app_info_get_icon(G_APP_INFO(appinfo));
-                    char *name = g_icon_to_string(icon);
-                    if (name)
-                      {
-                        menu_cmd_add_text(&j, &cmd, "--icon ");
-                        menu_cmd_add_text(&j, &cmd, name);
-                      }
-                    g_free(icon);
-                    g_free(name);
-                  }
+                  if (*entry.icon)
+                    {
+                      menu_cmd_add_text(&j, &cmd, "--icon ");
+                      menu_cmd_add_text(&j, &cmd, entry.icon);
+                    }
                   break;
                 case 'k':
                   // %k location of desktop entry file
-                  {
-                    const char *filename = g_desktop_app_info_get_filename(appinfo);
-                    menu_cmd_add_text(&j, &cmd, filename);
-                  }
+                  menu_cmd_add_text(&j, &cmd, entry.path);
                   break;
                 case 'f':
                 case 'u':
@@ -274,27 +728,45 @@ menu_item_execute(int id)
 
   // XXX: unquoting ???
 
-  execute_cmd(cmd);
+  if (entry.flags & ENTRY_TERMINAL)
+    {
+      // a prelaunched entry's histogram takes precedence
+      char *tcmd = terminal_command(cmd, NULL, window_us ? NULL : &window_us);
+      free(cmd);
+      cmd = tcmd;
+    }
+
+  execute_cmd(cmd, desktop_id, &policy, display, selected, window_us);
 }
 
 void
 session_logout_execute(void)
 {
-  char *cmd;
-  asprintf(&cmd, "gdbus call -e -d org.lxde.SessionManager -o /org/lxde/SessionManager -m org.lxde.SessionManager.Logout");
-  execute_cmd(cmd);
+  dbus_call_async("logout", "org.lxde.SessionManager", "/org/lxde/SessionManager",
+                  "org.lxde.SessionManager", "Logout", NULL);
 }
 
 void
-view_logfile_execute(void)
+view_logfile_execute(const char *display)
 {
   char logfile[PATH_MAX+1];
+  char *cmd = NULL;
+
+  if (logfile_path())
+    {
+      // follow the logfile by name, so we keep following it after rotation
+      asprintf(&cmd, "less --follow-name +F %s", logfile_path());
+      execute_cmd(terminal_command(cmd, logfile_path(), NULL), "logfile", NULL, display, 0, NULL);
+      free(cmd);
+      return;
+    }
+
   ssize_t l = readlink("/proc/self/fd/1", logfile, PATH_MAX);
   if (l > 0)
     {
       logfile[l] = 0; // readlink does not null terminate it's result
-      char *cmd = NULL;
-      asprintf(&cmd, "xterm -title '%s' -e less +F %s", logfile, logfile);
-      execute_cmd(cmd);
+      asprintf(&cmd, "less +F %s", logfile);
+      execute_cmd(terminal_command(cmd, logfile, NULL), "logfile", NULL, display, 0, NULL);
+      free(cmd);
     }
 }
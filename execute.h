@@ -29,8 +29,21 @@
 #ifndef EXECUTE_H
 #define EXECUTE_H
 
-void menu_item_execute(int id);
-void view_logfile_execute(void);
+#include <glib.h>
+
+typedef void (*execute_exited)(gpointer data);
+
+void menu_item_execute(int id, const char *display, gint64 selected);
+void view_logfile_execute(const char *display);
 void session_logout_execute(void);
+void execute_command(const char *cmd, const char *tag, const char *desktop_id,
+                     execute_exited exited, gpointer data);
+void execute_server(const char *cmd, const char *tag, const char *desktop_id,
+                    execute_exited exited, gpointer data);
+void execute_set_detached(int detach);
+void execute_init(void);
+void execute_shutdown(void);
+char *execute_spawned_summary(void);
+void execute_window_shown(gint64 shown);
 
 #endif /* EXECUTE_H */
@@ -0,0 +1,374 @@
+/*
+ * iconcache.c
+ *
+ * Copyright (C) Jon Turney 2015
+ *
+ * This file is part of xwin-xdg-menu
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+//
+// A read-only, memory-mapped cache of icons already converted to the pixel
+// format we make menu bitmaps from, which can be shared by every instance on
+// a host
+//
+// It's written by xwin-xdg-menu-cache, and is keyed by icon file and size, so
+// each instance still resolves icon names with its own theme, and just skips
+// decoding and converting icon files which are in the cache.  Icons which
+// aren't in it (e.g. those under the user's home directory), or whose file has
+// been modified since the cache was written, are decoded as usual.
+//
+// The file is laid out as:
+//
+// header
+// buckets: guint32 first record index in each hash chain
+// records: iconcache_record
+// strings and pixel data
+//
+// Values are in host byte order, since the cache is only useful on the host
+// it was generated on.  Pixel data is size*size 32-bit premultiplied BGRA,
+// top-down.
+//
+
+#include "iconcache.h"
+#include <string.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+
+#define ICONCACHE_MAGIC "XXDGICON"
+#define ICONCACHE_VERSION 1
+#define ICONCACHE_BYTE_ORDER 0x01020304
+#define ICONCACHE_NONE 0xffffffff
+
+typedef struct
+{
+  char magic[8];
+  guint32 version;
+  guint32 byte_order;
+  guint32 n_buckets;
+  guint32 n_records;
+  guint32 buckets;
+  guint32 records;
+} iconcache_header;
+
+typedef struct
+{
+  guint64 mtime;
+  guint32 filename;
+  guint32 next;
+  guint32 size;
+  guint32 pixels;
+} iconcache_record;
+
+struct _iconcache
+{
+  char *path;
+  struct stat st;
+  GMappedFile *mapped;
+  const guint8 *data;
+  gsize len;
+  const iconcache_header *header;
+  const guint32 *buckets;
+  const iconcache_record *records;
+};
+
+static guint32
+iconcache_hash(const char *filename, int size)
+{
+  guint32 h = 5381 + size;
+  const unsigned char *p;
+
+  for (p = (const unsigned char *)filename; *p; p++)
+    h = (h << 5) + h + *p;
+
+  return h;
+}
+
+//
+// Convert pixbuf-style RGB(A) pixels into 32-bit premultiplied BGRA, which is
+// what InsertMenuItem wants in a BI_RGB DIB section to use the alpha channel
+//
+void
+iconcache_convert_pixels(const guint8 *pixels, int width, int height,
+                         int rowstride, gboolean has_alpha, guint8 *bgra)
+{
+  int y, x;
+  for (y = 0; y < height; y++)
+    {
+      const guint8 *src = pixels + y * rowstride;
+      for (x = 0; x < width; x++)
+        {
+          guint8 r = src[0];
+          guint8 g = src[1];
+          guint8 b = src[2];
+          guint8 a = has_alpha ? src[3] : 0xff;
+
+          bgra[0] = b * a / 255;
+          bgra[1] = g * a / 255;
+          bgra[2] = r * a / 255;
+          bgra[3] = a;
+
+          src += has_alpha ? 4 : 3;
+          bgra += 4;
+        }
+    }
+}
+
+iconcache *
+iconcache_open(const char *path)
+{
+  iconcache *cache = g_new0(iconcache, 1);
+
+  if (g_stat(path, &cache->st) != 0)
+    goto fail;
+
+  cache->mapped = g_mapped_file_new(path, FALSE, NULL);
+  if (!cache->mapped)
+    goto fail;
+
+  cache->data = (const guint8 *)g_mapped_file_get_contents(cache->mapped);
+  cache->len = g_mapped_file_get_length(cache->mapped);
+  cache->header = (const iconcache_header *)cache->data;
+
+  if ((cache->len < sizeof(iconcache_header)) ||
+      memcmp(cache->header->magic, ICONCACHE_MAGIC, 8) ||
+      (cache->header->version != ICONCACHE_VERSION) ||
+      (cache->header->byte_order != ICONCACHE_BYTE_ORDER) ||
+      (cache->header->n_buckets == 0) ||
+      ((guint64)cache->header->buckets + (guint64)cache->header->n_buckets * sizeof(guint32) > cache->len) ||
+      ((guint64)cache->header->records + (guint64)cache->header->n_records * sizeof(iconcache_record) > cache->len))
+    {
+      g_print("Ignoring invalid shared icon cache %s\n", path);
+      goto fail;
+    }
+
+  cache->buckets = (const guint32 *)(cache->data + cache->header->buckets);
+  cache->records = (const iconcache_record *)(cache->data + cache->header->records);
+  cache->path = g_strdup(path);
+
+  return cache;
+
+ fail:
+  if (cache->mapped)
+    g_mapped_file_unref(cache->mapped);
+  g_free(cache);
+  return NULL;
+}
+
+void
+iconcache_close(iconcache *cache)
+{
+  if (!cache)
+    return;
+
+  g_mapped_file_unref(cache->mapped);
+  g_free(cache->path);
+  g_free(cache);
+}
+
+// has the cache file been replaced since we opened it?
+gboolean
+iconcache_is_stale(iconcache *cache)
+{
+  struct stat st;
+
+  if (g_stat(cache->path, &st) != 0)
+    return TRUE;
+
+  return (st.st_ino != cache->st.st_ino) || (st.st_mtime != cache->st.st_mtime);
+}
+
+//
+// Look up the pixels for filename at size, which are only returned if the
+// file hasn't been modified since the cache was generated
+//
+const guint8 *
+iconcache_lookup(iconcache *cache, const char *filename, int size)
+{
+  if (!cache)
+    return NULL;
+
+  // each record in a chain is earlier than the one which links to it, so a
+  // chain can't be longer than the number of records, and a link to a later
+  // one (or out of range) means the cache is corrupt
+  guint32 n_records = cache->header->n_records;
+  guint32 steps = n_records;
+  guint32 i = cache->buckets[iconcache_hash(filename, size) % cache->header->n_buckets];
+  while ((i < n_records) && steps--)
+    {
+      const iconcache_record *r = &cache->records[i];
+      const char *name = (const char *)(cache->data + r->filename);
+
+      if ((r->size == (guint32)size) &&
+          (r->filename < cache->len) &&
+          memchr(name, 0, cache->len - r->filename) &&
+          (strcmp(name, filename) == 0))
+        {
+          struct stat st;
+
+          if ((guint64)r->pixels + (guint64)size * size * 4 > cache->len)
+            return NULL;
+
+          if ((g_stat(filename, &st) != 0) || ((guint64)st.st_mtime != r->mtime))
+            return NULL;
+
+          return cache->data + r->pixels;
+        }
+
+      if ((r->next != ICONCACHE_NONE) && (r->next >= i))
+        return NULL;
+
+      i = r->next;
+    }
+
+  return NULL;
+}
+
+guint
+iconcache_count(iconcache *cache)
+{
+  return cache ? cache->header->n_records : 0;
+}
+
+gsize
+iconcache_mapped_size(iconcache *cache)
+{
+  return cache ? cache->len : 0;
+}
+
+//
+// writing
+//
+
+struct _iconcache_writer
+{
+  GArray *records;
+  GByteArray *data;
+};
+
+iconcache_writer *
+iconcache_writer_new(void)
+{
+  iconcache_writer *w = g_new0(iconcache_writer, 1);
+  w->records = g_array_new(FALSE, FALSE, sizeof(iconcache_record));
+  w->data = g_byte_array_new();
+  return w;
+}
+
+void
+iconcache_writer_free(iconcache_writer *w)
+{
+  g_array_free(w->records, TRUE);
+  g_byte_array_free(w->data, TRUE);
+  g_free(w);
+}
+
+static void
+writer_align(iconcache_writer *w, guint alignment)
+{
+  static const guint8 zero[16] = { 0 };
+  guint pad = (alignment - (w->data->len % alignment)) % alignment;
+  g_byte_array_append(w->data, zero, pad);
+}
+
+// add the size*size BGRA pixels for filename
+gboolean
+iconcache_writer_add(iconcache_writer *w, const char *filename, int size, const guint8 *bgra)
+{
+  struct stat st;
+  iconcache_record r;
+
+  if (g_stat(filename, &st) != 0)
+    return FALSE;
+
+  // offsets are relative to the data area until the layout is known
+  r.mtime = st.st_mtime;
+  r.size = size;
+  r.next = ICONCACHE_NONE;
+  r.filename = w->data->len;
+  g_byte_array_append(w->data, (const guint8 *)filename, strlen(filename) + 1);
+  writer_align(w, 16);
+  r.pixels = w->data->len;
+  g_byte_array_append(w->data, bgra, size * size * 4);
+
+  g_array_append_val(w->records, r);
+  return TRUE;
+}
+
+//
+// write the cache to path, atomically replacing any existing cache, so
+// instances which have the old one mapped are unaffected
+//
+gboolean
+iconcache_writer_save(iconcache_writer *w, const char *path, GError **error)
+{
+  iconcache_header header;
+  guint32 n_records = w->records->len;
+  guint32 n_buckets = MAX(n_records / 2, 1) | 1;
+  guint32 *buckets = g_new(guint32, n_buckets);
+  guint32 i;
+
+  memcpy(header.magic, ICONCACHE_MAGIC, 8);
+  header.version = ICONCACHE_VERSION;
+  header.byte_order = ICONCACHE_BYTE_ORDER;
+  header.n_buckets = n_buckets;
+  header.n_records = n_records;
+  header.buckets = sizeof(header);
+  header.records = header.buckets + n_buckets * sizeof(guint32);
+  // keep pixel data aligned
+  header.records = (header.records + 15) & ~15;
+  guint32 data = header.records + n_records * sizeof(iconcache_record);
+  data = (data + 15) & ~15;
+
+  for (i = 0; i < n_buckets; i++)
+    buckets[i] = ICONCACHE_NONE;
+
+  for (i = 0; i < n_records; i++)
+    {
+      iconcache_record *r = &g_array_index(w->records, iconcache_record, i);
+      const char *filename = (const char *)(w->data->data + r->filename);
+      guint32 bucket = iconcache_hash(filename, r->size) % n_buckets;
+
+      r->next = buckets[bucket];
+      buckets[bucket] = i;
+      r->filename += data;
+      r->pixels += data;
+    }
+
+  GByteArray *file = g_byte_array_sized_new(data + w->data->len);
+  g_byte_array_append(file, (const guint8 *)&header, sizeof(header));
+  g_byte_array_append(file, (const guint8 *)buckets, n_buckets * sizeof(guint32));
+  g_byte_array_set_size(file, header.records);
+  g_byte_array_append(file, (const guint8 *)w->records->data, n_records * sizeof(iconcache_record));
+  g_byte_array_set_size(file, data);
+  g_byte_array_append(file, w->data->data, w->data->len);
+
+  // g_file_set_contents() writes to a temporary file and renames it
+  gboolean ok = g_file_set_contents(path, (const gchar *)file->data, file->len, error);
+  if (ok)
+    g_chmod(path, 0644);
+
+  g_byte_array_free(file, TRUE);
+  g_free(buckets);
+
+  return ok;
+}
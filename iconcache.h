@@ -0,0 +1,55 @@
+/*
+ * iconcache.h
+ *
+ * Copyright (C) Jon Turney 2015
+ *
+ * This file is part of xwin-xdg-menu
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef ICONCACHE_H
+#define ICONCACHE_H
+
+#include <glib.h>
+
+#define ICONCACHE_DEFAULT_PATH "/var/cache/xwin-xdg-menu/icons.cache"
+
+void iconcache_convert_pixels(const guint8 *pixels, int width, int height,
+                              int rowstride, gboolean has_alpha, guint8 *bgra);
+
+typedef struct _iconcache iconcache;
+
+iconcache *iconcache_open(const char *path);
+void iconcache_close(iconcache *cache);
+gboolean iconcache_is_stale(iconcache *cache);
+const guint8 *iconcache_lookup(iconcache *cache, const char *filename, int size);
+guint iconcache_count(iconcache *cache);
+gsize iconcache_mapped_size(iconcache *cache);
+
+typedef struct _iconcache_writer iconcache_writer;
+
+iconcache_writer *iconcache_writer_new(void);
+gboolean iconcache_writer_add(iconcache_writer *writer, const char *filename, int size, const guint8 *bgra);
+gboolean iconcache_writer_save(iconcache_writer *writer, const char *path, GError **error);
+void iconcache_writer_free(iconcache_writer *writer);
+
+#endif /* ICONCACHE_H */
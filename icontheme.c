@@ -0,0 +1,822 @@
+/*
+ * icontheme.c
+ *
+ * Copyright (C) Jon Turney 2015
+ *
+ * This file is part of xwin-xdg-menu
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+//
+// Resolve icon names to files, following the Icon Theme Specification
+//
+// This does the job of GtkIconTheme, but without needing GTK to be
+// initialized, and without scanning every theme directory when a theme has an
+// up-to-date icon-theme.cache (as generated by gtk-update-icon-cache), which
+// is memory-mapped and used directly.  For themes without one, an index of the
+// theme's directories is built in memory the first time it is used.
+//
+// The results of lookups, including failed ones, are cached, until a rescan
+// finds that a theme has changed.
+//
+
+#include "icontheme.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// flags for each image in an icon-theme.cache, which we use for our own index
+// too
+#define HAS_SUFFIX_XPM 1
+#define HAS_SUFFIX_SVG 2
+#define HAS_SUFFIX_PNG 4
+
+typedef enum
+{
+  DIR_FIXED,
+  DIR_SCALABLE,
+  DIR_THRESHOLD,
+} dir_type;
+
+// a subdirectory of a theme, as described by index.theme
+typedef struct
+{
+  char *name;
+  dir_type type;
+  int size;
+  int scale;
+  int min_size;
+  int max_size;
+  int threshold;
+} theme_dir;
+
+// a base directory in which (part of) a theme is installed
+typedef struct
+{
+  char *path;
+  time_t mtime;
+
+  // the memory-mapped icon-theme.cache, if valid
+  GMappedFile *mapped;
+  const guint8 *cache;
+  gsize cache_len;
+  // map from cache directory index to theme_dir index (or -1)
+  int *cache_dirs;
+  guint n_cache_dirs;
+
+  // otherwise, our own index of icon name -> GArray of theme_image
+  GHashTable *index;
+} theme_location;
+
+typedef struct
+{
+  guint16 dir;
+  guint16 flags;
+} theme_image;
+
+typedef struct
+{
+  char *name;
+  // path and mtime of the index.theme which was read
+  char *index_path;
+  time_t index_mtime;
+  GArray *dirs;        // of theme_dir
+  GPtrArray *locations; // of theme_location
+  char **inherits;
+} theme;
+
+struct _iconresolver
+{
+  char *theme_name;
+  char **basedirs;
+  // loaded themes, name -> theme (NULL if it doesn't exist)
+  GHashTable *themes;
+  // "name size scale" -> path (NULL if not found)
+  GHashTable *lookups;
+
+  unsigned int hits;
+  unsigned int misses;
+};
+
+//
+// icon-theme.cache reading.  All values are big-endian, and all offsets are
+// from the start of the file.  Out of range reads return 0.
+//
+
+static guint16
+cache_read16(theme_location *l, guint32 offset)
+{
+  if (offset + 2 > l->cache_len)
+    return 0;
+  return GUINT16_FROM_BE(*(const guint16 *)(l->cache + offset));
+}
+
+static guint32
+cache_read32(theme_location *l, guint32 offset)
+{
+  if (offset + 4 > l->cache_len)
+    return 0;
+  return GUINT32_FROM_BE(*(const guint32 *)(l->cache + offset));
+}
+
+static const char *
+cache_string(theme_location *l, guint32 offset)
+{
+  if ((offset >= l->cache_len) || !memchr(l->cache + offset, 0, l->cache_len - offset))
+    return NULL;
+  return (const char *)(l->cache + offset);
+}
+
+// the hash function used by gtk-update-icon-cache
+static guint32
+cache_hash(const char *key)
+{
+  const signed char *p = (const signed char *)key;
+  guint32 h = *p;
+
+  if (h)
+    for (p += 1; *p != '\0'; p++)
+      h = (h << 5) - h + *p;
+
+  return h;
+}
+
+static gboolean
+location_load_cache(theme_location *l, GArray *dirs)
+{
+  gchar *path = g_build_filename(l->path, "icon-theme.cache", NULL);
+  struct stat st;
+
+  // the cache is stale if the theme directory has changed since it was written
+  if ((stat(path, &st) != 0) || (st.st_mtime < l->mtime))
+    {
+      g_free(path);
+      return FALSE;
+    }
+
+  l->mapped = g_mapped_file_new(path, FALSE, NULL);
+  g_free(path);
+  if (!l->mapped)
+    return FALSE;
+
+  l->cache = (const guint8 *)g_mapped_file_get_contents(l->mapped);
+  l->cache_len = g_mapped_file_get_length(l->mapped);
+
+  // the directory list has a 4 byte offset for each directory, so a count
+  // which couldn't fit in the file means it's corrupt
+  guint32 dir_list = cache_read32(l, 8);
+  guint32 n_cache_dirs = cache_read32(l, dir_list);
+  if ((cache_read16(l, 0) != 1) || (cache_read16(l, 2) != 0) ||
+      (dir_list >= l->cache_len) || (n_cache_dirs > (l->cache_len - dir_list) / 4))
+    {
+      g_mapped_file_unref(l->mapped);
+      l->mapped = NULL;
+      l->cache = NULL;
+      return FALSE;
+    }
+
+  // map the cache's directory list onto the directories from index.theme
+  guint i, j;
+  l->n_cache_dirs = n_cache_dirs;
+  l->cache_dirs = g_new(int, l->n_cache_dirs);
+  for (i = 0; i < l->n_cache_dirs; i++)
+    {
+      const char *name = cache_string(l, cache_read32(l, dir_list + 4 + 4 * i));
+      l->cache_dirs[i] = -1;
+      for (j = 0; name && (j < dirs->len); j++)
+        if (strcmp(name, g_array_index(dirs, theme_dir, j).name) == 0)
+          {
+            l->cache_dirs[i] = j;
+            break;
+          }
+    }
+
+  return TRUE;
+}
+
+static void
+theme_image_array_free(gpointer data)
+{
+  g_array_free(data, TRUE);
+}
+
+static void
+location_build_index(theme_location *l, GArray *dirs)
+{
+  guint i;
+
+  l->index = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, theme_image_array_free);
+
+  for (i = 0; i < dirs->len; i++)
+    {
+      gchar *path = g_build_filename(l->path, g_array_index(dirs, theme_dir, i).name, NULL);
+      GDir *dir = g_dir_open(path, 0, NULL);
+      const char *name;
+      g_free(path);
+
+      if (!dir)
+        continue;
+
+      while ((name = g_dir_read_name(dir)))
+        {
+          const char *dot = strrchr(name, '.');
+          guint16 flags;
+
+          if (!dot)
+            continue;
+          else if (strcmp(dot, ".png") == 0)
+            flags = HAS_SUFFIX_PNG;
+          else if (strcmp(dot, ".svg") == 0)
+            flags = HAS_SUFFIX_SVG;
+          else if (strcmp(dot, ".xpm") == 0)
+            flags = HAS_SUFFIX_XPM;
+          else
+            continue;
+
+          gchar *icon = g_strndup(name, dot - name);
+          GArray *images = g_hash_table_lookup(l->index, icon);
+          if (!images)
+            {
+              images = g_array_new(FALSE, FALSE, sizeof(theme_image));
+              g_hash_table_insert(l->index, icon, images);
+            }
+          else
+            g_free(icon);
+
+          // merge with an entry for the same directory
+          if (images->len && (g_array_index(images, theme_image, images->len - 1).dir == i))
+            g_array_index(images, theme_image, images->len - 1).flags |= flags;
+          else
+            {
+              theme_image image = { i, flags };
+              g_array_append_val(images, image);
+            }
+        }
+
+      g_dir_close(dir);
+    }
+}
+
+//
+// get the extension flags for icon_name in each theme directory, as an array
+// indexed by theme_dir.  Returns FALSE if the icon is not in this location.
+//
+static gboolean
+location_lookup(theme_location *l, const char *icon_name, guint16 *flags, guint n_dirs)
+{
+  gboolean found = FALSE;
+
+  if (l->cache)
+    {
+      guint32 hash = cache_read32(l, 4);
+      guint32 n_buckets = cache_read32(l, hash);
+      if (!n_buckets)
+        return FALSE;
+
+      // each icon in a chain takes 12 bytes, so a longer chain must be a loop
+      guint32 steps = l->cache_len / 12;
+      guint32 icon = cache_read32(l, hash + 4 + 4 * (cache_hash(icon_name) % n_buckets));
+      while (icon != 0xffffffff && icon && steps--)
+        {
+          const char *name = cache_string(l, cache_read32(l, icon + 4));
+          if (name && (strcmp(name, icon_name) == 0))
+            {
+              guint32 list = cache_read32(l, icon + 8);
+              guint32 n_images = cache_read32(l, list);
+              guint32 i;
+              for (i = 0; i < n_images; i++)
+                {
+                  guint16 dir = cache_read16(l, list + 4 + 8 * i);
+                  guint16 f = cache_read16(l, list + 4 + 8 * i + 2);
+                  if ((dir < l->n_cache_dirs) && (l->cache_dirs[dir] >= 0) &&
+                      ((guint)l->cache_dirs[dir] < n_dirs))
+                    {
+                      flags[l->cache_dirs[dir]] |= f;
+                      found = TRUE;
+                    }
+                }
+              break;
+            }
+          icon = cache_read32(l, icon);
+        }
+    }
+  else
+    {
+      GArray *images = g_hash_table_lookup(l->index, icon_name);
+      guint i;
+      for (i = 0; images && (i < images->len); i++)
+        {
+          theme_image *image = &g_array_index(images, theme_image, i);
+          if (image->dir < n_dirs)
+            {
+              flags[image->dir] |= image->flags;
+              found = TRUE;
+            }
+        }
+    }
+
+  return found;
+}
+
+static void
+theme_free(gpointer data)
+{
+  theme *t = data;
+  guint i;
+
+  if (!t)
+    return;
+
+  for (i = 0; i < t->dirs->len; i++)
+    g_free(g_array_index(t->dirs, theme_dir, i).name);
+  g_array_free(t->dirs, TRUE);
+
+  for (i = 0; i < t->locations->len; i++)
+    {
+      theme_location *l = g_ptr_array_index(t->locations, i);
+      if (l->mapped)
+        g_mapped_file_unref(l->mapped);
+      if (l->index)
+        g_hash_table_destroy(l->index);
+      g_free(l->cache_dirs);
+      g_free(l->path);
+      g_free(l);
+    }
+  g_ptr_array_free(t->locations, TRUE);
+
+  g_strfreev(t->inherits);
+  g_free(t->index_path);
+  g_free(t->name);
+  g_free(t);
+}
+
+static int
+key_file_get_int(GKeyFile *kf, const char *group, const char *key, int def)
+{
+  GError *err = NULL;
+  int value = g_key_file_get_integer(kf, group, key, &err);
+  if (err)
+    {
+      g_error_free(err);
+      return def;
+    }
+  return value;
+}
+
+static void
+theme_add_dirs(theme *t, GKeyFile *kf, const char *key)
+{
+  gchar **names = g_key_file_get_string_list(kf, "Icon Theme", key, NULL, NULL);
+  int i;
+
+  for (i = 0; names && names[i]; i++)
+    {
+      if (!g_key_file_has_group(kf, names[i]))
+        continue;
+
+      theme_dir d;
+      gchar *type = g_key_file_get_string(kf, names[i], "Type", NULL);
+      d.name = g_strdup(names[i]);
+      d.size = key_file_get_int(kf, names[i], "Size", 0);
+      d.scale = key_file_get_int(kf, names[i], "Scale", 1);
+      d.min_size = key_file_get_int(kf, names[i], "MinSize", d.size);
+      d.max_size = key_file_get_int(kf, names[i], "MaxSize", d.size);
+      d.threshold = key_file_get_int(kf, names[i], "Threshold", 2);
+      if (g_strcmp0(type, "Fixed") == 0)
+        d.type = DIR_FIXED;
+      else if (g_strcmp0(type, "Scalable") == 0)
+        d.type = DIR_SCALABLE;
+      else
+        d.type = DIR_THRESHOLD;
+      g_free(type);
+
+      g_array_append_val(t->dirs, d);
+    }
+
+  g_strfreev(names);
+}
+
+// read the index.theme in path, if there is one
+static theme *
+theme_new(const char *name, const char *path)
+{
+  gchar *index_path = g_build_filename(path, "index.theme", NULL);
+  GKeyFile *kf = g_key_file_new();
+  struct stat st;
+
+  if ((stat(index_path, &st) != 0) ||
+      !g_key_file_load_from_file(kf, index_path, G_KEY_FILE_NONE, NULL))
+    {
+      g_key_file_free(kf);
+      g_free(index_path);
+      return NULL;
+    }
+
+  // index.theme lists are comma-separated
+  g_key_file_set_list_separator(kf, ',');
+
+  theme *t = g_new0(theme, 1);
+  t->name = g_strdup(name);
+  t->index_path = index_path;
+  t->index_mtime = st.st_mtime;
+  t->dirs = g_array_new(FALSE, FALSE, sizeof(theme_dir));
+  t->locations = g_ptr_array_new();
+  theme_add_dirs(t, kf, "Directories");
+  theme_add_dirs(t, kf, "ScaledDirectories");
+  t->inherits = g_key_file_get_string_list(kf, "Icon Theme", "Inherits", NULL, NULL);
+  g_key_file_free(kf);
+
+  return t;
+}
+
+static theme *
+theme_load(iconresolver *r, const char *name)
+{
+  GPtrArray *locations = g_ptr_array_new();
+  theme *t = NULL;
+  guint i;
+
+  // every base directory with a directory for the theme holds part of it,
+  // whether or not it has an index.theme (e.g. applications install icons
+  // into ~/.local/share/icons/hicolor, which has none)
+  for (i = 0; r->basedirs[i]; i++)
+    {
+      gchar *path = g_build_filename(r->basedirs[i], name, NULL);
+      struct stat st;
+
+      if ((stat(path, &st) != 0) || !S_ISDIR(st.st_mode))
+        {
+          g_free(path);
+          continue;
+        }
+
+      theme_location *l = g_new0(theme_location, 1);
+      l->path = path;
+      l->mtime = st.st_mtime;
+      g_ptr_array_add(locations, l);
+
+      // the first index.theme found describes the theme
+      if (!t)
+        t = theme_new(name, path);
+    }
+
+  for (i = 0; i < locations->len; i++)
+    {
+      theme_location *l = g_ptr_array_index(locations, i);
+      if (!t)
+        {
+          g_free(l->path);
+          g_free(l);
+          continue;
+        }
+
+      if (!location_load_cache(l, t->dirs))
+        location_build_index(l, t->dirs);
+      g_ptr_array_add(t->locations, l);
+    }
+  g_ptr_array_free(locations, TRUE);
+
+  return t;
+}
+
+static theme *
+resolver_get_theme(iconresolver *r, const char *name)
+{
+  gpointer value;
+  if (g_hash_table_lookup_extended(r->themes, name, NULL, &value))
+    return value;
+
+  theme *t = theme_load(r, name);
+  g_hash_table_insert(r->themes, g_strdup(name), t);
+  return t;
+}
+
+static gboolean
+dir_matches_size(const theme_dir *d, int size, int scale)
+{
+  if (d->scale != scale)
+    return FALSE;
+
+  switch (d->type)
+    {
+    case DIR_FIXED:
+      return d->size == size;
+    case DIR_SCALABLE:
+      return (d->min_size <= size) && (size <= d->max_size);
+    case DIR_THRESHOLD:
+    default:
+      return (d->size - d->threshold <= size) && (size <= d->size + d->threshold);
+    }
+}
+
+static int
+dir_size_distance(const theme_dir *d, int size, int scale)
+{
+  switch (d->type)
+    {
+    case DIR_FIXED:
+      return abs(d->size * d->scale - size * scale);
+    case DIR_SCALABLE:
+      if (size * scale < d->min_size * d->scale)
+        return d->min_size * d->scale - size * scale;
+      if (size * scale > d->max_size * d->scale)
+        return size * scale - d->max_size * d->scale;
+      return 0;
+    case DIR_THRESHOLD:
+    default:
+      if (size * scale < (d->size - d->threshold) * d->scale)
+        return d->min_size * d->scale - size * scale;
+      if (size * scale > (d->size + d->threshold) * d->scale)
+        return size * scale - d->max_size * d->scale;
+      return 0;
+    }
+}
+
+static char *
+image_path(theme_location *l, const theme_dir *d, const char *icon_name, guint16 flags)
+{
+  const char *ext;
+  if (flags & HAS_SUFFIX_PNG)
+    ext = ".png";
+  else if (flags & HAS_SUFFIX_SVG)
+    ext = ".svg";
+  else if (flags & HAS_SUFFIX_XPM)
+    ext = ".xpm";
+  else
+    return NULL;
+
+  gchar *filename = g_strconcat(icon_name, ext, NULL);
+  gchar *path = g_build_filename(l->path, d->name, filename, NULL);
+  g_free(filename);
+  return path;
+}
+
+// LookupIcon() from the specification
+static char *
+theme_lookup(theme *t, const char *icon_name, int size, int scale)
+{
+  guint n_dirs = t->dirs->len;
+  guint n_locations = t->locations->len;
+  char *result = NULL;
+  guint i, k;
+
+  // the extensions present for icon_name, for each location and directory
+  guint16 *flags = g_new0(guint16, n_locations * n_dirs);
+  gboolean found = FALSE;
+  for (i = 0; i < n_locations; i++)
+    found |= location_lookup(g_ptr_array_index(t->locations, i), icon_name,
+                             flags + i * n_dirs, n_dirs);
+
+  if (!found)
+    {
+      g_free(flags);
+      return NULL;
+    }
+
+  // first, look for a directory matching the size
+  for (k = 0; (k < n_dirs) && !result; k++)
+    {
+      const theme_dir *d = &g_array_index(t->dirs, theme_dir, k);
+      if (!dir_matches_size(d, size, scale))
+        continue;
+
+      for (i = 0; (i < n_locations) && !result; i++)
+        if (flags[i * n_dirs + k])
+          result = image_path(g_ptr_array_index(t->locations, i), d, icon_name,
+                              flags[i * n_dirs + k]);
+    }
+
+  // otherwise, the closest size
+  int minimal = G_MAXINT;
+  guint closest = 0;
+  for (k = 0; (k < n_dirs) && !result; k++)
+    {
+      const theme_dir *d = &g_array_index(t->dirs, theme_dir, k);
+      int distance = dir_size_distance(d, size, scale);
+      if (distance >= minimal)
+        continue;
+
+      for (i = 0; i < n_locations; i++)
+        if (flags[i * n_dirs + k])
+          {
+            minimal = distance;
+            // remember the location and directory, rather than the path
+            closest = i * n_dirs + k;
+            break;
+          }
+    }
+
+  if (!result && (minimal != G_MAXINT))
+    result = image_path(g_ptr_array_index(t->locations, closest / n_dirs),
+                        &g_array_index(t->dirs, theme_dir, closest % n_dirs),
+                        icon_name, flags[closest]);
+
+  g_free(flags);
+  return result;
+}
+
+// FindIconHelper() from the specification
+static char *
+theme_find(iconresolver *r, const char *theme_name, const char *icon_name,
+           int size, int scale, int depth)
+{
+  theme *t = resolver_get_theme(r, theme_name);
+  char *result;
+  int i;
+
+  // guard against inheritance loops
+  if (!t || (depth > 16))
+    return NULL;
+
+  result = theme_lookup(t, icon_name, size, scale);
+
+  for (i = 0; !result && t->inherits && t->inherits[i]; i++)
+    result = theme_find(r, t->inherits[i], icon_name, size, scale, depth + 1);
+
+  return result;
+}
+
+static char *
+fallback_find_in(const char *dir, const char *icon_name)
+{
+  static const char *exts[] = { ".png", ".svg", ".xpm" };
+  int i;
+
+  for (i = 0; i < 3; i++)
+    {
+      gchar *filename = g_strconcat(icon_name, exts[i], NULL);
+      gchar *path = g_build_filename(dir, filename, NULL);
+      g_free(filename);
+
+      if (g_file_test(path, G_FILE_TEST_IS_REGULAR))
+        return path;
+      g_free(path);
+    }
+
+  return NULL;
+}
+
+// LookupFallbackIcon() from the specification
+static char *
+fallback_find(iconresolver *r, const char *icon_name)
+{
+  const gchar * const *data_dirs = g_get_system_data_dirs();
+  char *result = NULL;
+  int i;
+
+  for (i = 0; r->basedirs[i] && !result; i++)
+    result = fallback_find_in(r->basedirs[i], icon_name);
+
+  // unthemed icons are also found in pixmaps directories
+  for (i = 0; data_dirs[i] && !result; i++)
+    {
+      gchar *pixmaps = g_build_filename(data_dirs[i], "pixmaps", NULL);
+      result = fallback_find_in(pixmaps, icon_name);
+      g_free(pixmaps);
+    }
+
+  return result;
+}
+
+iconresolver *
+iconresolver_new(const char *theme_name)
+{
+  iconresolver *r = g_new0(iconresolver, 1);
+  GPtrArray *basedirs = g_ptr_array_new();
+  const gchar * const *data_dirs = g_get_system_data_dirs();
+  int i;
+
+  r->theme_name = g_strdup(theme_name ? theme_name : "hicolor");
+
+  // the base directories, in order of precedence
+  g_ptr_array_add(basedirs, g_build_filename(g_get_home_dir(), ".icons", NULL));
+  g_ptr_array_add(basedirs, g_build_filename(g_get_user_data_dir(), "icons", NULL));
+  for (i = 0; data_dirs[i]; i++)
+    g_ptr_array_add(basedirs, g_build_filename(data_dirs[i], "icons", NULL));
+  g_ptr_array_add(basedirs, NULL);
+  r->basedirs = (char **)g_ptr_array_free(basedirs, FALSE);
+
+  r->themes = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, theme_free);
+  r->lookups = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+  return r;
+}
+
+void
+iconresolver_free(iconresolver *r)
+{
+  g_hash_table_destroy(r->lookups);
+  g_hash_table_destroy(r->themes);
+  g_strfreev(r->basedirs);
+  g_free(r->theme_name);
+  g_free(r);
+}
+
+static gboolean
+theme_changed(theme *t)
+{
+  struct stat st;
+  guint i;
+
+  if ((stat(t->index_path, &st) != 0) || (st.st_mtime != t->index_mtime))
+    return TRUE;
+
+  for (i = 0; i < t->locations->len; i++)
+    {
+      theme_location *l = g_ptr_array_index(t->locations, i);
+      if ((stat(l->path, &st) != 0) || (st.st_mtime != l->mtime))
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+//
+// Check if any of the themes we have loaded have changed, and if so, discard
+// everything loaded and cached.  Returns TRUE if anything changed.
+//
+gboolean
+iconresolver_rescan_if_needed(iconresolver *r)
+{
+  GHashTableIter iter;
+  gpointer value;
+  gboolean changed = FALSE;
+
+  g_hash_table_iter_init(&iter, r->themes);
+  while (!changed && g_hash_table_iter_next(&iter, NULL, &value))
+    changed = value && theme_changed(value);
+
+  if (changed)
+    {
+      g_hash_table_remove_all(r->themes);
+      g_hash_table_remove_all(r->lookups);
+    }
+
+  return changed;
+}
+
+//
+// Find the file for icon_name at size and scale, returning it's path (to be
+// g_free()d by the caller), or NULL if there isn't one
+//
+char *
+iconresolver_lookup(iconresolver *r, const char *icon_name, int size, int scale)
+{
+  gpointer value;
+  char *result = NULL;
+
+  if (g_path_is_absolute(icon_name))
+    return g_file_test(icon_name, G_FILE_TEST_IS_REGULAR) ? g_strdup(icon_name) : NULL;
+
+  gchar *key = g_strdup_printf("%s %d %d", icon_name, size, scale);
+  if (g_hash_table_lookup_extended(r->lookups, key, NULL, &value))
+    {
+      r->hits++;
+      g_free(key);
+      return g_strdup(value);
+    }
+  r->misses++;
+
+  // some desktop entries give the icon name with an extension
+  gchar *name = g_strdup(icon_name);
+  char *dot = strrchr(name, '.');
+  if (dot && (!strcmp(dot, ".png") || !strcmp(dot, ".svg") || !strcmp(dot, ".xpm")))
+    *dot = 0;
+
+  result = theme_find(r, r->theme_name, name, size, scale, 0);
+  if (!result && strcmp(r->theme_name, "hicolor"))
+    result = theme_find(r, "hicolor", name, size, scale, 0);
+  if (!result)
+    result = fallback_find(r, name);
+  g_free(name);
+
+  g_hash_table_insert(r->lookups, key, g_strdup(result));
+
+  return result;
+}
+
+void
+iconresolver_stats(iconresolver *r, unsigned int *hits, unsigned int *misses)
+{
+  *hits = r->hits;
+  *misses = r->misses;
+}
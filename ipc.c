@@ -0,0 +1,368 @@
+/*
+ * ipc.c
+ *
+ * Copyright (C) Jon Turney 2015
+ *
+ * This file is part of xwin-xdg-menu
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+//
+// Forwarding requests to an already running instance
+//
+// The running instance listens on a per-user, per-DISPLAY Unix socket.  A
+// request is a single line, a request name optionally followed by a space and
+// an argument, and the reply is a single line, starting "ok" or "error".
+//
+// This is kept free of anything which needs GTK or the menu, so a second
+// instance can forward its request without initializing them.
+//
+// A socket left behind by an instance which died is detected by being unable
+// to connect to it, and is replaced.  Checking for that and binding is done
+// holding a lock file, so two instances starting at the same time can't both
+// decide the socket is stale.
+//
+// The running instance reads requests without blocking, collecting each
+// client's line from the main loop as it arrives, so a slow or silent client
+// can't hold up anything else.  A client which hasn't sent a whole line within
+// the timeout is dropped.
+//
+
+#include "ipc.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <glib-unix.h>
+
+#define IPC_LINE_MAX 256
+#define IPC_TIMEOUT 2000 // milliseconds
+
+struct _ipc_server
+{
+  int fd;
+  guint source;
+  char *path;
+  ipc_handler handler;
+  gpointer data;
+  // connections waiting for a request line
+  GList *clients;
+};
+
+// a connection to the server, and as much of the request line as has arrived
+typedef struct
+{
+  int fd;
+  guint source;
+  guint timeout;
+  ipc_server *server;
+  char line[IPC_LINE_MAX];
+  size_t len;
+} ipc_client;
+
+// the socket path for the current user and display
+char *
+ipc_socket_path(const char *display)
+{
+  char *name = g_strdup_printf("xwin-xdg-menu-%s.socket", display ? display : "");
+
+  // DISPLAY may contain '/' (e.g. a launchd socket path)
+  g_strdelimit(name, "/", '_');
+
+  char *path = g_build_filename(g_get_user_runtime_dir(), name, NULL);
+  g_free(name);
+
+  return path;
+}
+
+// connect to the Unix socket at path, returning the fd, or -1
+int
+ipc_connect(const char *path)
+{
+  struct sockaddr_un addr;
+
+  if (strlen(path) >= sizeof(addr.sun_path))
+    return -1;
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return -1;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+      close(fd);
+      return -1;
+    }
+
+  return fd;
+}
+
+// read a line, with a timeout
+static gboolean
+ipc_read_line(int fd, char *buf, size_t len)
+{
+  size_t n = 0;
+
+  while (n < len - 1)
+    {
+      struct pollfd pfd = { fd, POLLIN, 0 };
+      if (poll(&pfd, 1, IPC_TIMEOUT) <= 0)
+        return FALSE;
+
+      ssize_t r = read(fd, buf + n, len - 1 - n);
+      if (r < 0 && errno == EINTR)
+        continue;
+      if (r <= 0)
+        break;
+
+      n += r;
+      if (memchr(buf, '\n', n))
+        break;
+    }
+
+  buf[n] = 0;
+  char *nl = strchr(buf, '\n');
+  if (nl)
+    *nl = 0;
+
+  return (nl != NULL);
+}
+
+//
+// Send request to the running instance listening on path, and wait for the
+// reply
+//
+// Returns -1 if there's no running instance, otherwise 0 if the reply was
+// "ok", or 1 if it wasn't
+//
+int
+ipc_request(const char *path, const char *request, char *reply, size_t len)
+{
+  int fd = ipc_connect(path);
+  if (fd < 0)
+    return -1;
+
+  char *line = g_strconcat(request, "\n", NULL);
+  gboolean ok = (write(fd, line, strlen(line)) == (ssize_t)strlen(line)) &&
+    ipc_read_line(fd, reply, len);
+  g_free(line);
+  close(fd);
+
+  if (!ok)
+    {
+      g_strlcpy(reply, "error no reply", len);
+      return 1;
+    }
+
+  return g_str_has_prefix(reply, "ok") ? 0 : 1;
+}
+
+static void
+ipc_server_reply(ipc_server *server, int fd, char *line)
+{
+  GString *reply = g_string_new(NULL);
+  char *arg = strchr(line, ' ');
+  if (arg)
+    *arg++ = 0;
+
+  g_print("Request '%s%s%s' from another instance\n", line,
+          arg ? " " : "", arg ? arg : "");
+  server->handler(line, arg, reply, server->data);
+
+  if (!reply->len)
+    g_string_assign(reply, "ok");
+  g_string_append_c(reply, '\n');
+  // the reply is small enough to fit in the socket buffer, so this won't fail
+  // for want of space, even though the socket is non-blocking
+  if (write(fd, reply->str, reply->len) < 0)
+    g_print("Failed to reply to request: %s\n", strerror(errno));
+  g_string_free(reply, TRUE);
+}
+
+// destroy notify for the client's fd source
+static void
+ipc_client_free(gpointer data)
+{
+  ipc_client *client = data;
+
+  if (client->timeout)
+    g_source_remove(client->timeout);
+  client->server->clients = g_list_remove(client->server->clients, client);
+  close(client->fd);
+  g_free(client);
+}
+
+static gboolean
+ipc_client_timeout(gpointer data)
+{
+  ipc_client *client = data;
+
+  g_print("Dropped a connection from another instance which sent no request\n");
+  client->timeout = 0;
+  g_source_remove(client->source);
+
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean
+ipc_server_client(gint fd, GIOCondition condition, gpointer data)
+{
+  ipc_client *client = data;
+
+  ssize_t r = read(fd, client->line + client->len, sizeof(client->line) - 1 - client->len);
+  if ((r < 0) && ((errno == EINTR) || (errno == EAGAIN)))
+    return G_SOURCE_CONTINUE;
+
+  // the connection was closed before a whole line arrived
+  if (r <= 0)
+    return G_SOURCE_REMOVE;
+
+  char *nl = memchr(client->line + client->len, '\n', r);
+  client->len += r;
+  if (!nl)
+    {
+      // wait for the rest of the line, unless it's too long
+      return (client->len < sizeof(client->line) - 1) ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+    }
+
+  *nl = 0;
+  ipc_server_reply(client->server, fd, client->line);
+
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean
+ipc_server_accept(gint fd, GIOCondition condition, gpointer data)
+{
+  ipc_server *server = data;
+  int client_fd = accept(fd, NULL, NULL);
+
+  if (client_fd >= 0)
+    {
+      fcntl(client_fd, F_SETFD, FD_CLOEXEC);
+      fcntl(client_fd, F_SETFL, fcntl(client_fd, F_GETFL) | O_NONBLOCK);
+
+      ipc_client *client = g_new0(ipc_client, 1);
+      client->fd = client_fd;
+      client->server = server;
+      server->clients = g_list_prepend(server->clients, client);
+      client->source = g_unix_fd_add_full(G_PRIORITY_DEFAULT, client_fd,
+                                          G_IO_IN | G_IO_HUP | G_IO_ERR,
+                                          ipc_server_client, client, ipc_client_free);
+      client->timeout = g_timeout_add(IPC_TIMEOUT, ipc_client_timeout, client);
+    }
+
+  return G_SOURCE_CONTINUE;
+}
+
+//
+// Start listening on path, calling handler for each request received
+//
+// Returns NULL if another instance is already listening
+//
+ipc_server *
+ipc_server_new(const char *path, ipc_handler handler, gpointer data)
+{
+  struct sockaddr_un addr;
+
+  if (strlen(path) >= sizeof(addr.sun_path))
+    {
+      g_print("Socket path %s is too long\n", path);
+      return NULL;
+    }
+
+  char *dirname = g_path_get_dirname(path);
+  g_mkdir_with_parents(dirname, 0700);
+  g_free(dirname);
+
+  char *lockpath = g_strconcat(path, ".lock", NULL);
+  int lockfd = open(lockpath, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  g_free(lockpath);
+  if (lockfd >= 0)
+    flock(lockfd, LOCK_EX);
+
+  ipc_server *server = NULL;
+  int fd = ipc_connect(path);
+  if (fd >= 0)
+    {
+      // someone is listening
+      close(fd);
+      goto done;
+    }
+
+  // anything there now is stale
+  unlink(path);
+
+  fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    goto done;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  if ((bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) ||
+      (listen(fd, 8) != 0))
+    {
+      g_print("Failed to listen on %s: %s\n", path, strerror(errno));
+      close(fd);
+      goto done;
+    }
+
+  server = g_new0(ipc_server, 1);
+  server->fd = fd;
+  server->path = g_strdup(path);
+  server->handler = handler;
+  server->data = data;
+  server->source = g_unix_fd_add(fd, G_IO_IN, ipc_server_accept, server);
+
+ done:
+  if (lockfd >= 0)
+    close(lockfd);
+
+  return server;
+}
+
+void
+ipc_server_free(ipc_server *server)
+{
+  if (!server)
+    return;
+
+  g_source_remove(server->source);
+  // each client removes itself from the list when its source is destroyed
+  while (server->clients)
+    g_source_remove(((ipc_client *)server->clients->data)->source);
+  close(server->fd);
+  unlink(server->path);
+  g_free(server->path);
+  g_free(server);
+}
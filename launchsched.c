@@ -0,0 +1,279 @@
+/*
+ * launchsched.c
+ *
+ * Copyright (C) Jon Turney 2015
+ *
+ * This file is part of xwin-xdg-menu
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+//
+// Scheduling launches
+//
+// A launch of something which was launched less than window ms ago (e.g. an
+// impatient second click on a slow-starting application) is suppressed.
+//
+// At most concurrency launches are in flight at once, and any more wait in
+// a queue, to be started in the order they were asked for.  A launch is in
+// flight until it says it has finished (e.g. its command has exited), or for
+// at most startup ms, after which it's assumed to be running normally and no
+// longer competing with the launches after it.
+//
+// This doesn't know how to launch anything, so can be used anywhere GLib
+// can.  It's only used from the main thread.
+//
+
+#include "launchsched.h"
+
+// how many keys to remember before forgetting those launched too long ago
+#define LAUNCHSCHED_KEYS_MAX 64
+
+typedef struct
+{
+  char *label;
+  gpointer job;
+  gint64 queued;
+} launch_job;
+
+struct _launchsched
+{
+  int window;
+  int concurrency;
+  int startup;
+  launchsched_start start;
+  GDestroyNotify free_job;
+
+  // key -> monotonic time of its last launch
+  GHashTable *last;
+  // token -> timeout source for launches in flight
+  GHashTable *running;
+  GQueue queue;
+  guint next_token;
+  guint suppressed;
+};
+
+typedef struct
+{
+  launchsched *s;
+  guint token;
+} launch_timeout;
+
+static void
+launch_job_free(launchsched *s, launch_job *j)
+{
+  if (j->job && s->free_job)
+    s->free_job(j->job);
+  g_free(j->label);
+  g_free(j);
+}
+
+// launches for at most window ms after the last one of the same key are
+// suppressed (or none, if window is 0).  At most concurrency launches are in
+// flight (or any number, if it's 0), each for at most startup ms
+launchsched *
+launchsched_new(int window, int concurrency, int startup,
+                launchsched_start start, GDestroyNotify free_job)
+{
+  launchsched *s = g_new0(launchsched, 1);
+
+  s->window = MAX(window, 0);
+  s->concurrency = MAX(concurrency, 0);
+  s->startup = MAX(startup, 0);
+  s->start = start;
+  s->free_job = free_job;
+  s->last = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  s->running = g_hash_table_new(g_direct_hash, g_direct_equal);
+  g_queue_init(&s->queue);
+  s->next_token = 1;
+
+  return s;
+}
+
+void
+launchsched_free(launchsched *s)
+{
+  GHashTableIter iter;
+  gpointer value;
+  launch_job *j;
+
+  if (!s)
+    return;
+
+  g_hash_table_iter_init(&iter, s->running);
+  while (g_hash_table_iter_next(&iter, NULL, &value))
+    g_source_remove(GPOINTER_TO_UINT(value));
+  g_hash_table_destroy(s->running);
+  g_hash_table_destroy(s->last);
+
+  while ((j = g_queue_pop_head(&s->queue)))
+    launch_job_free(s, j);
+
+  g_free(s);
+}
+
+// should a launch of key be suppressed, since it was launched too recently?
+// If not, this counts as its launch
+gboolean
+launchsched_suppress(launchsched *s, const char *key)
+{
+  if (!key || !s->window)
+    return FALSE;
+
+  gint64 now = g_get_monotonic_time();
+  gint64 *last = g_hash_table_lookup(s->last, key);
+
+  if (last && (now - *last < (gint64)s->window * 1000))
+    {
+      s->suppressed++;
+      g_print("[%s] launch suppressed, %.1f ms after the last one\n", key,
+              (now - *last) / 1000.0);
+      return TRUE;
+    }
+
+  if (!last)
+    {
+      last = g_new(gint64, 1);
+      g_hash_table_insert(s->last, g_strdup(key), last);
+    }
+  *last = now;
+
+  // forget launches too old to matter, so this doesn't grow without limit
+  if (g_hash_table_size(s->last) > LAUNCHSCHED_KEYS_MAX)
+    {
+      GHashTableIter iter;
+      gpointer value;
+
+      g_hash_table_iter_init(&iter, s->last);
+      while (g_hash_table_iter_next(&iter, NULL, &value))
+        {
+          if (now - *(gint64 *)value >= (gint64)s->window * 1000)
+            g_hash_table_iter_remove(&iter);
+        }
+    }
+
+  return FALSE;
+}
+
+static void launchsched_run(launchsched *s);
+
+// it's now assumed to be running normally, though it may still say it's
+// finished later
+static gboolean
+launchsched_startup_timeout(gpointer data)
+{
+  launch_timeout *t = data;
+
+  g_hash_table_remove(t->s->running, GUINT_TO_POINTER(t->token));
+  launchsched_run(t->s);
+
+  return G_SOURCE_REMOVE;
+}
+
+// start queued launches while there's room for them
+static void
+launchsched_run(launchsched *s)
+{
+  while (!g_queue_is_empty(&s->queue) &&
+         (!s->concurrency || (g_hash_table_size(s->running) < (guint)s->concurrency)))
+    {
+      launch_job *j = g_queue_pop_head(&s->queue);
+      guint token = s->next_token++;
+
+      if (j->queued)
+        g_print("[%s] launch dequeued after %.1f ms, %u queued\n", j->label,
+                (g_get_monotonic_time() - j->queued) / 1000.0, g_queue_get_length(&s->queue));
+
+      launch_timeout *t = g_new(launch_timeout, 1);
+      t->s = s;
+      t->token = token;
+      guint source = g_timeout_add_full(G_PRIORITY_DEFAULT, MAX(s->startup, 1),
+                                        launchsched_startup_timeout, t, g_free);
+      g_hash_table_insert(s->running, GUINT_TO_POINTER(token), GUINT_TO_POINTER(source));
+
+      // the job now belongs to whatever started it
+      gpointer job = j->job;
+      j->job = NULL;
+      launch_job_free(s, j);
+
+      // it may have said it finished before saying it couldn't be started,
+      // which has already removed it
+      gpointer value;
+      if (!s->start(job, token) &&
+          g_hash_table_lookup_extended(s->running, GUINT_TO_POINTER(token), NULL, &value))
+        {
+          g_source_remove(GPOINTER_TO_UINT(value));
+          g_hash_table_remove(s->running, GUINT_TO_POINTER(token));
+        }
+    }
+}
+
+// launch job now, or once there's room for it
+void
+launchsched_submit(launchsched *s, const char *label, gpointer job)
+{
+  launch_job *j = g_new0(launch_job, 1);
+  j->label = g_strdup(label ? label : "-");
+  j->job = job;
+
+  if (s->concurrency && (g_hash_table_size(s->running) >= (guint)s->concurrency))
+    {
+      j->queued = g_get_monotonic_time();
+      g_print("[%s] launch queued, %u in flight, %u queued\n", j->label,
+              g_hash_table_size(s->running), g_queue_get_length(&s->queue) + 1);
+    }
+
+  g_queue_push_tail(&s->queue, j);
+  launchsched_run(s);
+}
+
+// the launch given token has finished
+void
+launchsched_finished(launchsched *s, guint token)
+{
+  gpointer source;
+
+  // it may already have been in flight for too long
+  if (!g_hash_table_lookup_extended(s->running, GUINT_TO_POINTER(token), NULL, &source))
+    return;
+
+  g_source_remove(GPOINTER_TO_UINT(source));
+  g_hash_table_remove(s->running, GUINT_TO_POINTER(token));
+  launchsched_run(s);
+}
+
+guint
+launchsched_running(launchsched *s)
+{
+  return g_hash_table_size(s->running);
+}
+
+guint
+launchsched_queued(launchsched *s)
+{
+  return g_queue_get_length(&s->queue);
+}
+
+guint
+launchsched_suppressed(launchsched *s)
+{
+  return s->suppressed;
+}
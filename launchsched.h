@@ -0,0 +1,50 @@
+/*
+ * launchsched.h
+ *
+ * Copyright (C) Jon Turney 2015
+ *
+ * This file is part of xwin-xdg-menu
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef LAUNCHSCHED_H
+#define LAUNCHSCHED_H
+
+#include <glib.h>
+
+typedef struct _launchsched launchsched;
+
+// start job, which should call launchsched_finished() with token once it's
+// done (or return FALSE, if it couldn't be started)
+typedef gboolean (*launchsched_start)(gpointer job, guint token);
+
+launchsched *launchsched_new(int window, int concurrency, int startup,
+                             launchsched_start start, GDestroyNotify free_job);
+void launchsched_free(launchsched *s);
+gboolean launchsched_suppress(launchsched *s, const char *key);
+void launchsched_submit(launchsched *s, const char *label, gpointer job);
+void launchsched_finished(launchsched *s, guint token);
+guint launchsched_running(launchsched *s);
+guint launchsched_queued(launchsched *s);
+guint launchsched_suppressed(launchsched *s);
+
+#endif /* LAUNCHSCHED_H */
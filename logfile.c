@@ -0,0 +1,479 @@
+/*
+ * logfile.c
+ *
+ * Copyright (C) Jon Turney 2015
+ *
+ * This file is part of xwin-xdg-menu
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+//
+// An optional log writer, with size and age based rotation
+//
+// If a logfile is configured, our stdout and stderr are redirected into a
+// pipe, which a writer thread drains into the logfile, so nothing which logs
+// ever waits on the disk.  When the logfile becomes too big or too old, it is
+// renamed aside with a timestamp and sequence number suffix, and a second
+// thread compresses the rotated segment and removes the oldest segments until
+// the total size of the log is under the cap.
+//
+
+#include "logfile.h"
+#include "menu.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <gio/gio.h>
+
+#define DEFAULT_MAX_SIZE  (10*1024)   // KiB
+#define DEFAULT_MAX_AGE   24          // hours
+#define DEFAULT_MAX_TOTAL (100*1024)  // KiB
+
+// how often to try again to open the logfile, if reopening it after a rotation
+// failed
+#define REOPEN_INTERVAL   (10*G_TIME_SPAN_SECOND)
+
+typedef struct
+{
+  // path of the current logfile
+  char *path;
+  int fd;
+  // written by the writer thread, and read by the compressor thread, under
+  // the size lock
+  gint64 size;
+  gint64 opened;
+
+  // suffix of the last rotated segment, and the sequence number which
+  // distinguishes segments rotated within the same second
+  gchar *stamp;
+  guint seq;
+
+  // limits, in bytes and microseconds
+  gint64 max_size;
+  gint64 max_age;
+  gint64 max_total;
+  gboolean compress;
+
+  // read end of the pipe which stdout and stderr are redirected into
+  int pipe;
+
+  GThread *writer;
+  GThread *compressor;
+  // paths of rotated segments waiting to be compressed
+  GAsyncQueue *rotated;
+} logwriter;
+
+// singleton instance
+static logwriter logw = { .fd = -1, .pipe = -1 };
+
+G_LOCK_DEFINE_STATIC(size);
+
+static gint64
+settings_get_int64(const char *key, gint64 def)
+{
+  GError *err = NULL;
+  gint64 value = g_key_file_get_int64(keyfile, "settings", key, &err);
+  if (err)
+    {
+      g_error_free(err);
+      return def;
+    }
+  return value;
+}
+
+static gboolean
+logfile_open(void)
+{
+  struct stat st;
+
+  logw.fd = open(logw.path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (logw.fd < 0)
+    return FALSE;
+
+  G_LOCK(size);
+  logw.size = (fstat(logw.fd, &st) == 0) ? st.st_size : 0;
+  G_UNLOCK(size);
+  logw.opened = g_get_real_time();
+  return TRUE;
+}
+
+static void
+logfile_reopen(void)
+{
+  if (logfile_open())
+    return;
+
+  g_printerr("Unable to reopen logfile %s: %s\n", logw.path, g_strerror(errno));
+
+  // start counting again, so the next attempt waits for REOPEN_INTERVAL, rather
+  // than being made on every write
+  G_LOCK(size);
+  logw.size = 0;
+  G_UNLOCK(size);
+  logw.opened = g_get_real_time();
+}
+
+static void
+logfile_rotate(void)
+{
+  GDateTime *now = g_date_time_new_now_local();
+  gchar *stamp = g_date_time_format(now, "%Y%m%d-%H%M%S");
+  g_date_time_unref(now);
+
+  // the timestamp only has one second resolution, so a sequence number keeps
+  // segments rotated in the same second apart (and in order), including any
+  // left by an earlier run
+  if (g_strcmp0(stamp, logw.stamp) == 0)
+    logw.seq++;
+  else
+    logw.seq = 0;
+  g_free(logw.stamp);
+  logw.stamp = stamp;
+
+  gchar *rotated, *gz;
+  while (1)
+    {
+      rotated = g_strdup_printf("%s.%s.%03u", logw.path, logw.stamp, logw.seq);
+      gz = g_strconcat(rotated, ".gz", NULL);
+      gboolean exists = g_file_test(rotated, G_FILE_TEST_EXISTS) || g_file_test(gz, G_FILE_TEST_EXISTS);
+      g_free(gz);
+      if (!exists)
+        break;
+      g_free(rotated);
+      logw.seq++;
+    }
+
+  close(logw.fd);
+  logw.fd = -1;
+  if (rename(logw.path, rotated) == 0)
+    g_async_queue_push(logw.rotated, rotated);
+  else
+    g_free(rotated);
+
+  logfile_reopen();
+}
+
+static gpointer
+logfile_writer_thread(gpointer data)
+{
+  char buf[4096];
+  ssize_t n;
+
+  while ((n = read(logw.pipe, buf, sizeof(buf))) != 0)
+    {
+      if (n < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          break;
+        }
+
+      if (logw.fd < 0)
+        {
+          // there's nothing to rotate, but try to open the logfile again
+          if (g_get_real_time() - logw.opened >= REOPEN_INTERVAL)
+            logfile_reopen();
+        }
+      else if ((logw.size >= logw.max_size) ||
+               (logw.max_age && (g_get_real_time() - logw.opened >= logw.max_age)))
+        logfile_rotate();
+
+      // if the logfile can't be written to, the output is discarded, rather
+      // than blocking whoever is writing to the pipe
+      if (logw.fd >= 0)
+        {
+          ssize_t w = write(logw.fd, buf, n);
+          if (w > 0)
+            {
+              G_LOCK(size);
+              logw.size += w;
+              G_UNLOCK(size);
+            }
+        }
+    }
+
+  // tell the compressor there is nothing more to come
+  g_async_queue_push(logw.rotated, g_strdup(""));
+
+  return NULL;
+}
+
+static gboolean
+logfile_compress(const char *path)
+{
+  gboolean ok = FALSE;
+  gchar *gzpath = g_strconcat(path, ".gz", NULL);
+  GFile *in_file = g_file_new_for_path(path);
+  GFile *out_file = g_file_new_for_path(gzpath);
+
+  GFileInputStream *in = g_file_read(in_file, NULL, NULL);
+  GFileOutputStream *out = g_file_replace(out_file, NULL, FALSE,
+                                          G_FILE_CREATE_NONE, NULL, NULL);
+  if (in && out)
+    {
+      GZlibCompressor *compressor = g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_GZIP, -1);
+      GOutputStream *gz = g_converter_output_stream_new(G_OUTPUT_STREAM(out),
+                                                        G_CONVERTER(compressor));
+
+      ok = (g_output_stream_splice(gz, G_INPUT_STREAM(in),
+                                   G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE |
+                                   G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
+                                   NULL, NULL) >= 0);
+
+      g_object_unref(gz);
+      g_object_unref(compressor);
+    }
+
+  if (in)
+    g_object_unref(in);
+  if (out)
+    g_object_unref(out);
+
+  if (ok)
+    unlink(path);
+  else
+    unlink(gzpath);
+
+  g_object_unref(in_file);
+  g_object_unref(out_file);
+  g_free(gzpath);
+
+  return ok;
+}
+
+static gint
+compare_paths(gconstpointer a, gconstpointer b)
+{
+  return strcmp(*(const char **)a, *(const char **)b);
+}
+
+// check that name is one of our rotated segments, i.e. the logfile basename
+// followed by the suffix logfile_rotate() adds, and optionally ".gz"
+static gboolean
+logfile_is_segment(const char *name, const char *basename)
+{
+  static const char pattern[] = ".########-######.";
+  const char *p;
+  int i;
+
+  if (!g_str_has_prefix(name, basename))
+    return FALSE;
+  p = name + strlen(basename);
+
+  // the timestamp
+  for (i = 0; pattern[i]; i++, p++)
+    {
+      if (pattern[i] == '#')
+        {
+          if (!g_ascii_isdigit(*p))
+            return FALSE;
+        }
+      else if (*p != pattern[i])
+        return FALSE;
+    }
+
+  // the sequence number is at least three digits
+  for (i = 0; g_ascii_isdigit(*p); i++, p++)
+    ;
+  if (i < 3)
+    return FALSE;
+
+  return (*p == '\0') || (strcmp(p, ".gz") == 0);
+}
+
+// remove the oldest rotated segments until the total size is under the cap
+static void
+logfile_enforce_cap(void)
+{
+  gchar *dirname = g_path_get_dirname(logw.path);
+  gchar *basename = g_path_get_basename(logw.path);
+  GDir *dir = g_dir_open(dirname, 0, NULL);
+  GPtrArray *segments = g_ptr_array_new_with_free_func(g_free);
+  gint64 total;
+  struct stat st;
+  const char *name;
+
+  G_LOCK(size);
+  total = logw.size;
+  G_UNLOCK(size);
+
+  if (dir)
+    {
+      while ((name = g_dir_read_name(dir)))
+        {
+          if (!logfile_is_segment(name, basename))
+            continue;
+
+          gchar *path = g_build_filename(dirname, name, NULL);
+          if ((lstat(path, &st) == 0) && S_ISREG(st.st_mode))
+            {
+              total += st.st_size;
+              g_ptr_array_add(segments, path);
+            }
+          else
+            g_free(path);
+        }
+      g_dir_close(dir);
+    }
+
+  // the timestamp and sequence number suffix makes name order the same as age
+  // order
+  g_ptr_array_sort(segments, compare_paths);
+
+  guint i;
+  for (i = 0; (i < segments->len) && (total > logw.max_total); i++)
+    {
+      const char *path = g_ptr_array_index(segments, i);
+      if ((stat(path, &st) == 0) && (unlink(path) == 0))
+        total -= st.st_size;
+    }
+
+  g_ptr_array_free(segments, TRUE);
+  g_free(basename);
+  g_free(dirname);
+}
+
+static gpointer
+logfile_compressor_thread(gpointer data)
+{
+  while (1)
+    {
+      gchar *path = g_async_queue_pop(logw.rotated);
+      if (!*path)
+        {
+          g_free(path);
+          break;
+        }
+
+      if (logw.compress)
+        logfile_compress(path);
+      g_free(path);
+
+      logfile_enforce_cap();
+    }
+
+  return NULL;
+}
+
+void
+logfile_init(void)
+{
+  GError *err = NULL;
+  gchar *path = g_key_file_get_string(keyfile, "settings", "logfile", &err);
+  if (err)
+    {
+      g_error_free(err);
+      return;
+    }
+
+  if (!*path)
+    {
+      g_free(path);
+      return;
+    }
+
+  // relative paths are relative to the user cache directory
+  if (g_path_is_absolute(path))
+    logw.path = path;
+  else
+    {
+      logw.path = g_build_filename(g_get_user_cache_dir(), path, NULL);
+      g_free(path);
+    }
+
+  logw.max_size = settings_get_int64("logmaxsize", DEFAULT_MAX_SIZE) * 1024;
+  logw.max_age = settings_get_int64("logmaxage", DEFAULT_MAX_AGE) * G_TIME_SPAN_HOUR;
+  logw.max_total = settings_get_int64("logmaxtotal", DEFAULT_MAX_TOTAL) * 1024;
+  logw.compress = TRUE;
+  if (g_key_file_has_key(keyfile, "settings", "logcompress", NULL))
+    logw.compress = g_key_file_get_boolean(keyfile, "settings", "logcompress", NULL);
+
+  gchar *dirname = g_path_get_dirname(logw.path);
+  g_mkdir_with_parents(dirname, 0755);
+  g_free(dirname);
+
+  int fds[2];
+  if (!logfile_open() || (pipe(fds) != 0))
+    {
+      g_printerr("Unable to open logfile %s: %s\n", logw.path, g_strerror(errno));
+      if (logw.fd >= 0)
+        close(logw.fd);
+      logw.fd = -1;
+      g_free(logw.path);
+      logw.path = NULL;
+      return;
+    }
+
+#ifdef F_SETPIPE_SZ
+  // more slack for bursts of output while the writer waits on the disk
+  fcntl(fds[1], F_SETPIPE_SZ, 1024*1024);
+#endif
+
+  fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+  logw.pipe = fds[0];
+  logw.rotated = g_async_queue_new();
+  logw.writer = g_thread_new("logfile writer", logfile_writer_thread, NULL);
+  logw.compressor = g_thread_new("logfile compressor", logfile_compressor_thread, NULL);
+
+  // redirect stdout and stderr into the pipe
+  fflush(stdout);
+  fflush(stderr);
+  dup2(fds[1], STDOUT_FILENO);
+  dup2(fds[1], STDERR_FILENO);
+  close(fds[1]);
+}
+
+const char *
+logfile_path(void)
+{
+  return logw.path;
+}
+
+void
+logfile_shutdown(void)
+{
+  if (!logw.path)
+    return;
+
+  // closing our ends of the pipe lets the writer see EOF, once anything still
+  // in the pipe has been written
+  fflush(stdout);
+  fflush(stderr);
+  int null = open("/dev/null", O_WRONLY);
+  dup2(null, STDOUT_FILENO);
+  dup2(null, STDERR_FILENO);
+  close(null);
+
+  g_thread_join(logw.writer);
+  g_thread_join(logw.compressor);
+  g_async_queue_unref(logw.rotated);
+
+  close(logw.pipe);
+  close(logw.fd);
+  g_free(logw.path);
+  logw.path = NULL;
+  g_free(logw.stamp);
+  logw.stamp = NULL;
+}
@@ -26,18 +26,48 @@
  *
  */
 
+#include "execute.h"
+#include "ipc.h"
+#include "logfile.h"
+#include "metrics.h"
 #include "menu.h"
 #include "msgwindow.h"
+#include "prelaunch.h"
+#include "proctable.h"
+#include "soak.h"
+#include "terminal.h"
+#include "trace.h"
 #include "trayicon.h"
 #include "resource.h"
 #include <glib.h>
 #include <gtk/gtk.h>
 #include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 gboolean in_session;
 GKeyFile *keyfile = NULL;
 
+// when main() was entered, in monotonic microseconds
+static gint64 process_start;
+
+static void
+startup_mark_at(const char *what, gint64 when)
+{
+  g_print("startup: %s at %.1f ms\n", what, (when - process_start) / 1000.0);
+}
+
+//
+// log a startup milestone, relative to process start
+//
+void
+startup_mark(const char *what)
+{
+  startup_mark_at(what, g_get_monotonic_time());
+}
+
 //
 // GSourceWinMsgQueue
 //
@@ -100,6 +130,265 @@ winMsgQueueCreate(void)
   return (GSource *)msgQueueSource;
 }
 
+//
+// requests from other instances
+//
+
+static HWND hwndMsg;
+
+// the displays we are serving, the index of which is the ID of their tray
+// icon.  The first is the one GTK uses
+static GPtrArray *displays;
+
+const char *
+display_name(int index)
+{
+  if ((index < 0) || (index >= (int)displays->len))
+    index = 0;
+
+  return g_ptr_array_index(displays, index);
+}
+
+// map an icon size in pixels to the menu command which selects it
+static int
+icon_size_to_id(int size)
+{
+  switch (size)
+    {
+    case 0:
+      return ID_SIZE_DEFAULT;
+    case 16:
+      return ID_SIZE_16;
+    case 24:
+      return ID_SIZE_24;
+    case 32:
+      return ID_SIZE_32;
+    case 48:
+      return ID_SIZE_48;
+    case 64:
+      return ID_SIZE_64;
+    }
+
+  return -1;
+}
+
+static void
+ipc_handle(const char *request, const char *arg, GString *reply, gpointer data)
+{
+  if (strcmp(request, "ping") == 0)
+    {
+    }
+  else if (strcmp(request, "show") == 0)
+    {
+      // as if the notification area icon for the display was clicked
+      PostMessage(hwndMsg, WM_TRAYICON, GPOINTER_TO_INT(data), WM_LBUTTONUP);
+    }
+  else if (strcmp(request, "rebuild") == 0)
+    {
+      menu_rebuild();
+    }
+  else if (strcmp(request, "iconsize") == 0)
+    {
+      int size_id = arg ? icon_size_to_id(atoi(arg)) : -1;
+      if (size_id < 0)
+        g_string_printf(reply, "error invalid icon size");
+      else
+        menu_set_icon_size(size_id);
+    }
+  else if (strcmp(request, "exit") == 0)
+    {
+      gtk_main_quit();
+    }
+  else
+    {
+      g_string_printf(reply, "error unknown request '%s'", request);
+    }
+}
+
+static int
+forward_request(const char *path, const char *request)
+{
+  char reply[256];
+  int result = ipc_request(path, request, reply, sizeof(reply));
+
+  if (result > 0)
+    fprintf(stderr, "'%s' failed: %s\n", request, reply);
+
+  return result;
+}
+
+//
+// Forward the requested actions to the running instance
+//
+// Returns -1 if there isn't one, otherwise an exit status
+//
+static int
+forward_requests(const char *path, gboolean show, gboolean rebuild, int iconsize, gboolean quit)
+{
+  int status = forward_request(path, "ping");
+  if (status < 0)
+    return -1;
+
+  if (iconsize >= 0)
+    {
+      char *request = g_strdup_printf("iconsize %d", iconsize);
+      status |= forward_request(path, request);
+      g_free(request);
+    }
+
+  if (rebuild)
+    status |= forward_request(path, "rebuild");
+
+  if (show)
+    {
+      // let it take the foreground, which we have if launched from a hotkey
+      AllowSetForegroundWindow(ASFW_ANY);
+      status |= forward_request(path, "show");
+    }
+
+  if (quit)
+    status |= forward_request(path, "exit");
+
+  if (!show && !rebuild && !quit && (iconsize < 0))
+    printf("xwin-xdg-menu is already running\n");
+
+  return status ? 1 : 0;
+}
+
+// our resident set size, in KiB
+static long
+rss_kib(void)
+{
+  long pages = 0;
+  FILE *f = fopen("/proc/self/statm", "r");
+  if (f)
+    {
+      if (fscanf(f, "%*d %ld", &pages) != 1)
+        pages = 0;
+      fclose(f);
+    }
+
+  return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static gint64
+rss_gauge(void)
+{
+  return rss_kib() * 1024;
+}
+
+static gint64
+gdi_objects_gauge(void)
+{
+  return GetGuiResources(GetCurrentProcess(), GR_GDIOBJECTS);
+}
+
+static gint64
+user_objects_gauge(void)
+{
+  return GetGuiResources(GetCurrentProcess(), GR_USEROBJECTS);
+}
+
+// serve metrics on a per-user socket, unless disabled
+static void
+metrics_init(void)
+{
+  GError *err = NULL;
+  gboolean enabled = g_key_file_get_boolean(keyfile, "settings", "metrics", &err);
+  if (err)
+    {
+      enabled = TRUE;
+      g_error_free(err);
+    }
+
+  metrics_gauge_new("rss_bytes", "Resident set size", rss_gauge);
+  metrics_gauge_new("gdi_objects", "GDI objects in use", gdi_objects_gauge);
+  metrics_gauge_new("user_objects", "USER objects in use", user_objects_gauge);
+
+  if (!enabled)
+    return;
+
+  // DISPLAY may contain '/' (e.g. a launchd socket path)
+  char *name = g_strdup_printf("xwin-xdg-menu-metrics-%s.socket", display_name(0));
+  g_strdelimit(name, "/", '_');
+  char *path = g_build_filename(g_get_user_runtime_dir(), name, NULL);
+  metrics_serve(path);
+  g_free(path);
+  g_free(name);
+}
+
+//
+// Soak testing: repeatedly rebuild the menu, change the icon size and launch
+// a command, checking that resource use doesn't grow
+//
+
+static int soak_iterations;
+static int soak_iteration;
+static gboolean soak_ok;
+
+static gboolean
+soak_step(gpointer data)
+{
+  static const int sizes[] = { ID_SIZE_16, ID_SIZE_24, ID_SIZE_32, ID_SIZE_48, ID_SIZE_64, ID_SIZE_DEFAULT };
+
+  // wait for the construction started by the last iteration to finish
+  if (menu_building())
+    return G_SOURCE_CONTINUE;
+
+  if (soak_iteration > 0)
+    soak_sample(soak_iteration);
+
+  if (soak_iteration == soak_iterations)
+    {
+      soak_ok = soak_finish();
+      gtk_main_quit();
+      return G_SOURCE_REMOVE;
+    }
+
+  soak_iteration++;
+
+  // alternately change the icon size and rebuild at the same size
+  if (soak_iteration % 2)
+    menu_set_icon_size(sizes[(soak_iteration / 2) % G_N_ELEMENTS(sizes)]);
+  else
+    menu_rebuild();
+
+  execute_command("true", "soak", NULL, NULL, NULL);
+  menu_update_running();
+
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+soak_run(int iterations)
+{
+  soak_iterations = iterations;
+  soak_init(iterations);
+  soak_watch("rss", soak_rss, 8 * 1024 * 1024, 0.1);
+  soak_watch("heap", soak_heap, 4 * 1024 * 1024, 0.1);
+  soak_watch("fds", soak_fds, 4, 0);
+  soak_watch("threads", soak_threads, 4, 0);
+  soak_watch("gdi", gdi_objects_gauge, 16, 0);
+  soak_watch("user", user_objects_gauge, 16, 0);
+
+  g_timeout_add(10, soak_step, NULL);
+  gtk_main();
+
+  return soak_ok;
+}
+
+// log how responsive we've been
+static void
+latency_report(void)
+{
+  char *shown = menu_shown_summary();
+  char *spawned = execute_spawned_summary();
+  g_print("Click to menu: %s\n", shown);
+  g_print("Selection to launch: %s\n", spawned);
+  g_free(spawned);
+  g_free(shown);
+}
+
 //
 // main
 //
@@ -110,9 +399,86 @@ winMsgQueueCreate(void)
 int
 main (int argc, char **argv)
 {
+  process_start = g_get_monotonic_time();
+
   // make sure stdout is line-buffered
   setvbuf(stdout, NULL, _IOLBF, BUFSIZ);
 
+  gboolean popup = FALSE;
+  gboolean show = FALSE;
+  gboolean rebuild = FALSE;
+  gboolean quit = FALSE;
+  int iconsize = -1;
+  int soak = 0;
+  gchar **display_args = NULL;
+  GOptionEntry entries[] =
+    {
+      { "display", 'd', 0, G_OPTION_ARG_STRING_ARRAY, &display_args, "X display to serve (may be repeated)", "DISPLAY" },
+      { "popup", 'p', 0, G_OPTION_ARG_NONE, &popup, "Show the menu at the cursor once, launch the selection, and exit", NULL },
+      { "show", 0, 0, G_OPTION_ARG_NONE, &show, "Show the menu of the running instance", NULL },
+      { "rebuild", 0, 0, G_OPTION_ARG_NONE, &rebuild, "Make the running instance re-read the menu", NULL },
+      { "iconsize", 0, 0, G_OPTION_ARG_INT, &iconsize, "Set the icon size (0 for the default)", "SIZE" },
+      { "exit", 0, 0, G_OPTION_ARG_NONE, &quit, "Make the running instance exit", NULL },
+      { "soak", 0, 0, G_OPTION_ARG_INT, &soak, "Rebuild the menu, change the icon size and launch a command this many times, checking for leaks, and exit", "ITERATIONS" },
+      { NULL }
+    };
+
+  // accept the traditional X -display, as well as --display
+  int i;
+  for (i = 1; i < argc; i++)
+    if (strcmp(argv[i], "-display") == 0)
+      argv[i] = "--display";
+
+  GError *error = NULL;
+  GOptionContext *context = g_option_context_new("- XDG menu in the notification area");
+  g_option_context_add_main_entries(context, entries, NULL);
+  // leave GTK's options for gtk_init()
+  g_option_context_set_ignore_unknown_options(context, TRUE);
+  if (!g_option_context_parse(context, &argc, &argv, &error))
+    {
+      fprintf(stderr, "%s\n", error->message);
+      return 1;
+    }
+  g_option_context_free(context);
+
+  if ((iconsize >= 0) && (icon_size_to_id(iconsize) < 0))
+    {
+      fprintf(stderr, "Invalid icon size %d\n", iconsize);
+      return 1;
+    }
+
+  displays = g_ptr_array_new_with_free_func(g_free);
+  if (display_args)
+    {
+      for (i = 0; display_args[i]; i++)
+        g_ptr_array_add(displays, g_strdup(display_args[i]));
+      g_strfreev(display_args);
+
+      // GTK uses the first display
+      g_setenv("DISPLAY", g_ptr_array_index(displays, 0), TRUE);
+    }
+  else
+    {
+      g_ptr_array_add(displays, g_strdup(g_getenv("DISPLAY") ? g_getenv("DISPLAY") : ""));
+    }
+
+  // if there's already an instance running for the (first) display, forward
+  // the request to it, before doing anything expensive
+  if (soak <= 0)
+    {
+      char *socket_path = ipc_socket_path(display_name(0));
+      int forwarded = forward_requests(socket_path, popup || show, rebuild, iconsize, quit);
+      g_free(socket_path);
+      if (forwarded >= 0)
+        return forwarded;
+    }
+
+  if (quit)
+    {
+      fprintf(stderr, "xwin-xdg-menu is not running\n");
+      return 1;
+    }
+
   gtk_init(&argc, &argv);
 
   in_session = !!g_getenv("_LXSESSION_PID");
@@ -128,31 +494,144 @@ main (int argc, char **argv)
       if (!err)
         size_id = tmp;
     }
+  if (iconsize >= 0)
+    size_id = icon_size_to_id(iconsize);
 
-  // construct menu
-  menu_init(size_id);
+  // start the log writer, if configured
+  logfile_init();
+
+  // start the tracer, if configured
+  trace_init();
+
+  // start tracking launched applications
+  proctable_init();
+  execute_init();
+
+  // process start was recorded on entry to main(), but is only logged now that
+  // the logfile (if any) is open
+  startup_mark_at("process start", process_start);
+  startup_mark("initialized");
 
   // construct message window
-  HWND hwndMsg = createMsgWindow();
+  hwndMsg = createMsgWindow();
   if (!hwndMsg)
     return -1;
 
+  // popup mode doesn't need the tray icon or the main loop, and launches
+  // commands detached, since we won't be around to log their output
+  if (popup)
+    {
+      execute_set_detached(TRUE);
+      menu_popup_init(size_id);
+      popupMenu(hwndMsg, 0, 0);
+      startup_mark("exit");
+
+      execute_shutdown();
+      trace_shutdown();
+
+      g_key_file_save_to_file(keyfile, filename, NULL);
+      g_key_file_free(keyfile);
+      g_free(filename);
+      logfile_shutdown();
+
+      return 0;
+    }
+
   // main loop
   GSource *msgQueueSource = winMsgQueueCreate();
   g_source_attach(msgQueueSource, g_main_context_default());
 
-  initNotifyIcon(hwndMsg);
+  // show the notification area icons as soon as possible, with a placeholder
+  // menu.  The real menu is constructed once the main loop is idle.  The
+  // menu, icon caches and change monitoring are shared by all the displays
+  menu_init(size_id);
 
-  gtk_main();
+  // soak testing doesn't need the tray icon, and leaves the settings alone
+  if (soak > 0)
+    {
+      gboolean ok = soak_run(soak);
+
+      g_source_destroy(msgQueueSource);
+      execute_shutdown();
+      trace_shutdown();
+
+      g_key_file_free(keyfile);
+      g_free(filename);
+      logfile_shutdown();
 
-  deleteNotifyIcon(hwndMsg);
+      return ok ? 0 : 1;
+    }
+
+  GPtrArray *servers = g_ptr_array_new();
+  long rss = rss_kib();
+  for (i = 0; i < (int)displays->len; i++)
+    {
+      // accept requests from other instances for this display.  If another
+      // instance is already serving it (e.g. we lost a race with it
+      // starting), leave it to that one
+      char *path = ipc_socket_path(display_name(i));
+      ipc_server *server = ipc_server_new(path, ipc_handle, GINT_TO_POINTER(i));
+      if (!server && (forward_requests(path, FALSE, FALSE, -1, FALSE) >= 0))
+        {
+          g_print("DISPLAY %s is served by another instance\n", display_name(i));
+          g_ptr_array_remove_index(displays, i);
+          i--;
+          g_free(path);
+          continue;
+        }
+      g_free(path);
+      g_ptr_array_add(servers, server);
+
+      initNotifyIcon(hwndMsg, i);
+
+      long now = rss_kib();
+      g_print("Serving DISPLAY %s, RSS %+ld KiB (%ld KiB total)\n",
+              display_name(i), now - rss, now);
+      rss = now;
+    }
+
+  // if every display is served by another instance, there's nothing to do,
+  // but still shut down as usual
+  if (displays->len)
+    {
+      startup_mark("icon visible");
+
+      metrics_init();
+
+      // start any warm instances, once we're idle
+      prelaunch_init();
+      terminal_init();
+
+      // for the time from selecting a menu item to its window being shown
+      HWINEVENTHOOK hook = watchWindowsShown();
+
+      gtk_main();
+
+      if (hook)
+        UnhookWinEvent(hook);
+
+      for (i = 0; i < (int)displays->len; i++)
+        {
+          deleteNotifyIcon(hwndMsg, i);
+          ipc_server_free(g_ptr_array_index(servers, i));
+        }
+
+      latency_report();
+    }
+  g_ptr_array_free(servers, TRUE);
 
   g_source_destroy(msgQueueSource);
 
+  execute_shutdown();
+  metrics_shutdown();
+  trace_shutdown();
+
   // save settings
   g_key_file_save_to_file(keyfile, filename, NULL);
   g_key_file_free(keyfile);
   g_free(filename);
 
+  logfile_shutdown();
+
   return 0;
 }
@@ -37,12 +37,22 @@
 //
 
 #include "menu.h"
+#include "dirwatch.h"
+#include "entrytable.h"
+#include "icontheme.h"
+#include "iconcache.h"
+#include "menulayout.h"
+#include "metrics.h"
+#include "proctable.h"
+#include "soak.h"
+#include "trace.h"
 
 #define GMENU_I_KNOW_THIS_IS_UNSTABLE
 #include <gmenu-tree.h>
 #include <gtk/gtk.h>
 #include <windows.h>
 #include <resource.h>
+#include <signal.h>
 
 extern HMENU hMenuTray;
 
@@ -52,7 +62,7 @@ typedef struct _xdgmenu
   GMenuTree* tree;
 
   // the icon theme
-  GtkIconTheme *theme;
+  iconresolver *theme;
 
   // the windows menu structure
   HMENU hMenu;
@@ -62,15 +72,271 @@ typedef struct _xdgmenu
 
   // mapping between menu item IDs and the menu item data
   int count;
-  GDesktopAppInfo **appinfo;
+  entrytable *entries;
 
   // bitmaps for menu items
   HBITMAP *bitmaps;
+
+  // the 'Running applications' submenu, and the processes (pid and start
+  // time) of its items
+  HMENU hRunningMenu;
+  GArray *running;
+
+  // if constructing submenus on demand, the submenus which haven't been
+  // constructed yet, and the directories they are for
+  GHashTable *deferred;
 } xdgmenu;
 
 // singleton instance
 static xdgmenu menu;
 
+// are we just popping up the menu once?
+static gboolean popup;
+
+// the name of the menu file
+#define MENU_FILE "xwin-applications.menu"
+
+// watches for changes to the menu, other than those libgnome-menu notices
+static dirwatch *watch;
+
+// a submenu being constructed
+typedef struct
+{
+  HMENU hMenu;
+  GMenuTreeIter *iter;
+  // for tracing, when it was started and the directory name
+  gint64 started;
+  char *name;
+
+  // if the directory has too many items for one menu, either the number of
+  // items per column, or its items and the alphabetical ranges they are split
+  // into
+  guint columns;
+  GArray *items;
+  guint next;
+  GArray *buckets;
+  guint bucket;
+  HMENU hBucketMenu;
+} build_frame;
+
+// an item of a directory which is being split
+typedef struct
+{
+  GMenuTreeItemType type;
+  gpointer item;
+} build_item;
+
+// how to lay out directories with too many items for one menu
+typedef enum
+{
+  LAYOUT_NONE,
+  LAYOUT_BUCKETS,
+  LAYOUT_COLUMNS,
+} menu_layout;
+
+//
+// The state of an in-progress menu construction
+//
+// Construction is done a slice at a time from an idle source, so the Windows
+// message queue continues to be serviced, and the new menu is only swapped in
+// once it is complete.
+//
+typedef struct
+{
+  // the menu being constructed
+  xdgmenu menu;
+  // the submenus being constructed, innermost last
+  GArray *stack;
+  guint source;
+
+  // time budget for a slice, in microseconds (0 for unlimited)
+  gint64 budget;
+  gint64 started;
+  int slices;
+  gint64 worst_slice;
+
+  // icons taken from the shared cache, and icons decoded
+  int shared_hits;
+  int decoded;
+  // icons known to be missing, and icons found to be missing
+  int missing_hits;
+  int missing;
+
+  // the most items in a menu before it's laid out using layout
+  guint max_items;
+  menu_layout layout;
+
+  // with libgnome-menu, the directories the entries came from
+  GHashTable *dirs;
+} xdgbuild;
+
+static xdgbuild build;
+
+// the shared icon cache, if there is one
+static iconcache *shared;
+
+// icons which couldn't be found or loaded, as "icon size", in theme_generation
+static GHashTable *missing_icons;
+static guint missing_generation;
+// incremented whenever the icon theme changes
+static guint theme_generation;
+
+// the bitmap used for items without a useable icon, one per size, shared by
+// all those items
+typedef struct
+{
+  int size;
+  HBITMAP hBitmap;
+} fallback_bitmap;
+static GArray *fallbacks;
+
+static metrics_counter *rebuilds;
+static metrics_histogram *rebuild_duration;
+static metrics_histogram *menu_shown;
+static metrics_histogram *click_queued;
+
+// when showing the menu was requested, if it hasn't been shown yet
+static gint64 show_requested;
+
+// how often to log the latency of showing the menu
+#define LATENCY_SUMMARY_INTERVAL 20
+
+static gpointer
+build_iter_get(GMenuTreeIter *iter, GMenuTreeItemType type)
+{
+  switch (type)
+    {
+    case GMENU_TREE_ITEM_ENTRY:
+      return gmenu_tree_iter_get_entry(iter);
+    case GMENU_TREE_ITEM_DIRECTORY:
+      return gmenu_tree_iter_get_directory(iter);
+    case GMENU_TREE_ITEM_ALIAS:
+      // ???
+      return gmenu_tree_iter_get_alias(iter);
+    default:
+      return NULL;
+    }
+}
+
+// the number of menu items directory will have
+static guint
+build_count(GMenuTreeDirectory *directory)
+{
+  GMenuTreeIter *iter = gmenu_tree_directory_iter(directory);
+  GMenuTreeItemType type;
+  guint count = 0;
+
+  while ((type = gmenu_tree_iter_next(iter)) != GMENU_TREE_ITEM_INVALID)
+    {
+      if ((type == GMENU_TREE_ITEM_ENTRY) || (type == GMENU_TREE_ITEM_DIRECTORY) ||
+          (type == GMENU_TREE_ITEM_SEPARATOR))
+        count++;
+    }
+  gmenu_tree_iter_unref(iter);
+
+  return count;
+}
+
+//
+// Split the items of directory into alphabetical ranges, each of which will
+// be a submenu
+//
+// Separators don't mean much when the items are split up like this, so
+// they're dropped.
+//
+static void
+build_buckets(build_frame *frame, GMenuTreeDirectory *directory)
+{
+  GMenuTreeIter *iter = gmenu_tree_directory_iter(directory);
+  GMenuTreeItemType type;
+  GPtrArray *names = g_ptr_array_new();
+
+  frame->items = g_array_new(FALSE, FALSE, sizeof(build_item));
+  while ((type = gmenu_tree_iter_next(iter)) != GMENU_TREE_ITEM_INVALID)
+    {
+      build_item bi = { type, NULL };
+
+      if (type == GMENU_TREE_ITEM_ENTRY)
+        {
+          bi.item = gmenu_tree_iter_get_entry(iter);
+          GDesktopAppInfo *appinfo = gmenu_tree_entry_get_app_info(bi.item);
+          g_ptr_array_add(names, (gpointer)g_app_info_get_display_name(G_APP_INFO(appinfo)));
+        }
+      else if (type == GMENU_TREE_ITEM_DIRECTORY)
+        {
+          bi.item = gmenu_tree_iter_get_directory(iter);
+          g_ptr_array_add(names, (gpointer)gmenu_tree_directory_get_name(bi.item));
+        }
+      else
+        continue;
+
+      g_array_append_val(frame->items, bi);
+    }
+  gmenu_tree_iter_unref(iter);
+
+  frame->buckets = menulayout_buckets((const char *const *)names->pdata, names->len,
+                                      build.max_items);
+  g_ptr_array_free(names, TRUE);
+}
+
+// start constructing the submenu hMenu, from directory
+static void
+build_push(HMENU hMenu, GMenuTreeDirectory *directory)
+{
+  build_frame frame = { hMenu, NULL, 0, NULL, 0, NULL, 0, NULL, 0, NULL };
+
+  if (trace_enabled)
+    {
+      frame.started = g_get_monotonic_time();
+      frame.name = g_strdup(gmenu_tree_directory_get_name(directory));
+    }
+
+  guint count = 0;
+  if (build.layout != LAYOUT_NONE)
+    count = build_count(directory);
+
+  if (count > build.max_items)
+    {
+      g_print("Submenu '%s' has %d items, more than %d\n",
+              gmenu_tree_directory_get_name(directory), count, build.max_items);
+
+      if (build.layout == LAYOUT_COLUMNS)
+        frame.columns = build.max_items;
+      else
+        build_buckets(&frame, directory);
+    }
+
+  if (!frame.items)
+    frame.iter = gmenu_tree_directory_iter(directory);
+
+  g_array_append_val(build.stack, frame);
+}
+
+// finish (or abandon) constructing the innermost submenu
+static void
+build_pop(void)
+{
+  build_frame *frame = &g_array_index(build.stack, build_frame, build.stack->len - 1);
+
+  if (frame->iter)
+    gmenu_tree_iter_unref(frame->iter);
+
+  if (frame->items)
+    {
+      // items not yet added, if abandoned
+      guint i;
+      for (i = frame->next; i < frame->items->len; i++)
+        gmenu_tree_item_unref(g_array_index(frame->items, build_item, i).item);
+      g_array_free(frame->items, TRUE);
+    }
+  menulayout_buckets_free(frame->buckets);
+
+  trace_complete("directory", frame->name, frame->started);
+  g_free(frame->name);
+
+  g_array_set_size(build.stack, build.stack->len - 1);
+}
+
 // '&' in menu text indicates a keyboard accelerator, so escape them with another '&'
 static const char *
 escape_ampersand(const char *text)
@@ -143,112 +409,234 @@ resource_to_bitmap(int id, int size)
   return hBitmap;
 }
 
+// find the file for a GIcon
+static char *
+gicon_to_filename(iconresolver *theme, GIcon *icon, int size)
+{
+  char *filename = NULL;
+
+  if (G_IS_FILE_ICON(icon))
+    {
+      filename = g_file_get_path(g_file_icon_get_file(G_FILE_ICON(icon)));
+    }
+  else if (G_IS_THEMED_ICON(icon))
+    {
+      const gchar * const *names = g_themed_icon_get_names(G_THEMED_ICON(icon));
+      int i;
+      for (i = 0; names[i] && !filename; i++)
+        filename = iconresolver_lookup(theme, names[i], size, 1);
+    }
+
+  return filename;
+}
+
+// make a bitmap from size*size premultiplied BGRA pixels
+static HBITMAP
+pixels_to_bitmap(const guint8 *bgra, int size)
+{
+  // It seems that InsertMenuItem only uses the alpha channel of the bitmap if
+  // it is a BI_RGB DIB, so we can't use BI_BITFIELDS
+  BITMAPV4HEADER bmiV4Header;
+  bmiV4Header.bV4Size = sizeof(BITMAPV4HEADER);
+  bmiV4Header.bV4Width = size;
+  bmiV4Header.bV4Height = -size; // top-down bitmap
+  bmiV4Header.bV4Planes = 1;
+  bmiV4Header.bV4BitCount = 32;
+  bmiV4Header.bV4V4Compression = BI_RGB;
+  bmiV4Header.bV4SizeImage = 0;
+  bmiV4Header.bV4XPelsPerMeter = 0;
+  bmiV4Header.bV4YPelsPerMeter = 0;
+  bmiV4Header.bV4ClrUsed = 0;
+  bmiV4Header.bV4ClrImportant = 0;
+  bmiV4Header.bV4AlphaMask = 0xff000000;
+  bmiV4Header.bV4CSType = 0;
+
+  HDC hDC = GetDC(NULL);
+
+  void *pBits;
+  HBITMAP hBitmap = CreateDIBSection(hDC, (BITMAPINFO *)&bmiV4Header,
+                                     DIB_RGB_COLORS, &pBits, NULL, 0);
+  if (hBitmap)
+    memcpy(pBits, bgra, size * size * 4);
+
+  ReleaseDC(NULL, hDC);
+
+  return hBitmap;
+}
+
+// the X icon, for items without a useable icon
+static HBITMAP
+fallback_to_bitmap(int size)
+{
+  guint i;
+
+  if (!fallbacks)
+    fallbacks = g_array_new(FALSE, FALSE, sizeof(fallback_bitmap));
+
+  for (i = 0; i < fallbacks->len; i++)
+    {
+      fallback_bitmap *f = &g_array_index(fallbacks, fallback_bitmap, i);
+      if (f->size == size)
+        return f->hBitmap;
+    }
+
+  fallback_bitmap f = { size, resource_to_bitmap(IDI_XWIN, size) };
+  g_array_append_val(fallbacks, f);
+
+  return f.hBitmap;
+}
+
+// delete a menu item bitmap, unless it's shared
+static void
+menu_bitmap_free(HBITMAP hBitmap)
+{
+  guint i;
+
+  if (!hBitmap)
+    return;
+
+  for (i = 0; fallbacks && (i < fallbacks->len); i++)
+    {
+      if (g_array_index(fallbacks, fallback_bitmap, i).hBitmap == hBitmap)
+        return;
+    }
+
+  DeleteObject(hBitmap);
+}
+
+// the key for icon at size in missing_icons, forgetting everything in it if
+// the theme has changed since it was filled in
+static char *
+missing_icon_key(GIcon *icon, int size)
+{
+  if (!missing_icons)
+    missing_icons = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+  if (missing_generation != theme_generation)
+    {
+      g_hash_table_remove_all(missing_icons);
+      missing_generation = theme_generation;
+    }
+
+  char *name = g_icon_to_string(icon);
+  char *key = g_strdup_printf("%s %d", name ? name : "", size);
+  g_free(name);
+
+  return key;
+}
+
 static HBITMAP
-gicon_to_bitmap(GtkIconTheme *theme, GIcon *icon, int size)
+gicon_to_bitmap(iconresolver *theme, GIcon *icon, int size)
 {
-  GtkIconInfo *iconInfo = NULL;
+  char *filename = NULL;
+  char *key = NULL;
   HBITMAP hBitmap = NULL;
 
   if (icon)
-    iconInfo = gtk_icon_theme_lookup_by_gicon(theme, icon, size, GTK_ICON_LOOKUP_FORCE_SIZE);
-  // It seems that InsertMenuItem only uses the alpha channel of the bitmap if
-  // it is a BI_RGB DIB, so we can't use BI_BITFIELDS
-  if (iconInfo)
     {
-      GdkPixbuf *pixbuf = gtk_icon_info_load_icon(iconInfo, NULL);
-      if (pixbuf)
+      // don't look again for an icon we've already failed to find
+      key = missing_icon_key(icon, size);
+      if (g_hash_table_contains(missing_icons, key))
         {
-          BITMAPV4HEADER bmiV4Header;
-          bmiV4Header.bV4Size = sizeof(BITMAPV4HEADER);
-          bmiV4Header.bV4Width = gdk_pixbuf_get_width(pixbuf);
-          bmiV4Header.bV4Height = -gdk_pixbuf_get_height(pixbuf); // top-down bitmap
-          bmiV4Header.bV4Planes = 1;
-          bmiV4Header.bV4BitCount = gdk_pixbuf_get_bits_per_sample(pixbuf) * gdk_pixbuf_get_n_channels(pixbuf);
-          bmiV4Header.bV4V4Compression = BI_RGB;
-          bmiV4Header.bV4SizeImage = 0;
-          bmiV4Header.bV4XPelsPerMeter = 0;
-          bmiV4Header.bV4YPelsPerMeter = 0;
-          bmiV4Header.bV4ClrUsed = 0;
-          bmiV4Header.bV4ClrImportant = 0;
-          bmiV4Header.bV4AlphaMask = gdk_pixbuf_get_has_alpha(pixbuf) ? 0xff000000 : 0;
-          bmiV4Header.bV4CSType = 0;
-
-          HDC hDC = GetDC(NULL);
-
-          void *pBits;
-          hBitmap = CreateDIBSection(hDC, (BITMAPINFO *)&bmiV4Header,
-                                    DIB_RGB_COLORS, &pBits, NULL, 0);
-          if (hBitmap)
+          build.missing_hits++;
+          g_free(key);
+          return fallback_to_bitmap(size);
+        }
+
+      TRACE_BEGIN("icon lookup", NULL);
+      filename = gicon_to_filename(theme, icon, size);
+      TRACE_END("icon lookup");
+    }
+
+  if (filename)
+    {
+      // use the pixels from the shared cache, if they are there
+      const guint8 *bgra = iconcache_lookup(shared, filename, size);
+      if (bgra)
+        {
+          hBitmap = pixels_to_bitmap(bgra, size);
+          build.shared_hits++;
+        }
+      else
+        {
+          TRACE_BEGIN("icon decode", filename);
+          GdkPixbuf *pixbuf = gdk_pixbuf_new_from_file_at_scale(filename, size, size, FALSE, NULL);
+          if (pixbuf)
             {
-              // copy in the pixbuf data
-              memcpy(pBits, gdk_pixbuf_get_pixels(pixbuf),
-                     gdk_pixbuf_get_byte_length(pixbuf));
-
-              if (gdk_pixbuf_get_has_alpha(pixbuf))
-                {
-                  // convert from RGBA to BGRA
-                  // convert to premultiplied alpha
-                  DWORD *pargb = pBits;
-                  ULONG y, x;
-                  for (y = -bmiV4Header.bV4Height; y; --y)
-                    {
-                      for (x = bmiV4Header.bV4Width; x; --x)
-                        {
-                          DWORD p = *pargb;
-                          BYTE b = p & 0xFF;
-                          BYTE g = (p >> 8) & 0xff;
-                          BYTE r = (p >> 16) & 0xff;
-                          BYTE a = p >> 24;
-                          *pargb = (a << 24) | RGB(r * a / 255,
-                                                   g * a / 255,
-                                                   b * a / 255);
-
-                          pargb++;
-                        }
-                    }
-                }
-              else
-                {
-                  BYTE *pRGB = pBits;
-                  ULONG y, x;
-                  for (y = -bmiV4Header.bV4Height; y; --y)
-                    {
-                      for (x = bmiV4Header.bV4Width; x; --x)
-                        {
-                          // convert from RGB to BGR
-                          BYTE b = pRGB[2];
-                          pRGB[2] = pRGB[0];
-                          pRGB[0] = b;
-
-                          pRGB = pRGB + 3;
-                        }
-                    }
-                }
+              guint8 *pixels = g_malloc(size * size * 4);
+              iconcache_convert_pixels(gdk_pixbuf_get_pixels(pixbuf),
+                                       gdk_pixbuf_get_width(pixbuf),
+                                       gdk_pixbuf_get_height(pixbuf),
+                                       gdk_pixbuf_get_rowstride(pixbuf),
+                                       gdk_pixbuf_get_has_alpha(pixbuf),
+                                       pixels);
+              hBitmap = pixels_to_bitmap(pixels, size);
+              build.decoded++;
+
+              g_free(pixels);
+              g_object_unref(pixbuf);
             }
-
-          ReleaseDC(NULL, hDC);
-          g_object_unref(pixbuf);
+          TRACE_END("icon decode");
         }
 
-      gtk_icon_info_free(iconInfo);
+      g_free(filename);
     }
 
   // if no useable icon was found, use the X icon
   if (!hBitmap)
     {
-      hBitmap = resource_to_bitmap(IDI_XWIN, size);
+      if (key)
+        {
+          g_hash_table_add(missing_icons, key);
+          key = NULL;
+          build.missing++;
+        }
+      hBitmap = fallback_to_bitmap(size);
     }
 
+  g_free(key);
+
   return hBitmap;
 }
 
 static void
-store_id_info(xdgmenu *menu, GDesktopAppInfo *pAppInfo, HBITMAP hBitmap)
+store_id_info(xdgmenu *menu, GDesktopAppInfo *pAppInfo, const char *desktop_id,
+              HBITMAP hBitmap)
 {
-  // Store GDesktopAppInfo and HBITMAP to be later accessed via ID
+  // Store what's needed to launch the entry, and the HBITMAP, to be later
+  // accessed via ID.  Items which aren't entries get an empty record.
+  if (!menu->entries)
+    menu->entries = entrytable_new();
+
+  if (pAppInfo)
+    {
+      GAppInfo *appinfo = G_APP_INFO(pAppInfo);
+      GIcon *icon = g_app_info_get_icon(appinfo);
+      char *icon_name = icon ? g_icon_to_string(icon) : NULL;
+      guint32 flags = 0;
+
+      if (g_desktop_app_info_get_boolean(pAppInfo, "Terminal"))
+        flags |= ENTRY_TERMINAL;
+      if (g_desktop_app_info_get_boolean(pAppInfo, "DBusActivatable"))
+        flags |= ENTRY_DBUS_ACTIVATABLE;
+
+      // the GDesktopAppInfo may not know its id, as it was made from a file
+      entrytable_add(menu->entries,
+                     desktop_id,
+                     g_desktop_app_info_get_filename(pAppInfo),
+                     g_app_info_get_display_name(appinfo),
+                     g_app_info_get_commandline(appinfo),
+                     icon_name,
+                     g_desktop_app_info_get_categories(pAppInfo),
+                     flags);
+      g_free(icon_name);
+    }
+  else
+    {
+      entrytable_add(menu->entries, NULL, NULL, NULL, NULL, NULL, NULL, 0);
+    }
+
   menu->count++;
-  menu->appinfo = realloc(menu->appinfo, sizeof(GDesktopAppInfo *) * menu->count);
-  menu->appinfo[menu->count-1] = pAppInfo;
   menu->bitmaps = realloc(menu->bitmaps, sizeof(HBITMAP) * menu->count);
   menu->bitmaps[menu->count-1] = hBitmap;
 }
@@ -265,7 +653,10 @@ menu_item_entry(xdgmenu *menu, HMENU hMenu, GMenuTreeEntry *entry)
 
   GIcon *pIcon = g_app_info_get_icon(G_APP_INFO(pAppInfo));
   HBITMAP hBitmap = gicon_to_bitmap(menu->theme, pIcon, size);
-  store_id_info(menu, pAppInfo, hBitmap);
+  store_id_info(menu, pAppInfo, gmenu_tree_entry_get_desktop_file_id(entry), hBitmap);
+
+  if (build.dirs)
+    g_hash_table_add(build.dirs, g_path_get_dirname(gmenu_tree_entry_get_desktop_file_path(entry)));
 
   //
   const gchar *cName = g_app_info_get_display_name(G_APP_INFO(pAppInfo));
@@ -275,12 +666,11 @@ menu_item_entry(xdgmenu *menu, HMENU hMenu, GMenuTreeEntry *entry)
   // Insert menu item
   MENUITEMINFOW mii;
   mii.cbSize = sizeof(MENUITEMINFO);
-  mii.fMask = MIIM_DATA | MIIM_STRING | MIIM_ID | MIIM_BITMAP;
+  mii.fMask = MIIM_STRING | MIIM_ID | MIIM_BITMAP;
   mii.fType = MFT_STRING;
   mii.dwTypeData = (wchar_t *)wtext;
   mii.fState = MFS_ENABLED;
   mii.wID = menu->count + ID_EXEC_BASE;
-  mii.dwItemData = (uintptr_t)pAppInfo;
   mii.hbmpItem = hBitmap;
 
   InsertMenuItemW(hMenu, -1, TRUE, &mii);
@@ -289,87 +679,179 @@ menu_item_entry(xdgmenu *menu, HMENU hMenu, GMenuTreeEntry *entry)
   free((char *)text);
 }
 
-static HMENU
-menu_from_directory(xdgmenu *menu, GMenuTreeDirectory *directory)
+static void
+menu_item_directory(xdgmenu *menu, HMENU hMenu, GMenuTreeDirectory *directory)
 {
-  HMENU hMenu;
-  GMenuTreeIter *iter;
-
-  hMenu = CreatePopupMenu();
-  if (!hMenu)
+  HMENU hSubMenu = CreatePopupMenu();
+  if (!hSubMenu)
     {
       g_print("Unable to CreatePopupMenu()\n");
-      return NULL;
+      return;
     }
 
-  iter = gmenu_tree_directory_iter(directory);
+  GIcon *icon = gmenu_tree_directory_get_icon(directory);
+  HBITMAP hBitmap = gicon_to_bitmap(menu->theme, icon, menu->size);
+  store_id_info(menu, NULL, NULL, hBitmap);
 
-  while (1)
+  if (build.dirs)
     {
-      gpointer item = NULL;
+      const char *path = gmenu_tree_directory_get_desktop_file_path(directory);
+      if (path)
+        g_hash_table_add(build.dirs, g_path_get_dirname(path));
+    }
+
+  const char *text = gmenu_tree_directory_get_name(directory);
+  text = escape_ampersand(text);
+  const wchar_t *wtext = utf8_to_wchar(text);
 
-      switch (gmenu_tree_iter_next (iter))
+  // Insert menu item
+  MENUITEMINFOW mii;
+  mii.cbSize = sizeof(MENUITEMINFO);
+  mii.fMask = MIIM_SUBMENU | MIIM_STRING | MIIM_ID | MIIM_BITMAP;
+  mii.fType = MFT_STRING;
+  mii.dwTypeData = (wchar_t *)wtext;
+  mii.fState = MFS_ENABLED;
+  mii.wID = menu->count + ID_EXEC_BASE;
+  mii.hSubMenu = hSubMenu;
+  mii.hbmpItem = hBitmap;
+
+  InsertMenuItemW(hMenu, -1, TRUE, &mii);
+
+  free((wchar_t *)wtext);
+  free((char *)text);
+
+  // the submenu is filled in by subsequent steps, or when it's about to be
+  // shown
+  if (menu->deferred)
+    {
+      g_hash_table_insert(menu->deferred, hSubMenu, gmenu_tree_item_ref(directory));
+    }
+  else
+    {
+      build_push(hSubMenu, directory);
+    }
+}
+
+// add a submenu for an alphabetical range of items
+static HMENU
+menu_item_bucket(HMENU hMenu, const char *label)
+{
+  HMENU hSubMenu = CreatePopupMenu();
+  const char *text = escape_ampersand(label);
+  const wchar_t *wtext = utf8_to_wchar(text);
+
+  MENUITEMINFOW mii;
+  mii.cbSize = sizeof(MENUITEMINFO);
+  mii.fMask = MIIM_SUBMENU | MIIM_STRING;
+  mii.fType = MFT_STRING;
+  mii.dwTypeData = (wchar_t *)wtext;
+  mii.fState = MFS_ENABLED;
+  mii.hSubMenu = hSubMenu;
+
+  InsertMenuItemW(hMenu, -1, TRUE, &mii);
+
+  free((wchar_t *)wtext);
+  free((char *)text);
+
+  return hSubMenu;
+}
+
+// start a new column at menu item position
+static void
+menu_column_break(HMENU hMenu, int position)
+{
+  MENUITEMINFO mii;
+  mii.cbSize = sizeof(MENUITEMINFO);
+  mii.fMask = MIIM_FTYPE;
+
+  if (GetMenuItemInfo(hMenu, position, TRUE, &mii))
+    {
+      mii.fType |= MFT_MENUBARBREAK;
+      SetMenuItemInfo(hMenu, position, TRUE, &mii);
+    }
+}
+
+//
+// Process the next item of the innermost directory being constructed.
+// Returns FALSE when there are no more items in it.
+//
+static gboolean
+menu_build_step(xdgmenu *m)
+{
+  build_frame *frame = &g_array_index(build.stack, build_frame, build.stack->len - 1);
+  // frame may be invalidated by pushing a new one
+  HMENU hMenu = frame->hMenu;
+  guint columns = frame->columns;
+  GMenuTreeItemType type;
+  gpointer item = NULL;
+
+  if (frame->items)
+    {
+      if (frame->next >= frame->items->len)
+        return FALSE;
+
+      // the item goes in the submenu for the range it's in
+      if (frame->buckets)
         {
-        case GMENU_TREE_ITEM_INVALID:
-          goto done;
-
-        case GMENU_TREE_ITEM_ENTRY:
-          item = gmenu_tree_iter_get_entry(iter);
-          menu_item_entry(menu, hMenu, (GMenuTreeEntry *)item);
-          break;
-
-        case GMENU_TREE_ITEM_DIRECTORY:
-          item = gmenu_tree_iter_get_directory(iter);
-          HMENU hSubMenu = menu_from_directory(menu, (GMenuTreeDirectory *)item);
-          GIcon *icon = gmenu_tree_directory_get_icon((GMenuTreeDirectory *)item);
-          HBITMAP hBitmap = gicon_to_bitmap(menu->theme, icon, menu->size);
-          store_id_info(menu, NULL, hBitmap);
-          const char *text = gmenu_tree_directory_get_name((GMenuTreeDirectory *)item);
-          text = escape_ampersand(text);
-          const wchar_t *wtext = utf8_to_wchar(text);
-
-          if (hSubMenu) {
-            // Insert menu item
-            MENUITEMINFOW mii;
-            mii.cbSize = sizeof(MENUITEMINFO);
-            mii.fMask = MIIM_SUBMENU | MIIM_STRING | MIIM_ID | MIIM_BITMAP;
-            mii.fType = MFT_STRING;
-            mii.dwTypeData = (wchar_t *)wtext;
-            mii.fState = MFS_ENABLED;
-            mii.wID = menu->count + ID_EXEC_BASE;
-            mii.hSubMenu = hSubMenu;
-            mii.hbmpItem = hBitmap;
-
-            InsertMenuItemW(hMenu, -1, TRUE, &mii);
-          }
-          free((wchar_t *)wtext);
-          free((char *)text);
-          break;
-
-        case GMENU_TREE_ITEM_HEADER:
-          break;
-
-        case GMENU_TREE_ITEM_SEPARATOR:
-          InsertMenu(hMenu, -1, MF_BYPOSITION | MF_SEPARATOR, 0, NULL);
-          break;
-
-        case GMENU_TREE_ITEM_ALIAS:
-          // ???
-          item = gmenu_tree_iter_get_alias(iter);
-          break;
-
-        default:
-          g_assert_not_reached();
-          break;
+          menu_bucket *b = &g_array_index(frame->buckets, menu_bucket, frame->bucket);
+          if (frame->next == b->end)
+            {
+              frame->bucket++;
+              b++;
+            }
+          if (frame->next == b->start)
+            frame->hBucketMenu = menu_item_bucket(frame->hMenu, b->label);
+          hMenu = frame->hBucketMenu;
         }
-      gmenu_tree_item_unref(item);
-      continue;
-    done:
+
+      build_item *bi = &g_array_index(frame->items, build_item, frame->next);
+      type = bi->type;
+      item = bi->item;
+      frame->next++;
+    }
+  else
+    {
+      type = gmenu_tree_iter_next(frame->iter);
+      if (type == GMENU_TREE_ITEM_INVALID)
+        return FALSE;
+
+      item = build_iter_get(frame->iter, type);
+    }
+
+  int position = columns ? GetMenuItemCount(hMenu) : 0;
+
+  switch (type)
+    {
+    case GMENU_TREE_ITEM_ENTRY:
+      menu_item_entry(m, hMenu, (GMenuTreeEntry *)item);
+      break;
+
+    case GMENU_TREE_ITEM_DIRECTORY:
+      menu_item_directory(m, hMenu, (GMenuTreeDirectory *)item);
+      break;
+
+    case GMENU_TREE_ITEM_HEADER:
+      break;
+
+    case GMENU_TREE_ITEM_SEPARATOR:
+      InsertMenu(hMenu, -1, MF_BYPOSITION | MF_SEPARATOR, 0, NULL);
+      break;
+
+    case GMENU_TREE_ITEM_ALIAS:
+      break;
+
+    default:
+      g_assert_not_reached();
       break;
     }
+  if (item)
+    gmenu_tree_item_unref(item);
 
-  gmenu_tree_iter_unref(iter);
-  return hMenu;
+  if (columns && (position > 0) && (position % columns == 0) &&
+      (GetMenuItemCount(hMenu) > position))
+    menu_column_break(hMenu, position);
+
+  return TRUE;
 }
 
 static int
@@ -378,12 +860,24 @@ menu_get_default_size(void)
   return MIN(GetSystemMetrics(SM_CXMENUCHECK), GetSystemMetrics(SM_CYMENUCHECK));
 }
 
+// the bitmap for a settings menu item, which is freed with the menu
+static HBITMAP
+settings_bitmap(xdgmenu *menu, const char *name, int size)
+{
+  GIcon *icon = g_icon_new_for_string(name, NULL);
+  HBITMAP hBitmap = gicon_to_bitmap(menu->theme, icon, size);
+  g_object_unref(icon);
+
+  store_id_info(menu, NULL, NULL, hBitmap);
+
+  return hBitmap;
+}
+
 static HMENU
 size_menu(xdgmenu *menu)
 {
   HMENU hMenu;
   MENUITEMINFO mii;
-  GIcon *icon, *icon_orig;
   HBITMAP hBitmap;
 
   hMenu = CreatePopupMenu();
@@ -394,43 +888,41 @@ size_menu(xdgmenu *menu)
     }
 
   // This applies to all subsequent menu items
-  icon = g_icon_new_for_string("zoom-fit-best", NULL);
-  icon_orig = g_icon_new_for_string("zoom-original", NULL);
   mii.cbSize = sizeof(MENUITEMINFO);
   mii.fMask = MIIM_ID | MIIM_STRING | MIIM_BITMAP;
 
   // Insert size menu items
-  hBitmap = gicon_to_bitmap(menu->theme, icon_orig, menu_get_default_size());
+  hBitmap = settings_bitmap(menu, "zoom-original", menu_get_default_size());
   mii.dwTypeData = (LPTSTR)"&Default";
   mii.wID = ID_SIZE_DEFAULT;
   mii.hbmpItem = hBitmap;
   InsertMenuItem(hMenu, -1, TRUE, &mii);
 
-  hBitmap = gicon_to_bitmap(menu->theme, icon, 16);
+  hBitmap = settings_bitmap(menu, "zoom-fit-best", 16);
   mii.dwTypeData = (LPTSTR)"&16x16";
   mii.wID = ID_SIZE_16;
   mii.hbmpItem = hBitmap;
   InsertMenuItem(hMenu, -1, TRUE, &mii);
 
-  hBitmap = gicon_to_bitmap(menu->theme, icon, 24);
+  hBitmap = settings_bitmap(menu, "zoom-fit-best", 24);
   mii.dwTypeData = (LPTSTR)"&24x24";
   mii.wID = ID_SIZE_24;
   mii.hbmpItem = hBitmap;
   InsertMenuItem(hMenu, -1, TRUE, &mii);
 
-  hBitmap = gicon_to_bitmap(menu->theme, icon, 32);
+  hBitmap = settings_bitmap(menu, "zoom-fit-best", 32);
   mii.dwTypeData = (LPTSTR)"&32x32";
   mii.wID = ID_SIZE_32;
   mii.hbmpItem = hBitmap;
   InsertMenuItem(hMenu, -1, TRUE, &mii);
 
-  hBitmap = gicon_to_bitmap(menu->theme, icon, 48);
+  hBitmap = settings_bitmap(menu, "zoom-fit-best", 48);
   mii.dwTypeData = (LPTSTR)"&48x48";
   mii.wID = ID_SIZE_48;
   mii.hbmpItem = hBitmap;
   InsertMenuItem(hMenu, -1, TRUE, &mii);
 
-  hBitmap = gicon_to_bitmap(menu->theme, icon, 64);
+  hBitmap = settings_bitmap(menu, "zoom-fit-best", 64);
   mii.dwTypeData = (LPTSTR)"&64x64";
   mii.wID = ID_SIZE_64;
   mii.hbmpItem = hBitmap;
@@ -444,7 +936,7 @@ settings_menu(xdgmenu *menu)
 {
   HMENU hMenu;
   MENUITEMINFO mii;
-  GIcon *icon;
+  const char *icon;
   HBITMAP hBitmap;
 
   hMenu = CreatePopupMenu();
@@ -458,8 +950,7 @@ settings_menu(xdgmenu *menu)
   mii.cbSize = sizeof(MENUITEMINFO);
 
   // Insert About menu item
-  icon = g_icon_new_for_string("help-about", NULL);
-  hBitmap = gicon_to_bitmap(menu->theme, icon, menu->size);
+  hBitmap = settings_bitmap(menu, "help-about", menu->size);
   mii.fMask = MIIM_ID | MIIM_STRING | MIIM_BITMAP;
   mii.dwTypeData = (LPTSTR)"&About...";
   mii.wID = ID_APP_ABOUT;
@@ -469,17 +960,25 @@ settings_menu(xdgmenu *menu)
   // Do not add 'View logfile' if stdout is a tty, as it won't work
   if (!isatty(STDOUT_FILENO))
     {
-      icon = g_icon_new_for_string("text-x-generic", NULL);
-      hBitmap = gicon_to_bitmap(menu->theme, icon, menu->size);
+      hBitmap = settings_bitmap(menu, "text-x-generic", menu->size);
       mii.dwTypeData = (LPTSTR)"View &logfile";
       mii.wID = ID_APP_LOGFILE;
       mii.hbmpItem = hBitmap;
       InsertMenuItem(hMenu, -1, TRUE, &mii);
     }
 
+  // Insert running applications submenu, which is filled in when the menu is
+  // shown
+  menu->hRunningMenu = CreatePopupMenu();
+  hBitmap = settings_bitmap(menu, "system-run", menu->size);
+  mii.fMask = MIIM_SUBMENU | MIIM_STRING | MIIM_BITMAP;
+  mii.dwTypeData = (LPTSTR)"&Running applications";
+  mii.hSubMenu = menu->hRunningMenu;
+  mii.hbmpItem = hBitmap;
+  InsertMenuItem(hMenu, -1, TRUE, &mii);
+
   // Insert icon size submenu
-  icon = g_icon_new_for_string("zoom-fit-best", NULL);
-  hBitmap = gicon_to_bitmap(menu->theme, icon, menu->size);
+  hBitmap = settings_bitmap(menu, "zoom-fit-best", menu->size);
   mii.fMask = MIIM_SUBMENU | MIIM_STRING | MIIM_BITMAP;
   mii.dwTypeData = (LPTSTR)"Icon &size";
   mii.hSubMenu = size_menu(menu);
@@ -489,15 +988,15 @@ settings_menu(xdgmenu *menu)
   // If this is being run from a session manager, logout upon exit
   if (in_session)
     {
-      icon = g_icon_new_for_string("system-log-out", NULL);
+      icon = "system-log-out";
       mii.dwTypeData = (LPTSTR)"E&xit session";
     }
    else
     {
-      icon = g_icon_new_for_string("application-exit", NULL);
+      icon = "application-exit";
       mii.dwTypeData = (LPTSTR)"E&xit";
     }
-  hBitmap = gicon_to_bitmap(menu->theme, icon, menu->size);
+  hBitmap = settings_bitmap(menu, icon, menu->size);
   mii.fMask = MIIM_ID | MIIM_STRING | MIIM_BITMAP;
   mii.wID = ID_APP_EXIT;
   mii.hbmpItem = hBitmap;
@@ -507,75 +1006,400 @@ settings_menu(xdgmenu *menu)
 }
 
 static void
-menu_from_tree(void)
-{
-    GError *error = NULL;
-
-    // Build the XDG desktop menu
-    if (!gmenu_tree_load_sync (menu.tree, &error))
-      {
-        g_printerr ("Failed to load tree: %s\n", error->message);
-        menu.hMenu = CreatePopupMenu();
-      }
-    else
-      {
-        GMenuTreeDirectory* root;
-        root = gmenu_tree_get_root_directory(menu.tree);
-
-        if (root == NULL)
-          {
-            g_warning ("The menu tree is empty.");
-          }
-        else
-          {
-            menu.hMenu = menu_from_directory(&menu, root);
-          }
-
-        gmenu_tree_item_unref (root);
-      }
-
-    // Add menu items specific to this application
-    InsertMenu(menu.hMenu, -1, MF_BYPOSITION | MF_SEPARATOR, 0, NULL);
-    HMENU hSettingsMenu = settings_menu(&menu);
-
-    // Add settings submenu, with the application icon
-    MENUITEMINFO mii;
-    mii.cbSize = sizeof(MENUITEMINFO);
-    mii.fMask = MIIM_SUBMENU | MIIM_STRING | MIIM_BITMAP;
-    mii.fType = MFT_STRING;
-    mii.dwTypeData = (LPTSTR)"XDG Menu";
-    mii.fState = MFS_ENABLED;
-    mii.wID = -1;
-    mii.hSubMenu = hSettingsMenu;
-    mii.hbmpItem = resource_to_bitmap(IDI_TRAY, menu.size);
-    InsertMenuItem(menu.hMenu, -1, TRUE, &mii);
-    store_id_info(&menu, NULL, mii.hbmpItem);
-
-    // Show a check-mark next to current icon size
-    CheckMenuItem(hSettingsMenu, menu.size_id, MF_BYCOMMAND | MF_CHECKED);
-
-    hMenuTray = menu.hMenu;
+menu_free(xdgmenu *m)
+{
+  int i;
+  for (i = 0; i < m->count; i++)
+    {
+      menu_bitmap_free(m->bitmaps[i]);
+    }
+  m->count = 0;
+
+  entrytable_free(m->entries);
+  m->entries = NULL;
+
+  free(m->bitmaps);
+  m->bitmaps = NULL;
+
+  DestroyMenu(m->hMenu);
+  m->hMenu = NULL;
+  m->hRunningMenu = NULL;
+
+  if (m->deferred)
+    g_hash_table_remove_all(m->deferred);
+
+  if (m == &menu)
+    hMenuTray = NULL;
+}
+
+//
+// libgnome-menu only watches what it reads while the GMenuTree is loaded,
+// which we don't keep once the menu is constructed (and isn't reliable on
+// remote filesystems anyway), so we watch the directories its entries and
+// directory files came from, the applications directories, and the menu
+// file's directory
+//
+
+static void menu_build_start(void);
+
+static void
+menu_changed(GMenuTree *tree)
+{
+  g_print("Re-reading menu tree\n");
+  menu_build_start();
+}
+
+static void
+menu_watch_changed(gpointer data)
+{
+  g_print("Re-reading menu\n");
+  menu_build_start();
 }
 
 static void
-menu_free(void)
+menu_watch_gmenu(void)
 {
+  const gchar * const *data_dirs = g_get_system_data_dirs();
+  GPtrArray *paths = g_ptr_array_new();
+  GHashTableIter iter;
+  gpointer key;
   int i;
-  for (i = 0; i < menu.count; i++)
+
+  const char *path = gmenu_tree_get_canonical_menu_path(menu.tree);
+  if (path)
+    g_hash_table_add(build.dirs, g_path_get_dirname(path));
+
+  // where new entries and directory files would appear
+  g_hash_table_add(build.dirs, g_build_filename(g_get_user_data_dir(), "applications", NULL));
+  g_hash_table_add(build.dirs, g_build_filename(g_get_user_data_dir(), "desktop-directories", NULL));
+  for (i = 0; data_dirs[i]; i++)
     {
-      DeleteObject(menu.bitmaps[i]);
+      g_hash_table_add(build.dirs, g_build_filename(data_dirs[i], "applications", NULL));
+      g_hash_table_add(build.dirs, g_build_filename(data_dirs[i], "desktop-directories", NULL));
     }
-  menu.count = 0;
 
-  free(menu.appinfo);
-  menu.appinfo = NULL;
+  g_hash_table_iter_init(&iter, build.dirs);
+  while (g_hash_table_iter_next(&iter, &key, NULL))
+    g_ptr_array_add(paths, key);
 
-  free(menu.bitmaps);
-  menu.bitmaps = NULL;
+  dirwatch_set_paths(watch, paths);
+  g_ptr_array_free(paths, TRUE);
+  g_hash_table_remove_all(build.dirs);
+}
 
-  DestroyMenu(menu.hMenu);
-  menu.hMenu = NULL;
-  hMenuTray = NULL;
+//
+// Once the menu is constructed, its items are launched from the entry table,
+// so what it was read from is released, except when just popping up the menu
+// once, as submenus are constructed from it when they are about to be shown
+//
+static void
+menu_release_source(void)
+{
+  if (popup || !menu.tree)
+    return;
+
+  gint64 rss = soak_rss();
+
+  g_signal_handlers_disconnect_by_func(menu.tree, menu_changed, NULL);
+  g_object_unref(menu.tree);
+  menu.tree = NULL;
+  build.menu.tree = NULL;
+
+  gint64 now = soak_rss();
+  if ((rss >= 0) && (now >= 0))
+    g_print("Released menu tree, RSS %+" G_GINT64_FORMAT " KiB (%" G_GINT64_FORMAT " KiB total)\n",
+            (now - rss) / 1024, now / 1024);
+}
+
+static gint64
+menu_watch_monitored_gauge(void)
+{
+  return dirwatch_monitored(watch);
+}
+
+static gint64
+menu_watch_polled_gauge(void)
+{
+  return dirwatch_polled(watch);
+}
+
+// abandon any in-progress construction
+static void
+menu_build_cancel(void)
+{
+  if (build.source)
+    {
+      g_source_remove(build.source);
+      build.source = 0;
+    }
+
+  while (build.stack->len)
+    build_pop();
+
+  menu_free(&build.menu);
+}
+
+static void
+menu_build_finish(void)
+{
+  xdgmenu *m = &build.menu;
+
+  // Add menu items specific to this application, except when just popping up
+  // the menu once
+  if (!popup)
+    {
+      InsertMenu(m->hMenu, -1, MF_BYPOSITION | MF_SEPARATOR, 0, NULL);
+      HMENU hSettingsMenu = settings_menu(m);
+
+      // Add settings submenu, with the application icon
+      MENUITEMINFO mii;
+      mii.cbSize = sizeof(MENUITEMINFO);
+      mii.fMask = MIIM_SUBMENU | MIIM_STRING | MIIM_BITMAP;
+      mii.fType = MFT_STRING;
+      mii.dwTypeData = (LPTSTR)"XDG Menu";
+      mii.fState = MFS_ENABLED;
+      mii.wID = -1;
+      mii.hSubMenu = hSettingsMenu;
+      mii.hbmpItem = resource_to_bitmap(IDI_TRAY, m->size);
+      InsertMenuItem(m->hMenu, -1, TRUE, &mii);
+      store_id_info(m, NULL, NULL, mii.hbmpItem);
+
+      // Show a check-mark next to current icon size
+      CheckMenuItem(hSettingsMenu, m->size_id, MF_BYCOMMAND | MF_CHECKED);
+    }
+
+  // Swap in the new menu
+  menu_free(&menu);
+  GHashTable *deferred = menu.deferred;
+  menu.deferred = m->deferred;
+  m->deferred = deferred;
+  menu.hMenu = m->hMenu;
+  menu.count = m->count;
+  menu.entries = m->entries;
+  menu.bitmaps = m->bitmaps;
+  menu.hRunningMenu = m->hRunningMenu;
+  hMenuTray = menu.hMenu;
+
+  m->hMenu = NULL;
+  m->count = 0;
+  m->entries = NULL;
+  m->bitmaps = NULL;
+  m->hRunningMenu = NULL;
+
+  gint64 duration = g_get_monotonic_time() - build.started;
+  metrics_counter_add(rebuilds, 1);
+  metrics_histogram_record(rebuild_duration, duration);
+
+  g_print("Menu constructed in %.1f ms, %d slices, longest slice %.1f ms\n",
+          duration / 1000.0, build.slices, build.worst_slice / 1000.0);
+  if (shared)
+    g_print("%d icons from shared cache, %d icons decoded\n",
+            build.shared_hits, build.decoded);
+  if (build.missing_hits + build.missing)
+    g_print("%d missing icons, %d already known (%.0f%% hit rate)\n",
+            build.missing_hits + build.missing, build.missing_hits,
+            100.0 * build.missing_hits / (build.missing_hits + build.missing));
+
+  if (menu.entries)
+    {
+      entrytable_freeze(menu.entries);
+      gsize size = entrytable_size(menu.entries);
+      guint count = entrytable_count(menu.entries);
+      g_print("Menu items use %" G_GSIZE_FORMAT " bytes, %" G_GSIZE_FORMAT " bytes per item\n",
+              size, size / count);
+    }
+
+  if (build.dirs)
+    menu_watch_gmenu();
+
+  menu_release_source();
+
+  static gboolean ready = FALSE;
+  if (!ready)
+    {
+      startup_mark("menu ready");
+      ready = TRUE;
+    }
+}
+
+static gboolean
+menu_build_slice(gpointer data)
+{
+  gint64 start = g_get_monotonic_time();
+
+  TRACE_BEGIN("menu slice", NULL);
+  while (build.stack->len)
+    {
+      if (!menu_build_step(&build.menu))
+        {
+          // finished this directory
+          build_pop();
+        }
+
+      if (build.budget && (g_get_monotonic_time() - start >= build.budget))
+        break;
+    }
+  TRACE_END("menu slice");
+
+  build.slices++;
+  build.worst_slice = MAX(build.worst_slice, g_get_monotonic_time() - start);
+
+  if (build.stack->len)
+    return G_SOURCE_CONTINUE;
+
+  build.source = 0;
+  menu_build_finish();
+  return G_SOURCE_REMOVE;
+}
+
+//
+// (Re)open the shared icon cache, if it isn't open, or has been regenerated
+// since it was opened
+//
+static void
+menu_shared_cache_open(void)
+{
+  if (shared && !iconcache_is_stale(shared))
+    return;
+
+  iconcache_close(shared);
+
+  shared = NULL;
+
+  // an empty path disables the shared cache
+  gchar *path = g_key_file_get_string(keyfile, "settings", "sharedcache", NULL);
+  if (!path)
+    path = g_strdup(ICONCACHE_DEFAULT_PATH);
+
+  if (*path)
+    shared = iconcache_open(path);
+
+  if (shared)
+    g_print("Using shared icon cache %s: %u icons, %" G_GSIZE_FORMAT " KiB mapped\n",
+            path, iconcache_count(shared), iconcache_mapped_size(shared) / 1024);
+  g_free(path);
+}
+
+//
+// The most items which fit in a menu the height of the screen, or the
+// configured maximum, if that is less
+//
+static guint
+menu_max_items(int size)
+{
+  GError *error = NULL;
+
+  // approximately, as items are at least as tall as the bitmaps
+  int row = MAX(GetSystemMetrics(SM_CYMENU), size + 2);
+  int rows = MAX(GetSystemMetrics(SM_CYFULLSCREEN) / row, 2);
+
+  int limit = g_key_file_get_integer(keyfile, "settings", "menuitems", &error);
+  if (error)
+    {
+      limit = 0;
+      g_clear_error(&error);
+    }
+
+  if ((limit > 1) && (limit < rows))
+    rows = limit;
+
+  return rows;
+}
+
+//
+// Start (re)constructing the menu, abandoning any construction already in
+// progress
+//
+static void
+menu_build_start(void)
+{
+  GError *error = NULL;
+
+  menu_build_cancel();
+
+  if (iconresolver_rescan_if_needed(menu.theme))
+    {
+      g_print("Icon theme has changed\n");
+      theme_generation++;
+    }
+
+  menu_shared_cache_open();
+
+  if (watch)
+    {
+      if (!build.dirs)
+        build.dirs = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+      g_hash_table_remove_all(build.dirs);
+    }
+
+  // create the GMenuTree object, which is released once the menu is
+  // constructed.  It notices changes to what it's read while it's loaded
+  if (!menu.tree)
+    {
+      menu.tree = gmenu_tree_new (MENU_FILE, GMENU_TREE_FLAGS_SORT_DISPLAY_NAME);
+      g_assert (menu.tree != NULL);
+      if (!popup)
+        g_signal_connect(menu.tree, "changed", G_CALLBACK(menu_changed), NULL);
+    }
+
+  // the new menu has the current settings
+  build.menu.tree = menu.tree;
+  build.menu.theme = menu.theme;
+  build.menu.size = menu.size;
+  build.menu.size_id = menu.size_id;
+  build.menu.hMenu = CreatePopupMenu();
+
+  int budget = g_key_file_get_integer(keyfile, "settings", "slicebudget", &error);
+  if (error)
+    {
+      budget = 4;
+      g_clear_error(&error);
+    }
+  build.budget = MAX(budget, 0) * 1000;
+
+  build.max_items = menu_max_items(menu.size);
+  gchar *layout = g_key_file_get_string(keyfile, "settings", "menulayout", NULL);
+  if (layout && (strcmp(layout, "none") == 0))
+    build.layout = LAYOUT_NONE;
+  else if (layout && (strcmp(layout, "columns") == 0))
+    build.layout = LAYOUT_COLUMNS;
+  else
+    build.layout = LAYOUT_BUCKETS;
+  g_free(layout);
+  build.started = g_get_monotonic_time();
+  build.slices = 0;
+  build.worst_slice = 0;
+  build.shared_hits = 0;
+  build.decoded = 0;
+  build.missing_hits = 0;
+  build.missing = 0;
+
+  // Load the XDG desktop menu
+  TRACE_BEGIN("tree load", NULL);
+  gboolean loaded = gmenu_tree_load_sync (menu.tree, &error);
+  TRACE_END("tree load");
+  if (!loaded)
+    {
+      g_printerr ("Failed to load tree: %s\n", error->message);
+      g_error_free(error);
+    }
+  else
+    {
+      GMenuTreeDirectory* root;
+      root = gmenu_tree_get_root_directory(menu.tree);
+
+      if (root == NULL)
+        {
+          g_warning ("The menu tree is empty.");
+        }
+      else
+        {
+          build_push(build.menu.hMenu, root);
+          gmenu_tree_item_unref (root);
+        }
+    }
+
+  build.source = g_idle_add_full(G_PRIORITY_DEFAULT_IDLE, menu_build_slice, NULL, NULL);
 }
 
 static int
@@ -618,45 +1442,322 @@ menu_set_icon_size(int size_id)
     {
       g_key_file_set_integer(keyfile, "settings", "iconsize", size_id);
 
-      menu_free();
       menu.size = size;
       menu.size_id = size_id;
-      menu_from_tree();
+      menu_build_start();
     }
 }
 
-static void
-menu_changed(GMenuTree *tree)
+// is the menu being constructed?
+gboolean
+menu_building(void)
 {
-  g_print("Re-reading menu tree\n");
-  menu_free();
-  menu_from_tree();
+  return build.source != 0;
 }
 
 void
-menu_init(int size_id)
+menu_rebuild(void)
 {
+  g_print("Rebuilding menu\n");
+  menu_build_start();
+}
+
+// the icon theme is the one set in our settings, or otherwise GTK's
+static iconresolver *
+menu_theme_new(void)
+{
+  gchar *name = g_key_file_get_string(keyfile, "settings", "icontheme", NULL);
+  if (!name)
+    g_object_get(gtk_settings_get_default(), "gtk-icon-theme-name", &name, NULL);
+
+  iconresolver *theme = iconresolver_new(name);
+  g_free(name);
+
+  return theme;
+}
+
+static void
+menu_theme_changed(GObject *settings, GParamSpec *pspec, gpointer data)
+{
+  g_print("Icon theme setting has changed\n");
+
+  // any construction in progress is using the old theme
+  menu_build_cancel();
+  iconresolver_free(menu.theme);
+  menu.theme = menu_theme_new();
+  theme_generation++;
+  menu_build_start();
+}
+
+// start constructing the real menu, to replace the placeholder
+static gboolean
+menu_init_idle(gpointer data)
+{
+  menu_build_start();
+
+  return G_SOURCE_REMOVE;
+}
+
+// a menu to show if we are clicked on before the real menu is ready
+static void
+menu_placeholder(void)
+{
+  menu.hMenu = CreatePopupMenu();
+  InsertMenuW(menu.hMenu, -1, MF_BYPOSITION | MF_STRING | MF_GRAYED, 0, L"Loading\u2026");
+  hMenuTray = menu.hMenu;
+}
+
+static gint64
+menu_bitmaps_gauge(void)
+{
+  return menu.count;
+}
+
+static gint64
+menu_entries_gauge(void)
+{
+  return menu.entries ? entrytable_size(menu.entries) : 0;
+}
+
+static void
+menu_init_common(int size_id)
+{
+  rebuilds = metrics_counter_new("rebuilds_total", "Menu constructions completed");
+  rebuild_duration = metrics_histogram_new("rebuild_duration_us", "Menu construction time, in microseconds");
+  menu_shown = metrics_histogram_new("menu_shown_us", "Time from a click on the tray icon (including time queued) to the menu being shown, in microseconds");
+  click_queued = metrics_histogram_new("click_queued_us", "Time a click on the tray icon waited in the message queue, in microseconds");
+  metrics_gauge_new("menu_bitmaps", "Bitmaps for menu items", menu_bitmaps_gauge);
+  metrics_gauge_new("menu_entries_bytes", "Memory used by menu item records and strings", menu_entries_gauge);
+
   menu.hMenu = NULL;
   menu.count = 0;
-  menu.appinfo = NULL;
+  menu.entries = NULL;
   menu.bitmaps = NULL;
+  menu.hRunningMenu = NULL;
+  menu.running = g_array_new(FALSE, FALSE, sizeof(proctable_entry));
+  build.stack = g_array_new(FALSE, FALSE, sizeof(build_frame));
+
+  GError *error = NULL;
+  int limit = g_key_file_get_integer(keyfile, "settings", "latencylimit", &error);
+  if (error)
+    {
+      limit = 250;
+      g_clear_error(&error);
+    }
+  metrics_histogram_set_limit(menu_shown, MAX(limit, 0) * 1000);
 
   menu.size_id = size_id;
   menu.size = menu_size_id_to_size(size_id);
 
-  // create the GMenuTree object
-  menu.tree = gmenu_tree_new ("xwin-applications.menu", GMENU_TREE_FLAGS_SORT_DISPLAY_NAME);
-  g_assert (menu.tree != NULL);
-  g_signal_connect(menu.tree, "changed", G_CALLBACK(menu_changed), NULL);
+  menu.theme = menu_theme_new();
+}
+
+void
+menu_init(int size_id)
+{
+  menu_init_common(size_id);
+
+  // what the menu was read from is watched with up to a budget of monitors,
+  // and polled beyond that
+  GError *error = NULL;
+  int budget = g_key_file_get_integer(keyfile, "settings", "watchbudget", &error);
+  if (error)
+    {
+      budget = 256;
+      g_clear_error(&error);
+    }
+  int interval = g_key_file_get_integer(keyfile, "settings", "pollinterval", &error);
+  if (error)
+    {
+      interval = 2000;
+      g_clear_error(&error);
+    }
+  watch = dirwatch_new(budget, interval, menu_watch_changed, NULL);
+  metrics_gauge_new("watch_monitored", "Menu files and directories watched for changes", menu_watch_monitored_gauge);
+  metrics_gauge_new("watch_polled", "Menu files and directories polled for changes", menu_watch_polled_gauge);
+
+  g_signal_connect(gtk_settings_get_default(), "notify::gtk-icon-theme-name",
+                   G_CALLBACK(menu_theme_changed), NULL);
 
-  menu.theme = gtk_icon_theme_get_default();
-  g_signal_connect(menu.theme, "changed", G_CALLBACK(menu_changed), NULL);
+  menu_placeholder();
+  g_idle_add_full(G_PRIORITY_LOW, menu_init_idle, NULL, NULL);
+}
 
-  menu_from_tree();
+//
+// Initialize for popping up the menu once
+//
+// Only the top level of the menu is constructed now.  Submenus (and so their
+// icons) are constructed when they are about to be shown, by menu_expand().
+// We don't watch for changes.
+//
+void
+menu_popup_init(int size_id)
+{
+  popup = TRUE;
+  menu_init_common(size_id);
+
+  menu.deferred = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+                                        (GDestroyNotify)gmenu_tree_item_unref);
+  build.menu.deferred = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+                                              (GDestroyNotify)gmenu_tree_item_unref);
+
+  // construct the top level now, rather than from the main loop
+  menu_build_start();
+  g_source_remove(build.source);
+  build.source = 0;
+  build.budget = 0;
+  menu_build_slice(NULL);
 }
 
-GDesktopAppInfo *
-menu_get_appinfo(int id)
+// the menu is going to be shown, in response to a click which was queued
+// for the given number of milliseconds
+void
+menu_show_requested(int queued)
 {
-  return menu.appinfo[id-1];
+  metrics_histogram_record(click_queued, queued * 1000);
+  show_requested = g_get_monotonic_time() - queued * 1000;
+}
+
+// how long the menu has taken to be shown
+char *
+menu_shown_summary(void)
+{
+  return metrics_histogram_summary(menu_shown);
+}
+
+//
+// A menu is about to be shown, so construct it if it was deferred
+//
+void
+menu_expand(HMENU hMenu)
+{
+  if (show_requested && (hMenu == menu.hMenu))
+    {
+      metrics_histogram_record(menu_shown, g_get_monotonic_time() - show_requested);
+      show_requested = 0;
+
+      if (metrics_histogram_count(menu_shown) % LATENCY_SUMMARY_INTERVAL == 0)
+        {
+          char *summary = menu_shown_summary();
+          g_print("Click to menu: %s\n", summary);
+          g_free(summary);
+        }
+    }
+
+  static gboolean shown = FALSE;
+  if (popup && !shown && (hMenu == menu.hMenu))
+    {
+      startup_mark("menu shown");
+      shown = TRUE;
+    }
+
+  if (!menu.deferred)
+    return;
+
+  GMenuTreeDirectory *directory = g_hash_table_lookup(menu.deferred, hMenu);
+  if (!directory)
+    return;
+
+  gint64 start = g_get_monotonic_time();
+  int count = menu.count;
+
+  build_push(hMenu, directory);
+  while (menu_build_step(&menu))
+    ;
+  build_pop();
+
+  g_print("Submenu '%s' constructed in %.1f ms, %d items\n",
+          gmenu_tree_directory_get_name(directory),
+          (g_get_monotonic_time() - start) / 1000.0, menu.count - count);
+
+  g_hash_table_remove(menu.deferred, hMenu);
+}
+
+gboolean
+menu_get_entry(int id, menu_entry *entry)
+{
+  if (!menu.entries)
+    return FALSE;
+
+  const entry_record *r = entrytable_get(menu.entries, id - 1);
+  if (!r || !r->id)
+    return FALSE;
+
+  entry->id = entrytable_string(menu.entries, r->id);
+  entry->path = entrytable_string(menu.entries, r->path);
+  entry->name = entrytable_string(menu.entries, r->name);
+  entry->exec = entrytable_string(menu.entries, r->exec);
+  entry->icon = entrytable_string(menu.entries, r->icon);
+  entry->categories = entrytable_string(menu.entries, r->categories);
+  entry->flags = r->flags;
+
+  return TRUE;
+}
+
+//
+// Update the 'Running applications' submenu from the process table
+//
+void
+menu_update_running(void)
+{
+  if (!menu.hRunningMenu)
+    return;
+
+  while (GetMenuItemCount(menu.hRunningMenu) > 0)
+    DeleteMenu(menu.hRunningMenu, 0, MF_BYPOSITION);
+  g_array_set_size(menu.running, 0);
+
+  proctable_sample();
+  GArray *snapshot = proctable_snapshot();
+  gint64 now = g_get_real_time();
+  guint i;
+
+  for (i = 0; (i < snapshot->len) && (i < ID_EXEC_BASE - ID_RUNNING_BASE); i++)
+    {
+      proctable_entry *e = &g_array_index(snapshot, proctable_entry, i);
+      gint64 elapsed = (now - e->started) / G_USEC_PER_SEC;
+      char *text = g_strdup_printf("%s (pid %d, %" G_GINT64_FORMAT ":%02d:%02d, cpu %.1fs, %ld MiB)",
+                                   e->id, e->pid,
+                                   elapsed / 3600, (int)(elapsed / 60 % 60), (int)(elapsed % 60),
+                                   e->cpu / 1e6, e->rss / 1024);
+      const char *escaped = escape_ampersand(text);
+      const wchar_t *wtext = utf8_to_wchar(escaped);
+
+      MENUITEMINFOW mii;
+      mii.cbSize = sizeof(MENUITEMINFOW);
+      mii.fMask = MIIM_STRING | MIIM_ID;
+      mii.dwTypeData = (wchar_t *)wtext;
+      mii.wID = ID_RUNNING_BASE + i;
+      InsertMenuItemW(menu.hRunningMenu, -1, TRUE, &mii);
+      proctable_entry item = *e;
+      item.id = NULL;
+      g_array_append_val(menu.running, item);
+
+      free((wchar_t *)wtext);
+      free((char *)escaped);
+      g_free(text);
+    }
+
+  if (!snapshot->len)
+    InsertMenu(menu.hRunningMenu, -1, MF_BYPOSITION | MF_STRING | MF_GRAYED, 0, "(none)");
+
+  proctable_snapshot_free(snapshot);
+}
+
+//
+// Terminate the application selected from the 'Running applications' submenu
+//
+void
+menu_running_terminate(int id)
+{
+  guint i = id - ID_RUNNING_BASE;
+  if (i < menu.running->len)
+    {
+      proctable_entry *e = &g_array_index(menu.running, proctable_entry, i);
+      // it may have exited since the menu was shown
+      if (proctable_signal(e->pid, e->started, SIGTERM))
+        g_print("Sent SIGTERM to pid %d\n", e->pid);
+      else
+        g_print("pid %d has already exited\n", e->pid);
+    }
 }
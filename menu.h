@@ -32,13 +32,36 @@
 #include <windows.h>
 #undef interface
 #include <gio/gdesktopappinfo.h>
+#include "entrytable.h"
+
+// what's needed to launch a menu item, valid until the menu is next rebuilt
+typedef struct
+{
+  const char *id;
+  const char *path;
+  const char *name;
+  const char *exec;
+  const char *icon;
+  const char *categories;
+  guint32 flags;
+} menu_entry;
 
 void menu_init(int size_id);
+void menu_popup_init(int size_id);
+void menu_expand(HMENU hMenu);
+void menu_show_requested(int queued);
+char *menu_shown_summary(void);
 void menu_set_icon_size(int size_id);
-GDesktopAppInfo *menu_get_appinfo(int id);
+void menu_rebuild(void);
+gboolean menu_building(void);
+gboolean menu_get_entry(int id, menu_entry *entry);
+void menu_update_running(void);
+void menu_running_terminate(int id);
 
 /* from main.c */
 extern gboolean in_session;
 extern GKeyFile *keyfile;
+void startup_mark(const char *what);
+const char *display_name(int index);
 
 #endif /* MENU_H */
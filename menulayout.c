@@ -0,0 +1,188 @@
+/*
+ * menulayout.c
+ *
+ * Copyright (C) Jon Turney 2015
+ *
+ * This file is part of xwin-xdg-menu
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+//
+// Split a long menu into alphabetical ranges
+//
+// Given the names of the items of a menu, in the (sorted) order they appear,
+// choose where to split them into buckets of at most max items each.  Buckets
+// are made about the same size, but a split is moved to where the initial
+// letter changes, if there is one nearby.  Each bucket is labelled with the
+// range of names it holds, like the guide words in a dictionary, using just
+// enough of the first and last names to distinguish them from the
+// neighbouring buckets.
+//
+// This doesn't know anything about Windows menus, see menu.c for that.
+//
+
+#include "menulayout.h"
+#include <string.h>
+
+static gunichar
+initial(const char *name)
+{
+  return g_unichar_tolower(g_utf8_get_char(name));
+}
+
+// the number of characters a and b have in common at the start, ignoring case
+static glong
+common_prefix(const char *a, const char *b)
+{
+  glong n = 0;
+
+  if (!a || !b)
+    return 0;
+
+  while (*a && *b && (g_unichar_tolower(g_utf8_get_char(a)) == g_unichar_tolower(g_utf8_get_char(b))))
+    {
+      a = g_utf8_next_char(a);
+      b = g_utf8_next_char(b);
+      n++;
+    }
+
+  return n;
+}
+
+// the start of name, long enough to distinguish it from other
+static char *
+guide_word(const char *name, const char *other)
+{
+  glong len = common_prefix(name, other) + 1;
+  glong max = g_utf8_strlen(name, -1);
+
+  if (len > max)
+    len = max;
+
+  return g_strndup(name, g_utf8_offset_to_pointer(name, len) - name);
+}
+
+// find the end of the bucket starting at start
+static guint
+bucket_end(const char *const *names, guint count, guint max, guint start, guint left)
+{
+  guint remaining = count - start;
+
+  if (remaining <= max)
+    return count;
+
+  // an even share of the remaining items, but no more than max
+  if (left < 1)
+    left = 1;
+  guint target = start + MIN((remaining + left - 1) / left, max);
+
+  // look outwards from there for a change of initial letter, in a window
+  // which doesn't make the bucket less than half the target size, or more
+  // than max
+  guint lo = start + (target - start + 1) / 2;
+  guint hi = start + max;
+  guint d;
+
+  for (d = 0; (target - d >= lo) || (target + d <= hi); d++)
+    {
+      guint end = target - d;
+      if ((end >= lo) && (end <= hi) &&
+          (initial(names[end - 1]) != initial(names[end])))
+        return end;
+
+      end = target + d;
+      if ((d > 0) && (end >= lo) && (end <= hi) &&
+          (initial(names[end - 1]) != initial(names[end])))
+        return end;
+    }
+
+  return target;
+}
+
+//
+// Returns an array of menu_bucket, or NULL if the items fit in one menu
+//
+GArray *
+menulayout_buckets(const char *const *names, guint count, guint max)
+{
+  if ((max < 2) || (count <= max))
+    return NULL;
+
+  guint nbuckets = (count + max - 1) / max;
+  GArray *buckets = g_array_new(FALSE, FALSE, sizeof(menu_bucket));
+
+  guint start = 0;
+  while (start < count)
+    {
+      menu_bucket b;
+      b.start = start;
+      b.end = bucket_end(names, count, max, start, nbuckets - MIN(buckets->len, nbuckets));
+      b.label = NULL;
+      g_array_append_val(buckets, b);
+      start = b.end;
+    }
+
+  guint i;
+  for (i = 0; i < buckets->len; i++)
+    {
+      menu_bucket *b = &g_array_index(buckets, menu_bucket, i);
+      const char *first = names[b->start];
+      const char *last = names[b->end - 1];
+      const char *prev = (b->start > 0) ? names[b->start - 1] : NULL;
+      const char *next = (b->end < count) ? names[b->end] : NULL;
+
+      char *from = guide_word(first, prev);
+      char *to = guide_word(last, next);
+
+      // the end of the range mustn't come before its start (e.g. the last
+      // bucket, whose last name has nothing after it to distinguish it from)
+      if ((b->end - b->start > 1) && (g_utf8_collate(to, from) < 0))
+        {
+          g_free(to);
+          to = guide_word(last, first);
+        }
+
+      if ((b->end - b->start == 1) || (g_utf8_collate(from, to) == 0))
+        b->label = g_strdup(from);
+      else
+        b->label = g_strdup_printf("%s \u2013 %s", from, to);
+
+      g_free(from);
+      g_free(to);
+    }
+
+  return buckets;
+}
+
+void
+menulayout_buckets_free(GArray *buckets)
+{
+  guint i;
+
+  if (!buckets)
+    return;
+
+  for (i = 0; i < buckets->len; i++)
+    g_free(g_array_index(buckets, menu_bucket, i).label);
+
+  g_array_free(buckets, TRUE);
+}
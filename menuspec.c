@@ -0,0 +1,1758 @@
+/*
+ * menuspec.c
+ *
+ * Copyright (C) Jon Turney 2015
+ *
+ * This file is part of xwin-xdg-menu
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+//
+// An implementation of the XDG desktop menu specification, which could be used
+// instead of libgnome-menu
+//
+// xwin-xdg-menu doesn't use it yet: it's only built into
+// xwin-xdg-menu-menucompare, until that has shown it reads real menu trees as
+// libgnome-menu does.
+//
+// The .menu file is parsed into a tree of its elements, with <MergeFile>,
+// <MergeDir>, <LegacyDir> and the <Default...> elements replaced by what they
+// stand for as they are parsed.  Submenus with the same name are then merged.
+//
+// Rather than testing every desktop entry against the rules of every menu,
+// the categories and filenames the <Include> rules mention are compiled into
+// an index of the menus an entry with that category or filename could belong
+// to, and each entry is only tested against those menus (and any whose rules
+// can match an entry without a particular category, e.g. <All/> or <Not>).
+// With rules like those in xwin-applications.menu, that's one or two menus
+// per entry, so assigning entries to menus takes time about linear in the
+// number of entries.
+//
+// <Move> and <Layout> aren't implemented: submenus come before entries, each
+// sorted by name, which is what libgnome-menu does by default.  As it also
+// does, empty and NoDisplay submenus, and entries which shouldn't be shown,
+// are left out.
+//
+
+#include "menuspec.h"
+#include <string.h>
+
+//
+// The elements of a .menu file
+//
+
+typedef enum
+{
+  NODE_MENU,
+  NODE_NAME,
+  NODE_DIRECTORY,
+  NODE_APP_DIR,
+  NODE_DIRECTORY_DIR,
+  NODE_LEGACY_DIR,
+  NODE_MERGE_FILE,
+  NODE_MERGE_DIR,
+  NODE_ONLY_UNALLOCATED,
+  NODE_NOT_ONLY_UNALLOCATED,
+  NODE_DELETED,
+  NODE_NOT_DELETED,
+  NODE_INCLUDE,
+  NODE_EXCLUDE,
+  NODE_FILENAME,
+  NODE_CATEGORY,
+  NODE_ALL,
+  NODE_AND,
+  NODE_OR,
+  NODE_NOT,
+  // replaced by other elements when parsed
+  NODE_DEFAULT_APP_DIRS,
+  NODE_DEFAULT_DIRECTORY_DIRS,
+  NODE_DEFAULT_MERGE_DIRS,
+  NODE_KDE_LEGACY_DIRS,
+  // not implemented, or not known
+  NODE_IGNORED,
+} node_type;
+
+static const struct
+{
+  const char *element;
+  node_type type;
+} elements[] =
+  {
+    { "Menu", NODE_MENU },
+    { "Name", NODE_NAME },
+    { "Directory", NODE_DIRECTORY },
+    { "AppDir", NODE_APP_DIR },
+    { "DirectoryDir", NODE_DIRECTORY_DIR },
+    { "LegacyDir", NODE_LEGACY_DIR },
+    { "MergeFile", NODE_MERGE_FILE },
+    { "MergeDir", NODE_MERGE_DIR },
+    { "OnlyUnallocated", NODE_ONLY_UNALLOCATED },
+    { "NotOnlyUnallocated", NODE_NOT_ONLY_UNALLOCATED },
+    { "Deleted", NODE_DELETED },
+    { "NotDeleted", NODE_NOT_DELETED },
+    { "Include", NODE_INCLUDE },
+    { "Exclude", NODE_EXCLUDE },
+    { "Filename", NODE_FILENAME },
+    { "Category", NODE_CATEGORY },
+    { "All", NODE_ALL },
+    { "And", NODE_AND },
+    { "Or", NODE_OR },
+    { "Not", NODE_NOT },
+    { "DefaultAppDirs", NODE_DEFAULT_APP_DIRS },
+    { "DefaultDirectoryDirs", NODE_DEFAULT_DIRECTORY_DIRS },
+    { "DefaultMergeDirs", NODE_DEFAULT_MERGE_DIRS },
+    { "KDELegacyDirs", NODE_KDE_LEGACY_DIRS },
+  };
+
+typedef struct _spec_node spec_node;
+struct _spec_node
+{
+  node_type type;
+  // the content, with paths made absolute
+  char *text;
+  // the prefix of a <LegacyDir>, or the type of a <MergeFile>
+  char *attribute;
+  GPtrArray *children;
+};
+
+//
+// A compiled <Include> or <Exclude> rule
+//
+
+typedef enum
+{
+  RULE_ALL,
+  RULE_CATEGORY,
+  RULE_FILENAME,
+  RULE_AND,
+  RULE_OR,
+  RULE_NOT,
+} rule_type;
+
+typedef struct _spec_rule spec_rule;
+struct _spec_rule
+{
+  rule_type type;
+  // the category index, or the desktop id number
+  guint value;
+  // for the rule of an <Exclude> element
+  gboolean exclude;
+  GPtrArray *children;
+};
+
+// the desktop entries available to a menu and its submenus, by desktop id
+// number, and the menus they're available to
+typedef struct
+{
+  GHashTable *entries;
+  guint64 *menus;
+} entry_pool;
+
+struct _menuspec_entry
+{
+  char *id;
+  guint number;
+  GDesktopAppInfo *appinfo;
+  // from a <LegacyDir>, so in the Legacy category
+  gboolean legacy;
+  // the categories which are mentioned in rules, as a bitset
+  guint64 *categories;
+  char *sort_key;
+};
+
+struct _menuspec_directory
+{
+  char *name;
+  char *display_name;
+  GIcon *icon;
+  gboolean nodisplay;
+  // the items, submenus first
+  GPtrArray *subdirectories;
+  GPtrArray *entries;
+
+  // while loading
+  menuspec_directory *parent;
+  guint index;
+  gboolean only_unallocated;
+  GPtrArray *directory_dirs;
+  GPtrArray *rules;
+  entry_pool *pool;
+};
+
+struct _menuspec
+{
+  char *name;
+  gboolean loaded;
+  menuspec_directory *root;
+  // all the menus, in the order they were compiled, which own them
+  GPtrArray *menus;
+
+  // files and directories the menu was read from
+  GPtrArray *sources;
+  GHashTable *source_set;
+  // .menu files already merged
+  GHashTable *merged;
+  // the name of the default merge directories
+  char *merged_dir;
+
+  // all the desktop entries, which own them, and those in each <AppDir> or
+  // <LegacyDir>
+  GPtrArray *entries;
+  GHashTable *app_dirs;
+  GPtrArray *pools;
+
+  // desktop id -> number + 1, and category -> index + 1
+  GHashTable *ids;
+  GHashTable *categories;
+};
+
+#define BITSET_WORDS(bits) (((bits) + 63) / 64)
+
+static void
+bitset_set(guint64 *set, guint bit)
+{
+  set[bit / 64] |= G_GUINT64_CONSTANT(1) << (bit % 64);
+}
+
+static gboolean
+bitset_test(const guint64 *set, guint bit)
+{
+  return (set[bit / 64] >> (bit % 64)) & 1;
+}
+
+static spec_node *
+node_new(node_type type, char *text, const char *attribute)
+{
+  spec_node *node = g_new0(spec_node, 1);
+  node->type = type;
+  node->text = text;
+  node->attribute = g_strdup(attribute);
+  node->children = g_ptr_array_new();
+
+  return node;
+}
+
+static void
+node_free(spec_node *node)
+{
+  guint i;
+
+  if (!node)
+    return;
+
+  for (i = 0; i < node->children->len; i++)
+    node_free(g_ptr_array_index(node->children, i));
+  g_ptr_array_free(node->children, TRUE);
+
+  g_free(node->text);
+  g_free(node->attribute);
+  g_free(node);
+}
+
+// the name of a <Menu>, which is the last <Name> in it
+static const char *
+node_name(spec_node *menu)
+{
+  const char *name = NULL;
+  guint i;
+
+  for (i = 0; i < menu->children->len; i++)
+    {
+      spec_node *child = g_ptr_array_index(menu->children, i);
+      if (child->type == NODE_NAME)
+        name = child->text;
+    }
+
+  return name;
+}
+
+// move the children of node to the end of the children of parent, and free it
+static void
+node_splice(spec_node *parent, spec_node *node)
+{
+  guint i;
+
+  for (i = 0; i < node->children->len; i++)
+    g_ptr_array_add(parent->children, g_ptr_array_index(node->children, i));
+  g_ptr_array_set_size(node->children, 0);
+
+  node_free(node);
+}
+
+// note a file or directory which the menu depends on
+static void
+spec_source(menuspec *spec, const char *path)
+{
+  if (g_hash_table_contains(spec->source_set, path))
+    return;
+
+  char *copy = g_strdup(path);
+  g_hash_table_add(spec->source_set, copy);
+  g_ptr_array_add(spec->sources, copy);
+}
+
+static guint
+spec_id(menuspec *spec, const char *id)
+{
+  gpointer value = g_hash_table_lookup(spec->ids, id);
+  if (value)
+    return GPOINTER_TO_UINT(value) - 1;
+
+  guint number = g_hash_table_size(spec->ids);
+  g_hash_table_insert(spec->ids, g_strdup(id), GUINT_TO_POINTER(number + 1));
+
+  return number;
+}
+
+static guint
+spec_category(menuspec *spec, const char *category)
+{
+  gpointer value = g_hash_table_lookup(spec->categories, category);
+  if (value)
+    return GPOINTER_TO_UINT(value) - 1;
+
+  guint index = g_hash_table_size(spec->categories);
+  g_hash_table_insert(spec->categories, g_strdup(category), GUINT_TO_POINTER(index + 1));
+
+  return index;
+}
+
+//
+// Parsing, and merging
+//
+
+typedef struct
+{
+  menuspec *spec;
+  const char *filename;
+  char *dirname;
+  // the elements being parsed, innermost last
+  GPtrArray *stack;
+  spec_node *root;
+  GString *text;
+} parse_state;
+
+static spec_node *spec_parse(menuspec *spec, const char *filename, GError **error);
+
+static gboolean
+node_has_text(node_type type)
+{
+  switch (type)
+    {
+    case NODE_NAME:
+    case NODE_DIRECTORY:
+    case NODE_FILENAME:
+    case NODE_CATEGORY:
+      return TRUE;
+    default:
+      return FALSE;
+    }
+}
+
+static gboolean
+node_has_path(node_type type)
+{
+  switch (type)
+    {
+    case NODE_APP_DIR:
+    case NODE_DIRECTORY_DIR:
+    case NODE_LEGACY_DIR:
+    case NODE_MERGE_FILE:
+    case NODE_MERGE_DIR:
+      return TRUE;
+    default:
+      return FALSE;
+    }
+}
+
+static gint
+compare_names(gconstpointer a, gconstpointer b)
+{
+  return strcmp(*(const char **)a, *(const char **)b);
+}
+
+// the sorted names of the entries of directory path
+static GPtrArray *
+dir_list(const char *path)
+{
+  GPtrArray *names = g_ptr_array_new_with_free_func(g_free);
+  GDir *dir = g_dir_open(path, 0, NULL);
+
+  if (dir)
+    {
+      const char *name;
+      while ((name = g_dir_read_name(dir)))
+        g_ptr_array_add(names, g_strdup(name));
+      g_dir_close(dir);
+    }
+
+  g_ptr_array_sort(names, compare_names);
+
+  return names;
+}
+
+// the XDG config or data directories, most important first
+static GPtrArray *
+xdg_dirs(gboolean config)
+{
+  const gchar *const *system = config ? g_get_system_config_dirs() : g_get_system_data_dirs();
+  GPtrArray *dirs = g_ptr_array_new();
+  guint i;
+
+  g_ptr_array_add(dirs, (gpointer)(config ? g_get_user_config_dir() : g_get_user_data_dir()));
+  for (i = 0; system[i]; i++)
+    g_ptr_array_add(dirs, (gpointer)system[i]);
+
+  return dirs;
+}
+
+//
+// Add what a <LegacyDir> stands for to menu, apart from making its entries
+// available: its entries are included, and each subdirectory becomes a
+// submenu named after it, which includes the entries in it, and uses its
+// .directory file
+//
+static void
+spec_legacy_menu(spec_node *menu, const char *path, const char *prefix)
+{
+  GPtrArray *names = dir_list(path);
+  spec_node *include = node_new(NODE_INCLUDE, NULL, NULL);
+  guint i;
+
+  for (i = 0; i < names->len; i++)
+    {
+      const char *name = g_ptr_array_index(names, i);
+      char *child = g_build_filename(path, name, NULL);
+
+      if (g_str_has_suffix(name, ".desktop"))
+        {
+          g_ptr_array_add(include->children,
+                          node_new(NODE_FILENAME, g_strconcat(prefix ? prefix : "", name, NULL), NULL));
+        }
+      else if (g_file_test(child, G_FILE_TEST_IS_DIR))
+        {
+          spec_node *submenu = node_new(NODE_MENU, NULL, NULL);
+          g_ptr_array_add(submenu->children, node_new(NODE_NAME, g_strdup(name), NULL));
+          g_ptr_array_add(submenu->children, node_new(NODE_DIRECTORY_DIR, g_strdup(child), NULL));
+          g_ptr_array_add(submenu->children, node_new(NODE_DIRECTORY, g_strdup(".directory"), NULL));
+          spec_legacy_menu(submenu, child, prefix);
+          g_ptr_array_add(menu->children, submenu);
+        }
+
+      g_free(child);
+    }
+
+  if (include->children->len)
+    g_ptr_array_add(menu->children, include);
+  else
+    node_free(include);
+
+  g_ptr_array_free(names, TRUE);
+}
+
+// merge the .menu file filename into parent, in place of the element which
+// named it
+static void
+spec_merge_file(parse_state *state, spec_node *parent, const char *filename)
+{
+  menuspec *spec = state->spec;
+  GError *error = NULL;
+  guint i;
+
+  spec_source(spec, filename);
+
+  // each file is only merged once, which also stops loops
+  if (g_hash_table_contains(spec->merged, filename) ||
+      !g_file_test(filename, G_FILE_TEST_IS_REGULAR))
+    return;
+  g_hash_table_add(spec->merged, g_strdup(filename));
+
+  spec_node *root = spec_parse(spec, filename, &error);
+  if (!root)
+    {
+      g_print("Not merging %s\n", error->message);
+      g_error_free(error);
+      return;
+    }
+
+  // the root <Menu> is replaced by what it contains, apart from its name
+  for (i = 0; i < root->children->len; )
+    {
+      spec_node *child = g_ptr_array_index(root->children, i);
+      if (child->type == NODE_NAME)
+        {
+          g_ptr_array_remove_index(root->children, i);
+          node_free(child);
+        }
+      else
+        i++;
+    }
+
+  node_splice(parent, root);
+}
+
+static void
+spec_merge_dir(parse_state *state, spec_node *parent, const char *path)
+{
+  GPtrArray *names = dir_list(path);
+  guint i;
+
+  spec_source(state->spec, path);
+
+  for (i = 0; i < names->len; i++)
+    {
+      const char *name = g_ptr_array_index(names, i);
+      if (g_str_has_suffix(name, ".menu"))
+        {
+          char *filename = g_build_filename(path, name, NULL);
+          spec_merge_file(state, parent, filename);
+          g_free(filename);
+        }
+    }
+
+  g_ptr_array_free(names, TRUE);
+}
+
+// the file at the same path as filename relative to an XDG config directory,
+// in the next less important one which has it
+static char *
+spec_parent_file(const char *filename)
+{
+  GPtrArray *dirs = xdg_dirs(TRUE);
+  const char *relative = NULL;
+  char *parent = NULL;
+  guint i;
+
+  for (i = 0; (i < dirs->len) && !parent; i++)
+    {
+      const char *dir = g_ptr_array_index(dirs, i);
+
+      if (relative)
+        {
+          parent = g_build_filename(dir, relative, NULL);
+          if (!g_file_test(parent, G_FILE_TEST_IS_REGULAR))
+            {
+              g_free(parent);
+              parent = NULL;
+            }
+        }
+      else if (g_str_has_prefix(filename, dir) && (filename[strlen(dir)] == G_DIR_SEPARATOR))
+        {
+          relative = filename + strlen(dir) + 1;
+        }
+    }
+
+  g_ptr_array_free(dirs, TRUE);
+
+  return parent;
+}
+
+static void spec_add(parse_state *state, spec_node *parent, spec_node *node);
+
+// add an element for the subdirectory subdir of each XDG data directory,
+// least important first, as later ones take priority
+static void
+spec_default_dirs(parse_state *state, spec_node *parent, node_type type,
+                  const char *subdir, const char *prefix)
+{
+  GPtrArray *dirs = xdg_dirs(FALSE);
+  int i;
+
+  for (i = dirs->len - 1; i >= 0; i--)
+    spec_add(state, parent,
+             node_new(type, g_build_filename(g_ptr_array_index(dirs, i), subdir, NULL), prefix));
+
+  g_ptr_array_free(dirs, TRUE);
+}
+
+static void
+spec_default_merge_dirs(parse_state *state, spec_node *parent)
+{
+  GPtrArray *dirs = xdg_dirs(TRUE);
+  int i;
+
+  for (i = dirs->len - 1; i >= 0; i--)
+    {
+      char *path = g_build_filename(g_ptr_array_index(dirs, i), "menus", state->spec->merged_dir, NULL);
+      spec_merge_dir(state, parent, path);
+      g_free(path);
+    }
+
+  g_ptr_array_free(dirs, TRUE);
+}
+
+// add a complete element to parent, or what it stands for
+static void
+spec_add(parse_state *state, spec_node *parent, spec_node *node)
+{
+  switch (node->type)
+    {
+    case NODE_DEFAULT_APP_DIRS:
+      spec_default_dirs(state, parent, NODE_APP_DIR, "applications", NULL);
+      break;
+
+    case NODE_DEFAULT_DIRECTORY_DIRS:
+      spec_default_dirs(state, parent, NODE_DIRECTORY_DIR, "desktop-directories", NULL);
+      break;
+
+    case NODE_KDE_LEGACY_DIRS:
+      spec_default_dirs(state, parent, NODE_LEGACY_DIR, "applnk", "kde-");
+      break;
+
+    case NODE_DEFAULT_MERGE_DIRS:
+      spec_default_merge_dirs(state, parent);
+      break;
+
+    case NODE_MERGE_FILE:
+      if (g_strcmp0(node->attribute, "parent") == 0)
+        {
+          char *filename = spec_parent_file(state->filename);
+          if (filename)
+            spec_merge_file(state, parent, filename);
+          g_free(filename);
+        }
+      else
+        {
+          spec_merge_file(state, parent, node->text);
+        }
+      break;
+
+    case NODE_MERGE_DIR:
+      spec_merge_dir(state, parent, node->text);
+      break;
+
+    case NODE_LEGACY_DIR:
+      // the element is kept, so its entries are available to the menu
+      g_ptr_array_add(parent->children, node);
+      spec_legacy_menu(parent, node->text, node->attribute);
+      return;
+
+    case NODE_IGNORED:
+      break;
+
+    default:
+      g_ptr_array_add(parent->children, node);
+      return;
+    }
+
+  node_free(node);
+}
+
+static void
+parse_start(GMarkupParseContext *context, const gchar *element_name,
+            const gchar **attribute_names, const gchar **attribute_values,
+            gpointer user_data, GError **error)
+{
+  parse_state *state = user_data;
+  node_type type = NODE_IGNORED;
+  const char *name = NULL;
+  const char *attribute = NULL;
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS(elements); i++)
+    {
+      if (strcmp(element_name, elements[i].element) == 0)
+        {
+          type = elements[i].type;
+          break;
+        }
+    }
+
+  if (state->stack->len)
+    {
+      // everything inside an element which is ignored is also ignored
+      spec_node *parent = g_ptr_array_index(state->stack, state->stack->len - 1);
+      if (parent->type == NODE_IGNORED)
+        type = NODE_IGNORED;
+    }
+  else if (state->root || (type != NODE_MENU))
+    {
+      g_set_error(error, G_MARKUP_ERROR, G_MARKUP_ERROR_INVALID_CONTENT,
+                  "<%s> where <Menu> was expected", element_name);
+      return;
+    }
+
+  if (type == NODE_LEGACY_DIR)
+    name = "prefix";
+  else if (type == NODE_MERGE_FILE)
+    name = "type";
+
+  for (i = 0; name && attribute_names[i]; i++)
+    {
+      if (strcmp(attribute_names[i], name) == 0)
+        attribute = attribute_values[i];
+    }
+
+  g_ptr_array_add(state->stack, node_new(type, NULL, attribute));
+  g_string_truncate(state->text, 0);
+}
+
+static void
+parse_end(GMarkupParseContext *context, const gchar *element_name,
+          gpointer user_data, GError **error)
+{
+  parse_state *state = user_data;
+  spec_node *node = g_ptr_array_index(state->stack, state->stack->len - 1);
+  g_ptr_array_remove_index(state->stack, state->stack->len - 1);
+
+  if (node_has_text(node->type) || node_has_path(node->type))
+    {
+      char *text = g_strstrip(g_strdup(state->text->str));
+
+      // paths are relative to the file they're in
+      if (node_has_path(node->type) && *text)
+        {
+          node->text = g_canonicalize_filename(text, state->dirname);
+          g_free(text);
+        }
+      else
+        {
+          node->text = text;
+        }
+
+      // an empty element means nothing, apart from <MergeFile type="parent"/>
+      if (!*node->text &&
+          !((node->type == NODE_MERGE_FILE) && (g_strcmp0(node->attribute, "parent") == 0)))
+        node->type = NODE_IGNORED;
+    }
+
+  if (state->stack->len)
+    spec_add(state, g_ptr_array_index(state->stack, state->stack->len - 1), node);
+  else
+    state->root = node;
+}
+
+static void
+parse_text(GMarkupParseContext *context, const gchar *text, gsize text_len,
+           gpointer user_data, GError **error)
+{
+  parse_state *state = user_data;
+  g_string_append_len(state->text, text, text_len);
+}
+
+static const GMarkupParser parser =
+  {
+    parse_start,
+    parse_end,
+    parse_text,
+    NULL,
+    NULL,
+  };
+
+// parse a .menu file, returning its root <Menu>
+static spec_node *
+spec_parse(menuspec *spec, const char *filename, GError **error)
+{
+  gchar *contents;
+  gsize length;
+  guint i;
+
+  if (!g_file_get_contents(filename, &contents, &length, error))
+    return NULL;
+
+  parse_state state;
+  state.spec = spec;
+  state.filename = filename;
+  state.dirname = g_path_get_dirname(filename);
+  state.stack = g_ptr_array_new();
+  state.root = NULL;
+  state.text = g_string_new(NULL);
+
+  GMarkupParseContext *context = g_markup_parse_context_new(&parser, 0, &state, NULL);
+  gboolean parsed = g_markup_parse_context_parse(context, contents, length, error) &&
+    g_markup_parse_context_end_parse(context, error);
+  g_markup_parse_context_free(context);
+
+  // elements left incomplete by an error
+  for (i = 0; i < state.stack->len; i++)
+    node_free(g_ptr_array_index(state.stack, i));
+  g_ptr_array_free(state.stack, TRUE);
+
+  if (!parsed)
+    {
+      g_prefix_error(error, "%s: ", filename);
+      node_free(state.root);
+      state.root = NULL;
+    }
+
+  g_string_free(state.text, TRUE);
+  g_free(state.dirname);
+  g_free(contents);
+
+  return state.root;
+}
+
+//
+// Merge submenus with the same name, and drop all but the last of duplicate
+// <AppDir>, <DirectoryDir> and <Directory> elements, as later ones take
+// priority
+//
+static void
+spec_consolidate(spec_node *menu)
+{
+  GPtrArray *children = menu->children;
+  guint i, j;
+
+  for (i = 0; i < children->len; i++)
+    {
+      spec_node *a = g_ptr_array_index(children, i);
+      if (a->type != NODE_MENU)
+        continue;
+
+      for (j = i + 1; j < children->len; )
+        {
+          spec_node *b = g_ptr_array_index(children, j);
+          if ((b->type == NODE_MENU) && (g_strcmp0(node_name(a), node_name(b)) == 0))
+            {
+              g_ptr_array_remove_index(children, j);
+              node_splice(a, b);
+            }
+          else
+            j++;
+        }
+    }
+
+  for (i = 0; i < children->len; )
+    {
+      spec_node *a = g_ptr_array_index(children, i);
+      gboolean superseded = FALSE;
+
+      if ((a->type == NODE_APP_DIR) || (a->type == NODE_DIRECTORY_DIR) ||
+          (a->type == NODE_DIRECTORY))
+        {
+          for (j = i + 1; (j < children->len) && !superseded; j++)
+            {
+              spec_node *b = g_ptr_array_index(children, j);
+              superseded = (b->type == a->type) && (strcmp(b->text, a->text) == 0);
+            }
+        }
+
+      if (superseded)
+        {
+          g_ptr_array_remove_index(children, i);
+          node_free(a);
+        }
+      else
+        i++;
+    }
+
+  for (i = 0; i < children->len; i++)
+    {
+      spec_node *child = g_ptr_array_index(children, i);
+      if (child->type == NODE_MENU)
+        spec_consolidate(child);
+    }
+}
+
+//
+// Rules
+//
+
+static void
+rule_free(spec_rule *rule)
+{
+  g_ptr_array_free(rule->children, TRUE);
+  g_free(rule);
+}
+
+static spec_rule *
+rule_new(rule_type type, guint value)
+{
+  spec_rule *rule = g_new0(spec_rule, 1);
+  rule->type = type;
+  rule->value = value;
+  rule->children = g_ptr_array_new_with_free_func((GDestroyNotify)rule_free);
+
+  return rule;
+}
+
+// compile an <Include> or <Exclude> element, or an element inside one
+static spec_rule *
+rule_compile(menuspec *spec, spec_node *node)
+{
+  spec_rule *rule;
+  guint i;
+
+  switch (node->type)
+    {
+    case NODE_CATEGORY:
+      return rule_new(RULE_CATEGORY, spec_category(spec, node->text));
+
+    case NODE_FILENAME:
+      return rule_new(RULE_FILENAME, spec_id(spec, node->text));
+
+    case NODE_ALL:
+      return rule_new(RULE_ALL, 0);
+
+    case NODE_AND:
+      rule = rule_new(RULE_AND, 0);
+      break;
+
+    case NODE_NOT:
+      // matches if none of its children do
+      rule = rule_new(RULE_NOT, 0);
+      break;
+
+    case NODE_OR:
+    case NODE_INCLUDE:
+    case NODE_EXCLUDE:
+      rule = rule_new(RULE_OR, 0);
+      rule->exclude = (node->type == NODE_EXCLUDE);
+      break;
+
+    default:
+      return NULL;
+    }
+
+  for (i = 0; i < node->children->len; i++)
+    {
+      spec_rule *child = rule_compile(spec, g_ptr_array_index(node->children, i));
+      if (child)
+        g_ptr_array_add(rule->children, child);
+    }
+
+  return rule;
+}
+
+static gboolean
+rule_match(spec_rule *rule, menuspec_entry *entry)
+{
+  guint i;
+
+  switch (rule->type)
+    {
+    case RULE_ALL:
+      return TRUE;
+
+    case RULE_CATEGORY:
+      return bitset_test(entry->categories, rule->value);
+
+    case RULE_FILENAME:
+      return rule->value == entry->number;
+
+    case RULE_AND:
+      for (i = 0; i < rule->children->len; i++)
+        {
+          if (!rule_match(g_ptr_array_index(rule->children, i), entry))
+            return FALSE;
+        }
+      return rule->children->len > 0;
+
+    case RULE_OR:
+      for (i = 0; i < rule->children->len; i++)
+        {
+          if (rule_match(g_ptr_array_index(rule->children, i), entry))
+            return TRUE;
+        }
+      return FALSE;
+
+    case RULE_NOT:
+      for (i = 0; i < rule->children->len; i++)
+        {
+          if (rule_match(g_ptr_array_index(rule->children, i), entry))
+            return FALSE;
+        }
+      return TRUE;
+    }
+
+  return FALSE;
+}
+
+//
+// Add to anchors the category and filename rules, one of which an entry must
+// match for rule to match it.  Returns FALSE if there's no such set of rules,
+// as for <All/> or <Not>.
+//
+static gboolean
+rule_anchors(spec_rule *rule, GPtrArray *anchors)
+{
+  guint i;
+
+  switch (rule->type)
+    {
+    case RULE_CATEGORY:
+    case RULE_FILENAME:
+      g_ptr_array_add(anchors, rule);
+      return TRUE;
+
+    case RULE_OR:
+      for (i = 0; i < rule->children->len; i++)
+        {
+          if (!rule_anchors(g_ptr_array_index(rule->children, i), anchors))
+            return FALSE;
+        }
+      return TRUE;
+
+    case RULE_AND:
+      // an entry must match every child, so any child's anchors will do
+      for (i = 0; i < rule->children->len; i++)
+        {
+          guint len = anchors->len;
+          if (rule_anchors(g_ptr_array_index(rule->children, i), anchors))
+            return TRUE;
+          g_ptr_array_set_size(anchors, len);
+        }
+      // an empty <And> matches nothing
+      return rule->children->len == 0;
+
+    default:
+      return FALSE;
+    }
+}
+
+//
+// Desktop entries
+//
+
+static void
+entry_free(menuspec_entry *entry)
+{
+  g_free(entry->id);
+  g_object_unref(entry->appinfo);
+  g_free(entry->categories);
+  g_free(entry->sort_key);
+  g_free(entry);
+}
+
+static void
+spec_entry_load(menuspec *spec, GPtrArray *entries, const char *path, char *id,
+                gboolean legacy)
+{
+  // this fails for entries which aren't applications, or whose TryExec isn't
+  // installed
+  GDesktopAppInfo *appinfo = g_desktop_app_info_new_from_filename(path);
+  if (!appinfo)
+    {
+      g_free(id);
+      return;
+    }
+
+  menuspec_entry *entry = g_new0(menuspec_entry, 1);
+  entry->id = id;
+  entry->number = spec_id(spec, id);
+  entry->appinfo = appinfo;
+  entry->legacy = legacy;
+
+  g_ptr_array_add(spec->entries, entry);
+  g_ptr_array_add(entries, entry);
+}
+
+static void
+spec_scan(menuspec *spec, GPtrArray *entries, const char *path, const char *prefix,
+          gboolean legacy)
+{
+  GPtrArray *names = dir_list(path);
+  guint i;
+
+  spec_source(spec, path);
+
+  for (i = 0; i < names->len; i++)
+    {
+      const char *name = g_ptr_array_index(names, i);
+      char *child = g_build_filename(path, name, NULL);
+
+      if (g_str_has_suffix(name, ".desktop"))
+        {
+          spec_entry_load(spec, entries, child, g_strconcat(prefix, name, NULL), legacy);
+        }
+      else if (g_file_test(child, G_FILE_TEST_IS_DIR))
+        {
+          // the ids of entries in subdirectories of an <AppDir> start with
+          // the subdirectory name
+          char *subprefix = legacy ? g_strdup(prefix) : g_strconcat(prefix, name, "-", NULL);
+          spec_scan(spec, entries, child, subprefix, legacy);
+          g_free(subprefix);
+        }
+
+      g_free(child);
+    }
+
+  g_ptr_array_free(names, TRUE);
+}
+
+//
+// The entries in an <AppDir>, or in a <LegacyDir>, when prefix is the prefix
+// for their ids.  Each directory is only read once.
+//
+static GPtrArray *
+spec_app_dir(menuspec *spec, const char *path, const char *prefix)
+{
+  char *key = prefix ? g_strdup_printf("%s\n%s", path, prefix) : g_strdup(path);
+  GPtrArray *entries = g_hash_table_lookup(spec->app_dirs, key);
+
+  if (entries)
+    {
+      g_free(key);
+      return entries;
+    }
+
+  entries = g_ptr_array_new();
+  spec_scan(spec, entries, path, prefix ? prefix : "", prefix != NULL);
+  g_hash_table_insert(spec->app_dirs, key, entries);
+
+  return entries;
+}
+
+static void
+pool_free(entry_pool *pool)
+{
+  g_hash_table_destroy(pool->entries);
+  g_free(pool->menus);
+  g_free(pool);
+}
+
+// the entries available to a menu: those available to its parent, and those
+// in its own <AppDir>s and <LegacyDir>s, which take priority
+static entry_pool *
+spec_pool(menuspec *spec, spec_node *menu, entry_pool *inherited)
+{
+  entry_pool *pool = NULL;
+  guint i, j;
+
+  for (i = 0; i < menu->children->len; i++)
+    {
+      spec_node *child = g_ptr_array_index(menu->children, i);
+      const char *prefix = NULL;
+
+      if (child->type == NODE_LEGACY_DIR)
+        prefix = child->attribute ? child->attribute : "";
+      else if (child->type != NODE_APP_DIR)
+        continue;
+
+      if (!pool)
+        {
+          pool = g_new0(entry_pool, 1);
+          pool->entries = g_hash_table_new(NULL, NULL);
+          g_ptr_array_add(spec->pools, pool);
+
+          if (inherited)
+            {
+              GHashTableIter iter;
+              gpointer key, value;
+
+              g_hash_table_iter_init(&iter, inherited->entries);
+              while (g_hash_table_iter_next(&iter, &key, &value))
+                g_hash_table_insert(pool->entries, key, value);
+            }
+        }
+
+      GPtrArray *entries = spec_app_dir(spec, child->text, prefix);
+      for (j = 0; j < entries->len; j++)
+        {
+          menuspec_entry *entry = g_ptr_array_index(entries, j);
+          g_hash_table_insert(pool->entries, GUINT_TO_POINTER(entry->number), entry);
+        }
+    }
+
+  return pool ? pool : inherited;
+}
+
+//
+// Menus
+//
+
+static void
+directory_free(menuspec_directory *directory)
+{
+  g_free(directory->name);
+  g_free(directory->display_name);
+  if (directory->icon)
+    g_object_unref(directory->icon);
+  g_ptr_array_free(directory->subdirectories, TRUE);
+  g_ptr_array_free(directory->entries, TRUE);
+  if (directory->directory_dirs)
+    g_ptr_array_free(directory->directory_dirs, TRUE);
+  if (directory->rules)
+    g_ptr_array_free(directory->rules, TRUE);
+  g_free(directory);
+}
+
+// like libgnome-menu, allow an icon to be a path, or a name with an extension
+static GIcon *
+spec_icon_new(const char *icon)
+{
+  if (g_path_is_absolute(icon))
+    {
+      GFile *file = g_file_new_for_path(icon);
+      GIcon *gicon = g_file_icon_new(file);
+      g_object_unref(file);
+      return gicon;
+    }
+
+  char *name = g_strdup(icon);
+  char *extension = strrchr(name, '.');
+  if (extension && ((strcmp(extension, ".png") == 0) || (strcmp(extension, ".xpm") == 0) ||
+                    (strcmp(extension, ".svg") == 0)))
+    *extension = '\0';
+
+  GIcon *gicon = g_themed_icon_new(name);
+  g_free(name);
+
+  return gicon;
+}
+
+static gboolean
+spec_directory_load(menuspec_directory *directory, const char *path)
+{
+  GKeyFile *file = g_key_file_new();
+  gboolean loaded = g_key_file_load_from_file(file, path, G_KEY_FILE_NONE, NULL);
+
+  if (loaded)
+    {
+      directory->display_name = g_key_file_get_locale_string(file, G_KEY_FILE_DESKTOP_GROUP,
+                                                             G_KEY_FILE_DESKTOP_KEY_NAME,
+                                                             NULL, NULL);
+
+      char *icon = g_key_file_get_string(file, G_KEY_FILE_DESKTOP_GROUP,
+                                         G_KEY_FILE_DESKTOP_KEY_ICON, NULL);
+      if (icon && *icon)
+        directory->icon = spec_icon_new(icon);
+      g_free(icon);
+
+      directory->nodisplay =
+        g_key_file_get_boolean(file, G_KEY_FILE_DESKTOP_GROUP, G_KEY_FILE_DESKTOP_KEY_NO_DISPLAY, NULL) ||
+        g_key_file_get_boolean(file, G_KEY_FILE_DESKTOP_GROUP, G_KEY_FILE_DESKTOP_KEY_HIDDEN, NULL);
+    }
+
+  g_key_file_free(file);
+
+  return loaded;
+}
+
+// use the .directory file named by the last <Directory> of a menu which can be
+// found in its <DirectoryDir>s, or those of its parents, later ones first
+static void
+spec_directory_file(menuspec_directory *directory, spec_node *menu)
+{
+  int i, j;
+
+  for (i = menu->children->len - 1; i >= 0; i--)
+    {
+      spec_node *child = g_ptr_array_index(menu->children, i);
+      menuspec_directory *d;
+
+      if (child->type != NODE_DIRECTORY)
+        continue;
+
+      for (d = directory; d; d = d->parent)
+        {
+          for (j = d->directory_dirs->len - 1; j >= 0; j--)
+            {
+              char *path = g_build_filename(g_ptr_array_index(d->directory_dirs, j), child->text, NULL);
+              gboolean loaded = spec_directory_load(directory, path);
+              g_free(path);
+
+              if (loaded)
+                return;
+            }
+        }
+    }
+}
+
+static menuspec_directory *
+spec_compile(menuspec *spec, spec_node *menu, menuspec_directory *parent)
+{
+  const char *name = node_name(menu);
+  gboolean deleted = FALSE;
+  gboolean only_unallocated = FALSE;
+  guint i;
+
+  // the last of each pair of opposites wins
+  for (i = 0; i < menu->children->len; i++)
+    {
+      spec_node *child = g_ptr_array_index(menu->children, i);
+      if (child->type == NODE_DELETED)
+        deleted = TRUE;
+      else if (child->type == NODE_NOT_DELETED)
+        deleted = FALSE;
+      else if (child->type == NODE_ONLY_UNALLOCATED)
+        only_unallocated = TRUE;
+      else if (child->type == NODE_NOT_ONLY_UNALLOCATED)
+        only_unallocated = FALSE;
+    }
+
+  if (!name || deleted)
+    return NULL;
+
+  menuspec_directory *directory = g_new0(menuspec_directory, 1);
+  directory->name = g_strdup(name);
+  directory->subdirectories = g_ptr_array_new();
+  directory->entries = g_ptr_array_new();
+  directory->parent = parent;
+  directory->index = spec->menus->len;
+  directory->only_unallocated = only_unallocated;
+  directory->directory_dirs = g_ptr_array_new_with_free_func(g_free);
+  directory->rules = g_ptr_array_new_with_free_func((GDestroyNotify)rule_free);
+  directory->pool = spec_pool(spec, menu, parent ? parent->pool : NULL);
+  g_ptr_array_add(spec->menus, directory);
+
+  for (i = 0; i < menu->children->len; i++)
+    {
+      spec_node *child = g_ptr_array_index(menu->children, i);
+      if (child->type == NODE_DIRECTORY_DIR)
+        {
+          spec_source(spec, child->text);
+          g_ptr_array_add(directory->directory_dirs, g_strdup(child->text));
+        }
+      else if ((child->type == NODE_INCLUDE) || (child->type == NODE_EXCLUDE))
+        {
+          g_ptr_array_add(directory->rules, rule_compile(spec, child));
+        }
+    }
+
+  spec_directory_file(directory, menu);
+
+  for (i = 0; i < menu->children->len; i++)
+    {
+      spec_node *child = g_ptr_array_index(menu->children, i);
+      if (child->type == NODE_MENU)
+        {
+          menuspec_directory *subdirectory = spec_compile(spec, child, directory);
+          if (subdirectory)
+            g_ptr_array_add(directory->subdirectories, subdirectory);
+        }
+    }
+
+  return directory;
+}
+
+// after applying the <Include> and <Exclude> rules of a menu in order, is
+// entry included?
+static gboolean
+spec_match(menuspec_directory *directory, menuspec_entry *entry)
+{
+  gboolean included = FALSE;
+  guint i;
+
+  for (i = 0; i < directory->rules->len; i++)
+    {
+      spec_rule *rule = g_ptr_array_index(directory->rules, i);
+      if ((rule->exclude == included) && rule_match(rule, entry))
+        included = !included;
+    }
+
+  return included;
+}
+
+//
+// Assign the entries to the menus whose rules they match
+//
+// Each menu is indexed under the categories and filenames which an entry must
+// have one of to be included by it, or otherwise marked as needing to be
+// checked for every entry.  An entry is then only checked against the menus
+// which its categories and filename lead to.
+//
+static void
+spec_assign(menuspec *spec)
+{
+  guint count = spec->menus->len;
+  guint words = BITSET_WORDS(count);
+  guint ncategories = g_hash_table_size(spec->categories);
+  guint category_words = BITSET_WORDS(ncategories);
+  guint64 *category_menus = g_new0(guint64, ncategories * words);
+  guint64 *unanchored = g_new0(guint64, words);
+  guint64 *candidates = g_new0(guint64, words);
+  guint64 *allocated = g_new0(guint64, BITSET_WORDS(g_hash_table_size(spec->ids)));
+  GHashTable *filename_menus = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+  GPtrArray *anchors = g_ptr_array_new();
+  guint i, j, w, pass;
+
+  for (i = 0; i < spec->pools->len; i++)
+    {
+      entry_pool *pool = g_ptr_array_index(spec->pools, i);
+      pool->menus = g_new0(guint64, words);
+    }
+
+  for (i = 0; i < count; i++)
+    {
+      menuspec_directory *directory = g_ptr_array_index(spec->menus, i);
+      gboolean anchored = TRUE;
+
+      if (!directory->pool)
+        continue;
+      bitset_set(directory->pool->menus, i);
+
+      g_ptr_array_set_size(anchors, 0);
+      for (j = 0; (j < directory->rules->len) && anchored; j++)
+        {
+          spec_rule *rule = g_ptr_array_index(directory->rules, j);
+          if (!rule->exclude)
+            anchored = rule_anchors(rule, anchors);
+        }
+
+      if (!anchored)
+        {
+          bitset_set(unanchored, i);
+          continue;
+        }
+
+      for (j = 0; j < anchors->len; j++)
+        {
+          spec_rule *anchor = g_ptr_array_index(anchors, j);
+          if (anchor->type == RULE_CATEGORY)
+            {
+              bitset_set(category_menus + anchor->value * words, i);
+            }
+          else
+            {
+              guint64 *menus = g_hash_table_lookup(filename_menus, GUINT_TO_POINTER(anchor->value + 1));
+              if (!menus)
+                {
+                  menus = g_new0(guint64, words);
+                  g_hash_table_insert(filename_menus, GUINT_TO_POINTER(anchor->value + 1), menus);
+                }
+              bitset_set(menus, i);
+            }
+        }
+    }
+
+  // the categories of each entry which rules mention
+  gpointer legacy = g_hash_table_lookup(spec->categories, "Legacy");
+  for (i = 0; i < spec->entries->len; i++)
+    {
+      menuspec_entry *entry = g_ptr_array_index(spec->entries, i);
+      const char *categories = g_desktop_app_info_get_categories(entry->appinfo);
+
+      entry->categories = g_new0(guint64, category_words);
+      if (categories)
+        {
+          gchar **list = g_strsplit(categories, ";", -1);
+          for (j = 0; list[j]; j++)
+            {
+              gpointer value = g_hash_table_lookup(spec->categories, list[j]);
+              if (value)
+                bitset_set(entry->categories, GPOINTER_TO_UINT(value) - 1);
+            }
+          g_strfreev(list);
+        }
+
+      if (entry->legacy && legacy)
+        bitset_set(entry->categories, GPOINTER_TO_UINT(legacy) - 1);
+    }
+
+  // menus with <OnlyUnallocated/> get the entries no other menu did, so are
+  // done afterwards
+  for (pass = 0; pass < 2; pass++)
+    {
+      for (i = 0; i < spec->pools->len; i++)
+        {
+          entry_pool *pool = g_ptr_array_index(spec->pools, i);
+          GHashTableIter iter;
+          gpointer value;
+
+          g_hash_table_iter_init(&iter, pool->entries);
+          while (g_hash_table_iter_next(&iter, NULL, &value))
+            {
+              menuspec_entry *entry = value;
+
+              if (pass && bitset_test(allocated, entry->number))
+                continue;
+
+              // the menus which could include it
+              memcpy(candidates, unanchored, words * sizeof(guint64));
+              for (w = 0; w < category_words; w++)
+                {
+                  guint64 bits = entry->categories[w];
+                  while (bits)
+                    {
+                      const guint64 *menus = category_menus + (w * 64 + __builtin_ctzll(bits)) * words;
+                      for (j = 0; j < words; j++)
+                        candidates[j] |= menus[j];
+                      bits &= bits - 1;
+                    }
+                }
+
+              const guint64 *menus = g_hash_table_lookup(filename_menus, GUINT_TO_POINTER(entry->number + 1));
+              for (j = 0; menus && (j < words); j++)
+                candidates[j] |= menus[j];
+
+              for (w = 0; w < words; w++)
+                {
+                  guint64 bits = candidates[w] & pool->menus[w];
+                  while (bits)
+                    {
+                      menuspec_directory *directory = g_ptr_array_index(spec->menus, w * 64 + __builtin_ctzll(bits));
+                      bits &= bits - 1;
+
+                      if ((directory->only_unallocated == (pass == 1)) && spec_match(directory, entry))
+                        {
+                          g_ptr_array_add(directory->entries, entry);
+                          if (!pass)
+                            bitset_set(allocated, entry->number);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+  g_ptr_array_free(anchors, TRUE);
+  g_hash_table_destroy(filename_menus);
+  g_free(allocated);
+  g_free(candidates);
+  g_free(unanchored);
+  g_free(category_menus);
+}
+
+static gint
+compare_entries(gconstpointer a, gconstpointer b)
+{
+  const menuspec_entry *ea = *(menuspec_entry *const *)a;
+  const menuspec_entry *eb = *(menuspec_entry *const *)b;
+
+  return strcmp(ea->sort_key, eb->sort_key);
+}
+
+static gint
+compare_directories(gconstpointer a, gconstpointer b)
+{
+  return g_utf8_collate(menuspec_directory_get_name(*(menuspec_directory *const *)a),
+                        menuspec_directory_get_name(*(menuspec_directory *const *)b));
+}
+
+//
+// Drop the entries of a menu which shouldn't be shown, and the submenus which
+// have nothing to show, and sort the rest.  Returns FALSE if the menu has
+// nothing to show.
+//
+static gboolean
+spec_finish(menuspec_directory *directory)
+{
+  guint i;
+
+  for (i = 0; i < directory->entries->len; )
+    {
+      menuspec_entry *entry = g_ptr_array_index(directory->entries, i);
+      GAppInfo *appinfo = G_APP_INFO(entry->appinfo);
+
+      if (g_desktop_app_info_get_is_hidden(entry->appinfo) || !g_app_info_should_show(appinfo))
+        {
+          g_ptr_array_remove_index_fast(directory->entries, i);
+          continue;
+        }
+
+      if (!entry->sort_key)
+        {
+          const char *name = g_app_info_get_display_name(appinfo);
+          entry->sort_key = g_utf8_collate_key(name ? name : entry->id, -1);
+        }
+      i++;
+    }
+  g_ptr_array_sort(directory->entries, compare_entries);
+
+  for (i = 0; i < directory->subdirectories->len; )
+    {
+      if (spec_finish(g_ptr_array_index(directory->subdirectories, i)))
+        i++;
+      else
+        g_ptr_array_remove_index_fast(directory->subdirectories, i);
+    }
+  g_ptr_array_sort(directory->subdirectories, compare_directories);
+
+  // only needed while loading
+  g_ptr_array_free(directory->directory_dirs, TRUE);
+  directory->directory_dirs = NULL;
+  g_ptr_array_free(directory->rules, TRUE);
+  directory->rules = NULL;
+  directory->pool = NULL;
+
+  return !directory->nodisplay &&
+    (directory->entries->len || directory->subdirectories->len);
+}
+
+// the .menu file name, if it's a path, or otherwise the first in the XDG
+// config directories
+static char *
+spec_find(menuspec *spec)
+{
+  if (g_path_is_absolute(spec->name))
+    {
+      spec_source(spec, spec->name);
+      return g_strdup(spec->name);
+    }
+
+  GPtrArray *dirs = xdg_dirs(TRUE);
+  char *filename = NULL;
+  guint i;
+
+  for (i = 0; (i < dirs->len) && !filename; i++)
+    {
+      filename = g_build_filename(g_ptr_array_index(dirs, i), "menus", spec->name, NULL);
+
+      // a more important one might be created
+      spec_source(spec, filename);
+
+      if (!g_file_test(filename, G_FILE_TEST_IS_REGULAR))
+        {
+          g_free(filename);
+          filename = NULL;
+        }
+    }
+
+  g_ptr_array_free(dirs, TRUE);
+
+  return filename;
+}
+
+//
+// The interface, which is like that of GMenuTree
+//
+
+// name is the name of a .menu file in the XDG config directories, or a path
+menuspec *
+menuspec_new(const char *name)
+{
+  menuspec *spec = g_new0(menuspec, 1);
+  spec->name = g_strdup(name);
+  spec->menus = g_ptr_array_new_with_free_func((GDestroyNotify)directory_free);
+  spec->sources = g_ptr_array_new();
+  spec->source_set = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  spec->merged = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  spec->entries = g_ptr_array_new_with_free_func((GDestroyNotify)entry_free);
+  spec->app_dirs = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                         (GDestroyNotify)g_ptr_array_unref);
+  spec->pools = g_ptr_array_new_with_free_func((GDestroyNotify)pool_free);
+  spec->ids = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  spec->categories = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+  // <DefaultMergeDirs/> are named after the .menu file
+  char *stem = g_path_get_basename(name);
+  if (g_str_has_suffix(stem, ".menu"))
+    stem[strlen(stem) - strlen(".menu")] = '\0';
+  spec->merged_dir = g_strconcat(stem, "-merged", NULL);
+  g_free(stem);
+
+  return spec;
+}
+
+gboolean
+menuspec_load(menuspec *spec, GError **error)
+{
+  if (spec->loaded)
+    return TRUE;
+
+  char *filename = spec_find(spec);
+  if (!filename)
+    {
+      g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_NOENT,
+                  "Menu file %s not found", spec->name);
+      return FALSE;
+    }
+
+  g_hash_table_add(spec->merged, g_strdup(filename));
+  spec_node *root = spec_parse(spec, filename, error);
+  g_free(filename);
+  if (!root)
+    return FALSE;
+
+  spec_consolidate(root);
+  spec->root = spec_compile(spec, root, NULL);
+  node_free(root);
+
+  spec_assign(spec);
+  if (spec->root)
+    spec_finish(spec->root);
+
+  // only the menus are needed now
+  g_ptr_array_set_size(spec->pools, 0);
+  g_hash_table_remove_all(spec->app_dirs);
+
+  spec->loaded = TRUE;
+  return TRUE;
+}
+
+void
+menuspec_free(menuspec *spec)
+{
+  if (!spec)
+    return;
+
+  g_ptr_array_free(spec->menus, TRUE);
+  g_ptr_array_free(spec->pools, TRUE);
+  g_hash_table_destroy(spec->app_dirs);
+  g_ptr_array_free(spec->entries, TRUE);
+  g_ptr_array_free(spec->sources, TRUE);
+  g_hash_table_destroy(spec->source_set);
+  g_hash_table_destroy(spec->merged);
+  g_hash_table_destroy(spec->ids);
+  g_hash_table_destroy(spec->categories);
+  g_free(spec->merged_dir);
+  g_free(spec->name);
+  g_free(spec);
+}
+
+menuspec_directory *
+menuspec_get_root(menuspec *spec)
+{
+  return spec->loaded ? spec->root : NULL;
+}
+
+// the files and directories the menu was read from, or would have been if
+// they existed, which are owned by spec
+GPtrArray *
+menuspec_get_sources(menuspec *spec)
+{
+  return spec->sources;
+}
+
+const char *
+menuspec_directory_get_name(menuspec_directory *directory)
+{
+  return directory->display_name ? directory->display_name : directory->name;
+}
+
+GIcon *
+menuspec_directory_get_icon(menuspec_directory *directory)
+{
+  return directory->icon;
+}
+
+guint
+menuspec_directory_get_n_items(menuspec_directory *directory)
+{
+  return directory->subdirectories->len + directory->entries->len;
+}
+
+menuspec_item_type
+menuspec_directory_get_item(menuspec_directory *directory, guint index, gpointer *item)
+{
+  if (index < directory->subdirectories->len)
+    {
+      *item = g_ptr_array_index(directory->subdirectories, index);
+      return MENUSPEC_ITEM_DIRECTORY;
+    }
+
+  *item = g_ptr_array_index(directory->entries, index - directory->subdirectories->len);
+  return MENUSPEC_ITEM_ENTRY;
+}
+
+const char *
+menuspec_entry_get_desktop_file_id(menuspec_entry *entry)
+{
+  return entry->id;
+}
+
+GDesktopAppInfo *
+menuspec_entry_get_app_info(menuspec_entry *entry)
+{
+  return entry->appinfo;
+}
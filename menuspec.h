@@ -0,0 +1,58 @@
+/*
+ * menuspec.h
+ *
+ * Copyright (C) Jon Turney 2015
+ *
+ * This file is part of xwin-xdg-menu
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef MENUSPEC_H
+#define MENUSPEC_H
+
+#include <gio/gdesktopappinfo.h>
+
+typedef struct _menuspec menuspec;
+typedef struct _menuspec_directory menuspec_directory;
+typedef struct _menuspec_entry menuspec_entry;
+
+typedef enum
+{
+  MENUSPEC_ITEM_DIRECTORY,
+  MENUSPEC_ITEM_ENTRY,
+} menuspec_item_type;
+
+menuspec *menuspec_new(const char *name);
+gboolean menuspec_load(menuspec *spec, GError **error);
+void menuspec_free(menuspec *spec);
+menuspec_directory *menuspec_get_root(menuspec *spec);
+GPtrArray *menuspec_get_sources(menuspec *spec);
+
+const char *menuspec_directory_get_name(menuspec_directory *directory);
+GIcon *menuspec_directory_get_icon(menuspec_directory *directory);
+guint menuspec_directory_get_n_items(menuspec_directory *directory);
+menuspec_item_type menuspec_directory_get_item(menuspec_directory *directory, guint index, gpointer *item);
+
+const char *menuspec_entry_get_desktop_file_id(menuspec_entry *entry);
+GDesktopAppInfo *menuspec_entry_get_app_info(menuspec_entry *entry);
+
+#endif /* MENUSPEC_H */
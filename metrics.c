@@ -0,0 +1,375 @@
+/*
+ * metrics.c
+ *
+ * Copyright (C) Jon Turney 2015
+ *
+ * This file is part of xwin-xdg-menu
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+//
+// Counters, gauges and latency histograms, exposed in a simple text format on
+// a Unix socket
+//
+// Counters and histograms may be updated from any thread, using atomic
+// operations.  Gauges are sampled when the metrics are exposed, from the main
+// thread.
+//
+// Histograms are log-linear (like HdrHistogram): values below
+// METRICS_SUB_BUCKETS have a bucket each, and each power of 2 above that is
+// split into METRICS_SUB_BUCKETS buckets, so a quantile is accurate to within
+// 1/METRICS_SUB_BUCKETS of its value.  Values are in microseconds.
+//
+// Nothing here is specific to Windows or the menu.
+//
+
+#include "metrics.h"
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <glib-unix.h>
+
+typedef enum { METRIC_COUNTER, METRIC_HISTOGRAM, METRIC_GAUGE } metric_type;
+
+typedef struct
+{
+  metric_type type;
+  const char *name;
+  const char *help;
+  gpointer data;
+} metric;
+
+// the registered metrics, in registration order
+static GArray *metrics;
+
+static int server_fd = -1;
+static guint server_source;
+static char *server_path;
+
+static void
+metrics_register(metric_type type, const char *name, const char *help, gpointer data)
+{
+  if (!metrics)
+    metrics = g_array_new(FALSE, FALSE, sizeof(metric));
+
+  metric m = { type, name, help, data };
+  g_array_append_val(metrics, m);
+}
+
+metrics_counter *
+metrics_counter_new(const char *name, const char *help)
+{
+  metrics_counter *c = g_new0(metrics_counter, 1);
+  c->name = name;
+  c->help = help;
+  metrics_register(METRIC_COUNTER, name, help, c);
+  return c;
+}
+
+void
+metrics_counter_add(metrics_counter *c, gint64 n)
+{
+  __atomic_add_fetch(&c->value, n, __ATOMIC_RELAXED);
+}
+
+metrics_histogram *
+metrics_histogram_new(const char *name, const char *help)
+{
+  metrics_histogram *h = g_new0(metrics_histogram, 1);
+  h->name = name;
+  h->help = help;
+  metrics_register(METRIC_HISTOGRAM, name, help, h);
+  return h;
+}
+
+static int
+metrics_bucket(gint64 value)
+{
+  if (value < METRICS_SUB_BUCKETS)
+    return MAX(value, 0);
+
+  if (value >= ((gint64)1 << METRICS_MAX_BITS))
+    return METRICS_BUCKETS - 1;
+
+  int msb = 63 - __builtin_clzll(value);
+  int shift = msb - METRICS_SUB_BITS;
+  int mantissa = value >> shift;
+
+  return (shift + 1) * METRICS_SUB_BUCKETS + (mantissa - METRICS_SUB_BUCKETS);
+}
+
+// the largest value which falls into bucket
+static gint64
+metrics_bucket_high(int bucket)
+{
+  if (bucket < METRICS_SUB_BUCKETS)
+    return bucket;
+
+  int shift = bucket / METRICS_SUB_BUCKETS - 1;
+  gint64 mantissa = bucket % METRICS_SUB_BUCKETS + METRICS_SUB_BUCKETS;
+
+  return ((mantissa + 1) << shift) - 1;
+}
+
+// don't judge the 99th percentile on too few values
+#define METRICS_LIMIT_MIN_COUNT 20
+
+//
+// Warn when the 99th percentile goes above the limit, and again when it comes
+// back below it
+//
+static void
+metrics_histogram_check(metrics_histogram *h)
+{
+  if (metrics_histogram_count(h) < METRICS_LIMIT_MIN_COUNT)
+    return;
+
+  gint64 p99 = metrics_histogram_quantile(h, 0.99);
+  gint over = (p99 > h->limit);
+
+  if (g_atomic_int_compare_and_exchange(&h->over, !over, over))
+    {
+      if (over)
+        g_print("Warning: %s 99th percentile is %.1f ms, above the limit of %.1f ms\n",
+                h->name, p99 / 1000.0, h->limit / 1000.0);
+      else
+        g_print("%s 99th percentile is %.1f ms, back below the limit of %.1f ms\n",
+                h->name, p99 / 1000.0, h->limit / 1000.0);
+    }
+}
+
+void
+metrics_histogram_record(metrics_histogram *h, gint64 value)
+{
+  g_atomic_int_inc(&h->buckets[metrics_bucket(value)]);
+  __atomic_add_fetch(&h->count, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&h->sum, value, __ATOMIC_RELAXED);
+
+  gint64 max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+  while ((value > max) &&
+         !__atomic_compare_exchange_n(&h->max, &max, value, FALSE,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+
+  if (h->limit)
+    metrics_histogram_check(h);
+}
+
+gint64
+metrics_histogram_count(metrics_histogram *h)
+{
+  return __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+}
+
+//
+// The value below which a fraction q of the recorded values fall, to within
+// the precision of the bucket it's in
+//
+gint64
+metrics_histogram_quantile(metrics_histogram *h, double q)
+{
+  gint64 total = 0;
+  int i;
+
+  // count the buckets, rather than using count, which may be updated
+  // separately
+  for (i = 0; i < METRICS_BUCKETS; i++)
+    total += g_atomic_int_get(&h->buckets[i]);
+
+  if (total == 0)
+    return 0;
+
+  gint64 rank = (gint64)(q * total + 0.5);
+  gint64 seen = 0;
+  rank = CLAMP(rank, 1, total);
+
+  for (i = 0; i < METRICS_BUCKETS; i++)
+    {
+      seen += g_atomic_int_get(&h->buckets[i]);
+      if (seen >= rank)
+        return MIN(metrics_bucket_high(i), __atomic_load_n(&h->max, __ATOMIC_RELAXED));
+    }
+
+  return __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+}
+
+void
+metrics_histogram_set_limit(metrics_histogram *h, gint64 limit)
+{
+  h->limit = limit;
+}
+
+// a one line summary, for logging, to be g_free()d by the caller
+char *
+metrics_histogram_summary(metrics_histogram *h)
+{
+  gint64 count = metrics_histogram_count(h);
+
+  if (count == 0)
+    return g_strdup("no samples");
+
+  return g_strdup_printf("p50 %.1f ms, p90 %.1f ms, p99 %.1f ms, max %.1f ms, %" G_GINT64_FORMAT " samples",
+                         metrics_histogram_quantile(h, 0.5) / 1000.0,
+                         metrics_histogram_quantile(h, 0.9) / 1000.0,
+                         metrics_histogram_quantile(h, 0.99) / 1000.0,
+                         __atomic_load_n(&h->max, __ATOMIC_RELAXED) / 1000.0,
+                         count);
+}
+
+void
+metrics_gauge_new(const char *name, const char *help, metrics_gauge_func func)
+{
+  metrics_register(METRIC_GAUGE, name, help, func);
+}
+
+//
+// Write all the metrics in the text exposition format
+//
+void
+metrics_expose(GString *out)
+{
+  static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+  guint i, j;
+
+  for (i = 0; metrics && (i < metrics->len); i++)
+    {
+      metric *m = &g_array_index(metrics, metric, i);
+
+      g_string_append_printf(out, "# HELP xwin_xdg_menu_%s %s\n", m->name, m->help);
+
+      switch (m->type)
+        {
+        case METRIC_COUNTER:
+          {
+            metrics_counter *c = m->data;
+            g_string_append_printf(out, "# TYPE xwin_xdg_menu_%s counter\n", m->name);
+            g_string_append_printf(out, "xwin_xdg_menu_%s %" G_GINT64_FORMAT "\n", m->name,
+                                   __atomic_load_n(&c->value, __ATOMIC_RELAXED));
+          }
+          break;
+
+        case METRIC_GAUGE:
+          {
+            metrics_gauge_func func = m->data;
+            g_string_append_printf(out, "# TYPE xwin_xdg_menu_%s gauge\n", m->name);
+            g_string_append_printf(out, "xwin_xdg_menu_%s %" G_GINT64_FORMAT "\n", m->name, func());
+          }
+          break;
+
+        case METRIC_HISTOGRAM:
+          {
+            metrics_histogram *h = m->data;
+            g_string_append_printf(out, "# TYPE xwin_xdg_menu_%s summary\n", m->name);
+            for (j = 0; j < G_N_ELEMENTS(quantiles); j++)
+              g_string_append_printf(out, "xwin_xdg_menu_%s{quantile=\"%g\"} %" G_GINT64_FORMAT "\n",
+                                     m->name, quantiles[j],
+                                     metrics_histogram_quantile(h, quantiles[j]));
+            g_string_append_printf(out, "xwin_xdg_menu_%s_max %" G_GINT64_FORMAT "\n", m->name,
+                                   __atomic_load_n(&h->max, __ATOMIC_RELAXED));
+            g_string_append_printf(out, "xwin_xdg_menu_%s_sum %" G_GINT64_FORMAT "\n", m->name,
+                                   __atomic_load_n(&h->sum, __ATOMIC_RELAXED));
+            g_string_append_printf(out, "xwin_xdg_menu_%s_count %" G_GINT64_FORMAT "\n", m->name,
+                                   __atomic_load_n(&h->count, __ATOMIC_RELAXED));
+          }
+          break;
+        }
+    }
+}
+
+// write the metrics to each client as it connects
+static gboolean
+metrics_accept(gint fd, GIOCondition condition, gpointer data)
+{
+  int client = accept(fd, NULL, NULL);
+  if (client < 0)
+    return G_SOURCE_CONTINUE;
+
+  GString *out = g_string_new(NULL);
+  metrics_expose(out);
+
+  gsize written = 0;
+  while (written < out->len)
+    {
+      ssize_t n = write(client, out->str + written, out->len - written);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        break;
+      written += n;
+    }
+
+  g_string_free(out, TRUE);
+  close(client);
+
+  return G_SOURCE_CONTINUE;
+}
+
+//
+// Serve the metrics on the Unix socket path.  We're the only instance for
+// this user and display, so anything already there is stale.
+//
+void
+metrics_serve(const char *path)
+{
+  struct sockaddr_un addr;
+
+  if (strlen(path) >= sizeof(addr.sun_path))
+    return;
+
+  unlink(path);
+
+  server_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (server_fd < 0)
+    return;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  if ((bind(server_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) ||
+      (listen(server_fd, 8) != 0))
+    {
+      g_print("Failed to serve metrics on %s: %s\n", path, strerror(errno));
+      close(server_fd);
+      server_fd = -1;
+      return;
+    }
+
+  server_path = g_strdup(path);
+  server_source = g_unix_fd_add(server_fd, G_IO_IN, metrics_accept, NULL);
+  g_print("Serving metrics on %s\n", path);
+}
+
+void
+metrics_shutdown(void)
+{
+  if (server_fd < 0)
+    return;
+
+  g_source_remove(server_source);
+  close(server_fd);
+  unlink(server_path);
+  g_free(server_path);
+  server_fd = -1;
+}
@@ -0,0 +1,80 @@
+/*
+ * metrics.h
+ *
+ * Copyright (C) Jon Turney 2015
+ *
+ * This file is part of xwin-xdg-menu
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <glib.h>
+
+// sub-buckets per power of 2, giving about 3% precision
+#define METRICS_SUB_BITS 5
+#define METRICS_SUB_BUCKETS (1 << METRICS_SUB_BITS)
+// values up to 2^40 us (about 12 days)
+#define METRICS_MAX_BITS 40
+#define METRICS_BUCKETS ((METRICS_MAX_BITS - METRICS_SUB_BITS + 1) * METRICS_SUB_BUCKETS)
+
+typedef struct
+{
+  const char *name;
+  const char *help;
+  gint64 value;
+} metrics_counter;
+
+typedef struct
+{
+  const char *name;
+  const char *help;
+  gint64 count;
+  gint64 sum;
+  gint64 max;
+  gint buckets[METRICS_BUCKETS];
+  // warn when the 99th percentile is above limit (0 for never), and whether
+  // it is
+  gint64 limit;
+  gint over;
+} metrics_histogram;
+
+typedef gint64 (*metrics_gauge_func)(void);
+
+metrics_counter *metrics_counter_new(const char *name, const char *help);
+void metrics_counter_add(metrics_counter *counter, gint64 n);
+
+metrics_histogram *metrics_histogram_new(const char *name, const char *help);
+void metrics_histogram_record(metrics_histogram *histogram, gint64 value);
+gint64 metrics_histogram_count(metrics_histogram *histogram);
+gint64 metrics_histogram_quantile(metrics_histogram *histogram, double q);
+void metrics_histogram_set_limit(metrics_histogram *histogram, gint64 limit);
+char *metrics_histogram_summary(metrics_histogram *histogram);
+
+void metrics_gauge_new(const char *name, const char *help, metrics_gauge_func func);
+
+void metrics_expose(GString *out);
+void metrics_serve(const char *path);
+void metrics_shutdown(void);
+
+#endif /* METRICS_H */
@@ -30,6 +30,8 @@
 #include <windows.h>
 #include "trayicon.h"
 #include "msgwindow.h"
+#include "menu.h"
+#include "execute.h"
 
 #define WINDOW_CLASS "xwin-xdg-menu"
 #define WINDOW_NAME "xwin-xdg-menu"
@@ -50,6 +52,10 @@ msgWindowProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam)
     switch (message) {
     case WM_TRAYICON:
       return handleIconMessage(hwnd, message, wParam, lParam);
+
+    case WM_INITMENUPOPUP:
+      menu_expand((HMENU) wParam);
+      return 0;
     }
 
     return DefWindowProc(hwnd, message, wParam, lParam);
@@ -100,3 +106,43 @@ createMsgWindow(void)
 
     return hwndMsg;
 }
+
+/*
+ * A window has been shown.  If it's a top-level window of another process
+ * (X windows are shown by the X server in multiwindow mode) which would appear
+ * on the taskbar, it may be that of an application we launched
+ */
+static void CALLBACK
+winEventProc(HWINEVENTHOOK hook, DWORD event, HWND hwnd, LONG idObject,
+             LONG idChild, DWORD idThread, DWORD time)
+{
+    LONG exstyle;
+
+    if ((idObject != OBJID_WINDOW) || (idChild != CHILDID_SELF))
+        return;
+
+    if (GetAncestor(hwnd, GA_PARENT) != GetDesktopWindow())
+        return;
+
+    exstyle = GetWindowLong(hwnd, GWL_EXSTYLE);
+    if (exstyle & WS_EX_TOOLWINDOW)
+        return;
+    if (GetWindow(hwnd, GW_OWNER) && !(exstyle & WS_EX_APPWINDOW))
+        return;
+
+    execute_window_shown(g_get_monotonic_time());
+}
+
+/*
+ * watchWindowsShown - Watch for windows of other processes being shown, to
+ * measure the time from a launch to its window.  The hook is out of context,
+ * so events are delivered by our message loop
+ */
+
+HWINEVENTHOOK
+watchWindowsShown(void)
+{
+    return SetWinEventHook(EVENT_OBJECT_SHOW, EVENT_OBJECT_SHOW, NULL,
+                           winEventProc, 0, 0,
+                           WINEVENT_OUTOFCONTEXT | WINEVENT_SKIPOWNPROCESS);
+}
@@ -32,5 +32,6 @@
 #include <windows.h>
 
 HWND createMsgWindow(void);
+HWINEVENTHOOK watchWindowsShown(void);
 
 #endif /* MSGWINDOW_H */
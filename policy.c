@@ -0,0 +1,380 @@
+/*
+ * policy.c
+ *
+ * Copyright (C) Jon Turney 2015
+ *
+ * This file is part of xwin-xdg-menu
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+//
+// Per-application scheduling policy and resource limits for launched
+// processes
+//
+// Policies are read from $XDG_CONFIG_HOME/xwin-xdg-menu-policy, a keyfile
+// like:
+//
+// [Default]
+// nice=5
+//
+// [Category Development]
+// rlimit-nofile=4096
+//
+// [emacs.desktop]
+// nice=0
+// ionice=best-effort:4
+// cpus=0-3
+// rlimit-as=2048
+// rlimit-as-hard=4096
+//
+// [xterm.desktop]
+// repeat=true
+//
+// Settings in the [Default] group apply to everything, are overridden by those
+// in a group for any of the desktop entry's categories, which are in turn
+// overridden by those in a group for its desktop ID.
+//
+// The rlimit- keys set the soft limit, which the application may raise as far
+// as the hard limit.  The hard limit is only changed if an rlimit-*-hard key
+// asks for it.
+//
+// 'repeat' isn't applied to the process, but says that launching the entry
+// again straight after launching it is intended, so shouldn't be suppressed.
+//
+// The policy is looked up before forking, and applied in the child between
+// fork and exec, where only async-signal-safe calls are allowed.
+//
+
+#include "policy.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#ifdef SYS_ioprio_set
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_SHIFT 13
+#endif
+
+static GKeyFile *policies = NULL;
+static time_t policies_mtime = 0;
+
+// (re)load the policy file if it has changed
+static void
+policy_load(void)
+{
+  gchar *filename = g_build_filename(g_get_user_config_dir(), "xwin-xdg-menu-policy", NULL);
+  struct stat st;
+
+  if (stat(filename, &st) != 0)
+    {
+      if (policies)
+        g_key_file_free(policies);
+      policies = NULL;
+      policies_mtime = 0;
+    }
+  else if (!policies || (st.st_mtime != policies_mtime))
+    {
+      GError *err = NULL;
+
+      if (policies)
+        g_key_file_free(policies);
+      policies = g_key_file_new();
+      policies_mtime = st.st_mtime;
+
+      if (!g_key_file_load_from_file(policies, filename, G_KEY_FILE_NONE, &err))
+        {
+          g_print("Unable to read %s: %s\n", filename, err->message);
+          g_error_free(err);
+        }
+    }
+
+  g_free(filename);
+}
+
+static gboolean
+parse_ioprio(const char *value, int *ioprio)
+{
+#ifdef SYS_ioprio_set
+  static const char *classes[] = { "none", "realtime", "best-effort", "idle" };
+  gchar **parts = g_strsplit(value, ":", 2);
+  int class = -1, level = 4;
+  int i;
+
+  for (i = 0; i < 4; i++)
+    if (strcmp(parts[0], classes[i]) == 0)
+      class = i;
+
+  if (parts[1])
+    level = CLAMP(atoi(parts[1]), 0, 7);
+  g_strfreev(parts);
+
+  if (class < 0)
+    return FALSE;
+
+  *ioprio = (class << IOPRIO_CLASS_SHIFT) | level;
+  return TRUE;
+#else
+  return FALSE;
+#endif
+}
+
+#ifdef CPU_SET
+// parse a cpu list like "0-3,6"
+static gboolean
+parse_cpus(const char *value, cpu_set_t *cpus)
+{
+  gchar **ranges = g_strsplit(value, ",", -1);
+  gboolean ok = TRUE;
+  int i;
+
+  CPU_ZERO(cpus);
+  for (i = 0; ranges[i] && ok; i++)
+    {
+      char *end;
+      long first = strtol(ranges[i], &end, 10);
+      long last = first;
+      if (*end == '-')
+        last = strtol(end + 1, &end, 10);
+
+      if ((end == ranges[i]) || *end || (first < 0) || (last < first) || (last >= CPU_SETSIZE))
+        {
+          ok = FALSE;
+          break;
+        }
+
+      for (; first <= last; first++)
+        CPU_SET(first, cpus);
+    }
+
+  g_strfreev(ranges);
+  return ok && CPU_COUNT(cpus);
+}
+#endif
+
+// read an integer from group, which must be between min and max.  Returns
+// FALSE if the key isn't there, or is invalid, which is logged
+static gboolean
+policy_get_integer(const char *group, const char *key, int min, int max, int *value)
+{
+  GError *err = NULL;
+
+  *value = g_key_file_get_integer(policies, group, key, &err);
+  if (!err && (*value >= min) && (*value <= max))
+    return TRUE;
+
+  if (!err || g_error_matches(err, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE))
+    {
+      gchar *s = g_key_file_get_string(policies, group, key, NULL);
+      g_print("[%s] %s '%s' is invalid\n", group, key, s);
+      g_free(s);
+    }
+
+  g_clear_error(&err);
+  return FALSE;
+}
+
+// override policy with any settings in group
+static void
+policy_merge(const char *group, launch_policy *policy)
+{
+  GError *err = NULL;
+  int value;
+  gchar *s;
+
+  if (!g_key_file_has_group(policies, group))
+    return;
+
+  if (policy_get_integer(group, "nice", -20, 19, &value))
+    {
+      policy->set_nice = TRUE;
+      policy->nice = value;
+    }
+
+  s = g_key_file_get_string(policies, group, "ionice", NULL);
+  if (s)
+    {
+      if (parse_ioprio(s, &policy->ioprio))
+        policy->set_ionice = TRUE;
+      else
+        g_print("[%s] ionice '%s' is invalid or unsupported\n", group, s);
+      g_free(s);
+    }
+
+  s = g_key_file_get_string(policies, group, "cpus", NULL);
+  if (s)
+    {
+#ifdef CPU_SET
+      if (parse_cpus(s, &policy->cpus))
+        policy->set_cpus = TRUE;
+      else
+#endif
+        g_print("[%s] cpus '%s' is invalid or unsupported\n", group, s);
+      g_free(s);
+    }
+
+  // address space limit is given in MiB
+  if (policy_get_integer(group, "rlimit-as", 1, G_MAXINT, &value))
+    {
+      policy->set_as = TRUE;
+      policy->as = (rlim_t)value * 1024 * 1024;
+    }
+
+  if (policy_get_integer(group, "rlimit-as-hard", 1, G_MAXINT, &value))
+    {
+      policy->set_as_hard = TRUE;
+      policy->as_hard = (rlim_t)value * 1024 * 1024;
+    }
+
+  if (policy_get_integer(group, "rlimit-nofile", 1, G_MAXINT, &value))
+    {
+      policy->set_nofile = TRUE;
+      policy->nofile = value;
+    }
+
+  if (policy_get_integer(group, "rlimit-nofile-hard", 1, G_MAXINT, &value))
+    {
+      policy->set_nofile_hard = TRUE;
+      policy->nofile_hard = value;
+    }
+
+  value = g_key_file_get_boolean(policies, group, "repeat", &err);
+  if (!err)
+    policy->repeat = value;
+  g_clear_error(&err);
+}
+
+//
+// Determine the policy for a desktop entry.  categories is the
+// semicolon-separated Categories key, which may be NULL.
+//
+void
+policy_lookup(const char *desktop_id, const char *categories, launch_policy *policy)
+{
+  memset(policy, 0, sizeof(*policy));
+
+  policy_load();
+  if (!policies)
+    return;
+
+  policy_merge("Default", policy);
+
+  if (categories)
+    {
+      gchar **list = g_strsplit(categories, ";", -1);
+      int i;
+      for (i = 0; list[i]; i++)
+        {
+          if (!*list[i])
+            continue;
+
+          gchar *group = g_strconcat("Category ", list[i], NULL);
+          policy_merge(group, policy);
+          g_free(group);
+        }
+      g_strfreev(list);
+    }
+
+  if (desktop_id)
+    policy_merge(desktop_id, policy);
+}
+
+static void
+policy_error(const char *what)
+{
+  // stdio isn't async-signal-safe
+  static const char prefix[] = "policy: failed to set ";
+  write(STDERR_FILENO, prefix, sizeof(prefix) - 1);
+  write(STDERR_FILENO, what, strlen(what));
+  write(STDERR_FILENO, "\n", 1);
+}
+
+// set the soft limit for resource, and the hard limit if asked to.  The soft
+// limit can't be above the hard limit, so is lowered to it if need be
+static gboolean
+policy_set_rlimit(int resource, gboolean set_soft, rlim_t soft, gboolean set_hard, rlim_t hard)
+{
+  struct rlimit rl;
+
+  if (getrlimit(resource, &rl) != 0)
+    return FALSE;
+
+  if (set_hard)
+    rl.rlim_max = hard;
+  if (set_soft)
+    rl.rlim_cur = soft;
+  if ((rl.rlim_max != RLIM_INFINITY) &&
+      ((rl.rlim_cur == RLIM_INFINITY) || (rl.rlim_cur > rl.rlim_max)))
+    rl.rlim_cur = rl.rlim_max;
+
+  return setrlimit(resource, &rl) == 0;
+}
+
+//
+// Apply policy to the current process.  This is called in the child after
+// fork, so must only use async-signal-safe functions.  Failures are reported
+// on stderr, which is logged, but aren't fatal.
+//
+void
+policy_apply(const launch_policy *policy)
+{
+  if (!policy)
+    return;
+
+  if (policy->set_nice)
+    {
+      if (setpriority(PRIO_PROCESS, 0, policy->nice) != 0)
+        policy_error("nice");
+    }
+
+#ifdef SYS_ioprio_set
+  if (policy->set_ionice)
+    {
+      if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, policy->ioprio) != 0)
+        policy_error("ionice");
+    }
+#endif
+
+#ifdef CPU_SET
+  if (policy->set_cpus)
+    {
+      if (sched_setaffinity(0, sizeof(policy->cpus), &policy->cpus) != 0)
+        policy_error("cpus");
+    }
+#endif
+
+  if (policy->set_as || policy->set_as_hard)
+    {
+      if (!policy_set_rlimit(RLIMIT_AS, policy->set_as, policy->as,
+                             policy->set_as_hard, policy->as_hard))
+        policy_error("rlimit-as");
+    }
+
+  if (policy->set_nofile || policy->set_nofile_hard)
+    {
+      if (!policy_set_rlimit(RLIMIT_NOFILE, policy->set_nofile, policy->nofile,
+                             policy->set_nofile_hard, policy->nofile_hard))
+        policy_error("rlimit-nofile");
+    }
+}
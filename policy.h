@@ -0,0 +1,63 @@
+/*
+ * policy.h
+ *
+ * Copyright (C) Jon Turney 2015
+ *
+ * This file is part of xwin-xdg-menu
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef POLICY_H
+#define POLICY_H
+
+#include <glib.h>
+#include <sched.h>
+#include <sys/resource.h>
+
+typedef struct
+{
+  gboolean set_nice;
+  int nice;
+
+  gboolean set_ionice;
+  int ioprio;
+
+#ifdef CPU_SET
+  gboolean set_cpus;
+  cpu_set_t cpus;
+#endif
+
+  // soft limits, and hard limits if they are to be changed too
+  gboolean set_as, set_as_hard;
+  rlim_t as, as_hard;
+
+  gboolean set_nofile, set_nofile_hard;
+  rlim_t nofile, nofile_hard;
+
+  // launching again soon after the last launch isn't suppressed
+  gboolean repeat;
+} launch_policy;
+
+void policy_lookup(const char *desktop_id, const char *categories, launch_policy *policy);
+void policy_apply(const launch_policy *policy);
+
+#endif /* POLICY_H */
@@ -0,0 +1,282 @@
+/*
+ * prelaunch.c
+ *
+ * Copyright (C) Jon Turney 2015
+ *
+ * This file is part of xwin-xdg-menu
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+//
+// Warm start for slow-starting applications
+//
+// For the desktop IDs listed in the 'prelaunch' setting, a server instance of
+// the application is started once we are idle after startup, and while it is
+// running, launching that entry runs a (fast) client command instead.
+//
+// The server and client commands are taken from the X-Prelaunch and
+// X-Prelaunch-Client keys of the desktop entry, or from 'server' and 'client'
+// keys in a [prelaunch <desktop ID>] group in the settings, e.g.
+//
+// [settings]
+// prelaunch=emacs.desktop;
+//
+// [prelaunch emacs.desktop]
+// server=emacs --fg-daemon
+// client=emacsclient -c
+// socket=emacs/server
+//
+// The server command must not daemonize, so we can tell if it's still running.
+// If the server listens on a Unix socket, given by the X-Prelaunch-Socket key
+// or a 'socket' key (relative to $XDG_RUNTIME_DIR, or to the home directory if
+// it starts with ~/), the client is only used once the socket accepts
+// connections, so a launch while the server is still starting isn't lost.
+//
+// If a server has exited when its entry is launched, it's restarted once we're
+// idle again.  The time from selection to a window being shown is recorded
+// separately for launches which could and couldn't use the server.
+//
+
+#include "prelaunch.h"
+#include "execute.h"
+#include "ipc.h"
+#include "menu.h"
+#include "metrics.h"
+#include "proctable.h"
+#include <string.h>
+#include <unistd.h>
+
+#define PRELAUNCH_DELAY 10 // seconds
+
+typedef struct
+{
+  char *id;
+  char *server;
+  char *client;
+  // the server's socket, or NULL if it's ready as soon as it's running
+  char *socket;
+  char *tag;
+  // the server has been started, and hasn't exited yet
+  gboolean pending;
+  unsigned int hits;
+  unsigned int misses;
+} prelaunch_entry;
+
+// desktop ID -> prelaunch_entry
+static GHashTable *entries = NULL;
+
+// the source which (re)starts servers, if one is scheduled
+static guint start_source;
+
+static metrics_histogram *warm_window_us;
+static metrics_histogram *cold_window_us;
+
+static void
+prelaunch_entry_free(gpointer data)
+{
+  prelaunch_entry *e = data;
+  g_free(e->id);
+  g_free(e->server);
+  g_free(e->client);
+  g_free(e->socket);
+  g_free(e->tag);
+  g_free(e);
+}
+
+static prelaunch_entry *
+prelaunch_entry_new(const char *id)
+{
+  gchar *group = g_strconcat("prelaunch ", id, NULL);
+  char *server = g_key_file_get_string(keyfile, group, "server", NULL);
+  char *client = g_key_file_get_string(keyfile, group, "client", NULL);
+  char *socket = g_key_file_get_string(keyfile, group, "socket", NULL);
+  g_free(group);
+
+  if (!server || !client || !socket)
+    {
+      GDesktopAppInfo *appinfo = g_desktop_app_info_new(id);
+      if (appinfo)
+        {
+          if (!server)
+            server = g_desktop_app_info_get_string(appinfo, "X-Prelaunch");
+          if (!client)
+            client = g_desktop_app_info_get_string(appinfo, "X-Prelaunch-Client");
+          if (!socket)
+            socket = g_desktop_app_info_get_string(appinfo, "X-Prelaunch-Socket");
+          g_object_unref(appinfo);
+        }
+    }
+
+  if (!server || !client)
+    {
+      g_print("prelaunch: no server and client commands for %s\n", id);
+      g_free(server);
+      g_free(client);
+      g_free(socket);
+      return NULL;
+    }
+
+  prelaunch_entry *e = g_new0(prelaunch_entry, 1);
+  e->id = g_strdup(id);
+  e->server = server;
+  e->client = client;
+  if (socket && *socket)
+    {
+      if (g_path_is_absolute(socket))
+        e->socket = g_strdup(socket);
+      else if (g_str_has_prefix(socket, "~/"))
+        e->socket = g_build_filename(g_get_home_dir(), socket + 2, NULL);
+      else
+        e->socket = g_build_filename(g_get_user_runtime_dir(), socket, NULL);
+    }
+  g_free(socket);
+  e->tag = g_strconcat("prelaunch:", id, NULL);
+  return e;
+}
+
+static void
+prelaunch_exited(gpointer data)
+{
+  prelaunch_entry *e = data;
+  e->pending = FALSE;
+}
+
+// start the server, unless it has already been started.  It isn't in the
+// process table until it has been forked, so that can't be used to tell
+static void
+prelaunch_start(prelaunch_entry *e)
+{
+  if (e->pending)
+    return;
+
+  e->pending = TRUE;
+  execute_server(e->server, e->tag, e->id, prelaunch_exited, e);
+}
+
+// whether the server is running, and accepting connections if it has a socket
+static gboolean
+prelaunch_ready(prelaunch_entry *e)
+{
+  if (!e->pending || !proctable_find(e->tag))
+    return FALSE;
+
+  if (!e->socket)
+    return TRUE;
+
+  int fd = ipc_connect(e->socket);
+  if (fd < 0)
+    return FALSE;
+  close(fd);
+  return TRUE;
+}
+
+static gboolean
+prelaunch_idle(gpointer data)
+{
+  GHashTableIter iter;
+  gpointer value;
+
+  start_source = 0;
+  g_hash_table_iter_init(&iter, entries);
+  while (g_hash_table_iter_next(&iter, NULL, &value))
+    prelaunch_start(value);
+
+  return G_SOURCE_REMOVE;
+}
+
+// start any servers which aren't running once we're idle, and not straight
+// away, so they don't compete with a launch which is starting
+static void
+prelaunch_start_later(void)
+{
+  if (!start_source)
+    start_source = g_timeout_add_seconds_full(G_PRIORITY_LOW, PRELAUNCH_DELAY,
+                                              prelaunch_idle, NULL, NULL);
+}
+
+void
+prelaunch_init(void)
+{
+  gchar **ids = g_key_file_get_string_list(keyfile, "settings", "prelaunch", NULL, NULL);
+  if (!ids)
+    return;
+
+  entries = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, prelaunch_entry_free);
+
+  int i;
+  for (i = 0; ids[i]; i++)
+    {
+      if (!*ids[i])
+        continue;
+
+      prelaunch_entry *e = prelaunch_entry_new(ids[i]);
+      if (e)
+        g_hash_table_replace(entries, e->id, e);
+    }
+  g_strfreev(ids);
+
+  warm_window_us = metrics_histogram_new("prelaunch_warm_window_us", "Time from selecting a prelaunched entry whose server was ready to a window being shown, in microseconds");
+  cold_window_us = metrics_histogram_new("prelaunch_cold_window_us", "Time from selecting a prelaunched entry whose server wasn't ready to a window being shown, in microseconds");
+
+  prelaunch_start_later();
+}
+
+//
+// If desktop_id has a warm instance running, return the client command to use
+// to launch it (to be free()d by the caller), otherwise NULL.  If desktop_id is
+// prelaunched, *window_us is set to the histogram to record the time to its
+// window in
+//
+char *
+prelaunch_client_cmd(const char *desktop_id, metrics_histogram **window_us)
+{
+  if (!entries || !desktop_id)
+    return NULL;
+
+  prelaunch_entry *e = g_hash_table_lookup(entries, desktop_id);
+  if (!e)
+    return NULL;
+
+  char *cmd = NULL;
+  if (prelaunch_ready(e))
+    {
+      e->hits++;
+      cmd = strdup(e->client);
+      *window_us = warm_window_us;
+    }
+  else
+    {
+      // launch normally, and restart the server for next time, if it's not
+      // still starting
+      e->misses++;
+      *window_us = cold_window_us;
+      g_print("prelaunch: %s server %s\n", desktop_id,
+              e->pending ? "not ready yet" : "not running, restarting once idle");
+      if (!e->pending)
+        prelaunch_start_later();
+    }
+
+  g_print("prelaunch: %s %s (%u hits, %u misses)\n", desktop_id,
+          cmd ? "hit" : "miss", e->hits, e->misses);
+
+  return cmd;
+}
@@ -0,0 +1,344 @@
+/*
+ * proctable.c
+ *
+ * Copyright (C) Jon Turney 2015
+ *
+ * This file is part of xwin-xdg-menu
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+//
+// A table of the processes we have launched and which are still running, with
+// their resource usage
+//
+// Children are added when forked, and removed in the same step as they are
+// reaped, at which point their rusage is summarized.  While they are running, their CPU time and RSS
+// are periodically sampled from /proc/<pid>/stat.
+//
+
+#include "proctable.h"
+#include "metrics.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define SAMPLE_INTERVAL 5 // seconds
+
+G_LOCK_DEFINE_STATIC(table);
+
+// pid -> proctable_entry
+static GHashTable *table;
+
+static void
+proctable_entry_free(gpointer data)
+{
+  proctable_entry *e = data;
+  g_free(e->id);
+  g_free(e);
+}
+
+static gint64
+proctable_count_gauge(void)
+{
+  return proctable_count();
+}
+
+static gboolean
+proctable_sample_cb(gpointer data)
+{
+  proctable_sample();
+  return G_SOURCE_CONTINUE;
+}
+
+void
+proctable_init(void)
+{
+  table = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+                                proctable_entry_free);
+  g_timeout_add_seconds(SAMPLE_INTERVAL, proctable_sample_cb, NULL);
+
+  metrics_gauge_new("children", "Launched processes still running", proctable_count_gauge);
+}
+
+void
+proctable_add(int pid, const char *id)
+{
+  proctable_entry *e = g_new0(proctable_entry, 1);
+  e->pid = pid;
+  e->id = g_strdup(id);
+  e->started = g_get_real_time();
+
+  G_LOCK(table);
+  g_hash_table_replace(table, GINT_TO_POINTER(pid), e);
+  G_UNLOCK(table);
+}
+
+static gint64
+timeval_to_us(const struct timeval *tv)
+{
+  return (gint64)tv->tv_sec * G_USEC_PER_SEC + tv->tv_usec;
+}
+
+//
+// wait for a child to exit and reap it, returning a summary of its resource
+// usage to be logged.  It's removed from the table under the table lock, in
+// the same step as it is reaped, so once its pid can be reused,
+// proctable_signal() can't find it
+//
+char *
+proctable_reap(int pid, int *status)
+{
+  struct rusage ru;
+  gint64 elapsed = 0;
+#ifndef WNOWAIT
+  gulong delay = 1000;
+#endif
+
+  memset(&ru, 0, sizeof(ru));
+
+  while (1)
+    {
+#ifdef WNOWAIT
+      // block until it has exited, but leave it to be reaped below
+      siginfo_t info;
+      if ((waitid(P_PID, pid, &info, WEXITED | WNOWAIT) < 0) && (errno == EINTR))
+        continue;
+#endif
+
+      G_LOCK(table);
+      pid_t r = wait4(pid, status, WNOHANG, &ru);
+      if (r != 0)
+        {
+          proctable_entry *e = g_hash_table_lookup(table, GINT_TO_POINTER(pid));
+          if (e)
+            elapsed = g_get_real_time() - e->started;
+          g_hash_table_remove(table, GINT_TO_POINTER(pid));
+        }
+      G_UNLOCK(table);
+
+      if ((r < 0) && (errno == EINTR))
+        continue;
+      if (r != 0)
+        break;
+
+#ifndef WNOWAIT
+      // without a way to wait for it to exit without reaping it, poll,
+      // backing off to once a second
+      g_usleep(delay);
+      delay = MIN(delay * 2, G_USEC_PER_SEC);
+#endif
+    }
+
+  return g_strdup_printf("elapsed %.3fs, user %.3fs, sys %.3fs, maxrss %ld KiB",
+                         elapsed / 1e6,
+                         timeval_to_us(&ru.ru_utime) / 1e6,
+                         timeval_to_us(&ru.ru_stime) / 1e6,
+                         ru.ru_maxrss);
+}
+
+// read CPU time and RSS for pid from /proc/<pid>/stat
+static gboolean
+proc_stat_read(int pid, gint64 *cpu, long *rss)
+{
+  char path[64];
+  char buf[1024];
+  snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+
+  FILE *f = fopen(path, "r");
+  if (!f)
+    return FALSE;
+  size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+  fclose(f);
+  buf[n] = 0;
+
+  // the command name may contain spaces and parentheses, so skip to the last
+  // ')' before splitting fields
+  char *p = strrchr(buf, ')');
+  if (!p)
+    return FALSE;
+
+  // fields 14 and 15 are utime and stime in clock ticks, 24 is RSS in pages
+  unsigned long utime, stime;
+  long pages;
+  if (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu %*d %*d %*d %*d %*d %*d %*u %*u %ld",
+             &utime, &stime, &pages) != 3)
+    return FALSE;
+
+  *cpu = (gint64)(utime + stime) * G_USEC_PER_SEC / sysconf(_SC_CLK_TCK);
+  *rss = pages * (sysconf(_SC_PAGESIZE) / 1024);
+  return TRUE;
+}
+
+typedef struct
+{
+  int pid;
+  gint64 started;
+  gint64 cpu;
+  long rss;
+  gboolean ok;
+} proc_sample;
+
+// the /proc reads are done without holding the lock, so launching and reaping
+// children isn't held up by them
+void
+proctable_sample(void)
+{
+  GArray *samples = g_array_new(FALSE, TRUE, sizeof(proc_sample));
+  GHashTableIter iter;
+  gpointer value;
+  guint i;
+
+  G_LOCK(table);
+  g_hash_table_iter_init(&iter, table);
+  while (g_hash_table_iter_next(&iter, NULL, &value))
+    {
+      proctable_entry *e = value;
+      proc_sample sample = { e->pid, e->started, 0, 0, FALSE };
+      g_array_append_val(samples, sample);
+    }
+  G_UNLOCK(table);
+
+  for (i = 0; i < samples->len; i++)
+    {
+      proc_sample *sample = &g_array_index(samples, proc_sample, i);
+      sample->ok = proc_stat_read(sample->pid, &sample->cpu, &sample->rss);
+    }
+
+  // the child may have exited meanwhile, and its pid even been reused by
+  // another one
+  G_LOCK(table);
+  for (i = 0; i < samples->len; i++)
+    {
+      proc_sample *sample = &g_array_index(samples, proc_sample, i);
+      proctable_entry *e = g_hash_table_lookup(table, GINT_TO_POINTER(sample->pid));
+      if (sample->ok && e && (e->started == sample->started))
+        {
+          e->cpu = sample->cpu;
+          e->rss = sample->rss;
+        }
+    }
+  G_UNLOCK(table);
+
+  g_array_free(samples, TRUE);
+}
+
+static gint
+compare_started(gconstpointer a, gconstpointer b)
+{
+  const proctable_entry *ea = a, *eb = b;
+  return (ea->started > eb->started) - (ea->started < eb->started);
+}
+
+//
+// a copy of the table, oldest first, which can be used without holding the
+// lock
+//
+GArray *
+proctable_snapshot(void)
+{
+  GArray *snapshot = g_array_new(FALSE, FALSE, sizeof(proctable_entry));
+  GHashTableIter iter;
+  gpointer value;
+
+  G_LOCK(table);
+  g_hash_table_iter_init(&iter, table);
+  while (g_hash_table_iter_next(&iter, NULL, &value))
+    {
+      proctable_entry e = *(proctable_entry *)value;
+      e.id = g_strdup(e.id);
+      g_array_append_val(snapshot, e);
+    }
+  G_UNLOCK(table);
+
+  g_array_sort(snapshot, compare_started);
+  return snapshot;
+}
+
+void
+proctable_snapshot_free(GArray *snapshot)
+{
+  guint i;
+  for (i = 0; i < snapshot->len; i++)
+    g_free(g_array_index(snapshot, proctable_entry, i).id);
+  g_array_free(snapshot, TRUE);
+}
+
+guint
+proctable_count(void)
+{
+  G_LOCK(table);
+  guint count = g_hash_table_size(table);
+  G_UNLOCK(table);
+  return count;
+}
+
+// the pid of a running child with the given id, or 0
+int
+proctable_find(const char *id)
+{
+  GHashTableIter iter;
+  gpointer value;
+  int pid = 0;
+
+  G_LOCK(table);
+  g_hash_table_iter_init(&iter, table);
+  while (g_hash_table_iter_next(&iter, NULL, &value))
+    {
+      proctable_entry *e = value;
+      if (g_strcmp0(e->id, id) == 0)
+        {
+          pid = e->pid;
+          break;
+        }
+    }
+  G_UNLOCK(table);
+
+  return pid;
+}
+
+//
+// send sig to the process group of a child, if it's still running.  started
+// distinguishes it from any later child which has been given the same pid.
+// Returns FALSE if it has already exited
+//
+gboolean
+proctable_signal(int pid, gint64 started, int sig)
+{
+  gboolean running = FALSE;
+
+  // a child is removed from the table in the same step as it's reaped, under
+  // the lock, so while the lock is held its pid can't have been reused
+  G_LOCK(table);
+  proctable_entry *e = g_hash_table_lookup(table, GINT_TO_POINTER(pid));
+  if (e && (e->started == started))
+    {
+      // it was started in a new session, so signal the whole process group
+      kill(-pid, sig);
+      running = TRUE;
+    }
+  G_UNLOCK(table);
+
+  return running;
+}
@@ -0,0 +1,56 @@
+/*
+ * proctable.h
+ *
+ * Copyright (C) Jon Turney 2015
+ *
+ * This file is part of xwin-xdg-menu
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef PROCTABLE_H
+#define PROCTABLE_H
+
+#include <glib.h>
+#include <sys/resource.h>
+
+typedef struct
+{
+  int pid;
+  char *id;
+  // when it was started, in real time microseconds
+  gint64 started;
+  // most recent sample of CPU time (microseconds) and RSS (KiB)
+  gint64 cpu;
+  long rss;
+} proctable_entry;
+
+void proctable_init(void);
+void proctable_add(int pid, const char *id);
+char *proctable_reap(int pid, int *status);
+void proctable_sample(void);
+GArray *proctable_snapshot(void);
+void proctable_snapshot_free(GArray *snapshot);
+guint proctable_count(void);
+int proctable_find(const char *id);
+gboolean proctable_signal(int pid, gint64 started, int sig);
+
+#endif /* PROCTABLE_H */
@@ -37,6 +37,7 @@
 #define IDD_ABOUT         103
 #define IDC_ABOUT_WEBSITE 104
 #define IDC_DISPLAY       105
+#define IDC_LATENCY       106
 
 #define ID_APP_ABOUT      200
 #define ID_APP_LOGFILE    201
@@ -48,6 +49,7 @@
 #define ID_SIZE_64        207
 #define ID_SIZE_24        208
 
+#define ID_RUNNING_BASE   500
 #define ID_EXEC_BASE     1000
 
 #endif /* RESOURCE_H */
@@ -0,0 +1,212 @@
+/*
+ * soak.c
+ *
+ * Copyright (C) Jon Turney 2015
+ *
+ * This file is part of xwin-xdg-menu
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+//
+// Resource accounting for soak testing
+//
+// Something repeats an operation (e.g. constructing the menu) many times,
+// calling soak_sample() after each iteration, which samples each of the
+// watched resources (e.g. memory, file descriptors, GDI objects).
+//
+// The first tenth of the iterations are a warm-up, while caches fill and so
+// on.  The rest are split into two halves, and the peak of each resource in
+// the first half is compared with its peak in the second: a resource which
+// grows by more than its slack, plus a fraction of its size, has probably
+// leaked.  Comparing peaks, rather than single samples, allows for iterations
+// which legitimately use different amounts of a resource (e.g. at different
+// icon sizes).
+//
+// Nothing here is specific to Windows or the menu.
+//
+
+#include "soak.h"
+#include <malloc.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct
+{
+  const char *name;
+  soak_sampler sample;
+  gint64 slack;
+  double ratio;
+  // the peaks after the warm-up, in the first and second halves
+  gint64 first;
+  gint64 second;
+  gint64 last;
+} soak_resource;
+
+static GArray *resources;
+static int iterations;
+static int warmup;
+
+void
+soak_init(int n)
+{
+  iterations = n;
+  warmup = MAX(n / 10, 1);
+  resources = g_array_new(FALSE, FALSE, sizeof(soak_resource));
+}
+
+// watch a resource, which may grow by slack plus ratio of its size.  Samplers
+// return -1 if the resource can't be measured here
+void
+soak_watch(const char *name, soak_sampler sample, gint64 slack, double ratio)
+{
+  if (sample() < 0)
+    return;
+
+  soak_resource r = { name, sample, slack, ratio, -1, -1, -1 };
+  g_array_append_val(resources, r);
+}
+
+// iteration has finished, counting from 1
+void
+soak_sample(int iteration)
+{
+  gboolean report = (iteration % MAX(iterations / 20, 1) == 0);
+  GString *line = report ? g_string_new(NULL) : NULL;
+  guint i;
+
+  for (i = 0; i < resources->len; i++)
+    {
+      soak_resource *r = &g_array_index(resources, soak_resource, i);
+      r->last = r->sample();
+
+      if (iteration > warmup)
+        {
+          gint64 *peak = (iteration <= warmup + (iterations - warmup) / 2) ? &r->first : &r->second;
+          *peak = MAX(*peak, r->last);
+        }
+
+      if (line)
+        g_string_append_printf(line, ", %s %" G_GINT64_FORMAT, r->name, r->last);
+    }
+
+  if (line)
+    {
+      g_print("Soak iteration %d of %d%s\n", iteration, iterations, line->str);
+      g_string_free(line, TRUE);
+    }
+}
+
+// report the growth of each resource, returning FALSE if any grew too much
+gboolean
+soak_finish(void)
+{
+  gboolean ok = TRUE;
+  guint i;
+
+  for (i = 0; i < resources->len; i++)
+    {
+      soak_resource *r = &g_array_index(resources, soak_resource, i);
+
+      if ((r->first < 0) || (r->second < 0))
+        continue;
+
+      gint64 growth = r->second - r->first;
+      gint64 bound = r->slack + r->first * r->ratio;
+      gboolean leaked = (growth > bound);
+
+      g_print("Soak %s: peak %" G_GINT64_FORMAT " then %" G_GINT64_FORMAT
+              ", growth %+" G_GINT64_FORMAT " (bound %" G_GINT64_FORMAT ")%s\n",
+              r->name, r->first, r->second, growth, bound, leaked ? ", LEAKED" : "");
+
+      if (leaked)
+        ok = FALSE;
+    }
+
+  g_array_free(resources, TRUE);
+  resources = NULL;
+
+  return ok;
+}
+
+//
+// Samplers for resources which can be measured anywhere we can run
+//
+
+// the resident set size, in bytes
+gint64
+soak_rss(void)
+{
+  long pages = -1;
+  FILE *f = fopen("/proc/self/statm", "r");
+  if (f)
+    {
+      if (fscanf(f, "%*d %ld", &pages) != 1)
+        pages = -1;
+      fclose(f);
+    }
+
+  return (pages < 0) ? -1 : (gint64)pages * sysconf(_SC_PAGESIZE);
+}
+
+// the bytes allocated by malloc() and not yet freed
+gint64
+soak_heap(void)
+{
+#if defined(__GLIBC__) && ((__GLIBC__ > 2) || (__GLIBC_MINOR__ >= 33))
+  return mallinfo2().uordblks;
+#else
+  return mallinfo().uordblks;
+#endif
+}
+
+static gint64
+count_dir(const char *path)
+{
+  GDir *dir = g_dir_open(path, 0, NULL);
+  gint64 count = 0;
+
+  if (!dir)
+    return -1;
+
+  while (g_dir_read_name(dir))
+    count++;
+  g_dir_close(dir);
+
+  return count;
+}
+
+// open file descriptors
+gint64
+soak_fds(void)
+{
+  gint64 count = count_dir("/proc/self/fd");
+
+  // not counting the one used to count them
+  return (count > 0) ? count - 1 : count;
+}
+
+gint64
+soak_threads(void)
+{
+  return count_dir("/proc/self/task");
+}
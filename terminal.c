@@ -0,0 +1,151 @@
+/*
+ * terminal.c
+ *
+ * Copyright (C) Jon Turney 2015
+ *
+ * This file is part of xwin-xdg-menu
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+//
+// Running commands in a terminal, for Terminal=true desktop entries and for
+// viewing the logfile
+//
+// By default, this is a new xterm.  The 'terminal' setting gives a different
+// command, to which the command to run is appended, e.g.
+//
+// [settings]
+// terminal=urxvt -e
+//
+// Starting a terminal emulator can be slow, so a client/server terminal can be
+// used instead, by giving 'terminalserver' and 'terminalclient' commands, e.g.
+//
+// terminalserver=urxvtd -q
+// terminalclient=urxvtc -e
+//
+// The server is started when a terminal is first needed, and kept running.
+// While it is running, the client command is used, falling back to the
+// terminal command if the client fails (e.g. if it can't reach the server).
+// Until it's running, the terminal command is used.
+//
+// The server command must not daemonize, so we can tell if it's still running.
+// It's only started again once it has exited.
+//
+// The time from selecting a Terminal=true menu item to a window being shown
+// is recorded separately for launches via the server and those spawning a
+// terminal.
+//
+
+#include "terminal.h"
+#include "execute.h"
+#include "menu.h"
+#include "metrics.h"
+#include "proctable.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define TERMINAL_SERVER_TAG "terminal-server"
+
+static unsigned int client_launches;
+static unsigned int spawn_launches;
+static metrics_histogram *client_window_us;
+static metrics_histogram *spawn_window_us;
+
+// the server has been started, and hasn't exited yet.  It isn't in the
+// process table until it has been forked, so that can't be used to tell
+static gboolean server_pending;
+
+static void
+terminal_server_exited(gpointer data)
+{
+  server_pending = FALSE;
+}
+
+void
+terminal_init(void)
+{
+  client_window_us = metrics_histogram_new("terminal_client_window_us", "Time from selecting a terminal menu item launched via the terminal server to a window being shown, in microseconds");
+  spawn_window_us = metrics_histogram_new("terminal_spawn_window_us", "Time from selecting a terminal menu item launched by spawning a terminal to a window being shown, in microseconds");
+}
+
+//
+// The command to run cmd in a terminal, titled title (if not NULL, and the
+// terminal is the default), which should be free()d.  If window_us isn't NULL,
+// *window_us is set to the histogram to record the time to its window in
+//
+char *
+terminal_command(const char *cmd, const char *title, metrics_histogram **window_us)
+{
+  gchar *terminal = g_key_file_get_string(keyfile, "settings", "terminal", NULL);
+  gchar *server = g_key_file_get_string(keyfile, "settings", "terminalserver", NULL);
+  gchar *client = g_key_file_get_string(keyfile, "settings", "terminalclient", NULL);
+  char *spawn;
+  char *result;
+
+  if (terminal && *terminal)
+    spawn = g_strdup_printf("%s %s", terminal, cmd);
+  else if (title)
+    spawn = g_strdup_printf("xterm -title '%s' -e %s", title, cmd);
+  else
+    spawn = g_strdup_printf("xterm -e %s", cmd);
+
+  if (server && *server && client && *client && server_pending &&
+      proctable_find(TERMINAL_SERVER_TAG))
+    {
+      char *both = g_strdup_printf("%s %s || %s", client, cmd, spawn);
+      result = strdup(both);
+      g_free(both);
+      client_launches++;
+      if (window_us)
+        *window_us = client_window_us;
+    }
+  else
+    {
+      // start the server for next time, unless it's still starting
+      if (server && *server && client && *client)
+        {
+          if (server_pending)
+            g_print("terminal: server not ready yet\n");
+          else
+            {
+              g_print("terminal: starting server '%s'\n", server);
+              server_pending = TRUE;
+              execute_server(server, TERMINAL_SERVER_TAG, NULL, terminal_server_exited, NULL);
+            }
+        }
+
+      result = strdup(spawn);
+      spawn_launches++;
+      if (window_us)
+        *window_us = spawn_window_us;
+    }
+
+  g_print("terminal: %u launches via server, %u launches spawned\n",
+          client_launches, spawn_launches);
+
+  g_free(spawn);
+  g_free(terminal);
+  g_free(server);
+  g_free(client);
+
+  return result;
+}
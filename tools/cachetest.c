@@ -0,0 +1,427 @@
+/*
+ * cachetest.c
+ *
+ * Copyright (C) Jon Turney 2015
+ *
+ * This file is part of xwin-xdg-menu
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+//
+// xwin-xdg-menu-cachetest: check the shared icon cache, and measure how much
+// of it is shared
+//
+// A cache of synthetic icons is written and read back as xwin-xdg-menu does
+// (iconcache.c), checking that every icon is found with the right pixels, and
+// that an icon whose file has been modified since isn't.  Copies of the cache
+// with corrupt hash chains (looping, or linking out of range) are then checked
+// to make lookups fail rather than hang or read outside the file.
+//
+// Finally, some readers are forked which each look up every icon, either
+// using the pixels in the cache or copying them (as decoding each icon
+// would), and report their proportional set size from
+// /proc/self/smaps_rollup while all of them have the icons, so the memory
+// saved by sharing the cache can be seen.  That is only available on Linux.
+//
+// Each check is reported, and the exit status is 2 if any failed.
+//
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include "../iconcache.h"
+
+// where the header and records are, as laid out by iconcache.c
+#define HEADER_N_RECORDS 20
+#define HEADER_RECORDS 28
+#define RECORD_SIZE 24
+#define RECORD_NEXT 12
+
+static const int sizes[] = { 16, 32 };
+
+static int failures;
+
+static void
+check(gboolean ok, const char *what)
+{
+  printf("%s: %s\n", ok ? "ok" : "FAIL", what);
+  if (!ok)
+    failures++;
+}
+
+static char *
+icon_path(const char *dir, int i)
+{
+  char *name = g_strdup_printf("icon-%d.png", i);
+  char *path = g_build_filename(dir, name, NULL);
+  g_free(name);
+  return path;
+}
+
+// distinct pixels for each icon and size
+static guint8 *
+icon_pixels(int i, int size)
+{
+  guint8 *bgra = g_malloc(size * size * 4);
+  int j;
+  for (j = 0; j < size * size * 4; j++)
+    bgra[j] = (i * 7 + size + j) & 0xff;
+  return bgra;
+}
+
+// look up every icon, and count those found with the right pixels
+static int
+lookup_all(iconcache *cache, const char *dir, int n_icons)
+{
+  int found = 0;
+  int i, k;
+
+  for (i = 0; i < n_icons; i++)
+    {
+      char *path = icon_path(dir, i);
+      for (k = 0; k < (int)G_N_ELEMENTS(sizes); k++)
+        {
+          const guint8 *pixels = iconcache_lookup(cache, path, sizes[k]);
+          guint8 *expected = icon_pixels(i, sizes[k]);
+          if (pixels && !memcmp(pixels, expected, sizes[k] * sizes[k] * 4))
+            found++;
+          g_free(expected);
+        }
+      g_free(path);
+    }
+
+  return found;
+}
+
+static guint32
+read32(const char *data, guint32 offset)
+{
+  guint32 value;
+  memcpy(&value, data + offset, sizeof(value));
+  return value;
+}
+
+//
+// write a copy of the cache in which each record's next link is set by
+// next(record index, number of records), and check every lookup in it
+// finishes, without finding more than the uncorrupted records
+//
+static void
+check_corrupt(const char *cache_path, const char *dir, int n_icons,
+              guint32 (*next)(guint32 i, guint32 n), const char *what)
+{
+  char *data;
+  gsize len;
+
+  if (!g_file_get_contents(cache_path, &data, &len, NULL))
+    {
+      check(FALSE, what);
+      return;
+    }
+
+  guint32 n_records = read32(data, HEADER_N_RECORDS);
+  guint32 records = read32(data, HEADER_RECORDS);
+  guint32 i;
+  for (i = 0; i < n_records; i++)
+    {
+      guint32 value = next(i, n_records);
+      memcpy(data + records + i * RECORD_SIZE + RECORD_NEXT, &value, sizeof(value));
+    }
+
+  char *path = g_strconcat(cache_path, ".corrupt", NULL);
+  g_file_set_contents(path, data, len, NULL);
+  g_free(data);
+
+  iconcache *cache = iconcache_open(path);
+  gint64 start = g_get_monotonic_time();
+  int found = cache ? lookup_all(cache, dir, n_icons) : 0;
+  gint64 took = g_get_monotonic_time() - start;
+  iconcache_close(cache);
+  g_unlink(path);
+  g_free(path);
+
+  char *message = g_strdup_printf("%s: %d of %d lookups found, in %.1f ms", what,
+                                  found, n_icons * (int)G_N_ELEMENTS(sizes), took / 1000.0);
+  check(cache && (found <= n_icons * (int)G_N_ELEMENTS(sizes)), message);
+  g_free(message);
+}
+
+static guint32
+next_self(guint32 i, guint32 n)
+{
+  return i;
+}
+
+static guint32
+next_later(guint32 i, guint32 n)
+{
+  return (i + 1) % n;
+}
+
+static guint32
+next_out_of_range(guint32 i, guint32 n)
+{
+  return n + i;
+}
+
+// the process's proportional set size, in KiB, or -1 if it can't be read
+static gint64
+pss(void)
+{
+  char *contents;
+  gint64 value = -1;
+
+  if (!g_file_get_contents("/proc/self/smaps_rollup", &contents, NULL, NULL))
+    return -1;
+
+  char *p = strstr(contents, "\nPss:");
+  if (p)
+    value = g_ascii_strtoll(p + 5, NULL, 10);
+
+  g_free(contents);
+  return value;
+}
+
+//
+// fork n_readers which each look up every icon, keeping their pixels (copied,
+// if copy is set), and return their mean PSS, in KiB, measured once all of
+// them have done so
+//
+static volatile guint64 touched;
+
+static gint64
+measure_readers(const char *cache_path, const char *dir, int n_icons, int n_readers, gboolean copy)
+{
+  int ready[2], go[2], results[2];
+  gint64 total = 0;
+  int i;
+
+  if (pipe(ready) || pipe(go) || pipe(results))
+    {
+      perror("pipe");
+      exit(1);
+    }
+
+  fflush(stdout);
+  for (i = 0; i < n_readers; i++)
+    {
+      int pid = fork();
+      if (pid < 0)
+        {
+          perror("fork");
+          exit(1);
+        }
+      if (pid == 0)
+        {
+          iconcache *cache = iconcache_open(cache_path);
+          GPtrArray *copies = g_ptr_array_new_with_free_func(g_free);
+          int j, k;
+
+          for (j = 0; cache && (j < n_icons); j++)
+            {
+              char *path = icon_path(dir, j);
+              for (k = 0; k < (int)G_N_ELEMENTS(sizes); k++)
+                {
+                  gsize len = sizes[k] * sizes[k] * 4;
+                  const guint8 *pixels = iconcache_lookup(cache, path, sizes[k]);
+                  if (!pixels)
+                    continue;
+                  if (copy)
+                    g_ptr_array_add(copies, g_memdup(pixels, len));
+                  else
+                    {
+                      // touch each page, as drawing the menu would
+                      gsize p;
+                      for (p = 0; p < len; p += 64)
+                        touched += pixels[p];
+                    }
+                }
+              g_free(path);
+            }
+          if (copy)
+            iconcache_close(cache);
+
+          // wait until every reader has its icons
+          close(go[1]);
+          write(ready[1], "", 1);
+          char c;
+          read(go[0], &c, 1);
+
+          gint64 size = pss();
+          write(results[1], &size, sizeof(size));
+          _exit(0);
+        }
+    }
+
+  close(ready[1]);
+  close(go[0]);
+  close(results[1]);
+
+  for (i = 0; i < n_readers; i++)
+    {
+      char c;
+      read(ready[0], &c, 1);
+    }
+  close(go[1]);
+
+  for (i = 0; i < n_readers; i++)
+    {
+      gint64 size = -1;
+      if ((read(results[0], &size, sizeof(size)) != sizeof(size)) || (size < 0))
+        total = -1;
+      else if (total >= 0)
+        total += size;
+    }
+
+  close(ready[0]);
+  close(results[0]);
+  while (wait(NULL) > 0)
+    ;
+
+  return (total < 0) ? -1 : total / n_readers;
+}
+
+static void
+remove_tree(const char *path)
+{
+  GDir *dir = g_dir_open(path, 0, NULL);
+  if (dir)
+    {
+      const char *name;
+      while ((name = g_dir_read_name(dir)))
+        {
+          char *child = g_build_filename(path, name, NULL);
+          if (g_file_test(child, G_FILE_TEST_IS_DIR) && !g_file_test(child, G_FILE_TEST_IS_SYMLINK))
+            remove_tree(child);
+          else
+            g_unlink(child);
+          g_free(child);
+        }
+      g_dir_close(dir);
+    }
+  g_rmdir(path);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n_icons = 1500;
+  int n_readers = 4;
+  GError *error = NULL;
+  int i, k;
+
+  GOptionEntry options[] =
+    {
+      { "icons", 'n', 0, G_OPTION_ARG_INT, &n_icons, "Number of icons in the cache (default 1500)", "N" },
+      { "readers", 'r', 0, G_OPTION_ARG_INT, &n_readers, "Number of readers to measure (default 4)", "N" },
+      { NULL }
+    };
+
+  GOptionContext *context = g_option_context_new("- check the shared icon cache, and measure how much of it is shared");
+  g_option_context_add_main_entries(context, options, NULL);
+  if (!g_option_context_parse(context, &argc, &argv, &error))
+    {
+      fprintf(stderr, "%s\n", error->message);
+      return 1;
+    }
+  g_option_context_free(context);
+
+  if ((n_icons < 2) || (n_readers < 1))
+    {
+      fprintf(stderr, "at least 2 icons and 1 reader are needed\n");
+      return 1;
+    }
+
+  char *dir = g_dir_make_tmp("xwin-cachetest-XXXXXX", &error);
+  if (!dir)
+    {
+      fprintf(stderr, "%s\n", error->message);
+      return 1;
+    }
+  char *cache_path = g_build_filename(dir, "icons.cache", NULL);
+
+  // the icon files only need to exist, as the cache is keyed by their path
+  // and mtime
+  iconcache_writer *writer = iconcache_writer_new();
+  for (i = 0; i < n_icons; i++)
+    {
+      char *path = icon_path(dir, i);
+      g_file_set_contents(path, "", 0, NULL);
+      for (k = 0; k < (int)G_N_ELEMENTS(sizes); k++)
+        {
+          guint8 *bgra = icon_pixels(i, sizes[k]);
+          iconcache_writer_add(writer, path, sizes[k], bgra);
+          g_free(bgra);
+        }
+      g_free(path);
+    }
+  check(iconcache_writer_save(writer, cache_path, NULL), "cache written");
+  iconcache_writer_free(writer);
+
+  iconcache *cache = iconcache_open(cache_path);
+  check(cache != NULL, "cache opened");
+  check(iconcache_count(cache) == (guint)(n_icons * G_N_ELEMENTS(sizes)), "every icon in the cache");
+  check(lookup_all(cache, dir, n_icons) == n_icons * (int)G_N_ELEMENTS(sizes), "every icon found with its pixels");
+  check(!iconcache_lookup(cache, "/nonesuch.png", 16), "unknown icon not found");
+
+  char *modified = icon_path(dir, 0);
+  struct utimbuf times = { 0, 0 };
+  g_utime(modified, &times);
+  check(!iconcache_lookup(cache, modified, 16), "modified icon not found");
+  g_free(modified);
+  gsize mapped = iconcache_mapped_size(cache);
+  iconcache_close(cache);
+
+  check_corrupt(cache_path, dir, n_icons, next_self, "chains which loop");
+  check_corrupt(cache_path, dir, n_icons, next_later, "chains linking to later records");
+  check_corrupt(cache_path, dir, n_icons, next_out_of_range, "chains linking out of range");
+
+  gint64 shared = measure_readers(cache_path, dir, n_icons, n_readers, FALSE);
+  gint64 copied = measure_readers(cache_path, dir, n_icons, n_readers, TRUE);
+  if ((shared < 0) || (copied < 0))
+    printf("PSS not measured, as /proc/self/smaps_rollup can't be read\n");
+  else
+    {
+      printf("cache %" G_GSIZE_FORMAT " KiB, PSS of each of %d readers: %" G_GINT64_FORMAT " KiB sharing it, %" G_GINT64_FORMAT " KiB copying from it\n",
+             mapped / 1024, n_readers, shared, copied);
+      if (n_readers > 1)
+        check(shared < copied, "sharing the cache uses less memory than copying");
+    }
+
+  remove_tree(dir);
+  g_free(cache_path);
+  g_free(dir);
+
+  if (failures)
+    {
+      printf("%d checks failed\n", failures);
+      return 2;
+    }
+
+  return 0;
+}
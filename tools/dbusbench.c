@@ -0,0 +1,371 @@
+/*
+ * dbusbench.c
+ *
+ * Copyright (C) Jon Turney 2015
+ *
+ * This file is part of xwin-xdg-menu
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+//
+// xwin-xdg-menu-dbusbench: benchmark activating D-Bus applications
+//
+// A private session bus is started (which needs dbus-daemon), and a thread
+// owns a name on it and implements org.freedesktop.Application, noting when
+// Activate is received.  The application is then activated repeatedly as
+// xwin-xdg-menu does (dbuscall.c), and by running 'gapplication launch' as
+// it used to.
+//
+// The median and 90th percentile time from asking for each activation to it
+// being received, the time until the call completed or the helper exited,
+// and the CPU time the helpers took, are reported.  The first of each is
+// reported separately, as it includes opening the connection.  The exit
+// status is 2 if any activation wasn't received.
+//
+
+#include <gio/gio.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../dbuscall.h"
+
+#define BUS_NAME "org.xwin.DBusBench"
+#define OBJECT_PATH "/org/xwin/DBusBench"
+
+static const char introspection[] =
+  "<node>"
+  "  <interface name='org.freedesktop.Application'>"
+  "    <method name='Activate'>"
+  "      <arg type='a{sv}' name='platform_data' direction='in'/>"
+  "    </method>"
+  "  </interface>"
+  "</node>";
+
+static int failures;
+
+static void
+check(gboolean ok, const char *what)
+{
+  printf("%s: %s\n", ok ? "ok" : "FAIL", what);
+  if (!ok)
+    failures++;
+}
+
+//
+// The application, which runs in its own thread with its own connection, so
+// it isn't held up by the activations being timed
+//
+
+static GMutex lock;
+static GCond ready;
+static gboolean owned;
+static GMainLoop *service_loop;
+// when the latest Activate was received, and how many have been
+static gint64 activated;
+static int activations;
+
+static void
+method_call(GDBusConnection *connection, const gchar *sender,
+            const gchar *object_path, const gchar *interface_name,
+            const gchar *method_name, GVariant *parameters,
+            GDBusMethodInvocation *invocation, gpointer data)
+{
+  g_mutex_lock(&lock);
+  activated = g_get_monotonic_time();
+  activations++;
+  g_mutex_unlock(&lock);
+
+  g_dbus_method_invocation_return_value(invocation, NULL);
+}
+
+static const GDBusInterfaceVTable vtable = { method_call };
+
+static void
+name_acquired(GDBusConnection *connection, const gchar *name, gpointer data)
+{
+  g_mutex_lock(&lock);
+  owned = TRUE;
+  g_cond_signal(&ready);
+  g_mutex_unlock(&lock);
+}
+
+static gpointer
+service_thread(gpointer data)
+{
+  GMainContext *context = g_main_context_new();
+  GError *error = NULL;
+
+  g_main_context_push_thread_default(context);
+  service_loop = g_main_loop_new(context, FALSE);
+
+  char *address = g_dbus_address_get_for_bus_sync(G_BUS_TYPE_SESSION, NULL, &error);
+  GDBusConnection *connection = address ?
+    g_dbus_connection_new_for_address_sync(address,
+                                           G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+                                           G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+                                           NULL, NULL, &error) : NULL;
+  if (!connection)
+    {
+      fprintf(stderr, "Unable to connect to the test bus: %s\n", error->message);
+      exit(1);
+    }
+
+  GDBusNodeInfo *node = g_dbus_node_info_new_for_xml(introspection, NULL);
+  g_dbus_connection_register_object(connection, OBJECT_PATH, node->interfaces[0],
+                                    &vtable, NULL, NULL, NULL);
+  guint owner = g_bus_own_name_on_connection(connection, BUS_NAME,
+                                             G_BUS_NAME_OWNER_FLAGS_NONE,
+                                             name_acquired, NULL, NULL, NULL);
+
+  g_main_loop_run(service_loop);
+
+  g_bus_unown_name(owner);
+  g_dbus_connection_close_sync(connection, NULL, NULL);
+  g_object_unref(connection);
+  g_dbus_node_info_unref(node);
+  g_free(address);
+  g_main_loop_unref(service_loop);
+  g_main_context_pop_thread_default(context);
+  g_main_context_unref(context);
+  return NULL;
+}
+
+static gboolean
+quit_service(gpointer data)
+{
+  g_main_loop_quit(service_loop);
+  return G_SOURCE_REMOVE;
+}
+
+static gint64
+last_activated(void)
+{
+  g_mutex_lock(&lock);
+  gint64 when = activated;
+  activated = 0;
+  g_mutex_unlock(&lock);
+  return when;
+}
+
+//
+// Timings, in ms
+//
+
+static gint
+compare_doubles(gconstpointer a, gconstpointer b)
+{
+  double da = *(const double *)a, db = *(const double *)b;
+  return (da > db) - (da < db);
+}
+
+static double
+percentile(GArray *values, int p)
+{
+  g_array_sort(values, compare_doubles);
+  return g_array_index(values, double, (values->len - 1) * p / 100);
+}
+
+typedef struct
+{
+  const char *how;
+  double first_received;
+  double first_done;
+  GArray *received;
+  GArray *done;
+} timings;
+
+static void
+timings_add(timings *t, int i, gint64 start, gint64 received, gint64 done)
+{
+  double r = received ? (received - start) / 1000.0 : -1;
+  double d = (done - start) / 1000.0;
+
+  if (i == 0)
+    {
+      t->first_received = r;
+      t->first_done = d;
+    }
+  else if (received)
+    {
+      g_array_append_val(t->received, r);
+      g_array_append_val(t->done, d);
+    }
+}
+
+static void
+timings_report(timings *t)
+{
+  printf("%s: first received after %.2f ms, done after %.2f ms\n",
+         t->how, t->first_received, t->first_done);
+  if (t->received->len)
+    printf("%s: received after %.2f ms (90%% %.2f ms), done after %.2f ms (90%% %.2f ms)\n",
+           t->how, percentile(t->received, 50), percentile(t->received, 90),
+           percentile(t->done, 50), percentile(t->done, 90));
+  g_array_free(t->received, TRUE);
+  g_array_free(t->done, TRUE);
+}
+
+// the activations are logged, which would drown out the results
+static int
+quiet(void)
+{
+  fflush(stdout);
+  int saved = dup(STDOUT_FILENO);
+  int null = open("/dev/null", O_WRONLY);
+  dup2(null, STDOUT_FILENO);
+  close(null);
+  return saved;
+}
+
+static void
+unquiet(int saved)
+{
+  fflush(stdout);
+  dup2(saved, STDOUT_FILENO);
+  close(saved);
+}
+
+static double
+children_cpu(void)
+{
+  struct rusage ru;
+  getrusage(RUSAGE_CHILDREN, &ru);
+  return ru.ru_utime.tv_sec * 1000.0 + ru.ru_utime.tv_usec / 1000.0 +
+    ru.ru_stime.tv_sec * 1000.0 + ru.ru_stime.tv_usec / 1000.0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n_activations = 200;
+  GError *error = NULL;
+  int i;
+
+  GOptionEntry options[] =
+    {
+      { "activations", 'n', 0, G_OPTION_ARG_INT, &n_activations, "Number of activations each way (default 200)", "N" },
+      { NULL }
+    };
+
+  GOptionContext *context = g_option_context_new("- benchmark activating D-Bus applications");
+  g_option_context_add_main_entries(context, options, NULL);
+  if (!g_option_context_parse(context, &argc, &argv, &error))
+    {
+      fprintf(stderr, "%s\n", error->message);
+      return 1;
+    }
+  g_option_context_free(context);
+  if (n_activations < 2)
+    n_activations = 2;
+
+  GTestDBus *bus = g_test_dbus_new(G_TEST_DBUS_NONE);
+  g_test_dbus_up(bus);
+
+  GThread *service = g_thread_new("service", service_thread, NULL);
+  g_mutex_lock(&lock);
+  while (!owned)
+    g_cond_wait(&ready, &lock);
+  g_mutex_unlock(&lock);
+
+  // in-process
+  timings in_process = { "in-process", 0, 0,
+                         g_array_new(FALSE, FALSE, sizeof(double)),
+                         g_array_new(FALSE, FALSE, sizeof(double)) };
+  int received = 0;
+  int saved = quiet();
+  for (i = 0; i < n_activations; i++)
+    {
+      gint64 start = g_get_monotonic_time();
+      dbus_call_activate(BUS_NAME);
+      while (dbus_call_pending())
+        g_main_context_iteration(NULL, TRUE);
+      gint64 when = last_activated();
+      timings_add(&in_process, i, start, when, g_get_monotonic_time());
+      if (when)
+        received++;
+    }
+  unquiet(saved);
+
+  char *message = g_strdup_printf("%d of %d in-process activations received", received, n_activations);
+  check(received == n_activations, message);
+  g_free(message);
+
+  // spawning the helper, as a launch did
+  timings spawned = { "gapplication launch", 0, 0,
+                      g_array_new(FALSE, FALSE, sizeof(double)),
+                      g_array_new(FALSE, FALSE, sizeof(double)) };
+  double cpu = children_cpu();
+  received = 0;
+  for (i = 0; i < n_activations; i++)
+    {
+      int status = -1;
+      gint64 start = g_get_monotonic_time();
+      int pid = fork();
+      if (pid == 0)
+        {
+          execl("/bin/sh", "/bin/sh", "-c", "gapplication launch " BUS_NAME, (char *)NULL);
+          _exit(127);
+        }
+      if (pid > 0)
+        waitpid(pid, &status, 0);
+      gint64 when = last_activated();
+      timings_add(&spawned, i, start, when, g_get_monotonic_time());
+      if (when && (status == 0))
+        received++;
+    }
+  cpu = children_cpu() - cpu;
+
+  message = g_strdup_printf("%d of %d spawned activations received", received, n_activations);
+  check(received == n_activations, message);
+  g_free(message);
+
+  g_mutex_lock(&lock);
+  message = g_strdup_printf("%d activations received in all", activations);
+  check(activations == 2 * n_activations, message);
+  g_mutex_unlock(&lock);
+  g_free(message);
+
+  timings_report(&in_process);
+  timings_report(&spawned);
+  printf("gapplication launch: %.2f ms CPU per activation\n", cpu / n_activations);
+
+  saved = quiet();
+  dbus_call_shutdown();
+  unquiet(saved);
+  g_main_context_invoke(g_main_loop_get_context(service_loop), quit_service, NULL);
+  g_thread_join(service);
+  g_test_dbus_down(bus);
+  g_object_unref(bus);
+
+  if (failures)
+    {
+      printf("%d checks failed\n", failures);
+      return 2;
+    }
+
+  return 0;
+}
@@ -0,0 +1,369 @@
+/*
+ * dirwatchtest.c
+ *
+ * Copyright (C) Jon Turney 2015
+ *
+ * This file is part of xwin-xdg-menu
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+//
+// xwin-xdg-menu-dirwatchtest: check noticing changes to the menu's files
+//
+// A temporary tree of directories and files is watched as xwin-xdg-menu does
+// (dirwatch.c), once polling everything (a budget of 0), and once monitoring
+// everything (no budget).  Files and directories are then created, edited and
+// deleted, and it's checked that the changed callback is called exactly once
+// for each change which alters a fingerprint, and not at all for those which
+// don't: a file rewritten in place with its modification time put back, and
+// a file created below a directory which is only watched itself.
+//
+// Each check is reported, with how long the change took to be noticed, and
+// the exit status is 2 if any failed.
+//
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../dirwatch.h"
+
+static int failures;
+
+static void
+check(gboolean ok, const char *what)
+{
+  printf("%s: %s\n", ok ? "ok" : "FAIL", what);
+  if (!ok)
+    failures++;
+}
+
+static int interval = 100;
+static int quiet_time = 3000;
+
+static char *root;
+static GPtrArray *paths;
+static dirwatch *watch;
+static int changes;
+static gint64 changed_at;
+
+// as menu.c does, what's there now is the new starting point
+static void
+changed(gpointer data)
+{
+  changes++;
+  if (!changed_at)
+    changed_at = g_get_monotonic_time();
+  dirwatch_set_paths(watch, paths);
+}
+
+// the dirwatch.c messages would drown out the results
+static void
+quiet(const gchar *string)
+{
+}
+
+static char *
+tree_path(const char *name)
+{
+  return g_build_filename(root, name, NULL);
+}
+
+static void
+write_file(const char *name, const char *contents)
+{
+  char *path = tree_path(name);
+  g_file_set_contents(path, contents, -1, NULL);
+  g_free(path);
+}
+
+static void
+remove_tree(const char *path)
+{
+  GDir *dir = g_dir_open(path, 0, NULL);
+  if (dir)
+    {
+      const char *name;
+      while ((name = g_dir_read_name(dir)))
+        {
+          char *child = g_build_filename(path, name, NULL);
+          if (g_file_test(child, G_FILE_TEST_IS_DIR) && !g_file_test(child, G_FILE_TEST_IS_SYMLINK))
+            remove_tree(child);
+          else
+            g_unlink(child);
+          g_free(child);
+        }
+      g_dir_close(dir);
+    }
+  g_rmdir(path);
+}
+
+//
+// The changes
+//
+
+static void
+create_entry(void)
+{
+  write_file("applications/new.desktop", "[Desktop Entry]\nName=New\n");
+}
+
+static void
+edit_entry(void)
+{
+  write_file("applications/a.desktop", "[Desktop Entry]\nName=Edited\n");
+}
+
+static void
+delete_entry(void)
+{
+  char *path = tree_path("applications/b.desktop");
+  g_unlink(path);
+  g_free(path);
+}
+
+static void
+create_directory(void)
+{
+  char *path = tree_path("desktop-directories");
+  g_mkdir(path, 0755);
+  g_free(path);
+  write_file("desktop-directories/new.directory", "[Desktop Entry]\nName=New\n");
+}
+
+static void
+edit_menu(void)
+{
+  write_file("menus/test.menu", "<Menu><Name>Edited</Name></Menu>\n");
+}
+
+// rewrite the menu file in place with the same contents, and put its
+// modification time back, so nothing that's fingerprinted changes, though a
+// monitor sees it
+static void
+rewrite_menu_unchanged(void)
+{
+  char *path = tree_path("menus/test.menu");
+  char *contents = NULL;
+  gsize len = 0;
+  struct stat st;
+
+  if (g_file_get_contents(path, &contents, &len, NULL) && (stat(path, &st) == 0))
+    {
+      int fd = open(path, O_WRONLY | O_TRUNC);
+      if (fd >= 0)
+        {
+          if (write(fd, contents, len) == (ssize_t)len)
+            {
+              struct timespec times[2] = { st.st_atim, st.st_mtim };
+              futimens(fd, times);
+            }
+          close(fd);
+        }
+    }
+
+  g_free(contents);
+  g_free(path);
+}
+
+// a directory below one which is watched changes, but the watched directory
+// and what's in it don't
+static void
+create_below(void)
+{
+  write_file("applications/kde/deep/hidden.desktop", "[Desktop Entry]\nName=Hidden\n");
+}
+
+typedef struct
+{
+  const char *what;
+  void (*change)(void);
+  gboolean fingerprinted;
+} change;
+
+static const change test_changes[] =
+  {
+    { "create an entry", create_entry, TRUE },
+    { "edit an entry", edit_entry, TRUE },
+    { "delete an entry", delete_entry, TRUE },
+    { "create a watched directory which didn't exist", create_directory, TRUE },
+    { "edit a watched file", edit_menu, TRUE },
+    { "rewrite a watched file unchanged", rewrite_menu_unchanged, FALSE },
+    { "create a file below a watched directory's subdirectory", create_below, FALSE },
+  };
+
+static gboolean
+timed_out(gpointer data)
+{
+  *(gboolean *)data = TRUE;
+  return G_SOURCE_REMOVE;
+}
+
+// run the main loop for ms
+static void
+run_for(int ms)
+{
+  gboolean done = FALSE;
+  g_timeout_add(ms, timed_out, &done);
+  while (!done)
+    g_main_context_iteration(NULL, TRUE);
+}
+
+// run the main loop until changed is called, or for up to ms
+static void
+run_until_changed(int ms)
+{
+  gint64 deadline = g_get_monotonic_time() + ms * 1000;
+  while (!changes && (g_get_monotonic_time() < deadline))
+    run_for(10);
+}
+
+static void
+setup(void)
+{
+  GError *error = NULL;
+
+  root = g_dir_make_tmp("xwin-dirwatchtest-XXXXXX", &error);
+  if (!root)
+    {
+      fprintf(stderr, "%s\n", error->message);
+      exit(1);
+    }
+
+  char *dir = tree_path("applications/kde/deep");
+  g_mkdir_with_parents(dir, 0755);
+  g_free(dir);
+  dir = tree_path("menus");
+  g_mkdir_with_parents(dir, 0755);
+  g_free(dir);
+
+  write_file("applications/a.desktop", "[Desktop Entry]\nName=A\n");
+  write_file("applications/b.desktop", "[Desktop Entry]\nName=B\n");
+  write_file("menus/test.menu", "<Menu><Name>Test</Name></Menu>\n");
+
+  // as menu.c watches: the menu file's directory, and the directories entries
+  // and directory files come from, or would
+  paths = g_ptr_array_new_with_free_func(g_free);
+  g_ptr_array_add(paths, tree_path("menus"));
+  g_ptr_array_add(paths, tree_path("menus/test.menu"));
+  g_ptr_array_add(paths, tree_path("applications"));
+  g_ptr_array_add(paths, tree_path("desktop-directories"));
+}
+
+static void
+teardown(void)
+{
+  remove_tree(root);
+  g_free(root);
+  root = NULL;
+  g_ptr_array_free(paths, TRUE);
+  paths = NULL;
+}
+
+static void
+run(int budget, const char *how)
+{
+  char *message;
+  guint i;
+
+  printf("%s:\n", how);
+  setup();
+
+  g_set_print_handler(quiet);
+  watch = dirwatch_new(budget, interval, changed, NULL);
+  dirwatch_set_paths(watch, paths);
+  g_set_print_handler(NULL);
+
+  message = g_strdup_printf("%u of %u paths monitored, %u polled",
+                            dirwatch_monitored(watch), paths->len, dirwatch_polled(watch));
+  check(budget == 0 ? (dirwatch_polled(watch) == paths->len) :
+        (dirwatch_monitored(watch) == paths->len), message);
+  g_free(message);
+
+  for (i = 0; i < G_N_ELEMENTS(test_changes); i++)
+    {
+      const change *c = &test_changes[i];
+
+      // let the polling interval back off, as it would have while idle
+      g_set_print_handler(quiet);
+      run_for(interval);
+      changes = 0;
+      changed_at = 0;
+      gint64 start = g_get_monotonic_time();
+      c->change();
+      if (c->fingerprinted)
+        run_until_changed(quiet_time * 2);
+      // and then for any further calls
+      run_for(quiet_time);
+      g_set_print_handler(NULL);
+
+      if (c->fingerprinted)
+        message = g_strdup_printf("%s: changed called %d times, after %.0f ms", c->what, changes,
+                                  changed_at ? (changed_at - start) / 1000.0 : -1.0);
+      else
+        message = g_strdup_printf("%s: changed called %d times", c->what, changes);
+      check(changes == (c->fingerprinted ? 1 : 0), message);
+      g_free(message);
+    }
+
+  dirwatch_free(watch);
+  watch = NULL;
+  teardown();
+}
+
+int
+main(int argc, char *argv[])
+{
+  GError *error = NULL;
+
+  GOptionEntry options[] =
+    {
+      { "interval", 'i', 0, G_OPTION_ARG_INT, &interval, "The shortest polling interval (default 100)", "MS" },
+      { "quiet", 'q', 0, G_OPTION_ARG_INT, &quiet_time, "Time to wait for changed to be called more than expected (default 3000)", "MS" },
+      { NULL }
+    };
+
+  GOptionContext *context = g_option_context_new("- check noticing changes to the menu's files");
+  g_option_context_add_main_entries(context, options, NULL);
+  if (!g_option_context_parse(context, &argc, &argv, &error))
+    {
+      fprintf(stderr, "%s\n", error->message);
+      return 1;
+    }
+  g_option_context_free(context);
+
+  run(0, "Polling everything (budget 0)");
+  run(-1, "Monitoring everything (no budget)");
+
+  if (failures)
+    {
+      printf("%d checks failed\n", failures);
+      return 2;
+    }
+
+  return 0;
+}
@@ -0,0 +1,295 @@
+/*
+ * fsrecord.c
+ *
+ * Copyright (C) Jon Turney 2015
+ *
+ * This file is part of xwin-xdg-menu
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+//
+// xwin-xdg-menu-fsrecord: record changes to the files the menu is built from
+//
+// This watches the directories containing desktop entries, directory files,
+// menu files and icon themes, and writes a timestamped line to a trace file
+// for each file created, changed or deleted, until interrupted.  The trace can
+// then be replayed by xwin-xdg-menu-fsreplay, to reproduce what happens to
+// the menu during e.g. a package upgrade.
+//
+// The trace is a text file.  After a header line, there is a line for each
+// watched root directory:
+//
+//   root <index> <path>
+//
+// followed by a line for each change, with tab separated fields:
+//
+//   <microseconds since start> <C|M|D> <root index> <path relative to root> <data>
+//
+// where data is "text:" followed by the (escaped) contents, for desktop
+// entries, directory files and menu files, or "size:" followed by the size of
+// the file, for anything else (e.g. icons and icon caches), which is all that
+// is needed to replay it as a change.
+//
+
+#include <glib.h>
+#include <glib-unix.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+
+#define TRACE_HEADER "# xwin-xdg-menu fs trace 1"
+
+// the most file contents to record
+#define TEXT_MAX (64 * 1024)
+
+typedef struct
+{
+  int index;
+  char *path;
+  GFile *file;
+} root;
+
+static FILE *out;
+static gint64 started;
+static unsigned int recorded;
+// GFile -> GFileMonitor for each watched directory
+static GHashTable *monitors;
+
+static void watch_dir(root *r, GFile *dir);
+
+static gboolean
+is_text(const char *path)
+{
+  return g_str_has_suffix(path, ".desktop") || g_str_has_suffix(path, ".directory") ||
+    g_str_has_suffix(path, ".menu");
+}
+
+static void
+record(root *r, char op, GFile *file)
+{
+  char *path = g_file_get_path(file);
+  char *relative = g_file_get_relative_path(r->file, file);
+  char *data = NULL;
+
+  if (!path || !relative)
+    goto out;
+
+  if (op != 'D')
+    {
+      gchar *contents;
+      gsize length;
+
+      if (is_text(path) && g_file_get_contents(path, &contents, &length, NULL) &&
+          (length <= TEXT_MAX))
+        {
+          char *escaped = g_strescape(contents, NULL);
+          data = g_strdup_printf("text:%s", escaped);
+          g_free(escaped);
+          g_free(contents);
+        }
+      else
+        {
+          GStatBuf st;
+          data = g_strdup_printf("size:%ld", (g_stat(path, &st) == 0) ? (long)st.st_size : 0L);
+        }
+    }
+
+  fprintf(out, "%" G_GINT64_FORMAT "\t%c\t%d\t%s\t%s\n",
+          g_get_monotonic_time() - started, op, r->index, relative, data ? data : "");
+  recorded++;
+
+ out:
+  g_free(data);
+  g_free(relative);
+  g_free(path);
+}
+
+static void
+changed(GFileMonitor *monitor, GFile *file, GFile *other, GFileMonitorEvent event, gpointer data)
+{
+  root *r = data;
+
+  switch (event)
+    {
+    case G_FILE_MONITOR_EVENT_CREATED:
+      if (g_file_query_file_type(file, G_FILE_QUERY_INFO_NONE, NULL) == G_FILE_TYPE_DIRECTORY)
+        watch_dir(r, file);
+      else
+        record(r, 'C', file);
+      break;
+
+    case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+      record(r, 'M', file);
+      break;
+
+    case G_FILE_MONITOR_EVENT_DELETED:
+      if (!g_hash_table_remove(monitors, file))
+        record(r, 'D', file);
+      break;
+
+    default:
+      break;
+    }
+}
+
+// watch dir, and all the directories under it
+static void
+watch_dir(root *r, GFile *dir)
+{
+  GError *error = NULL;
+
+  if (g_hash_table_contains(monitors, dir))
+    return;
+
+  GFileMonitor *monitor = g_file_monitor_directory(dir, G_FILE_MONITOR_NONE, NULL, &error);
+  if (!monitor)
+    {
+      char *path = g_file_get_path(dir);
+      fprintf(stderr, "Can't watch %s: %s\n", path, error->message);
+      g_free(path);
+      g_error_free(error);
+      return;
+    }
+  g_signal_connect(monitor, "changed", G_CALLBACK(changed), r);
+  g_hash_table_insert(monitors, g_object_ref(dir), monitor);
+
+  GFileEnumerator *e = g_file_enumerate_children(dir, G_FILE_ATTRIBUTE_STANDARD_NAME "," G_FILE_ATTRIBUTE_STANDARD_TYPE,
+                                                 G_FILE_QUERY_INFO_NONE, NULL, NULL);
+  if (!e)
+    return;
+
+  GFileInfo *info;
+  while ((info = g_file_enumerator_next_file(e, NULL, NULL)))
+    {
+      if (g_file_info_get_file_type(info) == G_FILE_TYPE_DIRECTORY)
+        {
+          GFile *child = g_file_get_child(dir, g_file_info_get_name(info));
+          watch_dir(r, child);
+          g_object_unref(child);
+        }
+      g_object_unref(info);
+    }
+  g_object_unref(e);
+}
+
+static gboolean
+stop(gpointer data)
+{
+  g_main_loop_quit(data);
+  return G_SOURCE_REMOVE;
+}
+
+int
+main(int argc, char *argv[])
+{
+  gchar *output = NULL;
+  int duration = 0;
+  gchar **dirs = NULL;
+  GError *error = NULL;
+  int i;
+
+  GOptionEntry entries[] =
+    {
+      { "output", 'o', 0, G_OPTION_ARG_FILENAME, &output, "Trace file to write (default standard output)", "FILE" },
+      { "duration", 'd', 0, G_OPTION_ARG_INT, &duration, "Stop after this many seconds (default when interrupted)", "SECONDS" },
+      { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &dirs, NULL, "[DIRECTORY...]" },
+      { NULL }
+    };
+
+  GOptionContext *context = g_option_context_new("- record changes to desktop entries, menus and icons");
+  g_option_context_add_main_entries(context, entries, NULL);
+  if (!g_option_context_parse(context, &argc, &argv, &error))
+    {
+      fprintf(stderr, "%s\n", error->message);
+      return 1;
+    }
+  g_option_context_free(context);
+
+  // by default, everywhere the menu is built from
+  if (!dirs)
+    {
+      GPtrArray *defaults = g_ptr_array_new();
+      const gchar * const *data_dirs = g_get_system_data_dirs();
+      const gchar * const *config_dirs = g_get_system_config_dirs();
+      static const char *data_subdirs[] = { "applications", "desktop-directories", "icons", NULL };
+      int j;
+
+      for (j = 0; data_subdirs[j]; j++)
+        g_ptr_array_add(defaults, g_build_filename(g_get_user_data_dir(), data_subdirs[j], NULL));
+      for (i = 0; data_dirs[i]; i++)
+        for (j = 0; data_subdirs[j]; j++)
+          g_ptr_array_add(defaults, g_build_filename(data_dirs[i], data_subdirs[j], NULL));
+
+      g_ptr_array_add(defaults, g_build_filename(g_get_user_config_dir(), "menus", NULL));
+      for (i = 0; config_dirs[i]; i++)
+        g_ptr_array_add(defaults, g_build_filename(config_dirs[i], "menus", NULL));
+
+      g_ptr_array_add(defaults, NULL);
+      dirs = (gchar **)g_ptr_array_free(defaults, FALSE);
+    }
+
+  out = output ? fopen(output, "w") : stdout;
+  if (!out)
+    {
+      perror(output);
+      return 1;
+    }
+
+  fprintf(out, TRACE_HEADER "\n");
+
+  monitors = g_hash_table_new_full(g_file_hash, (GEqualFunc)g_file_equal, g_object_unref, g_object_unref);
+  started = g_get_monotonic_time();
+
+  for (i = 0; dirs[i]; i++)
+    {
+      if (!g_file_test(dirs[i], G_FILE_TEST_IS_DIR))
+        continue;
+
+      root *r = g_new0(root, 1);
+      r->index = i;
+      r->path = g_strdup(dirs[i]);
+      r->file = g_file_new_for_path(r->path);
+      fprintf(out, "root %d %s\n", r->index, r->path);
+
+      watch_dir(r, r->file);
+    }
+  fflush(out);
+
+  fprintf(stderr, "Watching %u directories\n", g_hash_table_size(monitors));
+
+  GMainLoop *loop = g_main_loop_new(NULL, FALSE);
+  g_unix_signal_add(SIGINT, stop, loop);
+  g_unix_signal_add(SIGTERM, stop, loop);
+  if (duration > 0)
+    g_timeout_add_seconds(duration, stop, loop);
+  g_main_loop_run(loop);
+
+  fprintf(stderr, "Recorded %u changes\n", recorded);
+
+  g_hash_table_destroy(monitors);
+  if (out != stdout)
+    fclose(out);
+
+  return 0;
+}
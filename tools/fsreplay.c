@@ -0,0 +1,723 @@
+/*
+ * fsreplay.c
+ *
+ * Copyright (C) Jon Turney 2015
+ *
+ * This file is part of xwin-xdg-menu
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+//
+// xwin-xdg-menu-fsreplay: replay a trace of changes against a synthetic XDG
+// tree, and report how the menu kept up
+//
+// A trace recorded by xwin-xdg-menu-fsrecord is replayed, at the recorded
+// pace (or faster or slower), into a temporary directory which mirrors the
+// recorded directories, and which the XDG environment variables point at.
+// The directories are first populated with a number of synthetic desktop
+// entries.
+//
+// Meanwhile, the menu is constructed as xwin-xdg-menu does, rebuilding it
+// whenever libgnome-menu says the menu tree has changed, but without the
+// Windows menu and icons, so this runs anywhere libgnome-menu does.
+//
+// With --budget, changes are instead noticed as xwin-xdg-menu's own watching
+// (dirwatch.c) does, for every directory in the tree, monitoring at most that
+// many and polling the rest.  --budget 0 polls everything, as happens on a
+// network filesystem.
+//
+// After the last change, and a period for things to settle, the number of
+// rebuilds, the CPU time they took, and whether the final menu is up to date
+// (and how long after the last change it became so) are reported.
+//
+// Before replaying, the heap used by a loaded menu tree (which owns the
+// GDesktopAppInfo of each entry), as xwin-xdg-menu used to keep, is compared
+// with that used by the entry table it keeps instead.
+//
+// With --soak, the menu is then rebuilt many more times, checking that memory
+// and file descriptor use doesn't grow.  Built with -Db_sanitize=address, any
+// leaks are also reported on exit.
+//
+
+#define GMENU_I_KNOW_THIS_IS_UNSTABLE
+#include <gmenu-tree.h>
+#include <gio/gdesktopappinfo.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../dirwatch.h"
+#include "../entrytable.h"
+#include "../soak.h"
+
+#define TRACE_HEADER "# xwin-xdg-menu fs trace 1"
+
+// normally defined by the build to be the one in the source tree
+#ifndef XWIN_APPLICATIONS_MENU
+#define XWIN_APPLICATIONS_MENU "/etc/xdg/menus/xwin-applications.menu"
+#endif
+
+// the biggest file to create for a change which only recorded the size
+#define SIZE_MAX_REPLAYED (64 * 1024 * 1024)
+
+typedef struct
+{
+  gint64 time;
+  char op;
+  char *path;
+  char *data;
+} event;
+
+static GArray *events;
+static guint next_event;
+static double speed = 1.0;
+static int settle = 5000;
+
+static gint64 replay_started;
+static gint64 last_event;
+static unsigned int skipped;
+
+static GMainLoop *loop;
+static GMenuTree *tree;
+static guint rebuild_source;
+
+// if noticing changes with dirwatch.c, rather than libgnome-menu
+static dirwatch *watch;
+static char *watch_root;
+static const char *menu_path;
+
+// the most recently constructed menu
+static entrytable *built;
+static gint64 built_at;
+
+static unsigned int rebuilds;
+static gint64 rebuild_cpu;
+
+static gint64
+thread_cpu_time(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (gint64)ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+}
+
+//
+// Reading the trace
+//
+
+// the root directories in the trace, and where they are mirrored
+static GPtrArray *mirrors;
+static unsigned int nroots;
+
+static gboolean
+trace_read(const char *filename, const char *tmpdir)
+{
+  gchar *contents;
+  GError *error = NULL;
+
+  if (!g_file_get_contents(filename, &contents, NULL, &error))
+    {
+      fprintf(stderr, "%s\n", error->message);
+      g_error_free(error);
+      return FALSE;
+    }
+
+  gchar **lines = g_strsplit(contents, "\n", -1);
+  g_free(contents);
+
+  if (!lines[0] || (strcmp(lines[0], TRACE_HEADER) != 0))
+    {
+      fprintf(stderr, "%s isn't a trace file\n", filename);
+      g_strfreev(lines);
+      return FALSE;
+    }
+
+  events = g_array_new(FALSE, FALSE, sizeof(event));
+  mirrors = g_ptr_array_new();
+
+  int i;
+  for (i = 1; lines[i]; i++)
+    {
+      if (!*lines[i])
+        continue;
+
+      int index, offset;
+      if (sscanf(lines[i], "root %d %n", &index, &offset) == 1)
+        {
+          if (index < 0)
+            continue;
+          if ((guint)index >= mirrors->len)
+            g_ptr_array_set_size(mirrors, index + 1);
+          if (!g_ptr_array_index(mirrors, index))
+            nroots++;
+          g_free(g_ptr_array_index(mirrors, index));
+          g_ptr_array_index(mirrors, index) = g_build_filename(tmpdir, lines[i] + offset, NULL);
+          continue;
+        }
+
+      gchar **fields = g_strsplit(lines[i], "\t", 5);
+      if (g_strv_length(fields) == 5)
+        {
+          index = atoi(fields[2]);
+          if ((index >= 0) && ((guint)index < mirrors->len) && g_ptr_array_index(mirrors, index) &&
+              !strstr(fields[3], ".."))
+            {
+              event e;
+              e.time = g_ascii_strtoll(fields[0], NULL, 10);
+              e.op = fields[1][0];
+              e.path = g_build_filename(g_ptr_array_index(mirrors, index), fields[3], NULL);
+              e.data = g_strdup(fields[4]);
+              g_array_append_val(events, e);
+            }
+        }
+      g_strfreev(fields);
+    }
+
+  g_strfreev(lines);
+  return TRUE;
+}
+
+//
+// The synthetic XDG tree
+//
+
+static void
+append_dir(GString *dirs, const char *dir)
+{
+  if (dirs->len)
+    g_string_append_c(dirs, ':');
+  g_string_append(dirs, dir);
+}
+
+// point the XDG environment variables at the mirrored directories.  This must
+// be done before GLib looks at them
+static char *
+xdg_setup(const char *tmpdir)
+{
+  GString *data_dirs = g_string_new(NULL);
+  GString *config_dirs = g_string_new(NULL);
+  char *applications = NULL;
+  guint i;
+
+  for (i = 0; i < mirrors->len; i++)
+    {
+      const char *mirror = g_ptr_array_index(mirrors, i);
+      if (!mirror)
+        continue;
+
+      g_mkdir_with_parents(mirror, 0755);
+
+      char *base = g_path_get_basename(mirror);
+      char *parent = g_path_get_dirname(mirror);
+      if (strcmp(base, "menus") == 0)
+        append_dir(config_dirs, parent);
+      else if (!strstr(data_dirs->str, parent))
+        append_dir(data_dirs, parent);
+
+      if (!applications && (strcmp(base, "applications") == 0))
+        applications = g_strdup(mirror);
+
+      g_free(parent);
+      g_free(base);
+    }
+
+  if (!applications)
+    {
+      char *share = g_build_filename(tmpdir, "usr", "share", NULL);
+      append_dir(data_dirs, share);
+      applications = g_build_filename(share, "applications", NULL);
+      g_mkdir_with_parents(applications, 0755);
+      g_free(share);
+    }
+
+  char *home = g_build_filename(tmpdir, "home", NULL);
+  char *data_home = g_build_filename(home, ".local", "share", NULL);
+  char *config_home = g_build_filename(home, ".config", NULL);
+  g_setenv("XDG_DATA_HOME", data_home, TRUE);
+  g_setenv("XDG_CONFIG_HOME", config_home, TRUE);
+  g_setenv("XDG_DATA_DIRS", data_dirs->str, TRUE);
+  if (config_dirs->len)
+    g_setenv("XDG_CONFIG_DIRS", config_dirs->str, TRUE);
+  g_free(config_home);
+  g_free(data_home);
+  g_free(home);
+
+  g_string_free(config_dirs, TRUE);
+  g_string_free(data_dirs, TRUE);
+
+  return applications;
+}
+
+static void
+populate(const char *applications, int count)
+{
+  static const char *categories[] = { "Development", "Education", "Game", "Graphics",
+                                      "Network", "AudioVideo", "Office", "Settings",
+                                      "System", "Utility" };
+  int i;
+
+  for (i = 0; i < count; i++)
+    {
+      char *name = g_strdup_printf("xwin-replay-%d.desktop", i);
+      char *path = g_build_filename(applications, name, NULL);
+      char *contents = g_strdup_printf("[Desktop Entry]\n"
+                                       "Type=Application\n"
+                                       "Name=Synthetic application %d\n"
+                                       "Exec=true %d\n"
+                                       "Icon=xwin-replay-%d\n"
+                                       "Categories=%s;\n",
+                                       i, i, i, categories[i % G_N_ELEMENTS(categories)]);
+      g_file_set_contents(path, contents, -1, NULL);
+      g_free(contents);
+      g_free(path);
+      g_free(name);
+    }
+}
+
+static void
+remove_tree(const char *path)
+{
+  GDir *dir = g_dir_open(path, 0, NULL);
+  if (dir)
+    {
+      const char *name;
+      while ((name = g_dir_read_name(dir)))
+        {
+          char *child = g_build_filename(path, name, NULL);
+          if (g_file_test(child, G_FILE_TEST_IS_DIR) && !g_file_test(child, G_FILE_TEST_IS_SYMLINK))
+            remove_tree(child);
+          else
+            g_unlink(child);
+          g_free(child);
+        }
+      g_dir_close(dir);
+    }
+  g_rmdir(path);
+}
+
+//
+// Constructing the menu, as menu.c does, but only recording what's needed to
+// launch each entry
+//
+
+static void
+build_directory(entrytable *t, GMenuTreeDirectory *directory)
+{
+  GMenuTreeIter *iter = gmenu_tree_directory_iter(directory);
+  GMenuTreeItemType type;
+
+  while ((type = gmenu_tree_iter_next(iter)) != GMENU_TREE_ITEM_INVALID)
+    {
+      if (type == GMENU_TREE_ITEM_ENTRY)
+        {
+          GMenuTreeEntry *entry = gmenu_tree_iter_get_entry(iter);
+          GDesktopAppInfo *appinfo = gmenu_tree_entry_get_app_info(entry);
+          GIcon *icon = g_app_info_get_icon(G_APP_INFO(appinfo));
+          char *icon_name = icon ? g_icon_to_string(icon) : NULL;
+
+          entrytable_add(t, gmenu_tree_entry_get_desktop_file_id(entry),
+                         gmenu_tree_entry_get_desktop_file_path(entry),
+                         g_app_info_get_display_name(G_APP_INFO(appinfo)),
+                         g_app_info_get_commandline(G_APP_INFO(appinfo)),
+                         icon_name,
+                         g_desktop_app_info_get_categories(appinfo),
+                         0);
+          g_free(icon_name);
+          gmenu_tree_item_unref(entry);
+        }
+      else if (type == GMENU_TREE_ITEM_DIRECTORY)
+        {
+          GMenuTreeDirectory *subdirectory = gmenu_tree_iter_get_directory(iter);
+          build_directory(t, subdirectory);
+          gmenu_tree_item_unref(subdirectory);
+        }
+    }
+  gmenu_tree_iter_unref(iter);
+}
+
+static entrytable *
+build(GMenuTree *t)
+{
+  GError *error = NULL;
+  entrytable *table = entrytable_new();
+
+  if (!gmenu_tree_load_sync(t, &error))
+    {
+      fprintf(stderr, "Failed to load tree: %s\n", error->message);
+      g_error_free(error);
+      return table;
+    }
+
+  GMenuTreeDirectory *root = gmenu_tree_get_root_directory(t);
+  if (root)
+    {
+      build_directory(table, root);
+      gmenu_tree_item_unref(root);
+    }
+  entrytable_freeze(table);
+
+  return table;
+}
+
+//
+// Report the heap used per entry with a menu tree loaded, and once only the
+// entry table built from it is left.  GSlice allocations are only counted
+// with G_SLICE=always-malloc
+//
+static void
+footprint(const char *path)
+{
+  gint64 heap = soak_heap();
+  GMenuTree *t = gmenu_tree_new_for_path(path, GMENU_TREE_FLAGS_SORT_DISPLAY_NAME);
+  entrytable *table = build(t);
+  gint64 with_tree = soak_heap() - heap;
+
+  g_object_unref(t);
+  // let any monitors be torn down
+  while (g_main_context_iteration(NULL, FALSE))
+    ;
+  gint64 without_tree = soak_heap() - heap;
+
+  guint n = entrytable_count(table);
+  if (n)
+    printf("Heap per entry: %.0f bytes with the menu tree loaded, %.0f bytes with only the entry table (%.0f bytes of records and strings)\n",
+           (double)with_tree / n, (double)without_tree / n, (double)entrytable_size(table) / n);
+  entrytable_free(table);
+}
+
+// every directory under path
+static void
+collect_dirs(GPtrArray *paths, const char *path)
+{
+  GDir *dir = g_dir_open(path, 0, NULL);
+  if (!dir)
+    return;
+
+  g_ptr_array_add(paths, g_strdup(path));
+
+  const char *name;
+  while ((name = g_dir_read_name(dir)))
+    {
+      char *child = g_build_filename(path, name, NULL);
+      if (g_file_test(child, G_FILE_TEST_IS_DIR) && !g_file_test(child, G_FILE_TEST_IS_SYMLINK))
+        collect_dirs(paths, child);
+      g_free(child);
+    }
+  g_dir_close(dir);
+}
+
+// what was read is now the starting point for noticing changes
+static void
+watch_paths(void)
+{
+  GPtrArray *paths = g_ptr_array_new_with_free_func(g_free);
+
+  g_ptr_array_add(paths, g_strdup(menu_path));
+  collect_dirs(paths, watch_root);
+  dirwatch_set_paths(watch, paths);
+  g_ptr_array_free(paths, TRUE);
+}
+
+static gboolean
+rebuild(gpointer data)
+{
+  gint64 cpu = thread_cpu_time();
+
+  entrytable_free(built);
+  if (watch)
+    {
+      // a tree is only loaded again once it has changed, which it won't know
+      // about, so use a new one
+      g_object_unref(tree);
+      tree = gmenu_tree_new_for_path(menu_path, GMENU_TREE_FLAGS_SORT_DISPLAY_NAME);
+    }
+  built = build(tree);
+  built_at = g_get_monotonic_time();
+  if (watch)
+    watch_paths();
+
+  rebuilds++;
+  rebuild_cpu += thread_cpu_time() - cpu;
+  rebuild_source = 0;
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+changed(GMenuTree *t, gpointer data)
+{
+  // like xwin-xdg-menu, start again from the idle loop
+  if (!rebuild_source)
+    rebuild_source = g_idle_add(rebuild, NULL);
+}
+
+static void
+watch_changed(gpointer data)
+{
+  changed(NULL, NULL);
+}
+
+//
+// Replaying the trace
+//
+
+static void
+apply(event *e)
+{
+  switch (e->op)
+    {
+    case 'C':
+    case 'M':
+      {
+        char *parent = g_path_get_dirname(e->path);
+        g_mkdir_with_parents(parent, 0755);
+        g_free(parent);
+
+        if (g_str_has_prefix(e->data, "text:"))
+          {
+            char *contents = g_strcompress(e->data + strlen("text:"));
+            g_file_set_contents(e->path, contents, -1, NULL);
+            g_free(contents);
+          }
+        else
+          {
+            gsize size = 0;
+            if (g_str_has_prefix(e->data, "size:"))
+              size = MIN(g_ascii_strtoull(e->data + strlen("size:"), NULL, 10), SIZE_MAX_REPLAYED);
+            char *contents = g_malloc0(size);
+            g_file_set_contents(e->path, contents, size, NULL);
+            g_free(contents);
+          }
+      }
+      break;
+
+    case 'D':
+      if (g_unlink(e->path) != 0)
+        skipped++;
+      break;
+
+    default:
+      skipped++;
+    }
+}
+
+static gboolean
+finish(gpointer data)
+{
+  g_main_loop_quit(loop);
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean
+replay(gpointer data)
+{
+  gint64 now = g_get_monotonic_time();
+
+  // apply all the changes which are due
+  while ((next_event < events->len) &&
+         (g_array_index(events, event, next_event).time / speed <= now - replay_started))
+    {
+      apply(&g_array_index(events, event, next_event));
+      next_event++;
+    }
+  last_event = now;
+
+  if (next_event < events->len)
+    {
+      gint64 due = replay_started + g_array_index(events, event, next_event).time / speed;
+      g_timeout_add(MAX(due - now, 0) / 1000, replay, NULL);
+    }
+  else
+    {
+      g_timeout_add(settle, finish, NULL);
+    }
+
+  return G_SOURCE_REMOVE;
+}
+
+// the number of desktop ids in one table but not the other
+static unsigned int
+difference(entrytable *a, entrytable *b)
+{
+  GHashTable *ids = g_hash_table_new(g_str_hash, g_str_equal);
+  unsigned int differ = 0;
+  guint i;
+
+  for (i = 0; i < entrytable_count(a); i++)
+    g_hash_table_add(ids, (gpointer)entrytable_string(a, entrytable_get(a, i)->id));
+
+  for (i = 0; i < entrytable_count(b); i++)
+    if (!g_hash_table_remove(ids, entrytable_string(b, entrytable_get(b, i)->id)))
+      differ++;
+
+  differ += g_hash_table_size(ids);
+  g_hash_table_destroy(ids);
+
+  return differ;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int entries = 500;
+  int soak = 0;
+  int budget = -1;
+  int interval = 2000;
+  gchar *menu = NULL;
+  gboolean keep = FALSE;
+  gchar **args = NULL;
+  GError *error = NULL;
+
+  GOptionEntry options[] =
+    {
+      { "entries", 'n', 0, G_OPTION_ARG_INT, &entries, "Number of synthetic desktop entries (default 500)", "N" },
+      { "speed", 's', 0, G_OPTION_ARG_DOUBLE, &speed, "Replay this many times faster than recorded (default 1)", "FACTOR" },
+      { "settle", 0, 0, G_OPTION_ARG_INT, &settle, "Time to wait after the last change (default 5000)", "MS" },
+      { "menu", 'm', 0, G_OPTION_ARG_FILENAME, &menu, "Menu file (default " XWIN_APPLICATIONS_MENU ")", "FILE" },
+      { "keep", 'k', 0, G_OPTION_ARG_NONE, &keep, "Don't remove the synthetic tree afterwards", NULL },
+      { "soak", 0, 0, G_OPTION_ARG_INT, &soak, "Then rebuild this many times, checking for leaks", "ITERATIONS" },
+      { "budget", 0, 0, G_OPTION_ARG_INT, &budget, "Notice changes as xwin-xdg-menu's own watching does, monitoring at most N paths (0 to only poll)", "N" },
+      { "interval", 0, 0, G_OPTION_ARG_INT, &interval, "With --budget, the shortest polling interval (default 2000)", "MS" },
+      { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &args, NULL, "TRACE" },
+      { NULL }
+    };
+
+  GOptionContext *context = g_option_context_new("- replay a trace of changes and report how the menu kept up");
+  g_option_context_add_main_entries(context, options, NULL);
+  if (!g_option_context_parse(context, &argc, &argv, &error))
+    {
+      fprintf(stderr, "%s\n", error->message);
+      return 1;
+    }
+  g_option_context_free(context);
+
+  if (!args || !args[0] || (speed <= 0))
+    {
+      fprintf(stderr, "Usage: %s [OPTION...] TRACE\n", g_get_prgname());
+      return 1;
+    }
+
+  char *tmpdir = g_dir_make_tmp("xwin-xdg-menu-replay-XXXXXX", &error);
+  if (!tmpdir)
+    {
+      fprintf(stderr, "%s\n", error->message);
+      return 1;
+    }
+
+  if (!trace_read(args[0], tmpdir))
+    return 1;
+
+  char *applications = xdg_setup(tmpdir);
+  populate(applications, entries);
+  g_free(applications);
+
+  printf("Replaying %u changes to %u directories in %s\n", events->len, nroots, tmpdir);
+
+  menu_path = menu ? menu : XWIN_APPLICATIONS_MENU;
+  footprint(menu_path);
+  tree = gmenu_tree_new_for_path(menu_path, GMENU_TREE_FLAGS_SORT_DISPLAY_NAME);
+  if (budget >= 0)
+    {
+      watch_root = tmpdir;
+      watch = dirwatch_new(budget, interval, watch_changed, NULL);
+    }
+  else
+    g_signal_connect(tree, "changed", G_CALLBACK(changed), NULL);
+
+  // the initial construction isn't counted
+  built = build(tree);
+  built_at = g_get_monotonic_time();
+  printf("Initial menu has %u entries\n", entrytable_count(built));
+  if (watch)
+    {
+      watch_paths();
+      printf("Monitoring %u paths, polling %u\n", dirwatch_monitored(watch), dirwatch_polled(watch));
+    }
+
+  loop = g_main_loop_new(NULL, FALSE);
+  replay_started = g_get_monotonic_time();
+  g_idle_add(replay, NULL);
+  g_main_loop_run(loop);
+
+  // what the menu should be now
+  GMenuTree *fresh = gmenu_tree_new_for_path(menu ? menu : XWIN_APPLICATIONS_MENU, GMENU_TREE_FLAGS_SORT_DISPLAY_NAME);
+  entrytable *expected = build(fresh);
+  unsigned int differ = difference(built, expected);
+
+  printf("Replayed %u changes (%u skipped) over %.1f s\n", events->len, skipped,
+         (last_event - replay_started) / (double)G_USEC_PER_SEC);
+  printf("%u rebuilds, %.1f ms CPU time, %.1f ms per rebuild\n", rebuilds,
+         rebuild_cpu / 1000.0, rebuilds ? rebuild_cpu / 1000.0 / rebuilds : 0.0);
+  if (differ)
+    printf("Final menu is stale: %u entries differ, %d ms after the last change\n", differ, settle);
+  else
+    printf("Final menu is up to date, %.1f ms after the last change\n",
+           MAX(built_at - last_event, 0) / 1000.0);
+
+  entrytable_free(expected);
+  g_object_unref(fresh);
+
+  gboolean leaked = FALSE;
+  if (soak > 0)
+    {
+      int i;
+
+      soak_init(soak);
+      soak_watch("rss", soak_rss, 8 * 1024 * 1024, 0.1);
+      soak_watch("heap", soak_heap, 4 * 1024 * 1024, 0.1);
+      soak_watch("fds", soak_fds, 4, 0);
+      soak_watch("threads", soak_threads, 4, 0);
+
+      for (i = 1; i <= soak; i++)
+        {
+          // a tree is only loaded again once it has changed, so use a new one
+          GMenuTree *t = gmenu_tree_new_for_path(menu ? menu : XWIN_APPLICATIONS_MENU, GMENU_TREE_FLAGS_SORT_DISPLAY_NAME);
+          entrytable_free(built);
+          built = build(t);
+          g_object_unref(t);
+
+          // let any monitors be torn down
+          while (g_main_context_iteration(NULL, FALSE))
+            ;
+
+          soak_sample(i);
+        }
+
+      leaked = !soak_finish();
+    }
+
+  entrytable_free(built);
+  g_object_unref(tree);
+  dirwatch_free(watch);
+
+  if (!keep)
+    remove_tree(tmpdir);
+  g_free(tmpdir);
+
+  if (leaked)
+    return 3;
+
+  return differ ? 2 : 0;
+}
@@ -0,0 +1,306 @@
+/*
+ * iconcompare.c
+ *
+ * Copyright (C) Jon Turney 2015
+ *
+ * This file is part of xwin-xdg-menu
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+//
+// xwin-xdg-menu-iconcompare: check that icontheme.c resolves icons the same
+// way GtkIconTheme does
+//
+// Each icon name is looked up at each size with both, and any for which they
+// find different files (or only one finds a file) are listed.  By default, the
+// names are the icons of the installed desktop entries, in the default theme.
+//
+// With --synthetic, a small XDG tree is created in a temporary directory,
+// which the XDG environment variables point at, with icons in various kinds
+// of theme directory, in an inherited theme, in a base directory with no
+// index.theme of its own (as ~/.local/share/icons/hicolor usually is), and in
+// the pixmaps fallback directory, and those are compared.
+//
+// The total time each took for the lookups is reported.  The exit status is 2
+// if there were any differences.
+//
+
+#include <gio/gio.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gtk/gtk.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../icontheme.h"
+
+// a 16x16 PNG
+static const char icon_png[] =
+  "\x89\x50\x4e\x47\x0d\x0a\x1a\x0a\x00\x00\x00\x0d\x49\x48\x44\x52\x00\x00"
+  "\x00\x10\x00\x00\x00\x10\x08\x06\x00\x00\x00\x1f\xf3\xff\x61\x00\x00\x00"
+  "\x19\x49\x44\x41\x54\x78\xda\x63\x70\x68\x38\xf0\x9f\x12\xcc\x30\x6a\xc0"
+  "\xa8\x01\xa3\x06\x0c\x17\x03\x00\x09\x8f\x7f\x1f\xca\xd7\xb9\x3e\x00\x00"
+  "\x00\x00\x49\x45\x4e\x44\xae\x42\x60\x82";
+
+static const char icon_svg[] =
+  "<svg xmlns='http://www.w3.org/2000/svg' width='16' height='16'/>\n";
+
+//
+// The synthetic XDG tree
+//
+
+static void
+write_file(const char *dir, const char *name, const char *contents, gssize len)
+{
+  char *path = g_build_filename(dir, name, NULL);
+  char *parent = g_path_get_dirname(path);
+  g_mkdir_with_parents(parent, 0755);
+  g_file_set_contents(path, contents, len, NULL);
+  g_free(parent);
+  g_free(path);
+}
+
+static void
+xdg_setup(const char *tmpdir)
+{
+  char *home = g_build_filename(tmpdir, "home", NULL);
+  char *data_home = g_build_filename(home, ".local", "share", NULL);
+  char *share = g_build_filename(tmpdir, "usr", "share", NULL);
+
+  g_setenv("HOME", home, TRUE);
+  g_setenv("XDG_DATA_HOME", data_home, TRUE);
+  g_setenv("XDG_DATA_DIRS", share, TRUE);
+
+  write_file(share, "icons/hicolor/index.theme",
+             "[Icon Theme]\n"
+             "Name=Hicolor\n"
+             "Directories=16x16/apps,48x48/apps,scalable/apps\n"
+             "\n"
+             "[16x16/apps]\n"
+             "Size=16\n"
+             "Type=Threshold\n"
+             "\n"
+             "[48x48/apps]\n"
+             "Size=48\n"
+             "Type=Fixed\n"
+             "\n"
+             "[scalable/apps]\n"
+             "Size=48\n"
+             "MinSize=1\n"
+             "MaxSize=256\n"
+             "Type=Scalable\n", -1);
+  write_file(share, "icons/hicolor/16x16/apps/sized.png", icon_png, sizeof(icon_png) - 1);
+  write_file(share, "icons/hicolor/48x48/apps/sized.png", icon_png, sizeof(icon_png) - 1);
+  write_file(share, "icons/hicolor/48x48/apps/fixed.png", icon_png, sizeof(icon_png) - 1);
+  write_file(share, "icons/hicolor/scalable/apps/scalable.svg", icon_svg, -1);
+  write_file(share, "icons/hicolor/16x16/apps/both.png", icon_png, sizeof(icon_png) - 1);
+  write_file(share, "icons/hicolor/scalable/apps/both.svg", icon_svg, -1);
+
+  // no index.theme here, as usual
+  write_file(data_home, "icons/hicolor/48x48/apps/user.png", icon_png, sizeof(icon_png) - 1);
+  write_file(data_home, "icons/hicolor/16x16/apps/sized.png", icon_png, sizeof(icon_png) - 1);
+
+  write_file(share, "icons/xwin-test/index.theme",
+             "[Icon Theme]\n"
+             "Name=Test\n"
+             "Inherits=hicolor\n"
+             "Directories=32x32/apps\n"
+             "\n"
+             "[32x32/apps]\n"
+             "Size=32\n"
+             "Type=Threshold\n", -1);
+  write_file(share, "icons/xwin-test/32x32/apps/themed.png", icon_png, sizeof(icon_png) - 1);
+  write_file(share, "icons/xwin-test/32x32/apps/sized.png", icon_png, sizeof(icon_png) - 1);
+
+  write_file(share, "pixmaps/pixmap.png", icon_png, sizeof(icon_png) - 1);
+  write_file(share, "pixmaps/pixmap.xpm", "/* XPM */\n", -1);
+
+  g_free(share);
+  g_free(data_home);
+  g_free(home);
+}
+
+static void
+remove_tree(const char *path)
+{
+  GDir *dir = g_dir_open(path, 0, NULL);
+  if (dir)
+    {
+      const char *name;
+      while ((name = g_dir_read_name(dir)))
+        {
+          char *child = g_build_filename(path, name, NULL);
+          if (g_file_test(child, G_FILE_TEST_IS_DIR) && !g_file_test(child, G_FILE_TEST_IS_SYMLINK))
+            remove_tree(child);
+          else
+            g_unlink(child);
+          g_free(child);
+        }
+      g_dir_close(dir);
+    }
+  g_rmdir(path);
+}
+
+// the icon names of the installed desktop entries
+static void
+installed_icons(GPtrArray *names)
+{
+  GHashTable *seen = g_hash_table_new(g_str_hash, g_str_equal);
+  GList *apps = g_app_info_get_all();
+  GList *l;
+
+  for (l = apps; l; l = l->next)
+    {
+      GIcon *icon = g_app_info_get_icon(l->data);
+      if (icon && G_IS_THEMED_ICON(icon))
+        {
+          const gchar * const *icon_names = g_themed_icon_get_names(G_THEMED_ICON(icon));
+          if (icon_names[0] && !g_hash_table_contains(seen, icon_names[0]))
+            {
+              char *name = g_strdup(icon_names[0]);
+              g_hash_table_add(seen, name);
+              g_ptr_array_add(names, name);
+            }
+        }
+    }
+
+  g_list_free_full(apps, g_object_unref);
+  g_hash_table_destroy(seen);
+}
+
+int
+main(int argc, char *argv[])
+{
+  gchar *theme_name = NULL;
+  gchar **icon_args = NULL;
+  gchar *size_list = NULL;
+  gboolean synthetic = FALSE;
+  gboolean verbose = FALSE;
+  GError *error = NULL;
+  char *tmpdir = NULL;
+  unsigned int compared = 0, differences = 0;
+  gint64 ours_us = 0, theirs_us = 0, start;
+  int i, j;
+
+  GOptionEntry options[] =
+    {
+      { "theme", 't', 0, G_OPTION_ARG_STRING, &theme_name, "Icon theme (default hicolor, or the synthetic test theme)", "NAME" },
+      { "icon", 'i', 0, G_OPTION_ARG_STRING_ARRAY, &icon_args, "Icon name to look up (may be repeated)", "NAME" },
+      { "sizes", 's', 0, G_OPTION_ARG_STRING, &size_list, "Sizes to look up (default 16,24,32,48)", "N,..." },
+      { "synthetic", 0, 0, G_OPTION_ARG_NONE, &synthetic, "Compare on a synthetic XDG tree", NULL },
+      { "verbose", 'v', 0, G_OPTION_ARG_NONE, &verbose, "List every lookup, not just differences", NULL },
+      { NULL }
+    };
+
+  GOptionContext *context = g_option_context_new("- check that icons are resolved the same way as GtkIconTheme does");
+  g_option_context_add_main_entries(context, options, NULL);
+  if (!g_option_context_parse(context, &argc, &argv, &error))
+    {
+      fprintf(stderr, "%s\n", error->message);
+      return 1;
+    }
+  g_option_context_free(context);
+
+  gchar **sizes = g_strsplit(size_list ? size_list : "16,24,32,48", ",", -1);
+  GPtrArray *names = g_ptr_array_new_with_free_func(g_free);
+
+  // before anything asks GLib for the XDG directories
+  if (synthetic)
+    {
+      static const char *synthetic_names[] = { "sized", "fixed", "scalable", "both", "user",
+                                               "themed", "pixmap", "nonesuch" };
+
+      tmpdir = g_dir_make_tmp("xwin-iconcompare-XXXXXX", &error);
+      if (!tmpdir)
+        {
+          fprintf(stderr, "%s\n", error->message);
+          return 1;
+        }
+      xdg_setup(tmpdir);
+
+      for (i = 0; i < (int)G_N_ELEMENTS(synthetic_names); i++)
+        g_ptr_array_add(names, g_strdup(synthetic_names[i]));
+      if (!theme_name)
+        theme_name = g_strdup("xwin-test");
+    }
+
+  for (i = 0; icon_args && icon_args[i]; i++)
+    g_ptr_array_add(names, g_strdup(icon_args[i]));
+  if (!names->len)
+    installed_icons(names);
+
+  iconresolver *resolver = iconresolver_new(theme_name);
+  GtkIconTheme *gtk_theme = gtk_icon_theme_new();
+  gtk_icon_theme_set_custom_theme(gtk_theme, theme_name ? theme_name : "hicolor");
+
+  for (i = 0; i < (int)names->len; i++)
+    {
+      const char *name = g_ptr_array_index(names, i);
+      for (j = 0; sizes[j]; j++)
+        {
+          int size = atoi(sizes[j]);
+          start = g_get_monotonic_time();
+          char *ours = iconresolver_lookup(resolver, name, size, 1);
+          ours_us += g_get_monotonic_time() - start;
+
+          start = g_get_monotonic_time();
+          GtkIconInfo *info = gtk_icon_theme_lookup_icon(gtk_theme, name, size, 0);
+          theirs_us += g_get_monotonic_time() - start;
+          const char *theirs = info ? gtk_icon_info_get_filename(info) : NULL;
+
+          compared++;
+          if (g_strcmp0(ours, theirs) != 0)
+            {
+              differences++;
+              printf("%s %d: icontheme %s, GtkIconTheme %s\n", name, size,
+                     ours ? ours : "(none)", theirs ? theirs : "(none)");
+            }
+          else if (verbose)
+            printf("%s %d: %s\n", name, size, ours ? ours : "(none)");
+
+          if (info)
+            gtk_icon_info_free(info);
+          g_free(ours);
+        }
+    }
+
+  printf("%u lookups of %u icons, %u differences\n", compared, names->len, differences);
+  // including loading the theme, which both do on the first lookup
+  printf("lookups took %.1f ms with icontheme, %.1f ms with GtkIconTheme\n",
+         ours_us / 1000.0, theirs_us / 1000.0);
+
+  g_object_unref(gtk_theme);
+  iconresolver_free(resolver);
+  if (tmpdir)
+    {
+      remove_tree(tmpdir);
+      g_free(tmpdir);
+    }
+  g_ptr_array_free(names, TRUE);
+  g_strfreev(sizes);
+  g_strfreev(icon_args);
+  g_free(size_list);
+  g_free(theme_name);
+
+  return differences ? 2 : 0;
+}
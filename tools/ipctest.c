@@ -0,0 +1,372 @@
+/*
+ * ipctest.c
+ *
+ * Copyright (C) Jon Turney 2015
+ *
+ * This file is part of xwin-xdg-menu
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+//
+// xwin-xdg-menu-ipctest: check forwarding requests to a running instance
+//
+// A socket left behind by an instance which died is created, and it's
+// checked that requests to it fail and that a new server replaces it.  Some
+// processes then all try to become the server for one stale socket at once,
+// which exactly one of them should do.  Finally, some client threads send
+// requests concurrently to a server, as xwin-xdg-menu does (ipc.c), checking
+// each gets its own reply, and that a client which is slow to send its
+// request, or sends none, doesn't hold up the others.
+//
+// Each check is reported, and the exit status is 2 if any failed.
+//
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <glib-unix.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../ipc.h"
+
+static int failures;
+
+static void
+check(gboolean ok, const char *what)
+{
+  printf("%s: %s\n", ok ? "ok" : "FAIL", what);
+  if (!ok)
+    failures++;
+}
+
+// reply to "echo ARG" with "ok ARG"
+static void
+handler(const char *request, const char *arg, GString *reply, gpointer data)
+{
+  if (strcmp(request, "echo") == 0)
+    g_string_printf(reply, "ok %s", arg ? arg : "");
+  else
+    g_string_printf(reply, "error unknown request '%s'", request);
+}
+
+// leave a socket at path which nothing is listening on, as an instance which
+// died would
+static gboolean
+make_stale(const char *path)
+{
+  struct sockaddr_un addr;
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return FALSE;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  g_strlcpy(addr.sun_path, path, sizeof(addr.sun_path));
+  gboolean ok = (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) &&
+    (listen(fd, 1) == 0);
+  close(fd);
+
+  return ok && g_file_test(path, G_FILE_TEST_EXISTS);
+}
+
+static gboolean
+quit_loop(gint fd, GIOCondition condition, gpointer data)
+{
+  g_main_loop_quit(data);
+  return G_SOURCE_REMOVE;
+}
+
+//
+// fork n_servers which all try to listen on path at once, and return how many
+// did.  Each keeps its socket, and accepts connections to it as an instance
+// would, until all have tried, as otherwise a later one would find it stale
+// (or wait for the connection backlog to be accepted).
+//
+static int
+race_servers(const char *path, int n_servers)
+{
+  int ready[2], go[2];
+  int listening = 0;
+  int i;
+
+  if (pipe(ready) || pipe(go))
+    {
+      perror("pipe");
+      exit(1);
+    }
+
+  fflush(stdout);
+  for (i = 0; i < n_servers; i++)
+    {
+      int pid = fork();
+      if (pid < 0)
+        {
+          perror("fork");
+          exit(1);
+        }
+      if (pid == 0)
+        {
+          char c;
+          close(go[1]);
+          close(ready[0]);
+
+          ipc_server *server = ipc_server_new(path, handler, NULL);
+          c = server ? 1 : 0;
+          write(ready[1], &c, 1);
+
+          GMainLoop *waiting = g_main_loop_new(NULL, FALSE);
+          g_unix_fd_add(go[0], G_IO_IN | G_IO_HUP, quit_loop, waiting);
+          g_main_loop_run(waiting);
+          g_main_loop_unref(waiting);
+
+          ipc_server_free(server);
+          _exit(0);
+        }
+    }
+
+  close(ready[1]);
+  close(go[0]);
+  for (i = 0; i < n_servers; i++)
+    {
+      char c = 0;
+      if ((read(ready[0], &c, 1) == 1) && c)
+        listening++;
+    }
+  close(go[1]);
+  close(ready[0]);
+  while (wait(NULL) > 0)
+    ;
+
+  return listening;
+}
+
+// the server logs each request, which would drown out the results
+static void
+quiet(const gchar *string)
+{
+}
+
+static GMainLoop *loop;
+
+static gpointer
+server_thread(gpointer data)
+{
+  g_main_loop_run(loop);
+  return NULL;
+}
+
+typedef struct
+{
+  const char *path;
+  int id;
+  int requests;
+  int replies;
+} client;
+
+static gpointer
+client_thread(gpointer data)
+{
+  client *c = data;
+  int i;
+
+  for (i = 0; i < c->requests; i++)
+    {
+      char reply[256];
+      char *request = g_strdup_printf("echo %d-%d", c->id, i);
+      char *expected = g_strdup_printf("ok %d-%d", c->id, i);
+      if ((ipc_request(c->path, request, reply, sizeof(reply)) == 0) &&
+          (strcmp(reply, expected) == 0))
+        c->replies++;
+      g_free(expected);
+      g_free(request);
+    }
+
+  return NULL;
+}
+
+// read what's sent on fd until it's closed, or for up to timeout ms
+static char *
+read_all(int fd, int timeout)
+{
+  GString *got = g_string_new(NULL);
+  gint64 deadline = g_get_monotonic_time() + timeout * 1000;
+  char buf[256];
+
+  while (1)
+    {
+      int left = (deadline - g_get_monotonic_time()) / 1000;
+      struct pollfd pfd = { fd, POLLIN, 0 };
+      if ((left <= 0) || (poll(&pfd, 1, left) <= 0))
+        break;
+      ssize_t r = read(fd, buf, sizeof(buf));
+      if (r <= 0)
+        break;
+      g_string_append_len(got, buf, r);
+    }
+
+  return g_string_free(got, FALSE);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n_clients = 16;
+  int n_requests = 100;
+  int n_servers = 8;
+  GError *error = NULL;
+  char reply[256];
+  int i;
+
+  GOptionEntry options[] =
+    {
+      { "clients", 'c', 0, G_OPTION_ARG_INT, &n_clients, "Number of concurrent clients (default 16)", "N" },
+      { "requests", 'n', 0, G_OPTION_ARG_INT, &n_requests, "Number of requests each client sends (default 100)", "N" },
+      { "servers", 's', 0, G_OPTION_ARG_INT, &n_servers, "Number of processes racing to replace a stale socket (default 8)", "N" },
+      { NULL }
+    };
+
+  GOptionContext *context = g_option_context_new("- check forwarding requests to a running instance");
+  g_option_context_add_main_entries(context, options, NULL);
+  if (!g_option_context_parse(context, &argc, &argv, &error))
+    {
+      fprintf(stderr, "%s\n", error->message);
+      return 1;
+    }
+  g_option_context_free(context);
+
+  char *dir = g_dir_make_tmp("xwin-ipctest-XXXXXX", &error);
+  if (!dir)
+    {
+      fprintf(stderr, "%s\n", error->message);
+      return 1;
+    }
+  char *path = g_build_filename(dir, "test.socket", NULL);
+  char *lockpath = g_strconcat(path, ".lock", NULL);
+
+  // a stale socket
+  check(make_stale(path), "stale socket left behind");
+  check(ipc_request(path, "echo stale", reply, sizeof(reply)) == -1, "request to stale socket finds no instance");
+
+  ipc_server *server = ipc_server_new(path, handler, NULL);
+  check(server != NULL, "server replaces stale socket");
+  check(ipc_server_new(path, handler, NULL) == NULL, "second server refused while first listening");
+  ipc_server_free(server);
+  check(!g_file_test(path, G_FILE_TEST_EXISTS), "socket removed when server freed");
+
+  // servers racing to replace a stale socket
+  check(make_stale(path), "stale socket left behind again");
+  int listening = race_servers(path, n_servers);
+  char *message = g_strdup_printf("one of %d servers racing for a stale socket listens (%d did)", n_servers, listening);
+  check(listening == 1, message);
+  g_free(message);
+
+  // concurrent clients
+  g_set_print_handler(quiet);
+  server = ipc_server_new(path, handler, NULL);
+  check(server != NULL, "server listening");
+  loop = g_main_loop_new(NULL, FALSE);
+  GThread *serving = g_thread_new("server", server_thread, NULL);
+
+  client *clients = g_new0(client, n_clients);
+  GThread **threads = g_new(GThread *, n_clients);
+  gint64 start = g_get_monotonic_time();
+  for (i = 0; i < n_clients; i++)
+    {
+      clients[i].path = path;
+      clients[i].id = i;
+      clients[i].requests = n_requests;
+      threads[i] = g_thread_new("client", client_thread, &clients[i]);
+    }
+  int replies = 0;
+  for (i = 0; i < n_clients; i++)
+    {
+      g_thread_join(threads[i]);
+      replies += clients[i].replies;
+    }
+  gint64 took = g_get_monotonic_time() - start;
+  g_set_print_handler(NULL);
+
+  message = g_strdup_printf("%d of %d concurrent requests got their own reply",
+                            replies, n_clients * n_requests);
+  check(replies == n_clients * n_requests, message);
+  g_free(message);
+  check(ipc_request(path, "nonesuch", reply, sizeof(reply)) == 1, "unknown request gets an error");
+  printf("%d requests from %d clients in %.1f ms\n", n_clients * n_requests, n_clients, took / 1000.0);
+
+  // clients which are slow to send their request, or send nothing.  If the
+  // server has given up on them, writing fails rather than killing us
+  signal(SIGPIPE, SIG_IGN);
+  g_set_print_handler(quiet);
+  int silent = ipc_connect(path);
+  int slow = ipc_connect(path);
+  check((silent >= 0) && (slow >= 0) && (write(slow, "echo sl", 7) == 7),
+        "slow and silent clients connected");
+  g_usleep(100000);
+  start = g_get_monotonic_time();
+  gboolean answered = (ipc_request(path, "echo quick", reply, sizeof(reply)) == 0);
+  took = g_get_monotonic_time() - start;
+  message = g_strdup_printf("request answered while others are incomplete (in %.1f ms)", took / 1000.0);
+  check(answered && (took < 500000), message);
+  g_free(message);
+
+  char *got = NULL;
+  if (write(slow, "ow\n", 3) == 3)
+    got = read_all(slow, 1000);
+  check(g_strcmp0(got, "ok slow\n") == 0, "slow client's request answered once complete");
+  g_free(got);
+
+  // the server's timeout is 2 seconds
+  got = read_all(silent, 4000);
+  check(got && !*got, "silent client dropped without a reply");
+  g_free(got);
+  g_set_print_handler(NULL);
+  close(slow);
+  close(silent);
+
+  g_main_loop_quit(loop);
+  g_thread_join(serving);
+  g_main_loop_unref(loop);
+  ipc_server_free(server);
+
+  g_free(threads);
+  g_free(clients);
+  g_unlink(lockpath);
+  g_rmdir(dir);
+  g_free(lockpath);
+  g_free(path);
+  g_free(dir);
+
+  if (failures)
+    {
+      printf("%d checks failed\n", failures);
+      return 2;
+    }
+
+  return 0;
+}
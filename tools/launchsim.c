@@ -0,0 +1,207 @@
+/*
+ * launchsim.c
+ *
+ * Copyright (C) Jon Turney 2015
+ *
+ * This file is part of xwin-xdg-menu
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+//
+// xwin-xdg-menu-launchsim: exercise launch scheduling with dummy commands
+//
+// A number of launches are requested, one every so often, cycling through a
+// number of desktop ids, and scheduled as xwin-xdg-menu does (launchsched.c).
+// Each launch runs a dummy command (by default 'sleep 1'), and is finished
+// when it exits.
+//
+// How many launches were suppressed as repeats, the most in flight, running
+// and queued at once, and how long it all took are reported.  The exit status
+// is 2 if more were ever in flight than allowed.
+//
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../launchsched.h"
+
+typedef struct
+{
+  char *id;
+  gint64 requested;
+} dummy_launch;
+
+static launchsched *sched;
+static GMainLoop *loop;
+static char **argv_cmd;
+
+static int requests = 20;
+static int ids = 3;
+static int pause_ms = 100;
+static int concurrency = 4;
+
+static guint next_request;
+// in flight as far as the scheduler is concerned, and actually running
+static guint most_in_flight, running, most_running, most_queued;
+static guint started, exited;
+static gint64 most_waited;
+
+static void
+dummy_launch_free(gpointer data)
+{
+  dummy_launch *l = data;
+  g_free(l->id);
+  g_free(l);
+}
+
+static void
+dummy_exited(GPid pid, gint status, gpointer data)
+{
+  g_spawn_close_pid(pid);
+  running--;
+  exited++;
+
+  launchsched_finished(sched, GPOINTER_TO_UINT(data));
+
+  if ((next_request == (guint)requests) && (exited == started) && !launchsched_queued(sched))
+    g_main_loop_quit(loop);
+}
+
+static gboolean
+dummy_start(gpointer job, guint token)
+{
+  dummy_launch *l = job;
+  GError *error = NULL;
+  GPid pid;
+
+  most_waited = MAX(most_waited, g_get_monotonic_time() - l->requested);
+
+  if (!g_spawn_async(NULL, argv_cmd, NULL, G_SPAWN_DO_NOT_REAP_CHILD | G_SPAWN_SEARCH_PATH,
+                     NULL, NULL, &pid, &error))
+    {
+      fprintf(stderr, "[%s] %s\n", l->id, error->message);
+      g_error_free(error);
+      dummy_launch_free(l);
+      return FALSE;
+    }
+
+  g_child_watch_add(pid, dummy_exited, GUINT_TO_POINTER(token));
+  dummy_launch_free(l);
+
+  started++;
+  running++;
+  most_running = MAX(most_running, running);
+  most_in_flight = MAX(most_in_flight, launchsched_running(sched));
+
+  return TRUE;
+}
+
+static gboolean
+request(gpointer data)
+{
+  char *id = g_strdup_printf("dummy-%u.desktop", next_request % ids);
+  next_request++;
+
+  if (!launchsched_suppress(sched, id))
+    {
+      dummy_launch *l = g_new0(dummy_launch, 1);
+      l->id = id;
+      l->requested = g_get_monotonic_time();
+      launchsched_submit(sched, id, l);
+      most_queued = MAX(most_queued, launchsched_queued(sched));
+    }
+  else
+    g_free(id);
+
+  if (next_request < (guint)requests)
+    return G_SOURCE_CONTINUE;
+
+  if (exited == started && !launchsched_queued(sched))
+    g_main_loop_quit(loop);
+  return G_SOURCE_REMOVE;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int window = 1000;
+  int startup = 10000;
+  gchar *command = NULL;
+  GError *error = NULL;
+
+  GOptionEntry options[] =
+    {
+      { "requests", 'n', 0, G_OPTION_ARG_INT, &requests, "Number of launches to request (default 20)", "N" },
+      { "ids", 'i', 0, G_OPTION_ARG_INT, &ids, "Number of desktop ids to cycle through (default 3)", "N" },
+      { "pause", 'p', 0, G_OPTION_ARG_INT, &pause_ms, "Time between requests (default 100)", "MS" },
+      { "window", 'w', 0, G_OPTION_ARG_INT, &window, "Suppress repeats within this time (default 1000)", "MS" },
+      { "concurrency", 'c', 0, G_OPTION_ARG_INT, &concurrency, "Most launches in flight at once (default 4)", "N" },
+      { "startup", 's', 0, G_OPTION_ARG_INT, &startup, "Longest a launch is in flight (default 10000)", "MS" },
+      { "command", 0, 0, G_OPTION_ARG_STRING, &command, "Dummy command (default 'sleep 1')", "CMD" },
+      { NULL }
+    };
+
+  GOptionContext *context = g_option_context_new("- exercise launch scheduling with dummy commands");
+  g_option_context_add_main_entries(context, options, NULL);
+  if (!g_option_context_parse(context, &argc, &argv, &error))
+    {
+      fprintf(stderr, "%s\n", error->message);
+      return 1;
+    }
+  g_option_context_free(context);
+
+  if ((requests <= 0) || (ids <= 0) || (pause_ms < 0))
+    {
+      fprintf(stderr, "Usage: %s [OPTION...]\n", g_get_prgname());
+      return 1;
+    }
+
+  if (!g_shell_parse_argv(command ? command : "sleep 1", NULL, &argv_cmd, &error))
+    {
+      fprintf(stderr, "%s\n", error->message);
+      return 1;
+    }
+
+  sched = launchsched_new(window, concurrency, startup, dummy_start, dummy_launch_free);
+  loop = g_main_loop_new(NULL, FALSE);
+
+  gint64 start = g_get_monotonic_time();
+  g_timeout_add(pause_ms, request, NULL);
+  g_main_loop_run(loop);
+
+  printf("%d requests, %u suppressed, %u launched\n", requests,
+         launchsched_suppressed(sched), started);
+  printf("Most in flight %u, most running %u, most queued %u, longest wait %.1f ms\n",
+         most_in_flight, most_running, most_queued, most_waited / 1000.0);
+  printf("Took %.1f s\n", (g_get_monotonic_time() - start) / (double)G_USEC_PER_SEC);
+
+  launchsched_free(sched);
+  g_main_loop_unref(loop);
+  g_strfreev(argv_cmd);
+  g_free(command);
+
+  if (concurrency && (most_in_flight > (guint)concurrency))
+    return 2;
+
+  return 0;
+}
@@ -0,0 +1,256 @@
+/*
+ * layouttest.c
+ *
+ * Copyright (C) Jon Turney 2015
+ *
+ * This file is part of xwin-xdg-menu
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+//
+// xwin-xdg-menu-layouttest: check the splitting of long menus into
+// alphabetical ranges
+//
+// menulayout_buckets() is driven with some edge cases: no items, exactly as
+// many items as fit in one menu, one more than that, and runs of items with
+// the same initial letter which are longer than a bucket.  Then many random
+// sorted lists are split.  In every case, the buckets must cover all the
+// items, in order, with none empty or larger than the limit, and each must
+// have a label, whose range doesn't end before it starts.
+//
+// Each check is reported, and the exit status is 2 if any failed.
+//
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../menulayout.h"
+
+static int failures;
+static gboolean verbose;
+
+static void
+check(gboolean ok, const char *what)
+{
+  printf("%s: %s\n", ok ? "ok" : "FAIL", what);
+  if (!ok)
+    failures++;
+}
+
+// whether buckets is a valid split of count items into at most max each
+static gboolean
+valid(GArray *buckets, const char *const *names, guint count, guint max)
+{
+  if ((max < 2) || (count <= max))
+    return buckets == NULL;
+
+  if (!buckets || !buckets->len)
+    return FALSE;
+
+  guint i, next = 0;
+  for (i = 0; i < buckets->len; i++)
+    {
+      menu_bucket *b = &g_array_index(buckets, menu_bucket, i);
+      if ((b->start != next) || (b->end <= b->start) || (b->end - b->start > max) ||
+          !b->label || !*b->label)
+        return FALSE;
+      next = b->end;
+
+      // a range's end mustn't come before its start
+      const char *dash = strstr(b->label, " \u2013 ");
+      if (dash)
+        {
+          char *from = g_strndup(b->label, dash - b->label);
+          gboolean ordered = g_utf8_collate(from, dash + strlen(" \u2013 ")) <= 0;
+          g_free(from);
+          if (!ordered)
+            return FALSE;
+        }
+
+      if (verbose)
+        printf("  %u-%u (%u): %s\n", b->start, b->end - 1, b->end - b->start, b->label);
+    }
+
+  return next == count;
+}
+
+// split names, and check the result
+static void
+check_split(GPtrArray *names, guint max, const char *what)
+{
+  const char *const *list = (const char *const *)names->pdata;
+  GArray *buckets = menulayout_buckets(list, names->len, max);
+  char *message = g_strdup_printf("%s: %u items, at most %u in each of %u buckets", what,
+                                  names->len, max, buckets ? buckets->len : 0);
+  check(valid(buckets, list, names->len, max), message);
+  g_free(message);
+  menulayout_buckets_free(buckets);
+}
+
+// add count names starting with letter
+static void
+add_run(GPtrArray *names, char letter, guint count)
+{
+  guint i;
+  for (i = 0; i < count; i++)
+    g_ptr_array_add(names, g_strdup_printf("%c%04u", letter, i));
+}
+
+static gint
+compare_names(gconstpointer a, gconstpointer b)
+{
+  return g_utf8_collate(*(const char **)a, *(const char **)b);
+}
+
+// count random names, with initials skewed towards the start of the alphabet,
+// some of them the same, in sorted order
+static void
+add_random(GPtrArray *names, GRand *rand, guint count)
+{
+  guint i, j;
+  for (i = 0; i < count; i++)
+    {
+      guint len = g_rand_int_range(rand, 1, 9);
+      char *name = g_malloc(len + 1);
+      name[0] = 'a' + MIN(g_rand_int_range(rand, 0, 26), g_rand_int_range(rand, 0, 26));
+      for (j = 1; j < len; j++)
+        name[j] = 'a' + g_rand_int_range(rand, 0, 26);
+      name[len] = 0;
+      g_ptr_array_add(names, name);
+      if (g_rand_int_range(rand, 0, 10) == 0)
+        g_ptr_array_add(names, g_strdup(name));
+    }
+  g_ptr_array_sort(names, compare_names);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int max = 20;
+  int iterations = 1000;
+  int seed = 1;
+  GError *error = NULL;
+  int i;
+
+  GOptionEntry options[] =
+    {
+      { "max", 'm', 0, G_OPTION_ARG_INT, &max, "Most items in a bucket (default 20)", "N" },
+      { "iterations", 'n', 0, G_OPTION_ARG_INT, &iterations, "Number of random lists to split (default 1000)", "N" },
+      { "seed", 's', 0, G_OPTION_ARG_INT, &seed, "Seed for the random lists (default 1)", "N" },
+      { "verbose", 'v', 0, G_OPTION_ARG_NONE, &verbose, "List the buckets", NULL },
+      { NULL }
+    };
+
+  GOptionContext *context = g_option_context_new("- check the splitting of long menus into alphabetical ranges");
+  g_option_context_add_main_entries(context, options, NULL);
+  if (!g_option_context_parse(context, &argc, &argv, &error))
+    {
+      fprintf(stderr, "%s\n", error->message);
+      return 1;
+    }
+  g_option_context_free(context);
+
+  if (max < 2)
+    {
+      fprintf(stderr, "the most items in a bucket must be at least 2\n");
+      return 1;
+    }
+
+  GPtrArray *names = g_ptr_array_new_with_free_func(g_free);
+
+  check(menulayout_buckets(NULL, 0, max) == NULL, "no items aren't split");
+
+  add_run(names, 'a', max);
+  check_split(names, max, "exactly the limit");
+  g_ptr_array_set_size(names, 0);
+
+  add_run(names, 'a', max / 2);
+  add_run(names, 'b', max / 2 + max % 2 + 1);
+  check_split(names, max, "one more than the limit");
+  g_ptr_array_set_size(names, 0);
+
+  add_run(names, 'a', max * 3 + 1);
+  check_split(names, max, "one letter, longer than three buckets");
+  g_ptr_array_set_size(names, 0);
+
+  add_run(names, 'a', 1);
+  add_run(names, 'b', max * 2 + max / 2);
+  add_run(names, 'c', 1);
+  check_split(names, max, "a long run between single items");
+  g_ptr_array_set_size(names, 0);
+
+  add_run(names, 'a', max + 1);
+  add_run(names, 'b', max + 1);
+  add_run(names, 'c', max + 1);
+  check_split(names, max, "runs each one longer than a bucket");
+  g_ptr_array_set_size(names, 0);
+
+  for (i = 0; i < max * 2; i++)
+    g_ptr_array_add(names, g_strdup("same"));
+  check_split(names, max, "identical names");
+  g_ptr_array_set_size(names, 0);
+
+  g_ptr_array_add(names, g_strdup("\xc3\x89" "clair"));
+  add_run(names, 'e', max);
+  g_ptr_array_add(names, g_strdup("\xc3\xa9t\xc3\xa9"));
+  g_ptr_array_sort(names, compare_names);
+  check_split(names, max, "non-ASCII initials");
+  g_ptr_array_set_size(names, 0);
+
+  // random lists, only reporting failures
+  GRand *rand = g_rand_new_with_seed(seed);
+  gboolean saved = verbose;
+  int bad = 0;
+  verbose = FALSE;
+  for (i = 0; i < iterations; i++)
+    {
+      add_random(names, rand, g_rand_int_range(rand, 0, max * 10));
+      const char *const *list = (const char *const *)names->pdata;
+      GArray *buckets = menulayout_buckets(list, names->len, max);
+      if (!valid(buckets, list, names->len, max))
+        {
+          if (!bad)
+            printf("first bad split: iteration %d, %u items\n", i, names->len);
+          bad++;
+        }
+      menulayout_buckets_free(buckets);
+      g_ptr_array_set_size(names, 0);
+    }
+  verbose = saved;
+  g_rand_free(rand);
+
+  char *message = g_strdup_printf("%d random lists split, %d badly", iterations, bad);
+  check(bad == 0, message);
+  g_free(message);
+
+  g_ptr_array_free(names, TRUE);
+
+  if (failures)
+    {
+      printf("%d checks failed\n", failures);
+      return 2;
+    }
+
+  return 0;
+}
@@ -0,0 +1,343 @@
+/*
+ * logbench.c
+ *
+ * Copyright (C) Jon Turney 2015
+ *
+ * This file is part of xwin-xdg-menu
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+//
+// xwin-xdg-menu-logbench: benchmark logging of child output
+//
+// One noisy child writes lines as fast as it can, or at a given rate (by
+// default 1 MB/s), while some quiet children each write a timestamped line
+// every 100 ms.  Their output is read and logged as xwin-xdg-menu does
+// (childlog.c), and the log is read back, to see how long each of the quiet
+// children's lines took to reach it.
+//
+// How fast the noisy child's output was logged, how much CPU that took, how
+// many of its lines were suppressed, and the longest delay seen by the quiet
+// children are reported.  The exit status is 2 if a quiet child's line was
+// lost, or took longer than the limit to be logged.
+//
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../childlog.h"
+
+#define LINE_LEN 100
+#define QUIET_INTERVAL 100000
+
+static int duration = 5;
+static int noisy_rate = 1024 * 1024;
+static int quiet = 3;
+static int lograte = 100;
+static int logburst = 500;
+
+typedef struct
+{
+  childlog log;
+  int out_fd;
+  int err_fd;
+  gint64 finished;
+} follower;
+
+// CLOCK_MONOTONIC is shared between processes, so the children's timestamps
+// can be compared with ours
+static gint64
+now_us(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (gint64)ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+}
+
+static void
+sleep_until(gint64 t)
+{
+  gint64 delay = t - now_us();
+  if (delay > 0)
+    g_usleep(delay);
+}
+
+static void
+noisy_child(void)
+{
+  char line[LINE_LEN];
+  memset(line, 'x', sizeof(line) - 1);
+  line[sizeof(line) - 1] = '\n';
+
+  gint64 start = now_us();
+  gint64 total = (gint64)noisy_rate * duration;
+  gint64 written = 0;
+
+  // flat out, if no rate was given
+  if (!noisy_rate)
+    total = 64 * 1024 * 1024;
+
+  while (written < total)
+    {
+      if (noisy_rate)
+        sleep_until(start + written * G_USEC_PER_SEC / noisy_rate);
+
+      if (write(STDOUT_FILENO, line, sizeof(line)) != sizeof(line))
+        _exit(1);
+      written += sizeof(line);
+    }
+
+  _exit(0);
+}
+
+static void
+quiet_child(void)
+{
+  gint64 start = now_us();
+  gint64 t;
+  int i;
+
+  for (i = 0; (t = start + (gint64)i * QUIET_INTERVAL) < start + (gint64)duration * G_USEC_PER_SEC; i++)
+    {
+      sleep_until(t);
+      printf("t=%" G_GINT64_FORMAT "\n", now_us());
+      fflush(stdout);
+    }
+
+  _exit(0);
+}
+
+static gpointer
+follow_thread(gpointer data)
+{
+  follower *f = data;
+  childlog_follow(&f->log, f->out_fd, f->err_fd);
+  f->finished = now_us();
+  return NULL;
+}
+
+static GThread *
+start_child(follower *f, const char *tag, void (*child)(void))
+{
+  int out[2], err[2];
+  pid_t pid;
+
+  if (pipe(out) || pipe(err))
+    {
+      perror("pipe");
+      exit(1);
+    }
+
+  fflush(stdout);
+  switch (pid = fork())
+    {
+    case -1:
+      perror("fork");
+      exit(1);
+
+    case 0:
+      dup2(out[1], STDOUT_FILENO);
+      dup2(err[1], STDERR_FILENO);
+      close(out[0]);
+      close(out[1]);
+      close(err[0]);
+      close(err[1]);
+      child();
+    }
+
+  close(out[1]);
+  close(err[1]);
+
+  childlog_init(&f->log, tag, lograte, logburst);
+  f->log.pid = pid;
+  f->out_fd = out[0];
+  f->err_fd = err[0];
+
+  return g_thread_new(tag, follow_thread, f);
+}
+
+typedef struct
+{
+  int fd;
+  guint quiet_lines;
+  guint noisy_lines;
+  guint suppressed;
+  gint64 most_delayed;
+} log_reader;
+
+static void
+log_line(log_reader *r, const char *line)
+{
+  const char *text;
+  unsigned int n;
+  gint64 t;
+
+  if ((text = strstr(line, " stdout] t=")))
+    {
+      t = g_ascii_strtoll(text + strlen(" stdout] t="), NULL, 10);
+      r->most_delayed = MAX(r->most_delayed, now_us() - t);
+      r->quiet_lines++;
+    }
+  else if (strstr(line, "noisy stdout] "))
+    r->noisy_lines++;
+  else if ((text = strstr(line, "noisy -] ")) && (sscanf(text, "noisy -] %u lines suppressed", &n) == 1))
+    r->suppressed += n;
+}
+
+// read the log back as it's written
+static gpointer
+read_thread(gpointer data)
+{
+  log_reader *r = data;
+  char buf[65536];
+  size_t len = 0;
+  ssize_t n;
+
+  while ((n = read(r->fd, buf + len, sizeof(buf) - 1 - len)) != 0)
+    {
+      if (n < 0)
+        continue;
+      len += n;
+      buf[len] = 0;
+
+      char *start = buf;
+      char *nl;
+      while ((nl = strchr(start, '\n')))
+        {
+          *nl = 0;
+          log_line(r, start);
+          start = nl + 1;
+        }
+
+      len -= start - buf;
+      memmove(buf, start, len);
+    }
+
+  return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int limit = 100;
+  GError *error = NULL;
+  int i;
+
+  GOptionEntry options[] =
+    {
+      { "duration", 'd', 0, G_OPTION_ARG_INT, &duration, "How long the children write for (default 5)", "S" },
+      { "rate", 'r', 0, G_OPTION_ARG_INT, &noisy_rate, "Noisy child's output rate, or 0 for as fast as possible (default 1048576)", "BYTES/S" },
+      { "quiet", 'q', 0, G_OPTION_ARG_INT, &quiet, "Number of quiet children (default 3)", "N" },
+      { "lograte", 0, 0, G_OPTION_ARG_INT, &lograte, "Lines per second logged from each child (default 100)", "N" },
+      { "logburst", 0, 0, G_OPTION_ARG_INT, &logburst, "Lines logged from each child in a burst (default 500)", "N" },
+      { "limit", 'l', 0, G_OPTION_ARG_INT, &limit, "Longest a quiet child's line may take to be logged (default 100)", "MS" },
+      { NULL }
+    };
+
+  GOptionContext *context = g_option_context_new("- benchmark logging of child output");
+  g_option_context_add_main_entries(context, options, NULL);
+  if (!g_option_context_parse(context, &argc, &argv, &error))
+    {
+      fprintf(stderr, "%s\n", error->message);
+      return 1;
+    }
+  g_option_context_free(context);
+
+  if ((duration <= 0) || (noisy_rate < 0) || (quiet < 0))
+    {
+      fprintf(stderr, "Usage: %s [OPTION...]\n", g_get_prgname());
+      return 1;
+    }
+
+  // the log is written to stdout, so capture that, keeping the original for
+  // the report
+  int log_pipe[2];
+  int report_fd = dup(STDOUT_FILENO);
+  if ((report_fd < 0) || pipe(log_pipe))
+    {
+      perror("pipe");
+      return 1;
+    }
+  fflush(stdout);
+  dup2(log_pipe[1], STDOUT_FILENO);
+  close(log_pipe[1]);
+
+  log_reader reader = { log_pipe[0], 0, 0, 0, 0 };
+  GThread *reader_thread = g_thread_new("reader", read_thread, &reader);
+
+  struct rusage before, after;
+  getrusage(RUSAGE_SELF, &before);
+  gint64 start = now_us();
+
+  follower *followers = g_new0(follower, quiet + 1);
+  GThread **threads = g_new0(GThread *, quiet + 1);
+  threads[0] = start_child(&followers[0], "noisy", noisy_child);
+  for (i = 1; i <= quiet; i++)
+    {
+      char *tag = g_strdup_printf("quiet-%d", i);
+      threads[i] = start_child(&followers[i], tag, quiet_child);
+      g_free(tag);
+    }
+
+  for (i = 0; i <= quiet; i++)
+    {
+      g_thread_join(threads[i]);
+      childlog_clear(&followers[i].log);
+    }
+  while (waitpid(-1, NULL, 0) > 0)
+    ;
+
+  getrusage(RUSAGE_SELF, &after);
+  gint64 noisy_took = followers[0].finished - start;
+
+  // end of the log
+  fflush(stdout);
+  dup2(report_fd, STDOUT_FILENO);
+  close(report_fd);
+  g_thread_join(reader_thread);
+  close(log_pipe[0]);
+
+  double mb = (noisy_rate ? (double)noisy_rate * duration : 64.0 * 1024 * 1024) / (1024 * 1024);
+  double cpu = (after.ru_utime.tv_sec - before.ru_utime.tv_sec) + (after.ru_stime.tv_sec - before.ru_stime.tv_sec)
+    + ((after.ru_utime.tv_usec - before.ru_utime.tv_usec) + (after.ru_stime.tv_usec - before.ru_stime.tv_usec)) / 1e6;
+  guint expected = quiet * ((duration * G_USEC_PER_SEC + QUIET_INTERVAL - 1) / QUIET_INTERVAL);
+
+  printf("Noisy child's %.1f MB logged in %.2f s (%.1f MB/s), using %.2f s of CPU\n",
+         mb, noisy_took / (double)G_USEC_PER_SEC, mb * G_USEC_PER_SEC / noisy_took, cpu);
+  printf("%u of its lines logged, %u suppressed\n", reader.noisy_lines, reader.suppressed);
+  printf("%u of %u quiet lines logged, longest delay %.1f ms\n", reader.quiet_lines, expected,
+         reader.most_delayed / 1000.0);
+
+  g_free(followers);
+  g_free(threads);
+
+  if ((reader.quiet_lines < expected) || (reader.most_delayed > (gint64)limit * 1000))
+    return 2;
+
+  return 0;
+}
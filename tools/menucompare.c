@@ -0,0 +1,421 @@
+/*
+ * menucompare.c
+ *
+ * Copyright (C) Jon Turney 2015
+ *
+ * This file is part of xwin-xdg-menu
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+//
+// xwin-xdg-menu-menucompare: check that menuspec.c reads a menu the same way
+// libgnome-menu does, and compare how long they take
+//
+// Both read the menu, and each is flattened to a sorted list of the submenu
+// path and desktop id of every entry.  Any entries which only one has are
+// listed.
+//
+// With --bench, a synthetic XDG tree is created in a temporary directory,
+// which the XDG environment variables point at, and filled with increasing
+// numbers of desktop entries in random categories.  At each size both are
+// timed reading the menu (best of a few tries), and compared.
+//
+
+#define GMENU_I_KNOW_THIS_IS_UNSTABLE
+#include <gmenu-tree.h>
+#include <gio/gdesktopappinfo.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../menuspec.h"
+
+// normally defined by the build to be the one in the source tree
+#ifndef XWIN_APPLICATIONS_MENU
+#define XWIN_APPLICATIONS_MENU "/etc/xdg/menus/xwin-applications.menu"
+#endif
+
+// how many times each is timed reading the menu
+#define BENCH_TRIES 3
+
+//
+// Flattening each menu to "path<TAB>desktop id" lines
+//
+
+static void
+flatten_gmenu_directory(GPtrArray *lines, GMenuTreeDirectory *directory, const char *path)
+{
+  GMenuTreeIter *iter = gmenu_tree_directory_iter(directory);
+  GMenuTreeItemType type;
+
+  while ((type = gmenu_tree_iter_next(iter)) != GMENU_TREE_ITEM_INVALID)
+    {
+      if (type == GMENU_TREE_ITEM_ENTRY)
+        {
+          GMenuTreeEntry *entry = gmenu_tree_iter_get_entry(iter);
+          g_ptr_array_add(lines, g_strdup_printf("%s\t%s", path,
+                                                 gmenu_tree_entry_get_desktop_file_id(entry)));
+          gmenu_tree_item_unref(entry);
+        }
+      else if (type == GMENU_TREE_ITEM_DIRECTORY)
+        {
+          GMenuTreeDirectory *subdirectory = gmenu_tree_iter_get_directory(iter);
+          char *subpath = g_strdup_printf("%s/%s", path,
+                                          gmenu_tree_directory_get_name(subdirectory));
+          flatten_gmenu_directory(lines, subdirectory, subpath);
+          g_free(subpath);
+          gmenu_tree_item_unref(subdirectory);
+        }
+    }
+  gmenu_tree_iter_unref(iter);
+}
+
+static void
+flatten_spec_directory(GPtrArray *lines, menuspec_directory *directory, const char *path)
+{
+  guint count = menuspec_directory_get_n_items(directory);
+  guint i;
+
+  for (i = 0; i < count; i++)
+    {
+      gpointer item;
+      if (menuspec_directory_get_item(directory, i, &item) == MENUSPEC_ITEM_ENTRY)
+        {
+          g_ptr_array_add(lines, g_strdup_printf("%s\t%s", path,
+                                                 menuspec_entry_get_desktop_file_id(item)));
+        }
+      else
+        {
+          char *subpath = g_strdup_printf("%s/%s", path,
+                                          menuspec_directory_get_name(item));
+          flatten_spec_directory(lines, item, subpath);
+          g_free(subpath);
+        }
+    }
+}
+
+static int
+compare_lines(gconstpointer a, gconstpointer b)
+{
+  return strcmp(*(const char **)a, *(const char **)b);
+}
+
+// read the menu with libgnome-menu, returning the lines, or NULL on failure,
+// and how long it took
+static GPtrArray *
+read_gmenu(const char *filename, gint64 *elapsed)
+{
+  GError *error = NULL;
+  GPtrArray *lines = g_ptr_array_new_with_free_func(g_free);
+
+  // a tree is only loaded again once it has changed, so use a new one
+  GMenuTree *tree = gmenu_tree_new_for_path(filename, GMENU_TREE_FLAGS_SORT_DISPLAY_NAME);
+  gint64 start = g_get_monotonic_time();
+  gboolean loaded = gmenu_tree_load_sync(tree, &error);
+  *elapsed = g_get_monotonic_time() - start;
+
+  if (!loaded)
+    {
+      fprintf(stderr, "libgnome-menu failed to load tree: %s\n", error->message);
+      g_error_free(error);
+      g_object_unref(tree);
+      g_ptr_array_free(lines, TRUE);
+      return NULL;
+    }
+
+  GMenuTreeDirectory *root = gmenu_tree_get_root_directory(tree);
+  if (root)
+    {
+      flatten_gmenu_directory(lines, root, "");
+      gmenu_tree_item_unref(root);
+    }
+  g_object_unref(tree);
+
+  g_ptr_array_sort(lines, compare_lines);
+  return lines;
+}
+
+static GPtrArray *
+read_spec(const char *filename, gint64 *elapsed)
+{
+  GError *error = NULL;
+  GPtrArray *lines = g_ptr_array_new_with_free_func(g_free);
+
+  menuspec *spec = menuspec_new(filename);
+  gint64 start = g_get_monotonic_time();
+  gboolean loaded = menuspec_load(spec, &error);
+  *elapsed = g_get_monotonic_time() - start;
+
+  if (!loaded)
+    {
+      fprintf(stderr, "menuspec failed to load tree: %s\n", error->message);
+      g_error_free(error);
+      menuspec_free(spec);
+      g_ptr_array_free(lines, TRUE);
+      return NULL;
+    }
+
+  menuspec_directory *root = menuspec_get_root(spec);
+  if (root)
+    flatten_spec_directory(lines, root, "");
+  menuspec_free(spec);
+
+  g_ptr_array_sort(lines, compare_lines);
+  return lines;
+}
+
+// list the lines only in one or the other, returning how many there are
+static unsigned int
+difference(GPtrArray *gmenu, GPtrArray *spec, gboolean verbose)
+{
+  unsigned int differ = 0;
+  guint i = 0, j = 0;
+
+  while ((i < gmenu->len) || (j < spec->len))
+    {
+      int c;
+      if (i == gmenu->len)
+        c = 1;
+      else if (j == spec->len)
+        c = -1;
+      else
+        c = strcmp(g_ptr_array_index(gmenu, i), g_ptr_array_index(spec, j));
+
+      if (c < 0)
+        {
+          if (verbose)
+            printf("only libgnome-menu: %s\n", (char *)g_ptr_array_index(gmenu, i));
+          i++;
+          differ++;
+        }
+      else if (c > 0)
+        {
+          if (verbose)
+            printf("only menuspec:      %s\n", (char *)g_ptr_array_index(spec, j));
+          j++;
+          differ++;
+        }
+      else
+        {
+          i++;
+          j++;
+        }
+    }
+
+  return differ;
+}
+
+//
+// The synthetic XDG tree
+//
+
+static char *
+xdg_setup(const char *tmpdir)
+{
+  char *home = g_build_filename(tmpdir, "home", NULL);
+  char *data_home = g_build_filename(home, ".local", "share", NULL);
+  char *config_home = g_build_filename(home, ".config", NULL);
+  char *share = g_build_filename(tmpdir, "usr", "share", NULL);
+  char *applications = g_build_filename(share, "applications", NULL);
+
+  g_setenv("XDG_DATA_HOME", data_home, TRUE);
+  g_setenv("XDG_CONFIG_HOME", config_home, TRUE);
+  g_setenv("XDG_DATA_DIRS", share, TRUE);
+  g_mkdir_with_parents(applications, 0755);
+
+  g_free(share);
+  g_free(config_home);
+  g_free(data_home);
+  g_free(home);
+
+  return applications;
+}
+
+// add desktop entries numbered from..to-1, each in one or two categories
+static void
+populate(const char *applications, GRand *rand, int from, int to)
+{
+  static const char *categories[] = { "Development", "Education", "Game", "Graphics",
+                                      "Network", "AudioVideo", "Office", "Settings",
+                                      "System", "Utility", "Science", "Accessibility" };
+  int i;
+
+  for (i = from; i < to; i++)
+    {
+      const char *first = categories[g_rand_int_range(rand, 0, G_N_ELEMENTS(categories))];
+      const char *second = categories[g_rand_int_range(rand, 0, G_N_ELEMENTS(categories))];
+      char *name = g_strdup_printf("xwin-compare-%d.desktop", i);
+      char *path = g_build_filename(applications, name, NULL);
+      char *contents = g_strdup_printf("[Desktop Entry]\n"
+                                       "Type=Application\n"
+                                       "Name=Synthetic application %d\n"
+                                       "Exec=true %d\n"
+                                       "Categories=%s;%s;\n"
+                                       "%s",
+                                       i, i, first, second,
+                                       (i % 50 == 0) ? "NoDisplay=true\n" : "");
+      g_file_set_contents(path, contents, -1, NULL);
+      g_free(contents);
+      g_free(path);
+      g_free(name);
+    }
+}
+
+static void
+remove_tree(const char *path)
+{
+  GDir *dir = g_dir_open(path, 0, NULL);
+  if (dir)
+    {
+      const char *name;
+      while ((name = g_dir_read_name(dir)))
+        {
+          char *child = g_build_filename(path, name, NULL);
+          if (g_file_test(child, G_FILE_TEST_IS_DIR) && !g_file_test(child, G_FILE_TEST_IS_SYMLINK))
+            remove_tree(child);
+          else
+            g_unlink(child);
+          g_free(child);
+        }
+      g_dir_close(dir);
+    }
+  g_rmdir(path);
+}
+
+// read the menu with each, returning the number of differences, or -1 if
+// either failed
+static int
+compare(const char *filename, int tries, gboolean verbose)
+{
+  GPtrArray *gmenu = NULL, *spec = NULL;
+  gint64 gmenu_best = G_MAXINT64, spec_best = G_MAXINT64;
+  int differ = -1;
+  int i;
+
+  for (i = 0; i < tries; i++)
+    {
+      gint64 elapsed;
+
+      if (gmenu)
+        g_ptr_array_free(gmenu, TRUE);
+      gmenu = read_gmenu(filename, &elapsed);
+      gmenu_best = MIN(gmenu_best, elapsed);
+
+      if (spec)
+        g_ptr_array_free(spec, TRUE);
+      spec = read_spec(filename, &elapsed);
+      spec_best = MIN(spec_best, elapsed);
+    }
+
+  if (gmenu && spec)
+    {
+      differ = difference(gmenu, spec, verbose);
+      printf("%8u entries  libgnome-menu %8.1f ms  menuspec %8.1f ms  %d differ\n",
+             gmenu->len, gmenu_best / 1000.0, spec_best / 1000.0, differ);
+    }
+
+  if (gmenu)
+    g_ptr_array_free(gmenu, TRUE);
+  if (spec)
+    g_ptr_array_free(spec, TRUE);
+
+  return differ;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int bench = 0;
+  gchar *menu = NULL;
+  gboolean keep = FALSE;
+  gboolean verbose = FALSE;
+  GError *error = NULL;
+
+  GOptionEntry options[] =
+    {
+      { "menu", 'm', 0, G_OPTION_ARG_FILENAME, &menu, "Menu file (default " XWIN_APPLICATIONS_MENU ")", "FILE" },
+      { "bench", 'b', 0, G_OPTION_ARG_INT, &bench, "Compare synthetic trees of up to this many desktop entries", "N" },
+      { "keep", 'k', 0, G_OPTION_ARG_NONE, &keep, "Don't remove the synthetic tree afterwards", NULL },
+      { "verbose", 'v', 0, G_OPTION_ARG_NONE, &verbose, "List the entries which differ, when benchmarking", NULL },
+      { NULL }
+    };
+
+  GOptionContext *context = g_option_context_new("- compare menuspec with libgnome-menu");
+  g_option_context_add_main_entries(context, options, NULL);
+  if (!g_option_context_parse(context, &argc, &argv, &error))
+    {
+      fprintf(stderr, "%s\n", error->message);
+      return 1;
+    }
+  g_option_context_free(context);
+
+  const char *filename = menu ? menu : XWIN_APPLICATIONS_MENU;
+
+  if (bench <= 0)
+    {
+      int differ = compare(filename, 1, TRUE);
+      if (differ < 0)
+        return 1;
+      return differ ? 2 : 0;
+    }
+
+  char *tmpdir = g_dir_make_tmp("xwin-xdg-menu-compare-XXXXXX", &error);
+  if (!tmpdir)
+    {
+      fprintf(stderr, "%s\n", error->message);
+      return 1;
+    }
+
+  // this must be done before GLib looks at the XDG environment variables
+  char *applications = xdg_setup(tmpdir);
+  printf("Synthetic tree in %s\n", tmpdir);
+
+  // a fixed seed, so runs are comparable
+  GRand *rand = g_rand_new_with_seed(1);
+  int failed = 0;
+  int count = 0;
+  int size;
+
+  for (size = MIN(100, bench); ; size = MIN(size * 10, bench))
+    {
+      populate(applications, rand, count, size);
+      count = size;
+
+      int differ = compare(filename, BENCH_TRIES, verbose);
+      if (differ != 0)
+        failed = (differ < 0) ? 1 : 2;
+
+      if (size == bench)
+        break;
+    }
+
+  g_rand_free(rand);
+  g_free(applications);
+
+  if (!keep)
+    remove_tree(tmpdir);
+  g_free(tmpdir);
+
+  return failed;
+}
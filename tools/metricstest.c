@@ -0,0 +1,371 @@
+/*
+ * metricstest.c
+ *
+ * Copyright (C) Jon Turney 2015
+ *
+ * This file is part of xwin-xdg-menu
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+//
+// xwin-xdg-menu-metricstest: check the accuracy of latency histograms, and
+// updating metrics from several threads at once
+//
+// Values are drawn from some known distributions (uniform, exponential,
+// log-normal, a constant, and small values which have a bucket each), and the
+// quantiles the histogram reports (metrics.c) are compared with the exact ones
+// from the sorted values.  A reported quantile should be no smaller than the
+// exact one, and larger by less than 1/METRICS_SUB_BUCKETS of it.
+//
+// Then some threads record values into one histogram and add to one counter,
+// while another reads quantiles and exposes the metrics, and the count, sum,
+// maximum and quantiles are checked against the values recorded.  Finally,
+// the warning when the 99th percentile crosses the limit is checked.
+//
+// Each check is reported, and the exit status is 2 if any failed.
+//
+
+#include <glib.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../metrics.h"
+
+static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+static int failures;
+
+static void
+check(gboolean ok, const char *what)
+{
+  printf("%s: %s\n", ok ? "ok" : "FAIL", what);
+  if (!ok)
+    failures++;
+}
+
+static gint
+compare_values(gconstpointer a, gconstpointer b)
+{
+  gint64 x = *(const gint64 *)a;
+  gint64 y = *(const gint64 *)b;
+  return (x > y) - (x < y);
+}
+
+// the exact quantile of n sorted values, with the same rank metrics.c uses
+static gint64
+exact_quantile(const gint64 *sorted, int n, double q)
+{
+  gint64 rank = CLAMP((gint64)(q * n + 0.5), 1, n);
+  return sorted[rank - 1];
+}
+
+// whether the reported quantile is within the histogram's precision of the
+// exact one
+static gboolean
+quantile_ok(gint64 reported, gint64 exact)
+{
+  return (reported >= exact) && (reported - exact <= exact / METRICS_SUB_BUCKETS);
+}
+
+typedef enum { DIST_UNIFORM, DIST_EXPONENTIAL, DIST_LOGNORMAL, DIST_CONSTANT, DIST_SMALL } distribution;
+
+static const char *distribution_names[] = { "uniform", "exponential", "log-normal", "constant", "small" };
+
+// a value in microseconds from distribution
+static gint64
+draw(GRand *rand, distribution d)
+{
+  switch (d)
+    {
+    case DIST_UNIFORM:
+      // up to a second
+      return g_rand_int_range(rand, 0, G_USEC_PER_SEC);
+    case DIST_EXPONENTIAL:
+      // mean 50 ms
+      return (gint64)(-50000.0 * log(1.0 - g_rand_double(rand)));
+    case DIST_LOGNORMAL:
+      {
+        // median 20 ms, with a long tail
+        double u1 = 1.0 - g_rand_double(rand);
+        double u2 = g_rand_double(rand);
+        double z = sqrt(-2.0 * log(u1)) * cos(2.0 * G_PI * u2);
+        return (gint64)exp(log(20000.0) + 1.5 * z);
+      }
+    case DIST_CONSTANT:
+      return 12345;
+    case DIST_SMALL:
+      return g_rand_int_range(rand, 0, METRICS_SUB_BUCKETS);
+    }
+  return 0;
+}
+
+static void
+check_distribution(GRand *rand, distribution d, int n)
+{
+  metrics_histogram *h = metrics_histogram_new(distribution_names[d], "test values");
+  gint64 *values = g_new(gint64, n);
+  gint64 sum = 0;
+  double worst = 0;
+  gboolean ok = TRUE;
+  int i;
+  guint j;
+
+  for (i = 0; i < n; i++)
+    {
+      values[i] = draw(rand, d);
+      sum += values[i];
+      metrics_histogram_record(h, values[i]);
+    }
+  qsort(values, n, sizeof(gint64), compare_values);
+
+  for (j = 0; j < G_N_ELEMENTS(quantiles); j++)
+    {
+      gint64 exact = exact_quantile(values, n, quantiles[j]);
+      gint64 reported = metrics_histogram_quantile(h, quantiles[j]);
+      if (!quantile_ok(reported, exact))
+        {
+          printf("%s p%g: reported %" G_GINT64_FORMAT ", exact %" G_GINT64_FORMAT "\n",
+                 distribution_names[d], quantiles[j] * 100, reported, exact);
+          ok = FALSE;
+        }
+      if (exact)
+        worst = MAX(worst, (double)(reported - exact) / exact);
+    }
+
+  char *message = g_strdup_printf("%s quantiles within %.2f%% (worst %.2f%%), %d values",
+                                  distribution_names[d], 100.0 / METRICS_SUB_BUCKETS,
+                                  worst * 100, n);
+  check(ok, message);
+  g_free(message);
+
+  message = g_strdup_printf("%s count, sum and maximum", distribution_names[d]);
+  check((metrics_histogram_count(h) == n) && (h->sum == sum) && (h->max == values[n - 1]), message);
+  g_free(message);
+
+  g_free(values);
+}
+
+typedef struct
+{
+  metrics_histogram *h;
+  metrics_counter *c;
+  int seed;
+  int n;
+  gint64 *values;
+  gint64 sum;
+} writer;
+
+static gpointer
+writer_thread(gpointer data)
+{
+  writer *w = data;
+  GRand *rand = g_rand_new_with_seed(w->seed);
+  int i;
+
+  for (i = 0; i < w->n; i++)
+    {
+      w->values[i] = draw(rand, DIST_LOGNORMAL);
+      w->sum += w->values[i];
+      metrics_histogram_record(w->h, w->values[i]);
+      metrics_counter_add(w->c, 1);
+    }
+
+  g_rand_free(rand);
+  return NULL;
+}
+
+static gint reading;
+
+// read the histogram while it's being written, checking each quantile is in
+// the range of values which can have been recorded so far
+static gpointer
+reader_thread(gpointer data)
+{
+  metrics_histogram *h = data;
+  int *bad = g_new0(int, 1);
+
+  while (g_atomic_int_get(&reading))
+    {
+      gint64 before = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+      gint64 p50 = metrics_histogram_quantile(h, 0.5);
+      gint64 p99 = metrics_histogram_quantile(h, 0.99);
+      gint64 after = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+      if ((p50 > after) || (p99 > after) || (after < before))
+        (*bad)++;
+
+      GString *out = g_string_new(NULL);
+      metrics_expose(out);
+      g_string_free(out, TRUE);
+    }
+
+  return bad;
+}
+
+static void
+check_concurrent(int n_threads, int n)
+{
+  metrics_histogram *h = metrics_histogram_new("concurrent", "test values");
+  metrics_counter *c = metrics_counter_new("concurrent_total", "test counter");
+  writer *writers = g_new0(writer, n_threads);
+  GThread **threads = g_new(GThread *, n_threads);
+  gint64 *values = g_new(gint64, (gsize)n_threads * n);
+  gint64 sum = 0;
+  int i, j;
+
+  g_atomic_int_set(&reading, TRUE);
+  GThread *reader = g_thread_new("reader", reader_thread, h);
+
+  gint64 start = g_get_monotonic_time();
+  for (i = 0; i < n_threads; i++)
+    {
+      writers[i].h = h;
+      writers[i].c = c;
+      writers[i].seed = i + 1;
+      writers[i].n = n;
+      writers[i].values = values + (gsize)i * n;
+      threads[i] = g_thread_new("writer", writer_thread, &writers[i]);
+    }
+  for (i = 0; i < n_threads; i++)
+    {
+      g_thread_join(threads[i]);
+      sum += writers[i].sum;
+    }
+  gint64 took = g_get_monotonic_time() - start;
+
+  g_atomic_int_set(&reading, FALSE);
+  int *bad = g_thread_join(reader);
+
+  gint64 total = (gint64)n_threads * n;
+  qsort(values, total, sizeof(gint64), compare_values);
+
+  char *message = g_strdup_printf("%d threads recorded %" G_GINT64_FORMAT " values, counted %" G_GINT64_FORMAT " and %" G_GINT64_FORMAT,
+                                  n_threads, total, metrics_histogram_count(h), c->value);
+  check((metrics_histogram_count(h) == total) && (c->value == total), message);
+  g_free(message);
+
+  gint64 buckets = 0;
+  for (j = 0; j < METRICS_BUCKETS; j++)
+    buckets += h->buckets[j];
+  check(buckets == total, "bucket counts add up to the count");
+  check(h->sum == sum, "sum of concurrent values");
+  check(h->max == values[total - 1], "maximum of concurrent values");
+
+  gboolean ok = TRUE;
+  for (j = 0; j < (int)G_N_ELEMENTS(quantiles); j++)
+    ok = ok && quantile_ok(metrics_histogram_quantile(h, quantiles[j]),
+                           exact_quantile(values, total, quantiles[j]));
+  check(ok, "quantiles of concurrent values");
+
+  check(*bad == 0, "quantiles read while recording are consistent");
+
+  printf("%" G_GINT64_FORMAT " values recorded by %d threads in %.1f ms (%.0f ns each)\n",
+         total, n_threads, took / 1000.0, took * 1000.0 / total);
+
+  g_free(bad);
+  g_free(values);
+  g_free(threads);
+  g_free(writers);
+}
+
+static int warnings;
+
+static void
+count_warnings(const gchar *string)
+{
+  if (g_str_has_prefix(string, "Warning:"))
+    warnings++;
+}
+
+static void
+check_limit(void)
+{
+  metrics_histogram *h = metrics_histogram_new("limited", "test values");
+  int i;
+
+  metrics_histogram_set_limit(h, 10000);
+  g_set_print_handler(count_warnings);
+
+  for (i = 0; i < 100; i++)
+    metrics_histogram_record(h, 1000);
+  check(!h->over && !warnings, "no warning while the 99th percentile is under the limit");
+
+  for (i = 0; i < 10; i++)
+    metrics_histogram_record(h, 50000);
+  check(h->over && (warnings == 1), "one warning once the 99th percentile is over the limit");
+
+  for (i = 0; i < 2000; i++)
+    metrics_histogram_record(h, 1000);
+  check(!h->over && (warnings == 1), "back under the limit, without another warning");
+
+  g_set_print_handler(NULL);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n = 100000;
+  int n_threads = 8;
+  int seed = 1;
+  GError *error = NULL;
+  int d;
+
+  GOptionEntry options[] =
+    {
+      { "values", 'n', 0, G_OPTION_ARG_INT, &n, "Number of values from each distribution, and from each thread (default 100000)", "N" },
+      { "threads", 't', 0, G_OPTION_ARG_INT, &n_threads, "Number of threads recording at once (default 8)", "N" },
+      { "seed", 's', 0, G_OPTION_ARG_INT, &seed, "Random seed (default 1)", "N" },
+      { NULL }
+    };
+
+  GOptionContext *context = g_option_context_new("- check latency histograms and concurrent metric updates");
+  g_option_context_add_main_entries(context, options, NULL);
+  if (!g_option_context_parse(context, &argc, &argv, &error))
+    {
+      fprintf(stderr, "%s\n", error->message);
+      return 1;
+    }
+  g_option_context_free(context);
+
+  if ((n <= 0) || (n_threads <= 0))
+    {
+      fprintf(stderr, "--values and --threads must be positive\n");
+      return 1;
+    }
+
+  GRand *rand = g_rand_new_with_seed(seed);
+  for (d = DIST_UNIFORM; d <= DIST_SMALL; d++)
+    check_distribution(rand, d, n);
+  g_rand_free(rand);
+
+  check_concurrent(n_threads, n);
+  check_limit();
+
+  if (failures)
+    {
+      printf("%d checks failed\n", failures);
+      return 2;
+    }
+
+  return 0;
+}
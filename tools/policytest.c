@@ -0,0 +1,243 @@
+/*
+ * policytest.c
+ *
+ * Copyright (C) Jon Turney 2015
+ *
+ * This file is part of xwin-xdg-menu
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+//
+// xwin-xdg-menu-policytest: check that launch policies are applied
+//
+// A policy file is written to a temporary XDG_CONFIG_HOME, and policies are
+// looked up from it and applied in forked children as xwin-xdg-menu does
+// (policy.c).  Each child reports its nice value, resource limits and CPU
+// affinity, which are checked against the policy.  Invalid values in the
+// policy file should be logged and ignored.
+//
+// Each check is reported, and the exit status is 2 if any failed.  Checks
+// which need privileges we don't have (e.g. lowering our nice value) are
+// skipped.
+//
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../policy.h"
+
+static const char policy_file[] =
+  "[Default]\n"
+  "nice=5\n"
+  "\n"
+  "[Category Development]\n"
+  "rlimit-nofile=256\n"
+  "\n"
+  "[test.desktop]\n"
+  "cpus=0\n"
+  "rlimit-as=1024\n"
+  "\n"
+  "[hard.desktop]\n"
+  "rlimit-nofile=128\n"
+  "rlimit-nofile-hard=512\n"
+  "\n"
+  "[clamp.desktop]\n"
+  "rlimit-nofile=1024\n"
+  "rlimit-nofile-hard=64\n"
+  "\n"
+  "[bad.desktop]\n"
+  "nice=lots\n"
+  "rlimit-as=-5\n"
+  "rlimit-nofile=many\n"
+  "ionice=sideways\n";
+
+typedef struct
+{
+  int nice;
+  struct rlimit as;
+  struct rlimit nofile;
+  int cpus;
+  gboolean cpu0;
+} child_state;
+
+static int failures;
+
+static void
+check(gboolean ok, const char *what)
+{
+  printf("%s: %s\n", ok ? "ok" : "FAIL", what);
+  if (!ok)
+    failures++;
+}
+
+static void
+skip(const char *what)
+{
+  printf("skipped: %s\n", what);
+}
+
+static void
+get_state(child_state *state)
+{
+  memset(state, 0, sizeof(*state));
+  state->nice = getpriority(PRIO_PROCESS, 0);
+  getrlimit(RLIMIT_AS, &state->as);
+  getrlimit(RLIMIT_NOFILE, &state->nofile);
+#ifdef CPU_SET
+  cpu_set_t cpus;
+  if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0)
+    {
+      state->cpus = CPU_COUNT(&cpus);
+      state->cpu0 = CPU_ISSET(0, &cpus);
+    }
+#endif
+}
+
+// apply the policy for desktop_id in a child, and report its state
+static void
+apply_in_child(const char *desktop_id, const char *categories, child_state *state)
+{
+  launch_policy policy;
+  int fds[2];
+  pid_t pid;
+
+  policy_lookup(desktop_id, categories, &policy);
+
+  if (pipe(fds))
+    {
+      perror("pipe");
+      exit(1);
+    }
+
+  fflush(stdout);
+  switch (pid = fork())
+    {
+    case -1:
+      perror("fork");
+      exit(1);
+
+    case 0:
+      policy_apply(&policy);
+      get_state(state);
+      write(fds[1], state, sizeof(*state));
+      _exit(0);
+    }
+
+  close(fds[1]);
+  if (read(fds[0], state, sizeof(*state)) != sizeof(*state))
+    {
+      fprintf(stderr, "%s: child didn't report its state\n", desktop_id);
+      exit(1);
+    }
+  close(fds[0]);
+  waitpid(pid, NULL, 0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  child_state parent, state;
+  GError *error = NULL;
+
+  // before anything asks GLib for the config directory
+  gchar *dir = g_dir_make_tmp("policytest-XXXXXX", &error);
+  if (!dir)
+    {
+      fprintf(stderr, "%s\n", error->message);
+      return 1;
+    }
+  g_setenv("XDG_CONFIG_HOME", dir, TRUE);
+
+  gchar *filename = g_build_filename(dir, "xwin-xdg-menu-policy", NULL);
+  if (!g_file_set_contents(filename, policy_file, -1, &error))
+    {
+      fprintf(stderr, "%s\n", error->message);
+      return 1;
+    }
+
+  get_state(&parent);
+
+  // Default, category and desktop ID groups are merged
+  apply_in_child("test.desktop", "Development;Utility;", &state);
+  if (parent.nice <= 5)
+    check(state.nice == 5, "nice from [Default]");
+  else
+    skip("nice from [Default] (already nicer than 5)");
+  if (parent.nofile.rlim_max >= 256)
+    check(state.nofile.rlim_cur == 256, "rlimit-nofile soft limit from [Category Development]");
+  else
+    skip("rlimit-nofile soft limit (hard limit below 256)");
+  check(state.nofile.rlim_max == parent.nofile.rlim_max, "rlimit-nofile hard limit unchanged");
+  if ((parent.as.rlim_max == RLIM_INFINITY) || (parent.as.rlim_max >= (rlim_t)1024 * 1024 * 1024))
+    check(state.as.rlim_cur == (rlim_t)1024 * 1024 * 1024, "rlimit-as soft limit from [test.desktop]");
+  else
+    skip("rlimit-as soft limit (hard limit below 1 GiB)");
+  check(state.as.rlim_max == parent.as.rlim_max, "rlimit-as hard limit unchanged");
+  if (parent.cpu0)
+    check((state.cpus == 1) && state.cpu0, "affinity to cpu 0");
+  else
+    skip("affinity (cpu 0 not available)");
+
+  // without the category, nofile isn't limited
+  apply_in_child("test.desktop", NULL, &state);
+  check(state.nofile.rlim_cur == parent.nofile.rlim_cur, "rlimit-nofile not set without category");
+
+  // a hard limit is only set when asked for
+  apply_in_child("hard.desktop", NULL, &state);
+  if (parent.nofile.rlim_max >= 512)
+    check((state.nofile.rlim_cur == 128) && (state.nofile.rlim_max == 512),
+          "rlimit-nofile-hard sets hard limit");
+  else
+    skip("rlimit-nofile-hard (hard limit below 512)");
+
+  // the soft limit can't be above the hard limit
+  apply_in_child("clamp.desktop", NULL, &state);
+  check((state.nofile.rlim_cur == 64) && (state.nofile.rlim_max == 64),
+        "soft limit lowered to hard limit");
+
+  // invalid values are logged, and the ones they would override kept
+  launch_policy policy;
+  policy_lookup("bad.desktop", NULL, &policy);
+  check(policy.set_nice && (policy.nice == 5), "invalid nice ignored");
+  check(!policy.set_as && !policy.set_nofile, "invalid rlimits ignored");
+  check(!policy.set_ionice, "invalid ionice ignored");
+
+  g_unlink(filename);
+  g_rmdir(dir);
+  g_free(filename);
+  g_free(dir);
+
+  if (failures)
+    {
+      printf("%d checks failed\n", failures);
+      return 2;
+    }
+
+  return 0;
+}
@@ -0,0 +1,269 @@
+/*
+ * proctest.c
+ *
+ * Copyright (C) Jon Turney 2015
+ *
+ * This file is part of xwin-xdg-menu
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+//
+// xwin-xdg-menu-proctest: check the process table with dummy children
+//
+// Some dummy children are forked and tracked as xwin-xdg-menu does
+// (proctable.c): one which burns CPU and memory, one which sleeps with a
+// child of its own, and one which exits at once.  Sampling, lookup, reaping
+// and signalling are checked against them, including that a child which has
+// already exited isn't signalled, and then many short-lived children are added
+// and reaped while another thread samples the table.
+//
+// Each check is reported, and the exit status is 2 if any failed.
+//
+
+#include <glib.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../proctable.h"
+
+#define BUSY_RSS (16 * 1024 * 1024)
+
+static int failures;
+
+static void
+check(gboolean ok, const char *what)
+{
+  printf("%s: %s\n", ok ? "ok" : "FAIL", what);
+  if (!ok)
+    failures++;
+}
+
+static void
+busy_child(void)
+{
+  char *mem = malloc(BUSY_RSS);
+  memset(mem, 1, BUSY_RSS);
+  while (1)
+    mem[rand() % BUSY_RSS]++;
+}
+
+static int grandchild_pipe[2];
+
+static void
+sleeping_child(void)
+{
+  pid_t pid = fork();
+  if (pid == 0)
+    {
+      while (1)
+        pause();
+    }
+  write(grandchild_pipe[1], &pid, sizeof(pid));
+  while (1)
+    pause();
+}
+
+static void
+quick_child(void)
+{
+  _exit(3);
+}
+
+static int
+start_child(const char *id, void (*child)(void))
+{
+  fflush(stdout);
+  int pid = fork();
+  if (pid < 0)
+    {
+      perror("fork");
+      exit(1);
+    }
+  if (pid == 0)
+    {
+      // in a new session, as xwin-xdg-menu starts them
+      setsid();
+      child();
+    }
+
+  proctable_add(pid, id);
+  return pid;
+}
+
+// reap pid, and remove it from the table
+static int
+reap(int pid)
+{
+  int status = 0;
+  g_free(proctable_reap(pid, &status));
+  return status;
+}
+
+static gint64
+entry_started(int pid)
+{
+  GArray *snapshot = proctable_snapshot();
+  gint64 started = 0;
+  guint i;
+  for (i = 0; i < snapshot->len; i++)
+    if (g_array_index(snapshot, proctable_entry, i).pid == pid)
+      started = g_array_index(snapshot, proctable_entry, i).started;
+  proctable_snapshot_free(snapshot);
+  return started;
+}
+
+// whether pid has gone, or is a zombie waiting for someone else to reap it
+static gboolean
+process_gone(int pid)
+{
+  char path[64];
+  char *contents;
+  gboolean gone = TRUE;
+  snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+  if (g_file_get_contents(path, &contents, NULL, NULL))
+    {
+      char *p = strrchr(contents, ')');
+      gone = p && (p[2] == 'Z');
+      g_free(contents);
+    }
+  return gone;
+}
+
+static volatile gboolean sampling;
+
+static gpointer
+sample_thread(gpointer data)
+{
+  guint *samples = data;
+  while (sampling)
+    {
+      proctable_sample();
+      (*samples)++;
+    }
+  return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int churn = 200;
+  GError *error = NULL;
+  int i;
+
+  GOptionEntry options[] =
+    {
+      { "churn", 'n', 0, G_OPTION_ARG_INT, &churn, "Number of short-lived children to add and reap while sampling (default 200)", "N" },
+      { NULL }
+    };
+
+  GOptionContext *context = g_option_context_new("- check the process table with dummy children");
+  g_option_context_add_main_entries(context, options, NULL);
+  if (!g_option_context_parse(context, &argc, &argv, &error))
+    {
+      fprintf(stderr, "%s\n", error->message);
+      return 1;
+    }
+  g_option_context_free(context);
+
+  if (pipe(grandchild_pipe))
+    {
+      perror("pipe");
+      return 1;
+    }
+
+  proctable_init();
+
+  int busy = start_child("busy", busy_child);
+  int sleeping = start_child("sleeping", sleeping_child);
+  int quick = start_child("quick", quick_child);
+  pid_t grandchild = 0;
+  read(grandchild_pipe[0], &grandchild, sizeof(grandchild));
+
+  check(proctable_count() == 3, "three children in the table");
+  check(proctable_find("busy") == busy, "found by id");
+  check(proctable_find("nonesuch") == 0, "unknown id not found");
+
+  g_usleep(G_USEC_PER_SEC);
+  proctable_sample();
+  GArray *snapshot = proctable_snapshot();
+  check(snapshot->len == 3, "snapshot has three children");
+  if (snapshot->len == 3)
+    {
+      proctable_entry *e = &g_array_index(snapshot, proctable_entry, 0);
+      check((e->pid == busy) && !strcmp(e->id, "busy"), "snapshot is oldest first");
+      check(e->cpu >= G_USEC_PER_SEC / 2, "CPU time of busy child sampled");
+      check(e->rss >= BUSY_RSS / 1024, "RSS of busy child sampled");
+      printf("busy child: cpu %.2fs, rss %ld KiB\n", e->cpu / 1e6, e->rss);
+    }
+  proctable_snapshot_free(snapshot);
+
+  gint64 quick_started = entry_started(quick);
+  int status = reap(quick);
+  check(WIFEXITED(status) && (WEXITSTATUS(status) == 3), "quick child exited");
+  check(proctable_count() == 2, "reaped child removed");
+  check(proctable_find("quick") == 0, "reaped child not found");
+  check(!proctable_signal(quick, quick_started, SIGTERM), "reaped child not signalled");
+
+  gint64 sleeping_started = entry_started(sleeping);
+  check(!proctable_signal(sleeping, sleeping_started + 1, SIGTERM), "child with another start time not signalled");
+  check(!process_gone(sleeping), "... and still running");
+  check(proctable_signal(sleeping, sleeping_started, SIGTERM), "running child signalled");
+  status = reap(sleeping);
+  check(WIFSIGNALED(status) && (WTERMSIG(status) == SIGTERM), "running child terminated");
+  for (i = 0; (i < 100) && !process_gone(grandchild); i++)
+    g_usleep(10000);
+  check(process_gone(grandchild), "its process group terminated");
+
+  check(proctable_signal(busy, entry_started(busy), SIGKILL), "busy child signalled");
+  reap(busy);
+  check(proctable_count() == 0, "table empty");
+
+  // launching and reaping while the table is sampled
+  guint samples = 0;
+  sampling = TRUE;
+  GThread *sampler = g_thread_new("sampler", sample_thread, &samples);
+  gint64 start = g_get_monotonic_time();
+  for (i = 0; i < churn; i++)
+    {
+      char *id = g_strdup_printf("churn-%d", i);
+      int pid = start_child(id, quick_child);
+      g_free(id);
+      reap(pid);
+    }
+  gint64 took = g_get_monotonic_time() - start;
+  sampling = FALSE;
+  g_thread_join(sampler);
+  check(proctable_count() == 0, "table empty after churn");
+  printf("%d children added and reaped in %.1f ms, during %u samples\n", churn, took / 1000.0, samples);
+
+  if (failures)
+    {
+      printf("%d checks failed\n", failures);
+      return 2;
+    }
+
+  return 0;
+}
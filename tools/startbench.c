@@ -0,0 +1,440 @@
+/*
+ * startbench.c
+ *
+ * Copyright (C) Jon Turney 2015
+ *
+ * This file is part of xwin-xdg-menu
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+//
+// xwin-xdg-menu-startbench: benchmark the startup timeline
+//
+// A synthetic XDG tree is created in a temporary directory, which the XDG
+// environment variables point at, with (by default) 1500 desktop entries in
+// random categories, each with its own icon.  xwin-xdg-menu is started against
+// it a few times, and the 'startup:' milestones it logs (process start, icon
+// visible, menu ready, ...) are collected until the last one wanted is seen,
+// when it's terminated.
+//
+// For each milestone, the median and worst time after process start (as
+// logged), and the median time after it was spawned (as seen from here, so
+// including loading and linking) are reported.  The exit status is 2 if a run
+// didn't reach the last milestone within the timeout.
+//
+// This needs somewhere xwin-xdg-menu can run, i.e. Cygwin/X.
+//
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// normally defined by the build to be the one in the source tree
+#ifndef XWIN_APPLICATIONS_MENU
+#define XWIN_APPLICATIONS_MENU "/etc/xdg/menus/xwin-applications.menu"
+#endif
+
+// a 16x16 PNG
+static const char icon_png[] =
+  "\x89\x50\x4e\x47\x0d\x0a\x1a\x0a\x00\x00\x00\x0d\x49\x48\x44\x52\x00\x00"
+  "\x00\x10\x00\x00\x00\x10\x08\x06\x00\x00\x00\x1f\xf3\xff\x61\x00\x00\x00"
+  "\x19\x49\x44\x41\x54\x78\xda\x63\x70\x68\x38\xf0\x9f\x12\xcc\x30\x6a\xc0"
+  "\xa8\x01\xa3\x06\x0c\x17\x03\x00\x09\x8f\x7f\x1f\xca\xd7\xb9\x3e\x00\x00"
+  "\x00\x00\x49\x45\x4e\x44\xae\x42\x60\x82";
+
+typedef struct
+{
+  char *what;
+  // as logged, after process start, and as seen here, after spawning, in ms
+  GArray *logged;
+  GArray *seen;
+} milestone;
+
+// in the order first seen
+static GPtrArray *milestones;
+
+static void
+milestone_free(gpointer data)
+{
+  milestone *m = data;
+  g_free(m->what);
+  g_array_free(m->logged, TRUE);
+  g_array_free(m->seen, TRUE);
+  g_free(m);
+}
+
+static milestone *
+milestone_get(const char *what)
+{
+  guint i;
+  for (i = 0; i < milestones->len; i++)
+    {
+      milestone *m = g_ptr_array_index(milestones, i);
+      if (!strcmp(m->what, what))
+        return m;
+    }
+
+  milestone *m = g_new0(milestone, 1);
+  m->what = g_strdup(what);
+  m->logged = g_array_new(FALSE, FALSE, sizeof(double));
+  m->seen = g_array_new(FALSE, FALSE, sizeof(double));
+  g_ptr_array_add(milestones, m);
+  return m;
+}
+
+static gint
+compare_doubles(gconstpointer a, gconstpointer b)
+{
+  double da = *(const double *)a, db = *(const double *)b;
+  return (da > db) - (da < db);
+}
+
+static double
+median(GArray *values)
+{
+  g_array_sort(values, compare_doubles);
+  return g_array_index(values, double, values->len / 2);
+}
+
+//
+// The synthetic XDG tree
+//
+
+static void
+xdg_setup(const char *tmpdir, char **applications, char **icons)
+{
+  char *home = g_build_filename(tmpdir, "home", NULL);
+  char *data_home = g_build_filename(home, ".local", "share", NULL);
+  char *config_home = g_build_filename(home, ".config", NULL);
+  char *runtime = g_build_filename(tmpdir, "run", NULL);
+  char *share = g_build_filename(tmpdir, "usr", "share", NULL);
+  char *xdg = g_build_filename(tmpdir, "etc", "xdg", NULL);
+  char *menus = g_build_filename(xdg, "menus", NULL);
+  char *hicolor = g_build_filename(share, "icons", "hicolor", NULL);
+  char *contents;
+  gsize len;
+
+  g_setenv("XDG_DATA_HOME", data_home, TRUE);
+  g_setenv("XDG_CONFIG_HOME", config_home, TRUE);
+  g_setenv("XDG_DATA_DIRS", share, TRUE);
+  g_setenv("XDG_CONFIG_DIRS", xdg, TRUE);
+  // so the instances don't find one already running
+  g_setenv("XDG_RUNTIME_DIR", runtime, TRUE);
+  g_mkdir_with_parents(config_home, 0755);
+  g_mkdir_with_parents(runtime, 0700);
+  g_mkdir_with_parents(menus, 0755);
+
+  if (g_file_get_contents(XWIN_APPLICATIONS_MENU, &contents, &len, NULL))
+    {
+      char *menu = g_build_filename(menus, "xwin-applications.menu", NULL);
+      g_file_set_contents(menu, contents, len, NULL);
+      g_free(menu);
+      g_free(contents);
+    }
+  else
+    fprintf(stderr, "Can't read %s\n", XWIN_APPLICATIONS_MENU);
+
+  *applications = g_build_filename(share, "applications", NULL);
+  g_mkdir_with_parents(*applications, 0755);
+
+  *icons = g_build_filename(hicolor, "16x16", "apps", NULL);
+  g_mkdir_with_parents(*icons, 0755);
+  char *index = g_build_filename(hicolor, "index.theme", NULL);
+  g_file_set_contents(index,
+                      "[Icon Theme]\n"
+                      "Name=Hicolor\n"
+                      "Directories=16x16/apps\n"
+                      "\n"
+                      "[16x16/apps]\n"
+                      "Size=16\n"
+                      "Type=Threshold\n", -1, NULL);
+  g_free(index);
+
+  g_free(hicolor);
+  g_free(menus);
+  g_free(xdg);
+  g_free(share);
+  g_free(runtime);
+  g_free(config_home);
+  g_free(data_home);
+  g_free(home);
+}
+
+// add count desktop entries, each in one or two categories, with an icon
+static void
+populate(const char *applications, const char *icons, int count)
+{
+  static const char *categories[] = { "Development", "Education", "Game", "Graphics",
+                                      "Network", "AudioVideo", "Office", "Settings",
+                                      "System", "Utility", "Science", "Accessibility" };
+  GRand *rand = g_rand_new_with_seed(1500);
+  int i;
+
+  for (i = 0; i < count; i++)
+    {
+      const char *first = categories[g_rand_int_range(rand, 0, G_N_ELEMENTS(categories))];
+      const char *second = categories[g_rand_int_range(rand, 0, G_N_ELEMENTS(categories))];
+      char *name = g_strdup_printf("xwin-startbench-%d.desktop", i);
+      char *path = g_build_filename(applications, name, NULL);
+      char *contents = g_strdup_printf("[Desktop Entry]\n"
+                                       "Type=Application\n"
+                                       "Name=Synthetic application %d\n"
+                                       "Exec=true %d\n"
+                                       "Icon=xwin-startbench-%d\n"
+                                       "Categories=%s;%s;\n",
+                                       i, i, i, first, second);
+      g_file_set_contents(path, contents, -1, NULL);
+      g_free(contents);
+      g_free(path);
+      g_free(name);
+
+      name = g_strdup_printf("xwin-startbench-%d.png", i);
+      path = g_build_filename(icons, name, NULL);
+      g_file_set_contents(path, icon_png, sizeof(icon_png) - 1, NULL);
+      g_free(path);
+      g_free(name);
+    }
+
+  g_rand_free(rand);
+}
+
+static void
+remove_tree(const char *path)
+{
+  GDir *dir = g_dir_open(path, 0, NULL);
+  if (dir)
+    {
+      const char *name;
+      while ((name = g_dir_read_name(dir)))
+        {
+          char *child = g_build_filename(path, name, NULL);
+          if (g_file_test(child, G_FILE_TEST_IS_DIR) && !g_file_test(child, G_FILE_TEST_IS_SYMLINK))
+            remove_tree(child);
+          else
+            g_unlink(child);
+          g_free(child);
+        }
+      g_dir_close(dir);
+    }
+  g_rmdir(path);
+}
+
+//
+// Running it
+//
+
+// record a "startup: <what> at <ms> ms" line, returning the milestone, or NULL
+// if it isn't one
+static const char *
+startup_line(const char *line, gint64 spawned)
+{
+  const char *at;
+
+  if (!g_str_has_prefix(line, "startup: ") || !(at = g_strrstr(line, " at ")))
+    return NULL;
+
+  char *what = g_strndup(line + strlen("startup: "), at - line - strlen("startup: "));
+  milestone *m = milestone_get(what);
+  g_free(what);
+
+  double logged = g_ascii_strtod(at + strlen(" at "), NULL);
+  double seen = (g_get_monotonic_time() - spawned) / 1000.0;
+  g_array_append_val(m->logged, logged);
+  g_array_append_val(m->seen, seen);
+
+  return m->what;
+}
+
+// run it once, until until is logged, returning FALSE if it wasn't
+static gboolean
+run(char **argv, const char *until, int timeout, gboolean verbose)
+{
+  GError *error = NULL;
+  GPid pid;
+  int out;
+
+  gint64 spawned = g_get_monotonic_time();
+  if (!g_spawn_async_with_pipes(NULL, argv, NULL, G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD,
+                                NULL, NULL, &pid, NULL, &out, NULL, &error))
+    {
+      fprintf(stderr, "%s\n", error->message);
+      g_error_free(error);
+      return FALSE;
+    }
+
+  gint64 deadline = spawned + (gint64)timeout * 1000;
+  gboolean reached = FALSE;
+  char buf[4096];
+  size_t len = 0;
+
+  while (!reached)
+    {
+      gint64 now = g_get_monotonic_time();
+      struct pollfd pfd = { out, POLLIN, 0 };
+      if ((now >= deadline) || (poll(&pfd, 1, (deadline - now) / 1000 + 1) == 0))
+        break;
+
+      ssize_t n = read(out, buf + len, sizeof(buf) - 1 - len);
+      if ((n < 0) && (errno == EINTR))
+        continue;
+      if (n <= 0)
+        break;
+      len += n;
+      buf[len] = 0;
+
+      char *start = buf;
+      char *nl;
+      while ((nl = strchr(start, '\n')))
+        {
+          *nl = 0;
+          if (verbose)
+            printf("  %s\n", start);
+          const char *what = startup_line(start, spawned);
+          if (what && !strcmp(what, until))
+            reached = TRUE;
+          start = nl + 1;
+        }
+
+      // a line too long for the buffer isn't a milestone
+      if ((start == buf) && (len == sizeof(buf) - 1))
+        start = buf + len;
+
+      len -= start - buf;
+      memmove(buf, start, len);
+    }
+
+  kill(pid, SIGTERM);
+  int i;
+  for (i = 0; (i < 200) && (waitpid(pid, NULL, WNOHANG) == 0); i++)
+    g_usleep(10000);
+  if (i == 200)
+    {
+      kill(pid, SIGKILL);
+      waitpid(pid, NULL, 0);
+    }
+  g_spawn_close_pid(pid);
+  close(out);
+
+  return reached;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int entries = 1500;
+  int runs = 5;
+  int timeout = 60000;
+  gchar *command = NULL;
+  gchar *until = NULL;
+  gboolean verbose = FALSE;
+  GError *error = NULL;
+  char **argv_cmd;
+  int failed = 0;
+  int i;
+
+  GOptionEntry options[] =
+    {
+      { "entries", 'n', 0, G_OPTION_ARG_INT, &entries, "Number of desktop entries (default 1500)", "N" },
+      { "runs", 'r', 0, G_OPTION_ARG_INT, &runs, "Number of times to start it (default 5)", "N" },
+      { "until", 'u', 0, G_OPTION_ARG_STRING, &until, "Milestone to run until (default 'menu ready')", "WHAT" },
+      { "timeout", 't', 0, G_OPTION_ARG_INT, &timeout, "Longest to wait for it in each run (default 60000)", "MS" },
+      { "command", 0, 0, G_OPTION_ARG_STRING, &command, "Command to start (default 'xwin-xdg-menu')", "CMD" },
+      { "verbose", 'v', 0, G_OPTION_ARG_NONE, &verbose, "Show its output", NULL },
+      { NULL }
+    };
+
+  GOptionContext *context = g_option_context_new("- benchmark the startup timeline");
+  g_option_context_add_main_entries(context, options, NULL);
+  if (!g_option_context_parse(context, &argc, &argv, &error))
+    {
+      fprintf(stderr, "%s\n", error->message);
+      return 1;
+    }
+  g_option_context_free(context);
+
+  if ((entries < 0) || (runs <= 0) || (timeout <= 0))
+    {
+      fprintf(stderr, "Usage: %s [OPTION...]\n", g_get_prgname());
+      return 1;
+    }
+
+  if (!g_shell_parse_argv(command ? command : "xwin-xdg-menu", NULL, &argv_cmd, &error))
+    {
+      fprintf(stderr, "%s\n", error->message);
+      return 1;
+    }
+  if (!until)
+    until = g_strdup("menu ready");
+
+  char *tmpdir = g_dir_make_tmp("xwin-startbench-XXXXXX", &error);
+  if (!tmpdir)
+    {
+      fprintf(stderr, "%s\n", error->message);
+      return 1;
+    }
+
+  char *applications, *icons;
+  xdg_setup(tmpdir, &applications, &icons);
+  populate(applications, icons, entries);
+
+  milestones = g_ptr_array_new_with_free_func(milestone_free);
+  for (i = 0; i < runs; i++)
+    {
+      if (verbose)
+        printf("run %d:\n", i + 1);
+      if (!run(argv_cmd, until, timeout, verbose))
+        {
+          printf("run %d didn't reach '%s'\n", i + 1, until);
+          failed++;
+        }
+    }
+
+  printf("%d desktop entries, %d runs\n", entries, runs);
+  for (i = 0; i < (int)milestones->len; i++)
+    {
+      milestone *m = g_ptr_array_index(milestones, i);
+      double worst = 0;
+      guint j;
+      for (j = 0; j < m->logged->len; j++)
+        worst = MAX(worst, g_array_index(m->logged, double, j));
+      printf("%-16s median %8.1f ms, worst %8.1f ms after process start, median %8.1f ms after spawn\n",
+             m->what, median(m->logged), worst, median(m->seen));
+    }
+
+  g_ptr_array_free(milestones, TRUE);
+  remove_tree(tmpdir);
+  g_free(tmpdir);
+  g_free(applications);
+  g_free(icons);
+  g_strfreev(argv_cmd);
+  g_free(command);
+  g_free(until);
+
+  return failed ? 2 : 0;
+}
@@ -0,0 +1,379 @@
+/*
+ * trace.c
+ *
+ * Copyright (C) Jon Turney 2015
+ *
+ * This file is part of xwin-xdg-menu
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+//
+// An event tracer, which writes a trace in the Chrome trace event format, for
+// viewing in chrome://tracing or Perfetto
+//
+// It's enabled by the tracefile setting.  When disabled, each trace point is
+// just a test of trace_enabled.
+//
+// Each thread records events into its own fixed-size buffer, without
+// locking.  Buffers are linked into a list when a thread first records an
+// event.  An event is only visible to the reader once the count is advanced
+// past it.  Events recorded once a buffer is full are dropped (and counted).
+//
+// When a thread exits, the events it recorded are moved into a buffer just big
+// enough for them, which replaces its buffer in the list, and its buffer is
+// freed.  Events of exited threads are kept up to the size of the main
+// thread's buffer, and dropped after that.  The list is only changed, and only
+// read, holding a lock.
+//
+// The trace is written on exit, and whenever SIGUSR1 is received.
+//
+
+#include "trace.h"
+#include "menu.h"
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib-unix.h>
+
+#define TRACE_DETAIL_MAX 64
+#define DEFAULT_BUFFER_EVENTS 65536
+// other threads are just launching commands, so record few events
+#define THREAD_BUFFER_EVENTS 256
+
+typedef struct
+{
+  gint64 ts;
+  gint64 dur;
+  const char *name;
+  char phase;
+  char detail[TRACE_DETAIL_MAX];
+} trace_record;
+
+typedef struct _trace_buffer
+{
+  struct _trace_buffer *next;
+  int tid;
+  const char *thread_name;
+  int size;
+  volatile gint count;
+  volatile gint dropped;
+  trace_record *records;
+} trace_buffer;
+
+int trace_enabled = 0;
+
+static char *trace_path;
+static int trace_buffer_events;
+static trace_buffer *buffers;
+static int next_tid = 0;
+// events kept from threads which have exited, and those dropped
+static int retired_events;
+static int retired_dropped;
+static __thread trace_buffer *thread_buffer;
+
+G_LOCK_DEFINE_STATIC(buffers);
+
+static void trace_thread_exit(gpointer data);
+
+static GPrivate thread_key = G_PRIVATE_INIT(trace_thread_exit);
+
+static trace_buffer *
+trace_buffer_get(void)
+{
+  if (G_LIKELY(thread_buffer))
+    return thread_buffer;
+
+  trace_buffer *b = g_new0(trace_buffer, 1);
+
+  G_LOCK(buffers);
+  // the first buffer is the main thread's, created by trace_init()
+  b->size = buffers ? THREAD_BUFFER_EVENTS : trace_buffer_events;
+  b->records = g_new(trace_record, b->size);
+  b->tid = ++next_tid;
+  b->next = buffers;
+  buffers = b;
+  G_UNLOCK(buffers);
+
+  thread_buffer = b;
+  g_private_set(&thread_key, b);
+  return b;
+}
+
+// a thread which recorded events is exiting, so replace its buffer with one
+// just big enough for the events in it, or with nothing if it's empty or
+// there's no room left for them
+static void
+trace_thread_exit(gpointer data)
+{
+  trace_buffer *b = data;
+  trace_buffer *kept = NULL;
+  trace_buffer **p;
+  int n = g_atomic_int_get(&b->count);
+
+  G_LOCK(buffers);
+  if (n && (retired_events + n <= trace_buffer_events))
+    {
+      kept = g_new0(trace_buffer, 1);
+      kept->tid = b->tid;
+      kept->thread_name = b->thread_name;
+      kept->size = n;
+      kept->count = n;
+      kept->dropped = b->dropped;
+      kept->records = g_memdup(b->records, n * sizeof(trace_record));
+      retired_events += n;
+    }
+  else
+    retired_dropped += n + b->dropped;
+
+  for (p = &buffers; *p; p = &(*p)->next)
+    {
+      if (*p == b)
+        {
+          if (kept)
+            {
+              kept->next = b->next;
+              *p = kept;
+            }
+          else
+            *p = b->next;
+          break;
+        }
+    }
+  G_UNLOCK(buffers);
+
+  g_free(b->records);
+  g_free(b);
+}
+
+// copy detail into a record, truncated, and only up to any invalid UTF-8 (e.g.
+// a sequence cut short by truncating), which would make the trace invalid JSON
+static void
+trace_copy_detail(char *dest, const char *detail)
+{
+  const char *end;
+
+  g_strlcpy(dest, detail, TRACE_DETAIL_MAX);
+  if (!g_utf8_validate(dest, -1, &end))
+    dest[end - dest] = 0;
+}
+
+static trace_record *
+trace_record_new(const char *name, const char *detail)
+{
+  trace_buffer *b = trace_buffer_get();
+  int n = g_atomic_int_get(&b->count);
+
+  if (n >= b->size)
+    {
+      g_atomic_int_inc(&b->dropped);
+      return NULL;
+    }
+
+  trace_record *r = &b->records[n];
+  r->name = name;
+  r->dur = 0;
+  if (detail)
+    trace_copy_detail(r->detail, detail);
+  else
+    r->detail[0] = 0;
+
+  return r;
+}
+
+// make the record just filled in visible to the writer
+static void
+trace_record_commit(void)
+{
+  g_atomic_int_inc(&thread_buffer->count);
+}
+
+void
+trace_event(char phase, const char *name, const char *detail)
+{
+  trace_record *r = trace_record_new(name, detail);
+  if (!r)
+    return;
+
+  r->phase = phase;
+  r->ts = g_get_monotonic_time();
+  trace_record_commit();
+}
+
+// record an event which started at start, and has just finished
+void
+trace_complete(const char *name, const char *detail, gint64 start)
+{
+  if (!trace_enabled)
+    return;
+
+  trace_record *r = trace_record_new(name, detail);
+  if (!r)
+    return;
+
+  r->phase = 'X';
+  r->ts = start;
+  r->dur = g_get_monotonic_time() - start;
+  trace_record_commit();
+}
+
+// name the calling thread in the trace.  name must be a string literal
+void
+trace_thread_name(const char *name)
+{
+  if (!trace_enabled)
+    return;
+
+  trace_buffer_get()->thread_name = name;
+}
+
+static void
+trace_write_string(FILE *f, const char *s)
+{
+  fputc('"', f);
+  for (; *s; s++)
+    {
+      if (*s == '"' || *s == '\\')
+        fprintf(f, "\\%c", *s);
+      else if ((unsigned char)*s < 0x20)
+        fprintf(f, "\\u%04x", *s);
+      else
+        fputc(*s, f);
+    }
+  fputc('"', f);
+}
+
+static void
+trace_write(void)
+{
+  gchar *tmp = g_strconcat(trace_path, ".tmp", NULL);
+  FILE *f = fopen(tmp, "w");
+  if (!f)
+    {
+      g_print("Failed to write trace to %s\n", tmp);
+      g_free(tmp);
+      return;
+    }
+
+  int pid = getpid();
+  int events = 0, dropped = 0;
+  gboolean first = TRUE;
+  trace_buffer *b;
+
+  fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  G_LOCK(buffers);
+  for (b = buffers; b; b = b->next)
+    {
+      int n = g_atomic_int_get(&b->count);
+      int i;
+
+      if (b->thread_name)
+        {
+          fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":",
+                  first ? "" : ",\n", pid, b->tid);
+          trace_write_string(f, b->thread_name);
+          fprintf(f, "}}");
+          first = FALSE;
+        }
+
+      for (i = 0; i < n; i++)
+        {
+          trace_record *r = &b->records[i];
+
+          fprintf(f, "%s{\"name\":", first ? "" : ",\n");
+          trace_write_string(f, r->name);
+          fprintf(f, ",\"ph\":\"%c\",\"ts\":%" G_GINT64_FORMAT ",\"pid\":%d,\"tid\":%d",
+                  r->phase, r->ts, pid, b->tid);
+          if (r->phase == 'X')
+            fprintf(f, ",\"dur\":%" G_GINT64_FORMAT, r->dur);
+          if (r->phase == 'i')
+            fprintf(f, ",\"s\":\"t\"");
+          if (r->detail[0])
+            {
+              fprintf(f, ",\"args\":{\"detail\":");
+              trace_write_string(f, r->detail);
+              fprintf(f, "}");
+            }
+          fprintf(f, "}");
+          first = FALSE;
+        }
+
+      events += n;
+      dropped += g_atomic_int_get(&b->dropped);
+    }
+  dropped += retired_dropped;
+  G_UNLOCK(buffers);
+  fprintf(f, "\n]}\n");
+
+  if ((fclose(f) == 0) && (rename(tmp, trace_path) == 0))
+    g_print("Wrote %d trace events to %s (%d dropped)\n", events, trace_path, dropped);
+  else
+    g_print("Failed to write trace to %s\n", trace_path);
+
+  g_free(tmp);
+}
+
+static gboolean
+trace_signal(gpointer data)
+{
+  trace_write();
+  return G_SOURCE_CONTINUE;
+}
+
+void
+trace_init(void)
+{
+  gchar *path = g_key_file_get_string(keyfile, "settings", "tracefile", NULL);
+  if (!path || !*path)
+    {
+      g_free(path);
+      return;
+    }
+
+  // relative paths are relative to the user cache directory
+  if (g_path_is_absolute(path))
+    trace_path = path;
+  else
+    {
+      trace_path = g_build_filename(g_get_user_cache_dir(), path, NULL);
+      g_free(path);
+    }
+
+  GError *err = NULL;
+  trace_buffer_events = g_key_file_get_integer(keyfile, "settings", "tracebuffer", &err);
+  if (err || trace_buffer_events <= 0)
+    trace_buffer_events = DEFAULT_BUFFER_EVENTS;
+  g_clear_error(&err);
+
+  g_unix_signal_add(SIGUSR1, trace_signal, NULL);
+
+  trace_enabled = 1;
+  trace_thread_name("main");
+  g_print("Tracing to %s\n", trace_path);
+}
+
+void
+trace_shutdown(void)
+{
+  if (trace_enabled)
+    trace_write();
+}
@@ -0,0 +1,54 @@
+/*
+ * trace.h
+ *
+ * Copyright (C) Jon Turney 2015
+ *
+ * This file is part of xwin-xdg-menu
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <glib.h>
+
+// set once, by trace_init()
+extern int trace_enabled;
+
+void trace_init(void);
+void trace_shutdown(void);
+void trace_thread_name(const char *name);
+void trace_event(char phase, const char *name, const char *detail);
+void trace_complete(const char *name, const char *detail, gint64 start);
+
+//
+// name must be a string literal (it isn't copied), detail may be NULL or any
+// string (it is copied, truncated)
+//
+#define TRACE_BEGIN(name, detail) \
+  do { if (G_UNLIKELY(trace_enabled)) trace_event('B', name, detail); } while (0)
+#define TRACE_END(name) \
+  do { if (G_UNLIKELY(trace_enabled)) trace_event('E', name, NULL); } while (0)
+#define TRACE_INSTANT(name, detail) \
+  do { if (G_UNLIKELY(trace_enabled)) trace_event('i', name, detail); } while (0)
+
+#endif /* TRACE_H */
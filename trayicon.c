@@ -43,6 +43,9 @@
 
 HMENU hMenuTray;
 
+/* the longest time we believe a click can have been queued for */
+#define MAX_QUEUED_MS 60000
+
 /*
  * Return the HICON to use in the taskbar notification area
  */
@@ -59,23 +62,26 @@ taskbarIcon(void)
 }
 
 /*
- * Initialize the tray icon
+ * Initialize the tray icon for a display
+ *
+ * The icon ID is the index of the display, which is passed back to us in the
+ * wParam of notification messages
  */
 void
-initNotifyIcon(HWND hwnd)
+initNotifyIcon(HWND hwnd, int index)
 {
     NOTIFYICONDATA nid = { 0 };
 
     nid.cbSize = sizeof(NOTIFYICONDATA);
     nid.hWnd = hwnd;
-    nid.uID = 0;
+    nid.uID = index;
     nid.uFlags = NIF_ICON | NIF_MESSAGE | NIF_TIP;
     nid.uCallbackMessage = WM_TRAYICON;
     nid.hIcon = taskbarIcon();
 
     /* Set tooltip text */
     snprintf(nid.szTip, sizeof(nid.szTip),
-             "X applications menu on %s", getenv("DISPLAY"));
+             "X applications menu on %s", display_name(index));
 
     /* Add the tray icon */
     if (!Shell_NotifyIcon(NIM_ADD, &nid))
@@ -86,13 +92,13 @@ initNotifyIcon(HWND hwnd)
  * Delete the tray icon
  */
 void
-deleteNotifyIcon(HWND hwnd)
+deleteNotifyIcon(HWND hwnd, int index)
 {
     NOTIFYICONDATA nid = { 0 };
 
     nid.cbSize = sizeof(NOTIFYICONDATA);
     nid.hWnd = hwnd;
-    nid.uID = 0;
+    nid.uID = index;
 
     /* Delete the tray icon */
     if (!Shell_NotifyIcon(NIM_DELETE, &nid)) {
@@ -112,10 +118,20 @@ aboutDlgProc(HWND hwndDialog, UINT message, WPARAM wParam, LPARAM lParam)
 
       /* Set the DISPLAY */
       char *display = NULL;
-      if (asprintf(&display, "DISPLAY is %s", getenv("DISPLAY")) > 0)
+      if (asprintf(&display, "DISPLAY is %s", (const char *)lParam) > 0)
         SetWindowText(GetDlgItem(hwndDialog, IDC_DISPLAY), display);
       free(display);
 
+      /* Show how responsive we've been */
+      char *shown = menu_shown_summary();
+      char *spawned = execute_spawned_summary();
+      char *latency = NULL;
+      if (asprintf(&latency, "Click to menu: %s\r\nSelection to launch: %s", shown, spawned) > 0)
+        SetWindowText(GetDlgItem(hwndDialog, IDC_LATENCY), latency);
+      free(latency);
+      g_free(spawned);
+      g_free(shown);
+
       return TRUE;
     }
 
@@ -135,6 +151,77 @@ aboutDlgProc(HWND hwndDialog, UINT message, WPARAM wParam, LPARAM lParam)
   return FALSE;
 }
 
+/*
+ * Show the menu at the cursor, and act on the selection, launching on the
+ * display with the given index.  queued is how long, in milliseconds, the
+ * request to show it waited before we got to it.
+ */
+void
+popupMenu(HWND hwnd, int index, int queued)
+{
+  const char *display = display_name(index);
+  POINT ptCursor;
+
+  /* Get cursor position */
+  GetCursorPos(&ptCursor);
+
+  /*
+   * NOTE: This three-step procedure is required for
+   * proper popup menu operation.  Without the
+   * call to SetForegroundWindow the
+   * popup menu will often not disappear when you click
+   * outside of it.  Without the PostMessage the second
+   * time you display the popup menu it might immediately
+   * disappear.
+   */
+  SetForegroundWindow(hwnd);
+  menu_update_running();
+  menu_show_requested(queued);
+  int cmd = TrackPopupMenuEx(hMenuTray,
+                             TPM_LEFTALIGN | TPM_BOTTOMALIGN | TPM_RIGHTBUTTON | TPM_RETURNCMD,
+                             ptCursor.x, ptCursor.y, hwnd, NULL);
+  gint64 selected = g_get_monotonic_time();
+  PostMessage(hwnd, WM_NULL, 0, 0);
+
+  if (cmd > ID_EXEC_BASE)
+    {
+      menu_item_execute(cmd - ID_EXEC_BASE, display, selected);
+    }
+  else if (cmd >= ID_RUNNING_BASE)
+    {
+      menu_running_terminate(cmd);
+    }
+  else
+    {
+      switch(cmd)
+        {
+        case ID_APP_ABOUT:
+          DialogBoxParam(NULL, MAKEINTRESOURCE(IDD_ABOUT), hwnd, aboutDlgProc,
+                         (LPARAM)display);
+          break;
+
+        case ID_APP_LOGFILE:
+          view_logfile_execute(display);
+          break;
+
+        case ID_SIZE_DEFAULT:
+        case ID_SIZE_16:
+        case ID_SIZE_24:
+        case ID_SIZE_32:
+        case ID_SIZE_48:
+        case ID_SIZE_64:
+          menu_set_icon_size(cmd);
+          break;
+
+        case ID_APP_EXIT:
+          if (in_session)
+            session_logout_execute();
+          PostQuitMessage(0);  // XXX: needs confirmation dialog
+          break;
+        }
+    }
+}
+
 /*
  * Process messages intended for the tray icon
  */
@@ -145,58 +232,13 @@ handleIconMessage(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam)
   case WM_LBUTTONUP:
   case WM_RBUTTONUP:
     {
-      POINT ptCursor;
-
-      /* Get cursor position */
-      GetCursorPos(&ptCursor);
-
-      /*
-       * NOTE: This three-step procedure is required for
-       * proper popup menu operation.  Without the
-       * call to SetForegroundWindow the
-       * popup menu will often not disappear when you click
-       * outside of it.  Without the PostMessage the second
-       * time you display the popup menu it might immediately
-       * disappear.
-       */
-      SetForegroundWindow(hwnd);
-      int cmd = TrackPopupMenuEx(hMenuTray,
-                                 TPM_LEFTALIGN | TPM_BOTTOMALIGN | TPM_RIGHTBUTTON | TPM_RETURNCMD,
-                                 ptCursor.x, ptCursor.y, hwnd, NULL);
-      PostMessage(hwnd, WM_NULL, 0, 0);
-
-      if (cmd > ID_EXEC_BASE)
-        {
-          menu_item_execute(cmd - ID_EXEC_BASE);
-        }
-      else
-        {
-          switch(cmd)
-            {
-            case ID_APP_ABOUT:
-              DialogBox(NULL, MAKEINTRESOURCE(IDD_ABOUT), hwnd, aboutDlgProc);
-              break;
-
-            case ID_APP_LOGFILE:
-              view_logfile_execute();
-              break;
-
-            case ID_SIZE_DEFAULT:
-            case ID_SIZE_16:
-            case ID_SIZE_24:
-            case ID_SIZE_32:
-            case ID_SIZE_48:
-            case ID_SIZE_64:
-              menu_set_icon_size(cmd);
-              break;
-
-            case ID_APP_EXIT:
-              if (in_session)
-                session_logout_execute();
-              PostQuitMessage(0);  // XXX: needs confirmation dialog
-              break;
-            }
-        }
+      /* how long the click waited in the message queue.  Ignore nonsense,
+         e.g. if this message was sent rather than posted */
+      DWORD queued = GetTickCount() - GetMessageTime();
+      if (queued > MAX_QUEUED_MS)
+        queued = 0;
+
+      popupMenu(hwnd, wParam, queued);
     }
     break;
   }
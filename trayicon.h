@@ -33,8 +33,9 @@
 
 #define WM_TRAYICON               (WM_USER + 1000)
 
-void initNotifyIcon(HWND hwnd);
-void deleteNotifyIcon(HWND hwnd);
+void initNotifyIcon(HWND hwnd, int index);
+void deleteNotifyIcon(HWND hwnd, int index);
 LRESULT handleIconMessage(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam);
+void popupMenu(HWND hwnd, int index, int queued);
 
 #endif /* TRAYICON_H */